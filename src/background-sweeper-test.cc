@@ -0,0 +1,208 @@
+#include "background-sweeper.h"
+#include "vm-objects.h"
+#include "gtest/gtest.h"
+#include <unordered_map>
+#include <atomic>
+
+namespace mio {
+
+namespace {
+
+// Objects are not touched by sweeper, fake addresses are enough.
+HeapObject *FakeObject(intptr_t i) {
+    return reinterpret_cast<HeapObject *>((i + 1) * 16);
+}
+
+intptr_t FakeIndex(HeapObject *ob) {
+    return reinterpret_cast<intptr_t>(ob) / 16 - 1;
+}
+
+BackgroundSweeper::Disposition Decide(HeapObject *ob) {
+    auto i = FakeIndex(ob);
+    if (i % 2 == 0) {
+        return BackgroundSweeper::kLive;
+    }
+    return i % 3 == 0 ? BackgroundSweeper::kMoved : BackgroundSweeper::kDead;
+}
+
+void SweepAll(BackgroundSweeper *sweeper, int n) {
+    std::vector<HeapObject *> objects;
+    for (int i = 0; i < n; ++i) {
+        objects.push_back(FakeObject(i));
+    }
+
+    std::vector<HeapObject *> moved;
+    sweeper->Submit(&objects, nullptr, [&moved] (HeapObject *ob) {
+        auto disposition = Decide(ob);
+        if (disposition == BackgroundSweeper::kMoved) {
+            moved.push_back(ob);
+        }
+        return disposition;
+    });
+
+    std::vector<HeapObject *> dead;
+    while (!sweeper->TakeDead(&dead, true)) {
+    }
+
+    ASSERT_EQ((n + 1) / 2, static_cast<int>(objects.size()));
+    for (int i = 0; i < objects.size(); ++i) {
+        EXPECT_EQ(FakeObject(i * 2), objects[i]); // keep order.
+    }
+    for (auto ob : moved) {
+        EXPECT_EQ(BackgroundSweeper::kMoved, Decide(ob));
+    }
+    for (auto ob : dead) {
+        EXPECT_EQ(BackgroundSweeper::kDead, Decide(ob));
+    }
+    EXPECT_EQ(n, static_cast<int>(objects.size() + moved.size() + dead.size()));
+}
+
+} // namespace
+
+TEST(BackgroundSweeperTest, Sanity) {
+    BackgroundSweeper sweeper;
+    sweeper.Start();
+    EXPECT_TRUE(sweeper.running());
+
+    std::vector<HeapObject *> dead;
+    EXPECT_TRUE(sweeper.TakeDead(&dead, false));
+    EXPECT_TRUE(dead.empty());
+
+    SweepAll(&sweeper, 1000);
+    SweepAll(&sweeper, 7);
+    SweepAll(&sweeper, 0);
+    sweeper.Stop();
+    EXPECT_FALSE(sweeper.running());
+}
+
+TEST(BackgroundSweeperTest, NotRunning) {
+    BackgroundSweeper sweeper;
+    SweepAll(&sweeper, 1000);
+}
+
+TEST(BackgroundSweeperTest, StopAfterSubmit) {
+    BackgroundSweeper sweeper;
+    sweeper.Start();
+
+    std::vector<HeapObject *> objects;
+    for (int i = 0; i < 100; ++i) {
+        objects.push_back(FakeObject(i));
+    }
+    sweeper.Submit(&objects, nullptr, [] (HeapObject *) {
+        return BackgroundSweeper::kDead;
+    });
+    sweeper.Stop();
+
+    // Submitted table has been swept.
+    std::vector<HeapObject *> dead;
+    EXPECT_TRUE(sweeper.TakeDead(&dead, false));
+    EXPECT_EQ(100, dead.size());
+    EXPECT_TRUE(objects.empty());
+}
+
+// Mutator grabs and drops objects while sweeper updates their headers, no
+// update of the header flags should be lost.
+TEST(BackgroundSweeperTest, GrabDropDuringSweep) {
+    static const int kN = 16384;
+
+    // Only headers are used, 16 bytes is enough for every object.
+    std::vector<uint64_t> memory(kN * 2);
+    std::vector<HeapObject *> objects;
+    for (int i = 0; i < kN; ++i) {
+        auto ob = reinterpret_cast<HeapObject *>(&memory[i * 2]);
+        ob->Init(HeapObject::kString);
+        ob->SetColor(i % 2); // 0 is the dead white.
+        if (i % 4 == 0) {
+            ob->Grab(); // held by a handle during sweeping.
+        }
+        objects.push_back(ob);
+    }
+    auto all = objects;
+
+    BackgroundSweeper sweeper;
+    sweeper.Start();
+    sweeper.Submit(&objects, nullptr, [] (HeapObject *ob) {
+        if (ob->IsGrabbed()) {
+            ob->SetColor(2);
+            return BackgroundSweeper::kLive;
+        }
+        if (ob->GetColor() == 0) {
+            return BackgroundSweeper::kDead;
+        }
+        ob->SetGeneration(1);
+        return BackgroundSweeper::kLive;
+    });
+
+    std::vector<HeapObject *> dead;
+    do {
+        for (auto ob : all) {
+            ob->Grab();
+            ob->Drop();
+        }
+    } while (!sweeper.TakeDead(&dead, false));
+    sweeper.Stop();
+
+    EXPECT_EQ(kN, static_cast<int>(objects.size() + dead.size()));
+    for (auto ob : dead) {
+        EXPECT_EQ(0, ob->GetColor());
+    }
+    for (int i = 0; i < kN; ++i) {
+        auto ob = all[i];
+        EXPECT_EQ(HeapObject::kString, ob->GetKind());
+        EXPECT_EQ(i % 4 == 0 ? 1 : 0, ob->GetHandleCount()) << i;
+        if (i % 4 == 0) {
+            EXPECT_EQ(2, ob->GetColor()) << i;
+        } else if (i % 2 == 1) {
+            // May be grabbed by mutator when it is swept.
+            EXPECT_TRUE(ob->GetColor() == 2 || ob->GetGeneration() == 1) << i;
+        }
+    }
+}
+
+// Sweeper walks nursery blocks, while mutator releases dead objects and
+// allocates new ones, the new ones are not walked.
+TEST(BackgroundSweeperTest, WalkNursery) {
+    Nursery nursery(4 * Nursery::kBlockSize);
+    ASSERT_TRUE(nursery.Init());
+
+    std::unordered_map<void *, int> index;
+    int n = Nursery::kBlockSize / 16 * 2 + 100; // in 3 blocks.
+    for (int i = 0; i < n; ++i) {
+        auto p = nursery.Allocate(16);
+        ASSERT_NE(nullptr, p);
+        index[p] = i;
+    }
+    EXPECT_EQ(3, nursery.GetUsedBlocks());
+
+    BackgroundSweeper sweeper;
+    sweeper.Start();
+    std::vector<HeapObject *> objects;
+    std::atomic<int> walked(0);
+    sweeper.Submit(&objects, &nursery, [&] (HeapObject *ob) {
+        ++walked;
+        return index.at(ob) % 3 == 0 ? BackgroundSweeper::kDead :
+               BackgroundSweeper::kLive;
+    });
+
+    std::vector<HeapObject *> dead;
+    bool done = false;
+    int released = 0, fresh = 0;
+    while (!done) {
+        done = sweeper.TakeDead(&dead, false);
+        for (auto ob : dead) {
+            EXPECT_EQ(0, index.at(ob) % 3);
+            nursery.Free(ob);
+        }
+        released += static_cast<int>(dead.size());
+        dead.clear();
+        if (!done && fresh++ < 1000) {
+            ASSERT_NE(nullptr, nursery.Allocate(16));
+        }
+    }
+    sweeper.Stop();
+
+    EXPECT_EQ(n, walked.load());
+    EXPECT_EQ((n + 2) / 3, released);
+}
+
+} // namespace mio
@@ -0,0 +1,151 @@
+#include "background-sweeper.h"
+#include "vm-objects.h"
+
+namespace mio {
+
+BackgroundSweeper::~BackgroundSweeper() {
+    Stop();
+}
+
+void BackgroundSweeper::Start() {
+    DCHECK(thread_ == nullptr);
+    should_stop_ = false;
+    thread_ = new std::thread([this]() { Run(); });
+}
+
+void BackgroundSweeper::Stop() {
+    if (!thread_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        should_stop_ = true;
+    }
+    wakeup_.notify_one();
+    DCHECK(thread_->joinable());
+    thread_->join();
+    delete thread_;
+    thread_ = nullptr;
+    EndConcurrent();
+}
+
+void BackgroundSweeper::Submit(std::vector<HeapObject *> *objects,
+                               const Nursery *nursery, Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        DCHECK(!busy_) << "last table is sweeping.";
+        objects_  = DCHECK_NOTNULL(objects);
+        nursery_  = nursery;
+        spans_.clear();
+        if (nursery) {
+            nursery->GetSpans(&spans_);
+        }
+        callback_ = callback;
+        busy_     = true;
+        swept_    = false;
+        pending_  = true;
+    }
+    if (!thread_) {
+        pending_ = false;
+        Sweep();
+        return;
+    }
+    concurrent_ = true;
+    HeapObject::BeginConcurrentUpdating();
+    wakeup_.notify_one();
+}
+
+bool BackgroundSweeper::TakeDead(std::vector<HeapObject *> *dead, bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!busy_) {
+        return true;
+    }
+    if (wait) {
+        published_.wait(lock, [this] () { return !dead_.empty() || swept_; });
+    }
+    dead->insert(dead->end(), dead_.begin(), dead_.end());
+    dead_.clear();
+    if (!swept_) {
+        return false;
+    }
+    EndConcurrent();
+    busy_     = false;
+    objects_  = nullptr;
+    nursery_  = nullptr;
+    callback_ = nullptr;
+    return true;
+}
+
+void BackgroundSweeper::EndConcurrent() {
+    if (concurrent_) {
+        concurrent_ = false;
+        HeapObject::EndConcurrentUpdating();
+    }
+}
+
+void BackgroundSweeper::Run() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait(lock, [this] () { return should_stop_ || pending_; });
+            if (!pending_) {
+                return; // should stop and no table to sweep.
+            }
+            pending_ = false;
+        }
+        Sweep();
+    }
+}
+
+void BackgroundSweeper::Sweep() {
+    auto objects = objects_;
+    std::vector<HeapObject *> batch;
+    size_t live = 0;
+
+    for (size_t i = 0; i < objects->size(); ++i) {
+        auto x = (*objects)[i];
+        switch (callback_(x)) {
+            case kLive:
+                (*objects)[live++] = x;
+                break;
+
+            case kMoved:
+                break;
+
+            case kDead:
+                batch.push_back(x);
+                if (batch.size() >= kBatchSize) {
+                    Publish(&batch, false);
+                }
+                break;
+        }
+    }
+    objects->resize(live);
+
+    for (const auto &span : spans_) {
+        nursery_->Walk(span, [this, &batch] (void *p) {
+            auto x = static_cast<HeapObject *>(p);
+            auto disposition = callback_(x);
+            DCHECK_NE(kMoved, disposition);
+            if (disposition == kDead) {
+                batch.push_back(x);
+            }
+        });
+        if (batch.size() >= kBatchSize) {
+            Publish(&batch, false);
+        }
+    }
+    Publish(&batch, true);
+}
+
+void BackgroundSweeper::Publish(std::vector<HeapObject *> *batch, bool done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dead_.insert(dead_.end(), batch->begin(), batch->end());
+        swept_ = done;
+    }
+    batch->clear();
+    published_.notify_one();
+}
+
+} // namespace mio
@@ -0,0 +1,106 @@
+#ifndef MIO_BACKGROUND_SWEEPER_H_
+#define MIO_BACKGROUND_SWEEPER_H_
+
+#include "nursery.h"
+#include "base.h"
+#include "glog/logging.h"
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace mio {
+
+class HeapObject;
+
+/**
+ * Sweep a table of objects and nursery blocks in a dedicated thread.
+ *
+ * The sweeper thread walks the table and decides every object by a callback,
+ * living objects are packed in the table. Then it walks blocks of nursery
+ * taken at submitting. Dead objects are published in batches, the mutator
+ * takes and releases them, because allocators are only used by the thread
+ * running bit codes. Dead objects of a block are published after the block
+ * walked, or it may be recycled in walking.
+ *
+ * The table is owned by the sweeper after Submit(), until TakeDead() returns
+ * true. If the thread is not started, Submit() sweeps the table at once.
+ * Between them the sweeper thread updates header flags (color) of objects,
+ * so mutator grabs and drops handles by CAS.
+ */
+class BackgroundSweeper {
+public:
+    enum Disposition: int {
+        kLive,  // keep in table.
+        kMoved, // remove from table, callback has moved it to other one.
+                // Objects in nursery never move.
+        kDead,  // remove from table and release it.
+    };
+
+    /**
+     * Decide an object, it is called by the sweeper thread.
+     */
+    typedef std::function<Disposition (HeapObject *)> Callback;
+
+    static const int kBatchSize = 64;
+
+    BackgroundSweeper() = default;
+    ~BackgroundSweeper();
+
+    void Start();
+
+    /**
+     * Stop the thread, the submitted table will be swept at first.
+     */
+    void Stop();
+
+    /**
+     * @param nursery objects in its blocks are swept too, or null.
+     */
+    void Submit(std::vector<HeapObject *> *objects, const Nursery *nursery,
+                Callback callback);
+
+    /**
+     * Move published dead objects to dead.
+     *
+     * @param wait wait for a batch or the end of sweeping.
+     * @return true if table has been all swept and all dead objects are
+     *         taken, or there is no submitted table.
+     */
+    bool TakeDead(std::vector<HeapObject *> *dead, bool wait);
+
+    bool running() const { return thread_ != nullptr; }
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(BackgroundSweeper)
+private:
+    void Run();
+
+    void Sweep();
+
+    void Publish(std::vector<HeapObject *> *batch, bool done);
+
+    /**
+     * The sweeper thread never touches objects until next submitting.
+     */
+    void EndConcurrent();
+
+    std::thread *thread_ = nullptr;
+    bool should_stop_ = false;
+    bool pending_ = false; // submitted, sweeping not started.
+    bool busy_ = false;    // submitted, TakeDead() not returned true.
+    bool swept_ = false;
+    bool concurrent_ = false; // sweeping in the thread, flags are shared.
+    std::vector<HeapObject *> *objects_ = nullptr;
+    const Nursery *nursery_ = nullptr;
+    std::vector<Nursery::Span> spans_;
+    Callback callback_;
+    std::vector<HeapObject *> dead_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable published_;
+}; // class BackgroundSweeper
+
+} // namespace mio
+
+#endif // MIO_BACKGROUND_SWEEPER_H_
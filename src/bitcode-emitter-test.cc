@@ -162,6 +162,8 @@ TEST_F(BitCodeEmitterTest, P009_RecursiveFunctionCall) {
     ParseProject("009", &dasm);
 
     printf("%s\n", dasm.c_str());
+    // global function be called statically.
+    EXPECT_NE(std::string::npos, dasm.find(" call [")) << dasm;
 }
 
 TEST_F(BitCodeEmitterTest, P010_MapInitializer) {
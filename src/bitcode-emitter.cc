@@ -1,6 +1,7 @@
 #include "bitcode-emitter.h"
 #include "vm-memory-segment.h"
 #include "vm-bitcode-builder.h"
+#include "vm-bitcode-fusion.h"
 #include "vm-bitcode.h"
 #include "vm-objects.h"
 #include "vm-object-factory.h"
@@ -447,7 +448,14 @@ private:
                                TypeInfoIndex(type));
     }
 
-    void EmitFunctionCall(const VMValue &callee, Call *node);
+    // Module variable is emitted in the outermost scope at the first using.
+    void EmitUnbindedVariable(Variable *var);
+
+    // Global function can be called statically, its value is in global
+    // object segment.
+    bool GetGlobalFunction(Expression *expr, VMValue *value);
+    void EmitFunctionCall(const VMValue &callee, Call *node, bool tail = false);
+    bool EmitTailCallIfPossible(Expression *expr);
     void EmitMapAccessor(const VMValue &callee, Call *node);
     void EmitArrayAccessorOrMakeSlice(const VMValue &callee, Call *node);
 
@@ -694,6 +702,12 @@ void EmittingAstVisitor::VisitFunctionLiteral(FunctionLiteral *node) {
     naked_builder()->frame(frame_placement, info.p_stack_size(), info.o_stack_size(),
                            object_argument_size);
 
+    // fuse hot bit code pairs to superinstructions
+    BitCodeFusion fusion(info.constant_primitive_data(),
+                         info.constant_primitive_size());
+    fusion.Run(static_cast<uint64_t *>(naked_builder()->code()->offset(0)),
+               naked_builder()->pc());
+
     Handle<MIOFunction> ob = emitter_
             ->object_factory_
             ->CreateGeneratedFunction(info.constant_objects(),
@@ -846,6 +860,11 @@ void EmittingAstVisitor::VisitContinue(Continue *node) {
 }
 
 void EmittingAstVisitor::VisitReturn(Return *node) {
+    if (node->has_return_value() &&
+        EmitTailCallIfPossible(node->expression())) {
+        PushValue(VMValue::Void());
+        return;
+    }
     if (node->has_return_value()) {
         auto result = Emit(node->expression());
 
@@ -869,6 +888,14 @@ void EmittingAstVisitor::VisitReturn(Return *node) {
 }
 
 void EmittingAstVisitor::VisitCall(Call *node) {
+    if (node->callee_type()->IsFunctionPrototype()) {
+        VMValue global_fn;
+        if (GetGlobalFunction(node->expression(), &global_fn)) {
+            EmitFunctionCall(global_fn, node);
+            return;
+        }
+    }
+
     auto expr = Emit(node->expression());
     DCHECK_EQ(BC_LOCAL_OBJECT_SEGMENT, expr.segment);
 
@@ -1544,18 +1571,7 @@ void EmittingAstVisitor::VisitBinaryOperation(BinaryOperation *node) {
 
 void EmittingAstVisitor::VisitReference(Reference *node) {
     auto var = node->variable();
-    if (var->bind_kind() == Variable::UNBINDED) {
-        DCHECK_EQ(MODULE_SCOPE, var->scope()->type());
-
-        auto scope = current_;
-        while (scope->prev()) {
-            scope = scope->prev();
-        }
-        auto save = current_;
-        current_ = scope;
-        Emit(var->declaration());
-        current_ = save;
-    }
+    EmitUnbindedVariable(var);
     DCHECK_NE(Variable::UNBINDED, var->bind_kind()) << var->name()->ToString();
 
     VMValue value;
@@ -2086,7 +2102,69 @@ VMValue EmittingAstVisitor::EmitFloatingCmp(Type *type, Expression *lhs,
     return result;
 }
 
-void EmittingAstVisitor::EmitFunctionCall(const VMValue &callee, Call *node) {
+void EmittingAstVisitor::EmitUnbindedVariable(Variable *var) {
+    if (var->bind_kind() != Variable::UNBINDED) {
+        return;
+    }
+    DCHECK_EQ(MODULE_SCOPE, var->scope()->type());
+
+    auto scope = current_;
+    while (scope->prev()) {
+        scope = scope->prev();
+    }
+    auto save = current_;
+    current_ = scope;
+    Emit(var->declaration());
+    current_ = save;
+}
+
+bool EmittingAstVisitor::GetGlobalFunction(Expression *expr, VMValue *value) {
+    if (!expr->IsReference()) {
+        return false;
+    }
+    auto var = expr->AsReference()->variable();
+    if (var->link() || !var->is_function()) {
+        return false;
+    }
+    auto define = var->declaration()->AsFunctionDefine();
+    if (define->is_native() || !define->scope()->is_universal()) {
+        return false;
+    }
+
+    EmitUnbindedVariable(var);
+    DCHECK_EQ(Variable::GLOBAL, var->bind_kind()) << var->name()->ToString();
+
+    value->segment = BC_GLOBAL_OBJECT_SEGMENT;
+    value->size    = kObjectReferenceSize;
+    value->offset  = var->offset();
+    return true;
+}
+
+bool EmittingAstVisitor::EmitTailCallIfPossible(Expression *expr) {
+    if (!expr->IsCall()) {
+        return false;
+    }
+    auto call = expr->AsCall();
+    auto proto = call->callee_type()->AsFunctionPrototype();
+    if (!proto) {
+        return false;
+    }
+    // Callee's result must be the caller's result without any converting.
+    auto return_type = current_->prototype()->return_type();
+    if (proto->return_type()->GenerateId() != return_type->GenerateId()) {
+        return false;
+    }
+
+    VMValue global_fn;
+    if (!GetGlobalFunction(call->expression(), &global_fn)) {
+        return false;
+    }
+    EmitFunctionCall(global_fn, call, true);
+    return true;
+}
+
+void EmittingAstVisitor::EmitFunctionCall(const VMValue &callee, Call *node,
+                                          bool tail) {
     auto proto = DCHECK_NOTNULL(node->callee_type()->AsFunctionPrototype());
 
     std::vector<VMValue> args;
@@ -2104,7 +2182,7 @@ void EmittingAstVisitor::EmitFunctionCall(const VMValue &callee, Call *node) {
     }
 
     VMValue result;
-    if (!proto->return_type()->IsVoid()) {
+    if (!tail && !proto->return_type()->IsVoid()) {
         if (proto->return_type()->is_primitive()) {
             result = current_->MakePrimitiveValue(proto->return_type()->placement_size());
         } else {
@@ -2117,22 +2195,45 @@ void EmittingAstVisitor::EmitFunctionCall(const VMValue &callee, Call *node) {
         auto value = args[i];
         switch (value.segment) {
             case BC_LOCAL_PRIMITIVE_SEGMENT:
-                EmitMove(current_->MakePrimitiveValue(value.size), value,
-                         node->argument(i)->position());
+                args[i] = current_->MakePrimitiveValue(value.size);
                 break;
 
             case BC_LOCAL_OBJECT_SEGMENT:
-                EmitMove(current_->MakeObjectValue(), value,
-                         node->argument(i)->position());
+                args[i] = current_->MakeObjectValue();
                 break;
 
             default:
                 DLOG(FATAL) << "bad value segment: " << value.segment;
                 break;
         }
+        EmitMove(args[i], value, node->argument(i)->position());
+    }
+
+    if (tail) {
+        // Reuse the current frame: move arguments to the bottom of it in
+        // order. A moving can not clobber the following arguments, but its
+        // source and destination may overlap, mov bit codes allow it.
+        for (int i = 0; i < node->argument_size(); ++i) {
+            auto dest = args[i];
+            if (dest.segment == BC_LOCAL_PRIMITIVE_SEGMENT) {
+                dest.offset -= p_base;
+            } else {
+                dest.offset -= o_base;
+            }
+            if (dest.offset != args[i].offset) {
+                EmitMove(dest, args[i], node->argument(i)->position());
+            }
+        }
+        builder(node->position())->tail_call(current_->o_stack_size() - o_base,
+                                              callee.offset);
+        return;
     }
 
-    builder(node->position())->call_val(p_base, o_base, callee.offset);
+    if (callee.segment == BC_GLOBAL_OBJECT_SEGMENT) {
+        builder(node->position())->call(p_base, o_base, callee.offset);
+    } else {
+        builder(node->position())->call_val(p_base, o_base, callee.offset);
+    }
     if (proto->return_type()->IsVoid()) {
         PushValue(VMValue::Void());
     } else {
@@ -8,6 +8,11 @@
 #include "text-input-stream.h"
 #include "text-output-stream.h"
 #include "simple-file-system.h"
+#include "vm-baseline-compiler.h"
+#include "vm-objects.h"
+#include "nyaa/nyaa-code-generator.h"
+#include "nyaa/nyaa-graph-builder.h"
+#include "nyaa/nyaa-passes.h"
 #include <unordered_set>
 
 namespace mio {
@@ -305,4 +310,65 @@ ParsedUnitMap *Compiler::ParseProject(const char *project_dir,
     emitter.Run(all_modules, info);
 }
 
+/*static*/ void Compiler::BitCodeToNativeCodeFragment(MIOFunction *fn,
+                                                      int pc,
+                                                      int id,
+                                                      TraceTree *tree,
+                                                      CodeCache *cc,
+                                                      CodeRef *cr) {
+    // Trace compiling: only the hot path of the loop begins at pc.
+    auto generated = DCHECK_NOTNULL(fn->AsGeneratedFunction());
+    BaselineCompiler compiler(static_cast<uint64_t *>(generated->GetCode()),
+                              generated->GetCodeSize(),
+                              generated->GetConstantPrimitiveData(),
+                              generated->GetConstantPrimitiveSize());
+    *cr = compiler.CompileTrace(cc, pc, tree);
+}
+
+/*static*/ void Compiler::BitCodeToNativeCode(MIOFunction *fn,
+                                              int pc,
+                                              int id,
+                                              TraceTree *tree,
+                                              CodeCache *cc,
+                                              CodeRef *cr) {
+    // Baseline compiling translates the whole function from its first bit
+    // code, trace informations are not used yet.
+    DCHECK_EQ(0, pc);
+    auto generated = DCHECK_NOTNULL(fn->AsGeneratedFunction());
+    BaselineCompiler compiler(static_cast<uint64_t *>(generated->GetCode()),
+                              generated->GetCodeSize(),
+                              generated->GetConstantPrimitiveData(),
+                              generated->GetConstantPrimitiveSize());
+    *cr = compiler.Compile(cc);
+}
+
+/*static*/ void Compiler::BitCodeToOptimizedNativeCode(MIOFunction *fn,
+                                                       bool side_exits,
+                                                       CodeCache *cc,
+                                                       CodeRef *cr,
+                                                       std::vector<int> *entries,
+                                                       std::vector<int> *exits) {
+    // Optimizing compiling: lift the whole function to Nyaa SSA graph,
+    // optimize it then lower it with allocated registers. The native code is
+    // entered after frame, at loops (OSR) and after side exits.
+    auto generated = DCHECK_NOTNULL(fn->AsGeneratedFunction());
+
+    Zone zone;
+    NGraphBuilder builder(&zone, generated);
+    builder.set_side_exits(side_exits);
+    auto graph = builder.Build();
+    if (!graph) {
+        *cr = CodeRef(nullptr);
+        return;
+    }
+    NPassManager passes(builder.factory());
+    passes.AddDefaultPasses();
+    passes.Run(graph);
+
+    NCodeGenerator generator(graph);
+    *cr = generator.Generate(cc);
+    *entries = generator.entries();
+    *exits = generator.exits();
+}
+
 } // namespace mio
@@ -6,6 +6,7 @@
 #include "zone.h"
 #include "handles.h"
 #include <unordered_map>
+#include <vector>
 
 namespace mio {
 
@@ -126,6 +127,19 @@ public:
                                     CodeCache *cc,
                                     CodeRef *cr);
 
+    /**
+     * @param side_exits bit codes can not be compiled go back to interpreter,
+     *                   otherwise such function is not compiled.
+     * @param entries    pcs native code can be entered at.
+     * @param exits      pcs native code may deoptimize at.
+     */
+    static void BitCodeToOptimizedNativeCode(MIOFunction *fn,
+                                             bool side_exits,
+                                             CodeCache *cc,
+                                             CodeRef *cr,
+                                             std::vector<int> *entries,
+                                             std::vector<int> *exits);
+
     Compiler() = delete;
     ~Compiler() = delete;
     DISALLOW_IMPLICIT_CONSTRUCTORS(Compiler)
@@ -1,5 +1,6 @@
 #include "do-nothing-garbage-collector.h"
 #include "vm-object-surface.h"
+#include "vm-bitcode-decoder.h"
 #include "vm-objects.h"
 #include "glog/logging.h"
 #include <stdlib.h>
@@ -15,6 +16,9 @@ DoNothingGarbageCollector::DoNothingGarbageCollector(ManagedAllocator *allocator
 /*virtual*/
 DoNothingGarbageCollector::~DoNothingGarbageCollector() {
     for (auto ob : objects_) {
+        if (ob->IsGeneratedFunction()) {
+            BitCodeDecoder::Free(ob->AsGeneratedFunction()->GetDecodedCode());
+        }
         allocator_->Free(ob);
     }
 }
@@ -69,6 +73,7 @@ DoNothingGarbageCollector::CreateNativeFunction(const char *signature,
     ob->SetSignature(sign.get());
     ob->SetNativePointer(pointer);
     ob->SetNativeWarperIndex(nullptr);
+    ob->SetLeafPointer(nullptr);
     return make_handle(ob);
 }
 
@@ -92,6 +97,7 @@ DoNothingGarbageCollector::CreateGeneratedFunction(const std::vector<Handle<Heap
     ob->SetRecompilingKind(MIOGeneratedFunction::NONE);
     ob->SetNativeCodeFragment(nullptr);
     ob->SetDebugInfo(nullptr);
+    ob->SetDecodedCode(nullptr);
 
     ob->SetConstantPrimitiveSize(constant_primitive_size);
     memcpy(ob->GetConstantPrimitiveData(), constant_primitive_data, constant_primitive_size);
@@ -1,6 +1,7 @@
 #include "msg-garbage-collector.h"
 #include "managed-allocator.h"
 #include "vm-code-cache.h"
+#include "vm-bitcode-decoder.h"
 #include "vm-thread.h"
 #include "vm-memory-segment.h"
 #include "vm-object-scanner.h"
@@ -45,31 +46,20 @@ MSGGarbageCollector::MSGGarbageCollector(ManagedAllocator *allocator,
     , root_(DCHECK_NOTNULL(root))
     , main_thread_(DCHECK_NOTNULL(main_thread))
     , current_thread_(main_thread)
-    , handle_header_(static_cast<HeapObject *>(::malloc(HeapObject::kListEntryOffset)))
-    , gray_header_(static_cast<HeapObject *>(::malloc(HeapObject::kListEntryOffset)))
-    , gray_again_header_(static_cast<HeapObject *>(::malloc(HeapObject::kListEntryOffset)))
-    , weak_header_(static_cast<HeapObject *>(::malloc(HeapObject::kListEntryOffset)))
     , allocator_(DCHECK_NOTNULL(allocator))
+    , nursery_(new Nursery(kDefaultNurserySize))
+    , sweeper_(new BackgroundSweeper())
     , code_cache_(DCHECK_NOTNULL(code_cache)) {
-    handle_header_->InitEntry();
-    gray_header_->InitEntry();
-    gray_again_header_->InitEntry();
-    weak_header_->InitEntry();
-
-    for (int i = 0; i < kMaxGeneration; ++i) {
-        generations_[i] = static_cast<HeapObject *>(::malloc(HeapObject::kListEntryOffset));
-        generations_[i]->InitEntry();
+    if (!nursery_->Init()) {
+        DLOG(WARNING) << "no nursery, all objects are allocated.";
     }
 }
 
 /*virtual*/
 MSGGarbageCollector::~MSGGarbageCollector() {
-    for (int i = 0; i < kMaxGeneration; ++i) {
-        ::free(generations_[i]);
-    }
-    ::free(gray_again_header_);
-    ::free(gray_header_);
-    ::free(handle_header_);
+    // Sweeper is reading objects, stop it before they are gone.
+    delete sweeper_;
+    delete nursery_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -106,9 +96,19 @@ Handle<MIOString> MSGGarbageCollector::GetOrNewString(const mio_strbuf_t *bufs,
 
     auto iter = unique_strings_.find(ob->GetData());
     if (iter != unique_strings_.end()) {
-        HORemove(ob);
-        allocator_->Free(ob);
-        ob = const_cast<MIOString *>(MIOString::OffsetOfData(*iter));
+        // It may be dead and not released yet.
+        auto found = const_cast<MIOString *>(MIOString::OffsetOfData(*iter));
+        if (found->GetColor() == PrevWhite()) {
+            found->SetColor(white_);
+        }
+        if (nursery_->Contains(ob)) {
+            nursery_->FreeLast(ob, total_size);
+        } else {
+            DCHECK_EQ(ob, generations_[0].back());
+            generations_[0].pop_back();
+            allocator_->Free(ob);
+        }
+        ob = found;
     } else {
         unique_strings_.insert(ob->GetData());
     }
@@ -140,6 +140,7 @@ MSGGarbageCollector::CreateNativeFunction(const char *signature,
     ob->SetSignature(sign.get());
     ob->SetNativePointer(pointer);
     ob->SetNativeWarperIndex(nullptr);
+    ob->SetLeafPointer(nullptr);
     return make_handle(ob);
 }
 
@@ -163,6 +164,7 @@ MSGGarbageCollector::CreateGeneratedFunction(const std::vector<Handle<HeapObject
     ob->SetRecompilingKind(MIOGeneratedFunction::NONE);
     ob->SetNativeCodeFragment(nullptr);
     ob->SetDebugInfo(nullptr);
+    ob->SetDecodedCode(nullptr);
 
     ob->SetConstantPrimitiveSize(constant_primitive_size);
     memcpy(ob->GetConstantPrimitiveData(), constant_primitive_data, constant_primitive_size);
@@ -309,7 +311,12 @@ MSGGarbageCollector::GetOrNewUpValue(const void *data, int size,
                                     int32_t unique_id, bool is_primitive) {
     auto iter = unique_upvals_.find(unique_id);
     if (iter != unique_upvals_.end()) {
-        return make_handle(iter->second);
+        // It may be dead and not released yet.
+        auto found = iter->second;
+        if (found->GetColor() == PrevWhite()) {
+            found->SetColor(white_);
+        }
+        return make_handle(found);
     }
 
     auto placement_size = MIOUpValue::kHeaderOffset + size;
@@ -465,7 +472,8 @@ void MSGGarbageCollector::Step(int tick) {
             break;
 
         case kPropagate:
-            if (HOIsNotEmpty(gray_header_)) {
+            // Full gc marks all objects in atomic phase.
+            if (!gray_.empty() && !need_full_gc_) {
                 Propagate();
             } else {
                 Atomic();
@@ -496,20 +504,14 @@ void MSGGarbageCollector::Step(int tick) {
 
 /*virtual*/
 void MSGGarbageCollector::WriteBarrier(HeapObject *target, HeapObject *other) {
+    // Promoted objects out of nursery are moved to old table by young
+    // sweeping, the others are promoted in place.
     if (target->GetGeneration() > other->GetGeneration()) {
         other->SetGeneration(target->GetGeneration());
-        if (other->GetColor() != kGray) {
-            HORemove(other);
-            HOInsertHead(generations_[target->GetGeneration()], other);
-        }
     }
 
     if (other->GetGeneration() > target->GetGeneration()) {
         target->SetGeneration(other->GetGeneration());
-        if (target->GetColor() != kGray) {
-            HORemove(target);
-            HOInsertHead(generations_[other->GetGeneration()], target);
-        }
     }
 
     if (target->GetColor() == kBlack || target->IsGrabbed()) {
@@ -524,6 +526,7 @@ void MSGGarbageCollector::WriteBarrier(HeapObject *target, HeapObject *other) {
 
 /*virtual*/
 void MSGGarbageCollector::FullGC() {
+    waiting_ = true;
     while (phase_ != kPause) {
         Step(0);
     }
@@ -534,6 +537,7 @@ void MSGGarbageCollector::FullGC() {
         Step(0);
     }
     need_full_gc_ = false;
+    waiting_ = false;
 }
 
 void MSGGarbageCollector::MarkRoot() {
@@ -555,16 +559,12 @@ void MSGGarbageCollector::MarkRoot() {
         MarkGray(call_stack[i]);
     }
 
-    while (HOIsNotEmpty(handle_header_)) {
-        auto x = handle_header_->GetNext();
-        HORemove(x);
+    for (auto x : handles_) {
         if (x->IsGrabbed()) {
-            x->SetColor(kGray);
-            HOInsertHead(gray_header_, x);
-        } else {
-            HOInsertHead(generations_[x->GetGeneration()], x);
+            MarkGray(x);
         }
     }
+    handles_.clear();
 
     phase_ = kPropagate;
 }
@@ -573,14 +573,12 @@ void MSGGarbageCollector::Propagate() {
     ObjectScanner scanner;
     auto n = 0;
 
-    while (n < propagate_speed_ && HOIsNotEmpty(gray_header_)) {
-        auto x = gray_header_->GetNext();
+    while (n < propagate_speed_ && !gray_.empty()) {
+        auto x = gray_.back();
+        gray_.pop_back();
         if (ShouldProcessWeakMap(x)) {
             x->SetColor(kBlack);
-
-            HORemove(x);
-            DCHECK_NE(x, gray_again_header_);
-            HOInsertHead(weak_header_, x);
+            weak_.push_back(x);
             n++;
             continue;
         }
@@ -590,19 +588,17 @@ void MSGGarbageCollector::Propagate() {
                 case kWhite0:
                 case kWhite1:
                     ob->SetColor(kBlack);
+                    gray_again_.push_back(ob);
                     break;
 
                 case kGray:
                     Gray2Black(ob);
+                    gray_again_.push_back(ob);
                     break;
 
                 case kBlack:
                     break;
             }
-            HORemove(ob);
-            DCHECK_NE(ob, gray_again_header_);
-            HOInsertHead(gray_again_header_, ob);
-
             n++;
         });
     }
@@ -613,30 +609,41 @@ void MSGGarbageCollector::Propagate() {
 }
 
 void MSGGarbageCollector::Atomic() {
-    DCHECK(HOIsEmpty(gray_header_));
-    while (HOIsNotEmpty(gray_again_header_)) {
-        auto x = gray_again_header_->GetNext();
-        HORemove(x);
-        HOInsertHead(gray_header_, x);
+    // Propagate black objects again, mutator may change them.
+    gray_.insert(gray_.end(), gray_again_.begin(), gray_again_.end());
+    gray_again_.clear();
+    MarkRoot();
+
+    // Weak maps are not traced, the others are roots of parallel marking.
+    auto n = 0;
+    for (auto x : gray_) {
+        if (ShouldProcessWeakMap(x)) {
+            x->SetColor(kBlack);
+            weak_.push_back(x);
+        } else {
+            gray_[n++] = x;
+        }
     }
+    gray_.resize(n);
 
-    MarkRoot();
-    while (HOIsNotEmpty(gray_header_)) {
-        Propagate();
+    if (!marker_) {
+        marker_ = ParallelMarker::Shared();
+    }
+    // Black objects have been traced, only the gray stacks are traced again.
+    auto marked = marker_->Mark(gray_, kBlack);
+    gray_.clear();
+    if (trace_logging_) {
+        DLOG(INFO) << "atomic: " << marked << " objects, "
+                   << marker_->number_of_workers() << " workers, "
+                   << marker_->steals() << " steals.";
     }
 
-    while (HOIsNotEmpty(weak_header_)) {
+    while (!weak_.empty()) {
         CollectWeakReferences();
     }
 
-    while (HOIsNotEmpty(gray_again_header_)) {
-        auto x = gray_again_header_->GetNext();
-        HORemove(x);
-        HOInsertHead(generations_[x->GetGeneration()], x);
-    }
     SwitchWhite();
-    phase_ = kSweepYoung;
-    sweep_info_[0].iter = generations_[0]->GetNext();
+    StartSweeping(0);
 }
 
 void MSGGarbageCollector::CollectWeakReferences() {
@@ -644,8 +651,9 @@ void MSGGarbageCollector::CollectWeakReferences() {
     auto info = &sweep_info_[kWeakReferenceSweep];
 
     ++info->times;
-    while (n < sweep_speed_ && HOIsNotEmpty(weak_header_)) {
-        auto x = weak_header_->GetNext();
+    while (n < sweep_speed_ && !weak_.empty()) {
+        auto x = weak_.back();
+        weak_.pop_back();
         auto map = DCHECK_NOTNULL(x->AsHashMap());
         for (int i = 0; i < map->GetSlotSize(); ++i) {
             auto prev = reinterpret_cast<MIOPair *>(map->GetSlot(i));
@@ -680,100 +688,164 @@ void MSGGarbageCollector::CollectWeakReferences() {
                 }
             }
         }
-        HORemove(x);
-        HOInsertHead(generations_[x->GetGeneration()], x); // move to old generation.
         n++;
     }
 }
 
 void MSGGarbageCollector::SweepYoung() {
-    auto header = generations_[0];
-    auto n = 0;
+    if (!ReleaseSwept(waiting_)) {
+        return;
+    }
+    // Objects allocated during sweeping follow the living ones.
+    sweeping_.insert(sweeping_.end(), generations_[0].begin(),
+                     generations_[0].end());
+    generations_[0].swap(sweeping_);
+    sweeping_.clear();
+    generations_[1].insert(generations_[1].end(), promoted_.begin(),
+                           promoted_.end());
+    promoted_.clear();
 
     auto info = &sweep_info_[0];
-    ++info->times;
-    while (n < sweep_speed_ && info->iter != header) {
-        auto x = info->iter; info->iter = info->iter->GetNext();
-        if (x->IsGrabbed()) {
-            ++info->grabbed;
-            x->SetColor(white_);
-            HORemove(x);
-            HOInsertHead(handle_header_, x);
-        } else if (x->GetColor() == PrevWhite()) {
-            ++info->release;
-            info->release_bytes += x->GetSize();
-            HORemove(x);
-            DeleteObject(x);
-        } else if (x->GetColor() == white_) {
-            // junks
-            ++info->junks;
-            info->junks_bytes += x->GetSize();
-        } else {
-            ++info->grow_up;
-            x->SetGeneration(1);
-            HORemove(x);
-            HOInsertHead(generations_[1], x); // move to old generation.
-        }
-        n++;
+    if (need_full_gc_) {
+        StartSweeping(1);
+    } else {
+        phase_ = kFinialize;
     }
-    if (info->iter == header) {
-        if (need_full_gc_) {
-            phase_ = kSweepOld;
-            sweep_info_[1].iter = generations_[1]->GetNext();
-        } else {
-            phase_ = kFinialize;
-        }
 
-        if (trace_logging_) {
-            DLOG(INFO) << "------[young generation]------";
-            DLOG(INFO) << "-- release: " << info->release << ", " << info->release_bytes;
-            DLOG(INFO) << "-- junks: "   << info->junks   << ", " << info->junks_bytes;
-            DLOG(INFO) << "-- grabbed: " << info->grabbed;
-            DLOG(INFO) << "-- grow up: " << info->grow_up;
-        }
+    if (trace_logging_) {
+        DLOG(INFO) << "------[young generation]------";
+        DLOG(INFO) << "-- release: " << info->release << ", " << info->release_bytes;
+        DLOG(INFO) << "-- junks: "   << info->junks   << ", " << info->junks_bytes;
+        DLOG(INFO) << "-- grabbed: " << info->grabbed;
+        DLOG(INFO) << "-- grow up: " << info->grow_up;
     }
 }
 
 void MSGGarbageCollector::SweepOld() {
-    auto header = generations_[1];
-    auto n = 0;
+    if (!ReleaseSwept(waiting_)) {
+        return;
+    }
+    sweeping_.insert(sweeping_.end(), generations_[1].begin(),
+                     generations_[1].end());
+    generations_[1].swap(sweeping_);
+    sweeping_.clear();
 
     auto info = &sweep_info_[1];
-    ++info->times;
-    while (n < sweep_speed_ && info->iter != header) {
-        auto x = info->iter; info->iter = info->iter->GetNext();
+    phase_ = kFinialize;
 
-        if (x->IsGrabbed()) {
-            ++info->grabbed;
-            x->SetColor(white_);
-            HORemove(x);
-            HOInsertHead(handle_header_, x);
-        } else if (x->GetColor() == PrevWhite()) {
-            ++info->release;
-            info->release_bytes += x->GetSize();
-            HORemove(x);
-            DeleteObject(x);
-        } else if (x->GetColor() == white_) {
-            // junks
-            ++info->junks;
-            info->junks_bytes += x->GetSize();
-        } else {
-            x->SetColor(white_);
-            ++info->junks;
-            info->junks_bytes += x->GetSize();
-        }
-        n++;
+    if (trace_logging_) {
+        DLOG(INFO) << "------[old generation]------";
+        DLOG(INFO) << "-- release: " << info->release << ", " << info->release_bytes;
+        DLOG(INFO) << "-- junks: "   << info->junks   << ", " << info->junks_bytes;
+        DLOG(INFO) << "-- grabbed: " << info->grabbed;
     }
-    if (info->iter == header) {
-        phase_ = kFinialize;
+}
+
+void MSGGarbageCollector::StartSweeping(int g) {
+    DCHECK(sweeping_.empty());
+    if (!sweeper_->running()) {
+        sweeper_->Start();
+    }
+    sweeping_.swap(generations_[g]);
+    swept_ = false;
+    phase_ = g == 0 ? kSweepYoung : kSweepOld;
+    if (g == 0) {
+        sweeper_->Submit(&sweeping_, nursery_, [this] (HeapObject *x) {
+            return SweepYoungObject(x);
+        });
+    } else {
+        sweeper_->Submit(&sweeping_, nursery_, [this] (HeapObject *x) {
+            return SweepOldObject(x);
+        });
+    }
+}
 
-        if (trace_logging_) {
-            DLOG(INFO) << "------[old generation]------";
-            DLOG(INFO) << "-- release: " << info->release << ", " << info->release_bytes;
-            DLOG(INFO) << "-- junks: "   << info->junks   << ", " << info->junks_bytes;
-            DLOG(INFO) << "-- grabbed: " << info->grabbed;
+bool MSGGarbageCollector::ReleaseSwept(bool wait) {
+    if (swept_) {
+        return true;
+    }
+    auto g = phase_ == kSweepYoung ? 0 : 1;
+    ++sweep_info_[g].times;
+    swept_ = sweeper_->TakeDead(&dead_, wait);
+    if (swept_) {
+        auto info = &sweep_info_[g];
+        info->release       += sweeping_info_.release;
+        info->release_bytes += sweeping_info_.release_bytes;
+        info->grow_up       += sweeping_info_.grow_up;
+        info->junks         += sweeping_info_.junks;
+        info->junks_bytes   += sweeping_info_.junks_bytes;
+        info->grabbed       += sweeping_info_.grabbed;
+        sweeping_info_ = SweepInfo();
+    }
+    for (auto x : dead_) {
+        // Unique strings may be found again before released.
+        if (x->IsGrabbed() || x->GetColor() != PrevWhite()) {
+            x->SetColor(white_);
+            if (!nursery_->Contains(x)) {
+                generations_[g].push_back(x);
+            }
+            continue;
         }
+        DeleteObject(x);
+    }
+    dead_.clear();
+    return swept_;
+}
+
+BackgroundSweeper::Disposition
+MSGGarbageCollector::SweepYoungObject(HeapObject *x) {
+    auto in_nursery = nursery_->Contains(x);
+    if (in_nursery && x->GetGeneration() > 0) {
+        return BackgroundSweeper::kLive; // swept by old sweeping.
+    }
+    auto info = &sweeping_info_;
+    if (x->IsGrabbed()) {
+        ++info->grabbed;
+        x->SetColor(white_);
+        handles_.push_back(x);
+    } else if (x->GetColor() == PrevWhite()) {
+        ++info->release;
+        info->release_bytes += x->GetSize();
+        return BackgroundSweeper::kDead;
+    } else if (x->GetColor() == white_) {
+        // junks
+        ++info->junks;
+        info->junks_bytes += x->GetSize();
+    } else {
+        ++info->grow_up;
+        x->SetGeneration(1);
+    }
+    if (x->GetGeneration() > 0 && !in_nursery) {
+        promoted_.push_back(x); // move to old generation.
+        return BackgroundSweeper::kMoved;
+    }
+    return BackgroundSweeper::kLive;
+}
+
+BackgroundSweeper::Disposition
+MSGGarbageCollector::SweepOldObject(HeapObject *x) {
+    if (nursery_->Contains(x) && x->GetGeneration() == 0) {
+        return BackgroundSweeper::kLive; // swept by young sweeping.
+    }
+    auto info = &sweeping_info_;
+    if (x->IsGrabbed()) {
+        ++info->grabbed;
+        x->SetColor(white_);
+        handles_.push_back(x);
+    } else if (x->GetColor() == PrevWhite()) {
+        ++info->release;
+        info->release_bytes += x->GetSize();
+        return BackgroundSweeper::kDead;
+    } else if (x->GetColor() == white_) {
+        // junks
+        ++info->junks;
+        info->junks_bytes += x->GetSize();
+    } else {
+        x->SetColor(white_);
+        ++info->junks;
+        info->junks_bytes += x->GetSize();
     }
+    return BackgroundSweeper::kLive;
 }
 
 void MSGGarbageCollector::DeleteObject(const HeapObject *ob) {
@@ -800,12 +872,29 @@ void MSGGarbageCollector::DeleteObject(const HeapObject *ob) {
         case HeapObject::kGeneratedFunction: {
             auto fn = ob->AsGeneratedFunction();
             allocator_->Free(fn->GetDebugInfo());
+            BitCodeDecoder::Free(fn->GetDecodedCode());
+            auto fragment = fn->GetNativeCodeFragment();
+            while (fragment) {
+                auto next = fragment->next;
+                UnlinkInstalledNativeCodeFragment(fragment);
+                code_cache_->Free(CodeRef(fragment->index));
+                if (fragment->deopt_info) {
+                    allocator_->Free(fragment->deopt_info);
+                }
+                allocator_->Free(fragment);
+                fragment = next;
+            }
+            ++callable_epoch_;
         } break;
 
-        case HeapObject::kNativeFunction: {
-            auto fn = ob->AsNativeFunction();
-            code_cache_->Free(CodeRef(fn->GetNativeWarperIndex()));
-        } break;
+        case HeapObject::kNativeFunction:
+            // Warpers are shared by signatures, FunctionRegister owns them.
+            ++callable_epoch_;
+            break;
+
+        case HeapObject::kClosure:
+            ++callable_epoch_;
+            break;
 
         default:
             break;
@@ -815,7 +904,15 @@ void MSGGarbageCollector::DeleteObject(const HeapObject *ob) {
 //        printf("!!delete: %s\n", ob->AsString()->GetData());
 //    }
     Round32BytesFill(kFreeMemoryBytes, const_cast<HeapObject *>(ob), ob->GetSize());
-    allocator_->Free(ob);
+    FreeObject(ob);
+}
+
+void MSGGarbageCollector::FreeObject(const HeapObject *ob) {
+    if (nursery_->Contains(ob)) {
+        nursery_->Free(ob);
+    } else {
+        allocator_->Free(ob);
+    }
 }
 
 } // namespace mio
@@ -4,9 +4,13 @@
 #include "vm-garbage-collector.h"
 #include "vm-objects.h"
 #include "managed-allocator.h"
+#include "nursery.h"
+#include "parallel-marker.h"
+#include "background-sweeper.h"
 #include "base.h"
 #include "glog/logging.h"
 #include <unordered_set>
+#include <vector>
 
 namespace mio {
 
@@ -25,13 +29,24 @@ struct SweepInfo {
     int junks         = 0;
     int junks_bytes   = 0;
     int grabbed       = 0;
-    HeapObject *iter  = nullptr;
 
     SweepInfo() = default;
 };
 
 /**
  * The Mark-Sweep-Generation GC
+ *
+ * Objects have no list links in header, their generation is in header bits.
+ * Sweeping walks nursery blocks by their bitmaps, only objects out of
+ * nursery are kept in tables of generations, living ones are packed in their
+ * table. Marking uses a gray work stack.
+ *
+ * Atomic phase marks the rest gray objects by a ParallelMarker, full gc goes
+ * to atomic phase directly, so all objects are marked in parallel.
+ *
+ * A generation table is swept by BackgroundSweeper, mutator allocates
+ * objects to a new table meanwhile. Sweep steps only release dead objects
+ * found by sweeper, and nursery takes them if it has no free block.
  */
 class MSGGarbageCollector : public GarbageCollector {
 public:
@@ -58,6 +73,9 @@ public:
     static const int kDefaultSweepSpeed = 50;
     static const uint32_t kFreeMemoryBytes = 0xfeedfeed;
 
+    // Reserved bytes for young objects, see Nursery.
+    static const int kDefaultNurserySize = 4 * 1024 * 1024;
+
     MSGGarbageCollector(ManagedAllocator *allocator, CodeCache *code_cache,
                         MemorySegment *root, Thread *main_thread,
                         bool trace_logging);
@@ -169,6 +187,16 @@ public:
     virtual void FullGC() override;
     virtual void Active(bool active) override { pause_ = !active; }
 
+    Nursery *nursery() const { return nursery_; }
+
+    bool TEST_IsPaused() const { return phase_ == kPause; }
+
+    bool TEST_IsSweeping() const { return IsSweeping(); }
+
+    int TEST_GetTableSize(int g) const {
+        return static_cast<int>(generations_[g].size());
+    }
+
     typedef std::unordered_set<const char *,
                                MIOStringDataHash,
                                MIOStringDataEqualTo> UniqueStringSet;
@@ -186,13 +214,34 @@ private:
     void SweepYoung();
     void SweepOld();
 
+    /**
+     * Submit generation g to background sweeper, and go to its phase.
+     */
+    void StartSweeping(int g);
+
+    /**
+     * Release dead objects found by background sweeper.
+     *
+     * @return true if the sweeping generation has been all swept.
+     */
+    bool ReleaseSwept(bool wait);
+
+    /**
+     * Decide objects on sweeper thread.
+     */
+    BackgroundSweeper::Disposition SweepYoungObject(HeapObject *x);
+    BackgroundSweeper::Disposition SweepOldObject(HeapObject *x);
+
+    bool IsSweeping() const {
+        return phase_ == kSweepYoung || phase_ == kSweepOld;
+    }
+
     void MarkGray(HeapObject *x) {
         if (!x || x->GetColor() == kGray || x->GetColor() == kBlack) {
             return;
         }
         White2Gray(x);
-        HORemove(x);
-        HOInsertHead(gray_header_, x);
+        gray_.push_back(x);
     }
 
     template<class T>
@@ -200,6 +249,11 @@ private:
 
     void DeleteObject(const HeapObject *ob);
 
+    /**
+     * Give back memory of ob, to nursery or allocator.
+     */
+    void FreeObject(const HeapObject *ob);
+
     void White2Gray(HeapObject *ob) {
         DCHECK(ob->GetColor() == kWhite0 || ob->GetColor() == kWhite1)
             << "color: " << ob->GetColor()
@@ -226,6 +280,8 @@ private:
     int propagate_speed_ = kDefaultPropagateSpeed;
     int sweep_speed_ = kDefaultSweepSpeed;
     bool need_full_gc_ = false;
+    bool waiting_ = false; // full gc waits background sweeping.
+    bool swept_ = true;
 
     UniqueStringSet unique_strings_;
     std::unordered_map<int32_t, MIOUpValue *> unique_upvals_;
@@ -235,25 +291,52 @@ private:
     Thread *main_thread_;
     Thread *current_thread_;
 
-    HeapObject  *handle_header_;
-    HeapObject  *gray_header_;
-    HeapObject  *gray_again_header_;
-    HeapObject  *weak_header_;
-    HeapObject  *generations_[kMaxGeneration];
+    // Grabbed objects found by sweeping, they are roots of next marking.
+    // Sweeper thread owns it during sweeping, so as promoted_.
+    std::vector<HeapObject *> handles_;
+    // Young objects out of nursery moved to old generation by sweeping.
+    std::vector<HeapObject *> promoted_;
+    // The generation table is being swept.
+    std::vector<HeapObject *> sweeping_;
+    // Dead objects taken from sweeper.
+    std::vector<HeapObject *> dead_;
+    // Gray objects to propagate.
+    std::vector<HeapObject *> gray_;
+    // Black objects, they are propagated again in atomic phase.
+    std::vector<HeapObject *> gray_again_;
+    // Weak maps to sweep their weak references.
+    std::vector<HeapObject *> weak_;
+    // Objects out of nursery, the others are found by walking nursery.
+    std::vector<HeapObject *> generations_[kMaxGeneration];
     ManagedAllocator *allocator_;
+    Nursery *nursery_;
+    ParallelMarker *marker_ = nullptr; // shared, taken at first atomic phase.
+    BackgroundSweeper *sweeper_;
     CodeCache *code_cache_;
     SweepInfo sweep_info_[kMaxGeneration + 1];
+    // Counted by sweeper thread, added to sweep_info_ after all swept.
+    SweepInfo sweeping_info_;
 }; // class MSGGarbageCollector
 
 template<class T>
 inline T *MSGGarbageCollector::NewObject(int placement_size, int g) {
-    auto ob = static_cast<T *>(allocator_->Allocate(placement_size));
+    // Young objects are bumped in nursery, old or large ones are allocated.
+    auto chunk = g == 0 ? nursery_->Allocate(placement_size) : nullptr;
+    if (!chunk && g == 0 && placement_size <= Nursery::kMaxObjectSize &&
+        IsSweeping()) {
+        // No free block, wait for sweeping to release blocks.
+        ReleaseSwept(true);
+        chunk = nursery_->Allocate(placement_size);
+    }
+    auto ob = static_cast<T *>(chunk ? chunk : allocator_->Allocate(placement_size));
     if (!ob) {
         return nullptr;
     }
     ob->Init(static_cast<HeapObject::Kind>(T::kSelfKind));
     ob->SetColor(white_);
-    HOInsertHead(generations_[g], ob);
+    if (!chunk) {
+        generations_[g].push_back(ob);
+    }
     return ob;
 }
 
@@ -0,0 +1,97 @@
+#include "nursery.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+TEST(NurseryTest, Sanity) {
+    Nursery nursery(4 * Nursery::kBlockSize);
+    ASSERT_TRUE(nursery.Init());
+    EXPECT_EQ(4 * Nursery::kBlockSize, nursery.capacity());
+    EXPECT_EQ(4, nursery.block_size());
+    EXPECT_EQ(0, nursery.GetUsedBlocks());
+
+    auto p1 = static_cast<uint8_t *>(nursery.Allocate(13));
+    auto p2 = static_cast<uint8_t *>(nursery.Allocate(16));
+    ASSERT_NE(nullptr, p1);
+    EXPECT_EQ(p1 + 16, p2);
+    EXPECT_TRUE(nursery.Contains(p1));
+    EXPECT_TRUE(nursery.Contains(p2));
+    EXPECT_FALSE(nursery.Contains(&nursery));
+    EXPECT_EQ(1, nursery.GetUsedBlocks());
+
+    EXPECT_EQ(nullptr, nursery.Allocate(Nursery::kMaxObjectSize + 8));
+}
+
+TEST(NurseryTest, FreeLast) {
+    Nursery nursery(Nursery::kBlockSize);
+    ASSERT_TRUE(nursery.Init());
+
+    auto p1 = nursery.Allocate(24);
+    auto p2 = nursery.Allocate(40);
+    nursery.FreeLast(p2, 40);
+    EXPECT_EQ(p2, nursery.Allocate(32));
+    nursery.Free(p1);
+    EXPECT_EQ(1, nursery.GetUsedBlocks());
+}
+
+TEST(NurseryTest, RecycleBlocks) {
+    Nursery nursery(2 * Nursery::kBlockSize);
+    ASSERT_TRUE(nursery.Init());
+
+    static const int kSize = Nursery::kMaxObjectSize;
+    static const int kN = Nursery::kBlockSize / kSize;
+    void *first[kN];
+    for (int i = 0; i < kN; ++i) {
+        first[i] = nursery.Allocate(kSize);
+        ASSERT_NE(nullptr, first[i]);
+    }
+    auto p = nursery.Allocate(kSize);
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(2, nursery.GetUsedBlocks());
+    for (int i = 1; i < kN; ++i) {
+        ASSERT_NE(nullptr, nursery.Allocate(kSize));
+    }
+
+    // All blocks are in use.
+    EXPECT_EQ(nullptr, nursery.Allocate(8));
+
+    for (int i = 0; i < kN; ++i) {
+        nursery.Free(first[i]);
+    }
+    EXPECT_EQ(1, nursery.GetUsedBlocks());
+    EXPECT_EQ(first[0], nursery.Allocate(8));
+}
+
+TEST(NurseryTest, WalkAllocated) {
+    Nursery nursery(2 * Nursery::kBlockSize);
+    ASSERT_TRUE(nursery.Init());
+
+    std::vector<void *> all;
+    for (int i = 0; i < Nursery::kBlockSize / 24 + 10; ++i) {
+        all.push_back(nursery.Allocate(24));
+    }
+    for (size_t i = 0; i < all.size(); i += 2) {
+        nursery.Free(all[i]);
+        EXPECT_FALSE(nursery.IsAllocated(all[i]));
+    }
+
+    std::vector<Nursery::Span> spans;
+    nursery.GetSpans(&spans);
+    ASSERT_EQ(2, spans.size());
+    EXPECT_EQ(static_cast<int>(Nursery::kBlockSize), spans[0].end);
+    EXPECT_EQ(10 * 24, spans[1].end);
+
+    // Objects allocated after taking spans are not walked.
+    nursery.Allocate(24);
+    std::vector<void *> walked;
+    for (const auto &span : spans) {
+        nursery.Walk(span, [&walked] (void *p) { walked.push_back(p); });
+    }
+    ASSERT_EQ(all.size() / 2, walked.size());
+    for (size_t i = 0; i < walked.size(); ++i) {
+        EXPECT_EQ(all[i * 2 + 1], walked[i]);
+        EXPECT_TRUE(nursery.IsAllocated(walked[i]));
+    }
+}
+
+} // namespace mio
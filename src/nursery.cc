@@ -0,0 +1,96 @@
+#include "nursery.h"
+#include <sys/mman.h>
+
+namespace mio {
+
+Nursery::Nursery(int capacity)
+    : capacity_(RoundDown(capacity, kBlockSize)) {
+}
+
+Nursery::~Nursery() {
+    if (base_) {
+        munmap(base_, capacity_);
+    }
+    delete[] starts_;
+}
+
+bool Nursery::Init() {
+    if (capacity_ <= 0) {
+        capacity_ = 0;
+        return false;
+    }
+    auto chunk = mmap(nullptr, capacity_, PROT_READ|PROT_WRITE,
+                      MAP_ANON|MAP_PRIVATE, -1, 0);
+    if (chunk == MAP_FAILED) {
+        PLOG(ERROR) << "can not reserve nursery";
+        capacity_ = 0;
+        return false;
+    }
+    base_ = static_cast<uint8_t *>(chunk);
+    live_.resize(capacity_ / kBlockSize, 0);
+    auto words = capacity_ / kObjectAlignment / 32;
+    starts_ = new std::atomic<uint32_t>[words];
+    for (int i = 0; i < words; ++i) {
+        starts_[i].store(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void Nursery::Free(const void *p) {
+    DCHECK(Contains(p));
+    DCHECK(IsAllocated(p));
+    SetAllocated(p, false);
+    auto block = BlockOf(p);
+    DCHECK_GT(live_[block], 0);
+    if (--live_[block] > 0) {
+        return;
+    }
+    if (block == current_) {
+        top_ = base_ + block * kBlockSize; // reuse the whole buffer.
+    } else {
+        free_blocks_.push_back(block);
+    }
+}
+
+void Nursery::FreeLast(const void *p, int size) {
+    DCHECK_EQ(top_, static_cast<const uint8_t *>(p) + RoundUp(size, kObjectAlignment));
+    top_ = const_cast<uint8_t *>(static_cast<const uint8_t *>(p));
+    Free(p);
+}
+
+void Nursery::GetSpans(std::vector<Span> *spans) const {
+    for (int i = 0; i < fresh_; ++i) {
+        if (i == current_) {
+            spans->push_back({i, static_cast<int>(top_ - (base_ + i * kBlockSize))});
+        } else if (live_[i] > 0) {
+            spans->push_back({i, kBlockSize});
+        }
+    }
+}
+
+int Nursery::GetUsedBlocks() const {
+    return fresh_ - static_cast<int>(free_blocks_.size());
+}
+
+bool Nursery::NextBlock() {
+    int block = -1;
+    if (!free_blocks_.empty()) {
+        block = free_blocks_.back();
+        free_blocks_.pop_back();
+    } else if (fresh_ < block_size()) {
+        block = fresh_++;
+    } else {
+        return false;
+    }
+
+    // Retire the old buffer, it has been empty.
+    if (current_ >= 0 && live_[current_] == 0) {
+        free_blocks_.push_back(current_);
+    }
+    current_ = block;
+    top_     = base_ + block * kBlockSize;
+    limit_   = top_ + kBlockSize;
+    return true;
+}
+
+} // namespace mio
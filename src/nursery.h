@@ -0,0 +1,174 @@
+#ifndef MIO_NURSERY_H_
+#define MIO_NURSERY_H_
+
+#include "base.h"
+#include "bit-operations.h"
+#include "glog/logging.h"
+#include <atomic>
+#include <vector>
+
+namespace mio {
+
+/**
+ * Bump-pointer space for young objects.
+ *
+ * A reserved range is cut into fixed size blocks, the allocating thread owns
+ * one block as its allocation buffer, and allocating is a pointer increment
+ * in the buffer. Objects never move: survivors are promoted in place, so a
+ * block counts its living objects and is recycled when the count drops to
+ * zero.
+ *
+ * A side bitmap marks the first word of every allocated object, so GC walks
+ * blocks for objects, it keeps no table of them.
+ *
+ * Only the thread running bit codes allocates and frees objects, other
+ * threads can walk blocks.
+ */
+class Nursery {
+public:
+    static const int kBlockSize = 32 * 1024;
+
+    // Larger objects go to the managed allocator, or they waste blocks.
+    static const int kMaxObjectSize = kBlockSize / 8;
+
+    static const int kObjectAlignment = sizeof(void *);
+
+    // Objects begin before end (offset in block) of the block.
+    struct Span {
+        int block;
+        int end;
+    };
+
+    explicit Nursery(int capacity);
+    ~Nursery();
+
+    /**
+     * Reserve the range of blocks.
+     *
+     * @return false if no memory, the nursery is empty then.
+     */
+    bool Init();
+
+    /**
+     * @return null if size is too large or all blocks are in use.
+     */
+    inline void *Allocate(int size);
+
+    /**
+     * Release an object allocated by it.
+     */
+    void Free(const void *p);
+
+    /**
+     * Release the object just allocated, and take back its bytes.
+     */
+    void FreeLast(const void *p, int size);
+
+    bool Contains(const void *p) const {
+        return p >= base_ && p < base_ + capacity_;
+    }
+
+    /**
+     * p is an allocated object and not freed.
+     */
+    bool IsAllocated(const void *p) const {
+        auto bit = BitOf(p);
+        return (starts_[bit / 32].load(std::memory_order_relaxed) &
+                (1u << (bit % 32))) != 0;
+    }
+
+    /**
+     * Get spans of all blocks have objects in, objects allocated later are
+     * not in them.
+     */
+    void GetSpans(std::vector<Span> *spans) const;
+
+    /**
+     * Call f for every object in span by address order. It can be called by
+     * other thread, the allocating thread can allocate objects after the
+     * span and free the objects passed meanwhile.
+     */
+    template<class F>
+    inline void Walk(const Span &span, F f) const;
+
+    DEF_GETTER(int, capacity)
+
+    int block_size() const { return static_cast<int>(live_.size()); }
+
+    /**
+     * Blocks have living objects or allocation buffer in.
+     */
+    int GetUsedBlocks() const;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(Nursery)
+private:
+    /**
+     * Take a recycled or fresh block as the allocation buffer.
+     */
+    bool NextBlock();
+
+    int BlockOf(const void *p) const {
+        return static_cast<int>((static_cast<const uint8_t *>(p) - base_) / kBlockSize);
+    }
+
+    int BitOf(const void *p) const {
+        return static_cast<int>((static_cast<const uint8_t *>(p) - base_) / kObjectAlignment);
+    }
+
+    void SetAllocated(const void *p, bool allocated) {
+        auto bit = BitOf(p);
+        auto word = &starts_[bit / 32];
+        // Only the allocating thread writes bitmap, no read-modify-write.
+        auto bits = word->load(std::memory_order_relaxed);
+        bits = allocated ? (bits | (1u << (bit % 32))) : (bits & ~(1u << (bit % 32)));
+        word->store(bits, std::memory_order_relaxed);
+    }
+
+    uint8_t *base_ = nullptr;
+    int capacity_;
+    int fresh_ = 0; // next never used block.
+    std::vector<int> live_; // number of living objects in blocks.
+    std::vector<int> free_blocks_;
+    std::atomic<uint32_t> *starts_ = nullptr; // first words of objects.
+
+    // Allocation buffer of the thread.
+    int current_ = -1;
+    uint8_t *top_ = nullptr;
+    uint8_t *limit_ = nullptr;
+}; // class Nursery
+
+inline void *Nursery::Allocate(int size) {
+    size = RoundUp(size, kObjectAlignment);
+    if (size > kMaxObjectSize) {
+        return nullptr;
+    }
+    if (top_ + size > limit_ && !NextBlock()) {
+        return nullptr;
+    }
+    auto result = top_;
+    top_ += size;
+    ++live_[current_];
+    SetAllocated(result, true);
+    return result;
+}
+
+template<class F>
+inline void Nursery::Walk(const Span &span, F f) const {
+    auto begin = span.block * (kBlockSize / kObjectAlignment);
+    auto end = begin + span.end / kObjectAlignment;
+    for (int i = begin; i < end; i += 32) {
+        auto bits = starts_[i / 32].load(std::memory_order_relaxed);
+        while (bits) {
+            auto bit = i + Bits::FindFirstOne32(bits);
+            if (bit >= end) {
+                break;
+            }
+            bits &= bits - 1;
+            f(base_ + static_cast<intptr_t>(bit) * kObjectAlignment);
+        }
+    }
+}
+
+} // namespace mio
+
+#endif // MIO_NURSERY_H_
@@ -0,0 +1,239 @@
+#include "nyaa-code-generator.h"
+#include "nyaa-graph-builder.h"
+#include "nyaa-passes.h"
+#include "nyaa.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "vm-thread.h"
+#include "vm-objects.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+class NCodeGeneratorTest : public ::testing::Test {
+public:
+    virtual void SetUp() override {
+        zone_ = new Zone();
+        code_ = new MemorySegment();
+        builder_ = new BitCodeBuilder(code_);
+        cache_ = new CodeCache(16 * 1024);
+        ASSERT_TRUE(cache_->Init());
+        // Only the poll word of thread will be read by native code.
+        thread_ = new uint8_t[sizeof(Thread)]();
+    }
+
+    virtual void TearDown() override {
+        delete[] thread_;
+        delete cache_;
+        delete builder_;
+        delete code_;
+        delete zone_;
+    }
+
+    CodeRef Generate(const void *constants = nullptr, int constants_size = 0,
+                     bool side_exits = false) {
+        NGraphBuilder builder(zone_, static_cast<uint64_t *>(code_->offset(0)),
+                              builder_->pc(), constants, constants_size);
+        builder.set_side_exits(side_exits);
+        auto graph = builder.Build();
+        if (!graph) {
+            return CodeRef(nullptr);
+        }
+        NPassManager passes(builder.factory());
+        passes.AddDefaultPasses();
+        passes.Run(graph);
+
+        NCodeGenerator generator(graph);
+        auto code = generator.Generate(cache_);
+        entries_ = generator.entries();
+        exits_ = generator.exits();
+        return code;
+    }
+
+    int Run(CodeRef code, int pc) {
+        auto native = reinterpret_cast<MIONativeFragment>(code.data());
+        result_ = native(reinterpret_cast<Thread *>(thread_), p_stack_ + 16,
+                         o_stack_, &pc);
+        return pc;
+    }
+
+    template<class T>
+    T Slot(int offset) {
+        return *reinterpret_cast<T *>(p_stack_ + 16 + offset);
+    }
+
+    template<class T>
+    void SetSlot(int offset, T value) {
+        *reinterpret_cast<T *>(p_stack_ + 16 + offset) = value;
+    }
+
+protected:
+    Zone *zone_ = nullptr;
+    MemorySegment *code_ = nullptr;
+    BitCodeBuilder *builder_ = nullptr;
+    CodeCache *cache_ = nullptr;
+    uint8_t *thread_ = nullptr;
+    uint8_t p_stack_[64] = {0};
+    uint8_t o_stack_[64] = {0};
+    int result_ = -1;
+    std::vector<int> entries_;
+    std::vector<int> exits_;
+};
+
+TEST_F(NCodeGeneratorTest, IntegralLoop) {
+    builder_->frame(24, 0, 0);              // [0]
+    builder_->load_i32_imm(0, 0);           // [1] i = 0
+    builder_->load_i32_imm(4, 0);           // [2] sum = 0
+    builder_->load_i32_imm(12, 100);        // [3]
+    builder_->cmp_i32(CC_LT, 16, 0, 12);    // [4] i < 100
+    builder_->jz(0, 16, 5);                 // [5]
+    builder_->add_i32(4, 4, 0);             // [6] sum += i
+    builder_->mul_i32(20, 0, 0);            // [7] i * i
+    builder_->add_i32_imm(0, 0, 1);         // [8] i += 1
+    builder_->jmp(-5);                      // [9]
+    builder_->mov_4b(-4, 4);                // [10]
+    builder_->ret();                        // [11]
+
+    auto native = Generate();
+    ASSERT_FALSE(native.empty());
+
+    EXPECT_EQ(0, Run(native, 0)); // Can not enter at frame.
+    EXPECT_EQ(0, Slot<int32_t>(-4));
+    EXPECT_EQ(11, Run(native, 1));
+    EXPECT_EQ(4950, Slot<int32_t>(-4));
+}
+
+TEST_F(NCodeGeneratorTest, Int64Loop) {
+    mio_i64_t constants[] = { 1 };
+
+    builder_->frame(32, 0, 0);                                      // [0]
+    builder_->load_i32_imm(0, 0);                                   // [1] i = 0
+    builder_->load_8b(8, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 0); // [2] n = 1
+    builder_->load_i32_imm(16, 40);                                 // [3]
+    builder_->cmp_i32(CC_LT, 20, 0, 16);                            // [4] i < 40
+    builder_->jz(0, 20, 4);                                         // [5]
+    builder_->add_i64(8, 8, 8);                                     // [6] n *= 2
+    builder_->add_i32_imm(0, 0, 1);                                 // [7] i += 1
+    builder_->jmp(-4);                                              // [8]
+    builder_->mov_8b(-8, 8);                                        // [9]
+    builder_->ret();                                                // [10]
+
+    auto native = Generate(constants, sizeof(constants));
+    ASSERT_FALSE(native.empty());
+    EXPECT_EQ(10, Run(native, 1));
+    EXPECT_EQ(1LL << 40, Slot<int64_t>(-8));
+}
+
+TEST_F(NCodeGeneratorTest, FloatingLoop) {
+    mio_f64_t constants[] = { 0.5, 10.0 };
+
+    builder_->frame(40, 0, 0);                                      // [0]
+    builder_->load_8b(0, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 0); // [1] x = 0.5
+    builder_->load_8b(8, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 8); // [2] 10.0
+    builder_->cmp_f64(CC_LT, 16, 0, 8);                             // [3] x < 10
+    builder_->jz(0, 16, 4);                                         // [4]
+    builder_->add_f64(24, 0, 0);                                    // [5] x + x
+    builder_->mov_8b(0, 24);                                        // [6] x = x + x
+    builder_->jmp(-4);                                              // [7]
+    builder_->mov_8b(-8, 0);                                        // [8]
+    builder_->ret();                                                // [9]
+
+    auto native = Generate(constants, sizeof(constants));
+    ASSERT_FALSE(native.empty());
+    EXPECT_EQ(9, Run(native, 1));
+    EXPECT_EQ(16.0, Slot<mio_f64_t>(-8));
+}
+
+TEST_F(NCodeGeneratorTest, OnStackReplacement) {
+    builder_->frame(24, 0, 0);              // [0]
+    builder_->load_i32_imm(0, 0);           // [1] i = 0
+    builder_->load_i32_imm(4, 0);           // [2] sum = 0
+    builder_->load_i32_imm(12, 100);        // [3]
+    builder_->loop_entry(1, 0);             // [4]
+    builder_->cmp_i32(CC_LT, 16, 0, 12);    // [5] i < 100
+    builder_->jz(0, 16, 4);                 // [6]
+    builder_->add_i32(4, 4, 0);             // [7] sum += i
+    builder_->add_i32_imm(0, 0, 1);         // [8] i += 1
+    builder_->jmp(-5);                      // [9]
+    builder_->mov_4b(-4, 4);                // [10]
+    builder_->ret();                        // [11]
+
+    auto native = Generate();
+    ASSERT_FALSE(native.empty());
+    EXPECT_EQ((std::vector<int>{1, 4}), entries_);
+    EXPECT_TRUE(exits_.empty());
+
+    // Interpreter has run the loop 90 times.
+    SetSlot<int32_t>(0, 90);
+    SetSlot<int32_t>(4, 1000);
+    SetSlot<int32_t>(12, 100);
+    EXPECT_EQ(11, Run(native, 4));
+    EXPECT_EQ(kNativeFragmentContinue, result_);
+    EXPECT_EQ(1945, Slot<int32_t>(-4));
+
+    EXPECT_EQ(11, Run(native, 1));
+    EXPECT_EQ(4950, Slot<int32_t>(-4));
+}
+
+TEST_F(NCodeGeneratorTest, DividingGuard) {
+    builder_->frame(16, 0, 0);              // [0]
+    builder_->mov_4b(0, -8);                // [1]
+    builder_->mov_4b(4, -4);                // [2]
+    builder_->div_i32(8, 0, 4);             // [3]
+    builder_->mov_4b(-4, 8);                // [4]
+    builder_->ret();                        // [5]
+
+    auto native = Generate();
+    ASSERT_FALSE(native.empty());
+    EXPECT_EQ((std::vector<int>{3}), exits_);
+
+    SetSlot<int32_t>(-8, -7);
+    SetSlot<int32_t>(-4, 2);
+    EXPECT_EQ(5, Run(native, 1));
+    EXPECT_EQ(kNativeFragmentContinue, result_);
+    EXPECT_EQ(-3, Slot<int32_t>(-4));
+
+    // Interpreter runs the dividing again with rebuilt slots.
+    SetSlot<int32_t>(8, 0);
+    SetSlot<int32_t>(-8, 7);
+    SetSlot<int32_t>(-4, 0);
+    EXPECT_EQ(3, Run(native, 1));
+    EXPECT_EQ(kNativeFragmentDeopt, result_);
+    EXPECT_EQ(7, Slot<int32_t>(0));
+    EXPECT_EQ(0, Slot<int32_t>(4));
+
+    SetSlot<int32_t>(-4, -1);
+    EXPECT_EQ(3, Run(native, 1));
+    EXPECT_EQ(kNativeFragmentDeopt, result_);
+    EXPECT_EQ(-1, Slot<int32_t>(4));
+}
+
+TEST_F(NCodeGeneratorTest, SideExit) {
+    builder_->frame(16, 8, 0);              // [0]
+    builder_->load_i32_imm(0, 3);           // [1]
+    builder_->add_i32_imm(4, 0, 4);         // [2]
+    builder_->call_val(16, 8, 0);           // [3]
+    builder_->add_i32(8, 4, 0);             // [4]
+    builder_->mov_4b(-4, 8);                // [5]
+    builder_->ret();                        // [6]
+
+    EXPECT_TRUE(Generate().empty());
+
+    auto native = Generate(nullptr, 0, true);
+    ASSERT_FALSE(native.empty());
+    EXPECT_EQ((std::vector<int>{1, 4}), entries_);
+    EXPECT_EQ((std::vector<int>{3}), exits_);
+
+    EXPECT_EQ(3, Run(native, 1));
+    EXPECT_EQ(kNativeFragmentContinue, result_);
+    EXPECT_EQ(3, Slot<int32_t>(0));
+    EXPECT_EQ(7, Slot<int32_t>(4));
+
+    // Come back after calling.
+    SetSlot<int32_t>(0, 10);
+    EXPECT_EQ(6, Run(native, 4));
+    EXPECT_EQ(17, Slot<int32_t>(-4));
+}
+
+} // namespace mio
@@ -0,0 +1,1032 @@
+#include "nyaa-code-generator.h"
+#include "nyaa-instructions.h"
+#include "nyaa.h"
+#include "vm-bitcode.h"
+#include "vm-thread.h"
+#include "yui/asm-amd64.h"
+#include "glog/logging.h"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
+namespace mio {
+
+namespace {
+
+// Fixed registers in native code, all of them are callee saved.
+const Reg kThread         = {kRBX};
+const Reg kExitPC         = {kR12};
+const Reg kPrimitiveStack = {kR14};
+
+// Scratch registers, never be allocated.
+const Reg kScratch     = {kRAX};
+const Reg kScratch2    = {kRDX}; // also breaks cycles of parallel moves.
+const Reg kCallTarget  = {kR11};
+const Xmm kXmmScratch  = {0};
+const Xmm kXmmScratch2 = {15};   // also breaks cycles of parallel moves.
+
+const std::vector<int> kAllocatableRegs = {
+    kRCX, kRSI, kRDI, kR8, kR9, kR10, kR13, kR15,
+};
+
+// Allocatable registers must be saved around calling, r13 and r15 are callee
+// saved.
+const int kCallerSavedRegs[] = {
+    kRCX, kRSI, kRDI, kR8, kR9, kR10,
+};
+
+const std::vector<int> kAllocatableXmms = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+};
+
+const int kPrologueSize     = 128;
+const int kMaxMoveSize      = 32;
+const int kMaxInstrSize     = 64;
+const int kSafepointPollSize = 384;
+
+const Cond kComparatorConds[MAX_CC_COMPARATORS] = {
+    Equal,        // CC_EQ
+    NotEqual,     // CC_NE
+    Less,         // CC_LT
+    LessEqual,    // CC_LE
+    Greater,      // CC_GT
+    GreaterEqual, // CC_GE
+};
+
+inline Reg R(int code) { return Reg{code}; }
+inline Xmm X(int code) { return Xmm{code}; }
+
+inline OpdRef Primitive(Opd *op, int offset) {
+    return Operand0(op, kPrimitiveStack, offset);
+}
+
+// Integral values lower than 32 bits are kept sign-extended in 32 bits
+// registers.
+inline int RegisterBytes(NType type) { return type.bytes() == 8 ? 8 : 4; }
+
+inline bool IsInt32(int64_t value) {
+    return value == static_cast<int32_t>(value);
+}
+
+void LoadPrimitive(Asm *state, Reg dst, int offset, int bytes) {
+    Opd op;
+    switch (bytes) {
+        case 1:
+            Emit_movsxb_r_op(state, dst, Primitive(&op, offset));
+            break;
+        case 2:
+            Emit_movsxw_r_op(state, dst, Primitive(&op, offset));
+            break;
+        default:
+            Emit_movq_r_op(state, dst, Primitive(&op, offset), bytes);
+            break;
+    }
+}
+
+void StorePrimitive(Asm *state, int offset, Reg src, int bytes) {
+    Opd op;
+    switch (bytes) {
+        case 1:
+            Emit_movb_op_r(state, Primitive(&op, offset), src);
+            break;
+        case 2:
+            Emit_movw_op_r(state, Primitive(&op, offset), src);
+            break;
+        default:
+            Emit_movq_op_r(state, Primitive(&op, offset), src, bytes);
+            break;
+    }
+}
+
+void LoadFloating(Asm *state, Xmm dst, int offset, int bytes) {
+    Opd op;
+    if (bytes == 4) {
+        Emit_movss_x_op(state, dst, Primitive(&op, offset));
+    } else {
+        Emit_movsd_x_op(state, dst, Primitive(&op, offset));
+    }
+}
+
+void StoreFloating(Asm *state, int offset, Xmm src, int bytes) {
+    Opd op;
+    if (bytes == 4) {
+        Emit_movss_op_x(state, Primitive(&op, offset), src);
+    } else {
+        Emit_movsd_op_x(state, Primitive(&op, offset), src);
+    }
+}
+
+// setcc dst8; movzx dst32, dst8
+void EmitSetcc(Asm *state, Cond cc, Reg dst) {
+    // REX prefix makes spl, bpl, sil and dil addressable.
+    EmitB(state, 0x40 | RegHiBit(dst));
+    EmitB(state, 0x0F);
+    EmitB(state, 0x90 | cc);
+    EmitB(state, 0xC0 | RegLoBits(dst));
+
+    EmitB(state, 0x40 | RegHiBit(dst) << 2 | RegHiBit(dst));
+    EmitB(state, 0x0F);
+    EmitB(state, 0xB6);
+    EmitModRM(state, dst, dst);
+}
+
+// imul dst, src
+void EmitImul(Asm *state, Reg dst, Reg src, int bytes) {
+    EmitRex2(state, r_r, dst, src, bytes);
+    EmitB(state, 0x0F);
+    EmitB(state, 0xAF);
+    EmitModRM(state, dst, src);
+}
+
+// movq xmm, reg
+void EmitMovqXmmReg(Asm *state, Xmm dst, Reg src) {
+    EmitB(state, 0x66);
+    EmitB(state, 0x48 | (dst.code & 0x8) >> 1 | RegHiBit(src));
+    EmitB(state, 0x0F);
+    EmitB(state, 0x6E);
+    EmitOperand_x_r(state, dst, src);
+}
+
+// call reg
+void EmitCallReg(Asm *state, Reg addr) {
+    EmitOptionalRex32_r(state, addr);
+    EmitB(state, 0xFF);
+    EmitB(state, 0xC0 | (2 << 3) | RegLoBits(addr));
+}
+
+inline uint8_t SSEPrefix(NType type) {
+    return type == NType::Float32() ? 0xF3 : 0xF2;
+}
+
+} // namespace
+
+NCodeGenerator::NCodeGenerator(NGraph *graph)
+    : graph_(DCHECK_NOTNULL(graph))
+    , allocator_(new NRegisterAllocator(graph, kAllocatableRegs,
+                                        kAllocatableXmms)) {
+}
+
+NCodeGenerator::~NCodeGenerator() {
+}
+
+/*static*/ bool NCodeGenerator::IsSupported(NValue *value) {
+    auto type = value->type();
+    switch (value->opcode()) {
+        case NValue::kConstant:
+        case NValue::kParameter:
+        case NValue::kPhi:
+        case NValue::kStore:
+        case NValue::kBranch:
+        case NValue::kJump:
+        case NValue::kReturn:
+        case NValue::kEntry:
+        case NValue::kDeoptimize:
+        case NValue::kNot:
+            return true;
+
+        case NValue::kAdd:
+        case NValue::kSub:
+        case NValue::kMul:
+            return type.bytes() >= 4;
+
+        case NValue::kDiv:
+            // Integral dividing deoptimizes if it may trap.
+            return type.is_floating() ||
+                   (type.bytes() >= 4 &&
+                    static_cast<NInstruction *>(value)->frame_state());
+
+        case NValue::kAnd:
+        case NValue::kOr:
+        case NValue::kXor:
+        case NValue::kInv:
+            return type.is_integral() && type.bytes() >= 4;
+
+        case NValue::kShl:
+        case NValue::kShr: {
+            auto rhs = NConstant::cast(value->operand(1));
+            return type.is_integral() && type.bytes() >= 4 && rhs &&
+                   rhs->i64_value() >= 0 && rhs->i64_value() < type.bytes() * 8;
+        }
+
+        case NValue::kCompare: {
+            auto cmp = NCompare::cast(value);
+            if (cmp->lhs()->type().is_integral()) {
+                return true;
+            }
+            return cmp->condition() != CC_EQ && cmp->condition() != CC_NE;
+        }
+
+        case NValue::kMod:
+        case NValue::kUShr:
+        default:
+            break;
+    }
+    return false;
+}
+
+CodeRef NCodeGenerator::Generate(CodeCache *cc) {
+    for (int i = 0; i < graph_->block_size(); ++i) {
+        auto block = graph_->block(i);
+        for (int j = 0; j < block->phi_size(); ++j) {
+            if (!IsSupported(block->phi(j))) {
+                return CodeRef(nullptr);
+            }
+        }
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            if (!IsSupported(ins)) {
+                return CodeRef(nullptr);
+            }
+        }
+    }
+    if (!allocator_->Run()) {
+        return CodeRef(nullptr);
+    }
+
+    int max_block_id = 0;
+    for (auto block : allocator_->blocks()) {
+        max_block_id = std::max(max_block_id, block->id());
+    }
+    linear_index_.assign(max_block_id + 1, -1);
+    int guards = 0;
+    for (size_t i = 0; i < allocator_->blocks().size(); ++i) {
+        auto block = allocator_->blocks()[i];
+        linear_index_[block->id()] = static_cast<int>(i);
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            guards += (ins->frame_state() && !ins->is_control());
+        }
+    }
+
+    auto buf_size = EstimatedSize();
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[buf_size]);
+    std::unique_ptr<YILabel[]> labels(new YILabel[max_block_id + 1]());
+    std::unique_ptr<YILabel[]> stub_labels(new YILabel[guards + 1]());
+    YILabel leave = {0, 0}, abort = {0, 0}, deopt = {0, 0};
+
+    Asm state;
+    state.code = buf.get();
+    state.pc   = state.code;
+    state.size = buf_size;
+    state_  = &state;
+    labels_ = labels.get();
+    leave_  = &leave;
+    abort_  = &abort;
+    deopt_  = &deopt;
+    stub_labels_ = stub_labels.get();
+    stubs_.clear();
+    entries_.clear();
+    exits_.clear();
+
+    EmitPrologue();
+    const auto &blocks = allocator_->blocks();
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        next_block_ = i + 1 < blocks.size() ? blocks[i + 1] : nullptr;
+        EmitBlock(blocks[i]);
+    }
+    for (const auto &stub : stubs_) {
+        Bind(state_, stub.label);
+        EmitFrameState(stub.instruction);
+        Emit_jmp_l(state_, deopt_, 1);
+    }
+    EmitEpilogue();
+    DCHECK_LE(PCOffset(&state), buf_size);
+
+    auto code_size = PCOffset(&state);
+    auto ref = cc->Install(state.code, code_size);
+    state_ = nullptr;
+    labels_ = nullptr;
+    leave_ = nullptr;
+    abort_ = nullptr;
+    deopt_ = nullptr;
+    stub_labels_ = nullptr;
+    return ref;
+}
+
+int NCodeGenerator::EstimatedSize() const {
+    auto size = kPrologueSize;
+    for (auto block : allocator_->blocks()) {
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            size += kMaxInstrSize;
+            // Deoptimizing writes the frame state back.
+            size += ins->frame_state_size() * kMaxMoveSize;
+            if (ins->opcode() == NValue::kEntry) {
+                size += NEntry::cast(ins)->pc_size() * kMaxInstrSize;
+            }
+        }
+        // Moves for phis and polling on every out edge.
+        for (int i = 0; i < block->next_block_size(); ++i) {
+            size += block->next_block(i)->phi_size() * kMaxMoveSize +
+                    kSafepointPollSize;
+        }
+    }
+    return size;
+}
+
+void NCodeGenerator::EmitPrologue() {
+    Emit_pushq_r(state_, rbp);
+    Emit_movq_r_r(state_, rbp, rsp, 8);
+    Emit_pushq_r(state_, kThread);
+    Emit_pushq_r(state_, kExitPC);
+    Emit_pushq_r(state_, r13);
+    Emit_pushq_r(state_, kPrimitiveStack);
+    Emit_pushq_r(state_, r15);
+    // Keep stack aligned to 16 bytes for calling.
+    Emit_subq_r_i(state_, rsp, Imm{8});
+    Emit_movq_r_r(state_, kThread, RegArgv[0], 8);
+    Emit_movq_r_r(state_, kPrimitiveStack, RegArgv[1], 8);
+    Emit_movq_r_r(state_, kExitPC, RegArgv[3], 8);
+}
+
+void NCodeGenerator::EmitEpilogue() {
+    YILabel epilogue = {0, 0};
+
+    Bind(state_, abort_);
+    Emit_movq_r_i(state_, rax, Imm{kNativeFragmentExit}, 4);
+    Emit_jmp_l(state_, &epilogue, 1);
+
+    Bind(state_, deopt_);
+    Emit_movq_r_i(state_, rax, Imm{kNativeFragmentDeopt}, 4);
+    Emit_jmp_l(state_, &epilogue, 1);
+
+    Bind(state_, leave_);
+    Emit_xor_r_r(state_, rax, rax, 4);
+
+    Bind(state_, &epilogue);
+    Emit_addq_r_i(state_, rsp, Imm{8});
+    Emit_popq_r(state_, r15);
+    Emit_popq_r(state_, kPrimitiveStack);
+    Emit_popq_r(state_, r13);
+    Emit_popq_r(state_, kExitPC);
+    Emit_popq_r(state_, kThread);
+    Emit_popq_r(state_, rbp);
+    Emit_ret_i(state_, 0);
+}
+
+void NCodeGenerator::EmitBlock(NBasicBlock *block) {
+    Bind(state_, &labels_[block->id()]);
+    for (auto ins = block->first(); ins; ins = ins->next()) {
+        switch (ins->opcode()) {
+            case NValue::kBranch:
+                EmitBranch(block, ins);
+                break;
+            case NValue::kJump:
+                EmitEdge(block, NJump::cast(ins)->target(), true);
+                break;
+            case NValue::kReturn:
+                EmitReturn(block, ins);
+                break;
+            case NValue::kEntry:
+                EmitEntry(block, ins);
+                break;
+            case NValue::kDeoptimize:
+                // Side exit, interpreter goes on at its pc.
+                EmitFrameState(ins);
+                Emit_jmp_l(state_, leave_, 1);
+                break;
+            default:
+                EmitInstruction(ins);
+                break;
+        }
+    }
+}
+
+void NCodeGenerator::EmitEntry(NBasicBlock *block, NInstruction *ins) {
+    auto entry = NEntry::cast(ins);
+    Opd op;
+    Emit_movq_r_op(state_, kScratch, Operand0(&op, kExitPC, 0), 4);
+    for (int i = 0; i < entry->target_size(); ++i) {
+        YILabel next = {0, 0};
+        EmitArithOp_r_i(state_, 0x7, kScratch, Imm{entry->pc(i)}, 4);
+        Emit_jcc_l(state_, NotEqual, &next, 1);
+        EmitEdge(block, entry->target(i), false);
+        Bind(state_, &next);
+        entries_.push_back(entry->pc(i));
+    }
+    // Not an entry, interpreter goes on.
+    Emit_jmp_l(state_, leave_, 1);
+}
+
+void NCodeGenerator::EmitInstruction(NInstruction *ins) {
+    switch (ins->opcode()) {
+        case NValue::kConstant: // rematerialized on every using.
+            break;
+
+        case NValue::kParameter: {
+            auto param = NParameter::cast(ins);
+            auto location = allocator_->location(param);
+            auto bytes = param->type().bytes();
+            if (location.kind == NLocation::kRegister) {
+                LoadPrimitive(state_, R(location.index), param->offset(), bytes);
+            } else if (location.kind == NLocation::kXmm) {
+                LoadFloating(state_, X(location.index), param->offset(), bytes);
+            } else {
+                // Spilled parameter is just in its slot.
+                DCHECK(location.kind != NLocation::kSlot ||
+                       location.index == param->offset());
+            }
+        } break;
+
+        case NValue::kDiv:
+            if (ins->type().is_floating()) {
+                EmitFloatingBinary(ins);
+            } else {
+                EmitDividing(ins);
+            }
+            break;
+
+        case NValue::kAdd:
+        case NValue::kSub:
+        case NValue::kMul:
+        case NValue::kAnd:
+        case NValue::kOr:
+        case NValue::kXor:
+        case NValue::kShl:
+        case NValue::kShr:
+            if (ins->type().is_floating()) {
+                EmitFloatingBinary(ins);
+            } else {
+                EmitBinary(ins);
+            }
+            break;
+
+        case NValue::kInv: {
+            auto dst = DefGP(ins);
+            LoadGP(dst, NInv::cast(ins)->value());
+            Emit_not_r(state_, R(dst), RegisterBytes(ins->type()));
+            SpillIfNeeded(ins, dst);
+        } break;
+
+        case NValue::kNot: {
+            auto src = UseGP(NNot::cast(ins)->value(), kScratch.code);
+            auto dst = DefGP(ins);
+            Emit_test_r_r(state_, R(src), R(src), 4);
+            EmitSetcc(state_, Equal, R(dst));
+            SpillIfNeeded(ins, dst);
+        } break;
+
+        case NValue::kCompare:
+            EmitCompare(ins);
+            break;
+
+        case NValue::kStore: {
+            auto store = NStore::cast(ins);
+            NLocation dst = {NLocation::kSlot, store->offset()};
+            EmitMove(dst, allocator_->location(store->value()),
+                     store->value()->type(), store->value());
+        } break;
+
+        default:
+            DLOG(FATAL) << "noreached! opcode: " << ins->opcode();
+            break;
+    }
+}
+
+void NCodeGenerator::EmitBinary(NInstruction *ins) {
+    auto binary = static_cast<NBinaryOperation *>(ins);
+    auto bytes  = RegisterBytes(ins->type());
+    auto dst    = DefGP(ins);
+
+    LoadGP(dst, binary->lhs());
+    if (ins->opcode() == NValue::kShl || ins->opcode() == NValue::kShr) {
+        Imm amount = { static_cast<int32_t>(NConstant::cast(binary->rhs())->i64_value()) };
+        Emit_shift_r_i(state_, R(dst), amount,
+                       ins->opcode() == NValue::kShl ? 0x4 : 0x7, bytes);
+        SpillIfNeeded(ins, dst);
+        return;
+    }
+
+    uint8_t op = 0, subcode = 0;
+    switch (ins->opcode()) {
+        case NValue::kAdd: op = 0x03; subcode = 0x0; break;
+        case NValue::kSub: op = 0x2B; subcode = 0x5; break;
+        case NValue::kAnd: op = 0x23; subcode = 0x4; break;
+        case NValue::kOr:  op = 0x0B; subcode = 0x1; break;
+        case NValue::kXor: op = 0x33; subcode = 0x6; break;
+        case NValue::kMul: break;
+        default:
+            DLOG(FATAL) << "noreached! opcode: " << ins->opcode();
+            break;
+    }
+    auto is_mul = ins->opcode() == NValue::kMul;
+
+    Opd opd;
+    auto rhs = binary->rhs();
+    auto location = allocator_->location(rhs);
+    switch (location.kind) {
+        case NLocation::kConstant: {
+            auto value = NConstant::cast(rhs)->i64_value();
+            if (!is_mul && IsInt32(value)) {
+                EmitArithOp_r_i(state_, subcode, R(dst),
+                                Imm{static_cast<int32_t>(value)}, bytes);
+                break;
+            }
+            LoadGP(kScratch2.code, rhs);
+            if (is_mul) {
+                EmitImul(state_, R(dst), kScratch2, bytes);
+            } else {
+                EmitArithOp_r_r(state_, op, R(dst), kScratch2, bytes);
+            }
+        } break;
+
+        case NLocation::kRegister:
+            DCHECK_NE(dst, location.index);
+            if (is_mul) {
+                EmitImul(state_, R(dst), R(location.index), bytes);
+            } else {
+                EmitArithOp_r_r(state_, op, R(dst), R(location.index), bytes);
+            }
+            break;
+
+        case NLocation::kSlot:
+            Primitive(&opd, location.index);
+            if (is_mul) {
+                EmitSSEArith_r_op(state_, 0, 0xAF, R(dst), &opd, bytes);
+            } else {
+                EmitArithOp_r_op(state_, op, R(dst), &opd, bytes);
+            }
+            break;
+
+        default:
+            DLOG(FATAL) << "noreached! location: " << location.kind;
+            break;
+    }
+    SpillIfNeeded(ins, dst);
+}
+
+void NCodeGenerator::EmitDividing(NInstruction *ins) {
+    auto binary = static_cast<NBinaryOperation *>(ins);
+    auto bytes  = RegisterBytes(ins->type());
+    auto guard  = NewDeoptStub(ins);
+
+    // Dividing by 0 panics and the minimal value divided by -1 traps, let
+    // interpreter handle both of them.
+    int divisor = kCallTarget.code;
+    auto constant = NConstant::cast(binary->rhs());
+    if (constant) {
+        if (constant->i64_value() == 0 || constant->i64_value() == -1) {
+            Emit_jmp_l(state_, guard, 1);
+            return;
+        }
+        LoadGP(divisor, constant);
+    } else {
+        divisor = UseGP(binary->rhs(), kCallTarget.code);
+        Emit_test_r_r(state_, R(divisor), R(divisor), bytes);
+        Emit_jcc_l(state_, Zero, guard, 1);
+        EmitArithOp_r_i(state_, 0x7, R(divisor), Imm{-1}, bytes);
+        Emit_jcc_l(state_, Equal, guard, 1);
+    }
+
+    LoadGP(kScratch.code, binary->lhs());
+    // cdq/cqo; idiv divisor
+    if (bytes == 8) {
+        EmitRex64(state_);
+    }
+    EmitB(state_, 0x99);
+    EmitRex1(state_, r, R(divisor), bytes);
+    EmitB(state_, 0xF7);
+    EmitB(state_, 0xC0 | (0x7 << 3) | RegLoBits(R(divisor)));
+
+    auto dst = DefGP(ins);
+    if (dst != kScratch.code) {
+        Emit_movq_r_r(state_, R(dst), kScratch, bytes);
+    }
+    SpillIfNeeded(ins, dst);
+}
+
+void NCodeGenerator::EmitFloatingBinary(NInstruction *ins) {
+    auto binary = static_cast<NBinaryOperation *>(ins);
+    auto prefix = SSEPrefix(ins->type());
+    auto dst    = DefXmm(ins);
+
+    uint8_t subcode = 0;
+    switch (ins->opcode()) {
+        case NValue::kAdd: subcode = 0x58; break;
+        case NValue::kSub: subcode = 0x5C; break;
+        case NValue::kMul: subcode = 0x59; break;
+        case NValue::kDiv: subcode = 0x5E; break;
+        default:
+            DLOG(FATAL) << "noreached! opcode: " << ins->opcode();
+            break;
+    }
+
+    LoadXmm(dst, binary->lhs());
+    auto location = allocator_->location(binary->rhs());
+    if (location.kind == NLocation::kSlot) {
+        Opd op;
+        EmitSSEArith_x_op(state_, prefix, subcode, X(dst),
+                          Primitive(&op, location.index));
+    } else {
+        auto rhs = UseXmm(binary->rhs(), kXmmScratch2.code);
+        DCHECK_NE(dst, rhs);
+        EmitSSEArith_x_x(state_, prefix, subcode, X(dst), X(rhs));
+    }
+    SpillIfNeeded(ins, dst);
+}
+
+void NCodeGenerator::EmitCompare(NInstruction *ins) {
+    auto cmp = NCompare::cast(ins);
+    auto type = cmp->lhs()->type();
+    Cond cond = kComparatorConds[cmp->condition()];
+
+    if (type.is_floating()) {
+        // Unordered comparing sets CF, so Above/AboveEqual are false for NaN.
+        NValue *lhs = cmp->lhs(), *rhs = cmp->rhs();
+        switch (cmp->condition()) {
+            case CC_LT: std::swap(lhs, rhs); cond = Above;      break;
+            case CC_LE: std::swap(lhs, rhs); cond = AboveEqual; break;
+            case CC_GT: cond = Above;      break;
+            case CC_GE: cond = AboveEqual; break;
+            default:
+                DLOG(FATAL) << "noreached! condition: " << cmp->condition();
+                break;
+        }
+        auto a = UseXmm(lhs, kXmmScratch.code);
+        auto b = UseXmm(rhs, kXmmScratch2.code);
+        if (type == NType::Float32()) {
+            Emit_ucomiss_x_x(state_, X(a), X(b));
+        } else {
+            Emit_ucomisd_x_x(state_, X(a), X(b));
+        }
+    } else {
+        auto bytes = RegisterBytes(type);
+        auto lhs = UseGP(cmp->lhs(), kScratch.code);
+        auto location = allocator_->location(cmp->rhs());
+        Opd op;
+        if (location.kind == NLocation::kConstant &&
+            IsInt32(NConstant::cast(cmp->rhs())->i64_value())) {
+            Imm imm = { static_cast<int32_t>(NConstant::cast(cmp->rhs())->i64_value()) };
+            EmitArithOp_r_i(state_, 0x7, R(lhs), imm, bytes);
+        } else if (location.kind == NLocation::kSlot && type.bytes() >= 4) {
+            EmitArithOp_r_op(state_, 0x3B, R(lhs),
+                             Primitive(&op, location.index), bytes);
+        } else {
+            auto rhs = UseGP(cmp->rhs(), kScratch2.code);
+            EmitArithOp_r_r(state_, 0x3B, R(lhs), R(rhs), bytes);
+        }
+    }
+
+    auto dst = DefGP(ins);
+    EmitSetcc(state_, cond, R(dst));
+    SpillIfNeeded(ins, dst);
+}
+
+void NCodeGenerator::EmitBranch(NBasicBlock *block, NInstruction *ins) {
+    auto branch = NBranch::cast(ins);
+    auto condition = branch->condition();
+    auto location = allocator_->location(condition);
+    Opd op;
+    switch (location.kind) {
+        case NLocation::kRegister:
+            Emit_test_r_r(state_, R(location.index), R(location.index), 4);
+            break;
+        case NLocation::kSlot:
+            Emit_cmpb_op_i(state_, Primitive(&op, location.index), Imm{0});
+            break;
+        default: // constant conditions were folded.
+            LoadGP(kScratch.code, condition);
+            Emit_test_r_r(state_, kScratch, kScratch, 4);
+            break;
+    }
+
+    auto true_target  = branch->true_target();
+    auto false_target = branch->false_target();
+    if (IsTrivialEdge(block, true_target)) {
+        Emit_jcc_l(state_, NotZero, &labels_[true_target->id()], 1);
+        EmitEdge(block, false_target, true);
+    } else if (IsTrivialEdge(block, false_target)) {
+        Emit_jcc_l(state_, Zero, &labels_[false_target->id()], 1);
+        EmitEdge(block, true_target, true);
+    } else {
+        YILabel false_edge = {0, 0};
+        Emit_jcc_l(state_, Zero, &false_edge, 1);
+        EmitEdge(block, true_target, false);
+        Bind(state_, &false_edge);
+        EmitEdge(block, false_target, true);
+    }
+}
+
+void NCodeGenerator::EmitReturn(NBasicBlock *block, NInstruction *ins) {
+    // Values of returning slots were stored, interpreter runs the ret.
+    DCHECK_GE(ins->position(), 0);
+    Opd op;
+    Emit_movq_op_i(state_, Operand0(&op, kExitPC, 0), Imm{ins->position()}, 4);
+    Emit_jmp_l(state_, leave_, 1);
+}
+
+void NCodeGenerator::EmitFrameState(NInstruction *ins) {
+    auto state = DCHECK_NOTNULL(ins->frame_state());
+    std::vector<Move> moves;
+    for (int i = 0; i < state->value_size(); ++i) {
+        auto value = state->value(i);
+        NLocation dst = {NLocation::kSlot, state->offset(i)};
+        auto src = allocator_->location(value);
+        if (dst != src) {
+            moves.push_back({dst, src, value});
+        }
+    }
+    EmitParallelMoves(&moves);
+
+    Opd op;
+    Emit_movq_op_i(state_, Operand0(&op, kExitPC, 0), Imm{state->pc()}, 4);
+    exits_.push_back(state->pc());
+}
+
+YILabel *NCodeGenerator::NewDeoptStub(NInstruction *ins) {
+    auto label = &stub_labels_[stubs_.size()];
+    stubs_.push_back({ins, label});
+    return label;
+}
+
+void NCodeGenerator::EmitEdge(NBasicBlock *from, NBasicBlock *to,
+                              bool may_fall_through) {
+    auto index = to->IndexOfPrevBlock(from);
+    DCHECK_GE(index, 0);
+
+    std::vector<Move> moves;
+    for (int i = 0; i < to->phi_size(); ++i) {
+        auto phi = to->phi(i);
+        auto dst = allocator_->location(phi);
+        auto src = allocator_->location(phi->input(index));
+        if (dst.kind != NLocation::kNone && dst != src) {
+            moves.push_back({dst, src, phi->input(index)});
+        }
+    }
+    EmitParallelMoves(&moves);
+
+    if (IsBackEdge(from, to)) {
+        EmitSafepointPoll();
+    }
+    if (!may_fall_through || to != next_block_) {
+        Emit_jmp_l(state_, &labels_[to->id()], 1);
+    }
+}
+
+bool NCodeGenerator::IsBackEdge(NBasicBlock *from, NBasicBlock *to) const {
+    return linear_index_[to->id()] <= linear_index_[from->id()];
+}
+
+bool NCodeGenerator::IsTrivialEdge(NBasicBlock *from, NBasicBlock *to) const {
+    if (IsBackEdge(from, to)) {
+        return false;
+    }
+    auto index = to->IndexOfPrevBlock(from);
+    DCHECK_GE(index, 0);
+    for (int i = 0; i < to->phi_size(); ++i) {
+        auto phi = to->phi(i);
+        auto dst = allocator_->location(phi);
+        if (dst.kind != NLocation::kNone &&
+            dst != allocator_->location(phi->input(index))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void NCodeGenerator::EmitSafepointPoll() {
+    YILabel done = {0, 0};
+    Opd op;
+    Emit_cmpl_op_i(state_, Operand0(&op, kThread, Thread::poll_word_offset()),
+                   Imm{0});
+    Emit_jcc_l(state_, Equal, &done, 1);
+
+    // Save all allocatable caller saved registers, 6 pushes and 14 xmms keep
+    // stack aligned.
+    for (auto code : kCallerSavedRegs) {
+        Emit_pushq_r(state_, R(code));
+    }
+    auto xmm_bytes = static_cast<int>(kAllocatableXmms.size()) * 8;
+    Emit_subq_r_i(state_, rsp, Imm{xmm_bytes});
+    for (size_t i = 0; i < kAllocatableXmms.size(); ++i) {
+        Emit_movsd_op_x(state_, Operand0(&op, rsp, static_cast<int>(i) * 8),
+                        X(kAllocatableXmms[i]));
+    }
+
+    Emit_movq_r_r(state_, RegArgv[0], kThread, 8);
+    Emit_movq_p(state_, kCallTarget,
+                reinterpret_cast<void *>(&Thread::ProcessSafepointFromNative));
+    EmitCallReg(state_, kCallTarget);
+
+    for (size_t i = 0; i < kAllocatableXmms.size(); ++i) {
+        Emit_movsd_x_op(state_, X(kAllocatableXmms[i]),
+                        Operand0(&op, rsp, static_cast<int>(i) * 8));
+    }
+    Emit_addq_r_i(state_, rsp, Imm{xmm_bytes});
+    for (int i = arraysize(kCallerSavedRegs) - 1; i >= 0; --i) {
+        Emit_popq_r(state_, R(kCallerSavedRegs[i]));
+    }
+    Emit_test_r_r(state_, rax, rax, 4);
+    Emit_jcc_l(state_, Zero, abort_, 1);
+    Bind(state_, &done);
+}
+
+void NCodeGenerator::EmitParallelMoves(std::vector<Move> *moves) {
+    while (!moves->empty()) {
+        // Emit a move whose destination is not read by others.
+        auto ready = moves->end();
+        for (auto iter = moves->begin(); iter != moves->end(); ++iter) {
+            auto blocked = false;
+            for (const auto &other : *moves) {
+                if (&other != &*iter && other.src == iter->dst) {
+                    blocked = true;
+                    break;
+                }
+            }
+            if (!blocked) {
+                ready = iter;
+                break;
+            }
+        }
+        if (ready != moves->end()) {
+            EmitMove(ready->dst, ready->src, ready->value->type(), ready->value);
+            moves->erase(ready);
+            continue;
+        }
+
+        // All of them are in cycles: save one destination, which must be read
+        // by another move, to scratch then read it from there.
+        auto saved = moves->front().dst;
+        auto reader = moves->begin();
+        while (reader->src != saved) {
+            ++reader;
+            DCHECK(reader != moves->end());
+        }
+        NLocation scratch;
+        if (reader->value->type().is_floating()) {
+            scratch = {NLocation::kXmm, kXmmScratch2.code};
+        } else {
+            scratch = {NLocation::kRegister, kScratch2.code};
+        }
+        EmitMove(scratch, saved, reader->value->type(), reader->value);
+        for (auto &move : *moves) {
+            if (move.src == saved) {
+                move.src = scratch;
+            }
+        }
+    }
+}
+
+void NCodeGenerator::EmitMove(NLocation dst, NLocation src, NType type,
+                              NValue *value) {
+    auto bytes = type.bytes();
+    if (dst == src) {
+        return;
+    }
+    switch (dst.kind) {
+        case NLocation::kRegister:
+            if (src.kind == NLocation::kRegister) {
+                Emit_movq_r_r(state_, R(dst.index), R(src.index),
+                              RegisterBytes(type));
+            } else if (src.kind == NLocation::kSlot) {
+                LoadPrimitive(state_, R(dst.index), src.index, bytes);
+            } else {
+                LoadGP(dst.index, value);
+            }
+            break;
+
+        case NLocation::kXmm:
+            if (src.kind == NLocation::kXmm) {
+                Emit_movaps_x_x(state_, X(dst.index), X(src.index));
+            } else if (src.kind == NLocation::kSlot) {
+                LoadFloating(state_, X(dst.index), src.index, bytes);
+            } else {
+                LoadXmm(dst.index, value);
+            }
+            break;
+
+        case NLocation::kSlot:
+            if (src.kind == NLocation::kRegister) {
+                StorePrimitive(state_, dst.index, R(src.index), bytes);
+            } else if (src.kind == NLocation::kXmm) {
+                StoreFloating(state_, dst.index, X(src.index), bytes);
+            } else if (src.kind == NLocation::kSlot) {
+                // Bits are just copied, even for floating.
+                LoadPrimitive(state_, kScratch, src.index, bytes);
+                StorePrimitive(state_, dst.index, kScratch, bytes);
+            } else if (type.is_floating()) {
+                LoadXmm(kXmmScratch.code, value);
+                StoreFloating(state_, dst.index, kXmmScratch, bytes);
+            } else {
+                LoadGP(kScratch.code, value);
+                StorePrimitive(state_, dst.index, kScratch, bytes);
+            }
+            break;
+
+        default:
+            DLOG(FATAL) << "noreached! location: " << dst.kind;
+            break;
+    }
+}
+
+void NCodeGenerator::LoadGP(int dst, NValue *value) {
+    auto location = allocator_->location(value);
+    switch (location.kind) {
+        case NLocation::kRegister:
+            if (location.index != dst) {
+                Emit_movq_r_r(state_, R(dst), R(location.index),
+                              RegisterBytes(value->type()));
+            }
+            break;
+
+        case NLocation::kSlot:
+            LoadPrimitive(state_, R(dst), location.index,
+                          value->type().bytes());
+            break;
+
+        case NLocation::kConstant: {
+            auto constant = NConstant::cast(value);
+            auto i64 = constant->i64_value();
+            if (value->type().bytes() < 8) {
+                Emit_movq_r_i(state_, R(dst), Imm{static_cast<int32_t>(i64)}, 4);
+            } else if (IsInt32(i64)) {
+                Emit_movq_r_i(state_, R(dst), Imm{static_cast<int32_t>(i64)}, 8);
+            } else {
+                Emit_movq_i64(state_, R(dst), i64);
+            }
+        } break;
+
+        default:
+            DLOG(FATAL) << "noreached! location: " << location.kind;
+            break;
+    }
+}
+
+void NCodeGenerator::LoadXmm(int dst, NValue *value) {
+    auto location = allocator_->location(value);
+    switch (location.kind) {
+        case NLocation::kXmm:
+            if (location.index != dst) {
+                Emit_movaps_x_x(state_, X(dst), X(location.index));
+            }
+            break;
+
+        case NLocation::kSlot:
+            LoadFloating(state_, X(dst), location.index, value->type().bytes());
+            break;
+
+        case NLocation::kConstant: {
+            auto constant = NConstant::cast(value);
+            int64_t bits = 0;
+            if (value->type() == NType::Float32()) {
+                auto f32 = static_cast<float>(constant->f64_value());
+                int32_t i32;
+                memcpy(&i32, &f32, sizeof(i32));
+                bits = static_cast<uint32_t>(i32);
+            } else {
+                auto f64 = constant->f64_value();
+                memcpy(&bits, &f64, sizeof(bits));
+            }
+            if (bits == 0) {
+                Emit_xorps_x_x(state_, X(dst), X(dst));
+            } else {
+                Emit_movq_i64(state_, kScratch, bits);
+                EmitMovqXmmReg(state_, X(dst), kScratch);
+            }
+        } break;
+
+        default:
+            DLOG(FATAL) << "noreached! location: " << location.kind;
+            break;
+    }
+}
+
+int NCodeGenerator::UseGP(NValue *value, int scratch) {
+    auto location = allocator_->location(value);
+    if (location.kind == NLocation::kRegister) {
+        return location.index;
+    }
+    LoadGP(scratch, value);
+    return scratch;
+}
+
+int NCodeGenerator::UseXmm(NValue *value, int scratch) {
+    auto location = allocator_->location(value);
+    if (location.kind == NLocation::kXmm) {
+        return location.index;
+    }
+    LoadXmm(scratch, value);
+    return scratch;
+}
+
+int NCodeGenerator::DefGP(NValue *value) {
+    auto location = allocator_->location(value);
+    return location.kind == NLocation::kRegister ? location.index : kScratch.code;
+}
+
+int NCodeGenerator::DefXmm(NValue *value) {
+    auto location = allocator_->location(value);
+    return location.kind == NLocation::kXmm ? location.index : kXmmScratch.code;
+}
+
+void NCodeGenerator::SpillIfNeeded(NValue *value, int reg) {
+    auto location = allocator_->location(value);
+    if (location.kind != NLocation::kSlot) {
+        return;
+    }
+    if (value->type().is_floating()) {
+        StoreFloating(state_, location.index, X(reg), value->type().bytes());
+    } else {
+        StorePrimitive(state_, location.index, R(reg), value->type().bytes());
+    }
+}
+
+} // namespace mio
@@ -0,0 +1,167 @@
+#ifndef MIO_NYAA_CODE_GENERATOR_H_
+#define MIO_NYAA_CODE_GENERATOR_H_
+
+#include "nyaa-register-allocator.h"
+#include "nyaa-types.h"
+#include "vm-code-cache.h"
+#include "base.h"
+#include <memory>
+#include <vector>
+
+struct Asm;
+struct YILabel;
+
+namespace mio {
+
+class NGraph;
+class NBasicBlock;
+class NValue;
+class NInstruction;
+
+/**
+ * Lower Nyaa graph to amd64 code, values are kept in registers assigned by
+ * NRegisterAllocator.
+ *
+ * The native code is a MIONativeFragment for the whole function, same as
+ * BaselineCompiler's:
+ *
+ * int native(Thread *thread, void *p_base, void *o_base, int *pc)
+ *
+ * It can be entered at pcs of NEntry: function entry (the first bit code after
+ * frame), every loop_entry for on-stack replacement, and bit codes after side
+ * exits. Other pcs are refused by returning 0 at once. It runs until returning:
+ * stores values of returning slots, then sets *pc to the ret bit code and goes
+ * back to interpreter. Back-edges poll safepoint by calling
+ * Thread::ProcessSafepointFromNative(), native code returns
+ * kNativeFragmentExit if the thread should exit.
+ *
+ * Deoptimizing writes values of frame state back to slots, then sets *pc to
+ * its bit code: side exits return 0 as usual, failed guards (integral dividing
+ * by 0 or -1) return kNativeFragmentDeopt. The interpreter frame is still the
+ * one native code was entered in, so only primitive slots need rebuilding.
+ *
+ * rbx, r12 and r14 hold thread, pc pointer and primitive stack base; rax, rdx,
+ * r11, xmm0 and xmm15 are scratch registers; others are allocatable.
+ */
+class NCodeGenerator {
+public:
+    explicit NCodeGenerator(NGraph *graph);
+    ~NCodeGenerator();
+
+    /**
+     * @return empty CodeRef if graph has unsupported instructions, register
+     *         allocation failed or code cache is full.
+     */
+    CodeRef Generate(CodeCache *cc);
+
+    /**
+     * Integral dividing without frame state, unsigned shifting, i8/i16
+     * arithmetic and floating equality comparing are not supported.
+     */
+    static bool IsSupported(NValue *value);
+
+    const NRegisterAllocator *allocator() const { return allocator_.get(); }
+
+    /**
+     * Pcs generated code can be entered at.
+     */
+    const std::vector<int> &entries() const { return entries_; }
+
+    /**
+     * Pcs generated code may deoptimize at.
+     */
+    const std::vector<int> &exits() const { return exits_; }
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NCodeGenerator)
+private:
+    struct Move {
+        NLocation dst;
+        NLocation src;
+        NValue   *value; // for type and constant.
+    };
+
+    // Out of line code for a failed guard.
+    struct DeoptStub {
+        NInstruction *instruction;
+        YILabel      *label;
+    };
+
+    int EstimatedSize() const;
+
+    void EmitPrologue();
+    void EmitEpilogue();
+    void EmitBlock(NBasicBlock *block);
+    void EmitEntry(NBasicBlock *block, NInstruction *ins);
+    void EmitInstruction(NInstruction *ins);
+    void EmitBinary(NInstruction *ins);
+    void EmitDividing(NInstruction *ins);
+    void EmitFloatingBinary(NInstruction *ins);
+    void EmitCompare(NInstruction *ins);
+    void EmitBranch(NBasicBlock *block, NInstruction *ins);
+    void EmitReturn(NBasicBlock *block, NInstruction *ins);
+
+    /**
+     * Write values of frame state back to slots and set exit pc.
+     */
+    void EmitFrameState(NInstruction *ins);
+
+    /**
+     * @return label of deoptimizing stub for the guard of instruction.
+     */
+    YILabel *NewDeoptStub(NInstruction *ins);
+
+    /**
+     * Phi moves, safepoint polling for back-edge then jump to target, the
+     * jumping is omitted if target is the next block and may_fall_through.
+     */
+    void EmitEdge(NBasicBlock *from, NBasicBlock *to, bool may_fall_through);
+    bool IsBackEdge(NBasicBlock *from, NBasicBlock *to) const;
+    bool IsTrivialEdge(NBasicBlock *from, NBasicBlock *to) const;
+    void EmitSafepointPoll();
+
+    void EmitParallelMoves(std::vector<Move> *moves);
+    void EmitMove(NLocation dst, NLocation src, NType type, NValue *value);
+
+    /**
+     * Load value to register, constants are materialized.
+     */
+    void LoadGP(int dst, NValue *value);
+    void LoadXmm(int dst, NValue *value);
+
+    /**
+     * @return register code holds value, load it to scratch if it is not in
+     *         register.
+     */
+    int UseGP(NValue *value, int scratch);
+    int UseXmm(NValue *value, int scratch);
+
+    /**
+     * @return register code for defining value, scratch if it was spilled.
+     */
+    int DefGP(NValue *value);
+    int DefXmm(NValue *value);
+
+    /**
+     * Store scratch back to slot if value was spilled.
+     */
+    void SpillIfNeeded(NValue *value, int reg);
+
+    NGraph *graph_;
+    std::unique_ptr<NRegisterAllocator> allocator_;
+    std::vector<int> entries_;
+    std::vector<int> exits_;
+
+    Asm *state_ = nullptr;
+    std::vector<int> linear_index_; // by block id
+    YILabel *labels_ = nullptr; // by block id
+    YILabel *leave_ = nullptr; // return 0
+    YILabel *abort_ = nullptr; // return kNativeFragmentExit
+    YILabel *deopt_ = nullptr; // return kNativeFragmentDeopt
+    YILabel *stub_labels_ = nullptr; // for every guard.
+    std::vector<DeoptStub> stubs_;
+    NBasicBlock *next_block_ = nullptr; // next block in linear order.
+}; // class NCodeGenerator
+
+} // namespace mio
+
+#endif // MIO_NYAA_CODE_GENERATOR_H_
@@ -0,0 +1,178 @@
+#include "nyaa-graph-builder.h"
+#include "nyaa.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "memory-output-stream.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+class NGraphBuilderTest : public ::testing::Test {
+public:
+    virtual void SetUp() override {
+        zone_ = new Zone();
+        code_ = new MemorySegment();
+        builder_ = new BitCodeBuilder(code_);
+    }
+
+    virtual void TearDown() override {
+        delete builder_;
+        delete code_;
+        delete zone_;
+    }
+
+    NGraph *Build(const void *constants = nullptr, int constants_size = 0) {
+        NGraphBuilder builder(zone_, static_cast<uint64_t *>(code_->offset(0)),
+                              builder_->pc(), constants, constants_size);
+        auto graph = builder.Build();
+        if (graph) {
+            MemoryOutputStream stream(&text_);
+            graph->ToString(&stream);
+        }
+        return graph;
+    }
+
+    static int CountInstructions(NBasicBlock *block, NValue::Opcode opcode) {
+        int n = 0;
+        for (auto i = block->first(); i; i = i->next()) {
+            n += (i->opcode() == opcode);
+        }
+        return n;
+    }
+
+protected:
+    Zone *zone_ = nullptr;
+    MemorySegment *code_ = nullptr;
+    BitCodeBuilder *builder_ = nullptr;
+    std::string text_;
+};
+
+TEST_F(NGraphBuilderTest, Sanity) {
+    builder_->frame(16, 0, 0);            // [0]
+    builder_->load_i32_imm(0, 1);         // [1]
+    builder_->add_i32(4, 0, 8);           // [2] param [8] + 1
+    builder_->mov_4b(-4, 4);              // [3] return value
+    builder_->ret();                      // [4]
+
+    auto graph = Build();
+    ASSERT_NE(nullptr, graph) << text_;
+    ASSERT_EQ(2, graph->block_size()) << text_;
+
+    auto body = graph->block(1);
+    EXPECT_EQ(1, CountInstructions(graph->entry(), NValue::kParameter)) << text_;
+    EXPECT_EQ(1, CountInstructions(body, NValue::kAdd)) << text_;
+    ASSERT_EQ(NValue::kReturn, body->control()->opcode());
+
+    auto store = NStore::cast(body->control()->prev());
+    ASSERT_NE(nullptr, store) << text_;
+    EXPECT_EQ(-4, store->offset());
+    EXPECT_EQ(NValue::kAdd, store->value()->opcode());
+}
+
+TEST_F(NGraphBuilderTest, LoopPhis) {
+    builder_->frame(24, 0, 0);            // [0]
+    builder_->load_i32_imm(0, 0);         // [1] i = 0
+    builder_->load_i32_imm(4, 0);         // [2] sum = 0
+    builder_->load_i32_imm(8, 1);         // [3]
+    builder_->load_i32_imm(12, 100);      // [4]
+    builder_->loop_entry(1, 0);           // [5]
+    builder_->cmp_i32(CC_LT, 16, 0, 12);  // [6] i < 100
+    builder_->jz(2, 16, 4);               // [7]
+    builder_->add_i32(4, 4, 0);           // [8] sum += i
+    builder_->add_i32(0, 0, 8);           // [9] i += 1
+    builder_->jmp(-5);                    // [10]
+    builder_->mov_4b(-4, 4);              // [11]
+    builder_->ret();                      // [12]
+
+    auto graph = Build();
+    ASSERT_NE(nullptr, graph) << text_;
+    // entry, [1, 5), [5, 8), [8, 11), [11, 13)
+    ASSERT_EQ(5, graph->block_size()) << text_;
+
+    // Entered from entry block for on-stack replacement, [1, 5) and back-edge.
+    auto header = graph->block(2);
+    EXPECT_EQ(3, header->prev_block_size()) << text_;
+    EXPECT_LE(2, header->phi_size()) << text_;
+    for (int i = 0; i < header->phi_size(); ++i) {
+        EXPECT_EQ(3, header->phi(i)->input_size());
+    }
+    ASSERT_NE(nullptr, header->control());
+    auto branch = NBranch::cast(header->control());
+    ASSERT_NE(nullptr, branch) << text_;
+    EXPECT_EQ(graph->block(3), branch->true_target());
+    EXPECT_EQ(graph->block(4), branch->false_target());
+}
+
+TEST_F(NGraphBuilderTest, FloatingConstant) {
+    double constants[] = { 2.0 };
+
+    builder_->frame(16, 0, 0);                                      // [0]
+    builder_->load_8b(0, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 0); // [1]
+    builder_->add_f64(8, 0, 0);                                     // [2]
+    builder_->mov_8b(-8, 8);                                        // [3]
+    builder_->ret();                                                // [4]
+
+    auto graph = Build(constants, sizeof(constants));
+    ASSERT_NE(nullptr, graph) << text_;
+    auto add = NAdd::cast(NStore::cast(graph->block(1)->control()->prev())->value());
+    ASSERT_NE(nullptr, add) << text_;
+    auto lhs = NConstant::cast(add->lhs());
+    ASSERT_NE(nullptr, lhs) << text_;
+    EXPECT_TRUE(lhs->type() == NType::Float64());
+    EXPECT_EQ(2.0, lhs->f64_value());
+}
+
+TEST_F(NGraphBuilderTest, Unsupported) {
+    builder_->frame(16, 8, 0);      // [0]
+    builder_->call_val(16, 8, 0);   // [1]
+    builder_->ret();                // [2]
+    EXPECT_EQ(nullptr, Build());
+}
+
+TEST_F(NGraphBuilderTest, SideExit) {
+    builder_->frame(16, 8, 0);          // [0]
+    builder_->load_i32_imm(0, 1);       // [1]
+    builder_->call_val(16, 8, 0);       // [2]
+    builder_->add_i32(4, 0, 0);         // [3]
+    builder_->mov_4b(-4, 4);            // [4]
+    builder_->ret();                    // [5]
+
+    NGraphBuilder builder(zone_, static_cast<uint64_t *>(code_->offset(0)),
+                          builder_->pc(), nullptr, 0);
+    builder.set_side_exits(true);
+    auto graph = builder.Build();
+    ASSERT_NE(nullptr, graph);
+
+    // entry, [1, 3), [3, 6)
+    ASSERT_EQ(3, graph->block_size());
+    auto entry = NEntry::cast(graph->entry()->control());
+    ASSERT_NE(nullptr, entry);
+    ASSERT_EQ(2, entry->pc_size());
+    EXPECT_EQ(1, entry->pc(0));
+    EXPECT_EQ(3, entry->pc(1));
+    EXPECT_EQ(graph->block(2), entry->target(1));
+
+    auto exit = graph->block(1)->control();
+    ASSERT_EQ(NValue::kDeoptimize, exit->opcode());
+    auto state = exit->frame_state();
+    ASSERT_NE(nullptr, state);
+    EXPECT_EQ(2, state->pc());
+    // [-4] is not written before exit, it is a parameter.
+    ASSERT_EQ(3, state->value_size());
+    EXPECT_EQ(-4, state->offset(0));
+    EXPECT_EQ(NValue::kParameter, state->value(0)->opcode());
+    EXPECT_EQ(0, state->offset(1));
+    EXPECT_EQ(NValue::kConstant, state->value(1)->opcode());
+    EXPECT_EQ(3, exit->operand_size());
+}
+
+TEST_F(NGraphBuilderTest, OverlappedSlots) {
+    builder_->frame(16, 0, 0);          // [0]
+    builder_->load_i32_imm(4, 1);       // [1]
+    builder_->add_i64(8, 0, 0);         // [2] [0, 8) overlaps [4, 8)
+    builder_->ret();                    // [3]
+    EXPECT_EQ(nullptr, Build());
+}
+
+} // namespace mio
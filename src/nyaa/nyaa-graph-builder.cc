@@ -0,0 +1,730 @@
+#include "nyaa-graph-builder.h"
+#include "nyaa.h"
+#include "vm-bitcode-disassembler.h"
+#include "vm-bitcode.h"
+#include "vm-objects.h"
+#include <string.h>
+#include <algorithm>
+
+namespace mio {
+
+namespace {
+
+/**
+ * @return number of successors, -1 if bit code jumps out of code.
+ */
+int GetSuccessors(int pc, uint64_t bc, int size, int succ[2]) {
+    auto target = pc + BitCodeDisassembler::GetImm32(bc);
+    switch (BitCodeDisassembler::GetInst(bc)) {
+        case BC_jz:
+        case BC_jnz:
+            if (target < 0 || target >= size) {
+                return -1;
+            }
+            succ[0] = pc + 1;
+            succ[1] = target;
+            return 2;
+        case BC_jmp:
+            if (target < 0 || target >= size) {
+                return -1;
+            }
+            succ[0] = target;
+            return 1;
+        case BC_ret:
+            return 0;
+        default:
+            succ[0] = pc + 1;
+            return 1;
+    }
+}
+
+inline bool IsControl(uint64_t bc) {
+    switch (BitCodeDisassembler::GetInst(bc)) {
+        case BC_jz:
+        case BC_jnz:
+        case BC_jmp:
+        case BC_ret:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int64_t SignExtend(int64_t value, int bytes) {
+    switch (bytes) {
+        case 1:
+            return static_cast<int8_t>(value);
+        case 2:
+            return static_cast<int16_t>(value);
+        case 4:
+            return static_cast<int32_t>(value);
+        default:
+            return value;
+    }
+}
+
+} // namespace
+
+NGraphBuilder::NGraphBuilder(Zone *zone, const uint64_t *code, int size,
+                             const void *constant_primitive_data,
+                             int constant_primitive_size)
+    : zone_(DCHECK_NOTNULL(zone))
+    , code_(DCHECK_NOTNULL(code))
+    , size_(size)
+    , constant_primitive_data_(static_cast<const uint8_t *>(constant_primitive_data))
+    , constant_primitive_size_(constant_primitive_size)
+    , factory_(zone) {
+}
+
+NGraphBuilder::NGraphBuilder(Zone *zone, MIOGeneratedFunction *fn)
+    : NGraphBuilder(zone, static_cast<const uint64_t *>(fn->GetCode()),
+                    fn->GetCodeSize(), fn->GetConstantPrimitiveData(),
+                    fn->GetConstantPrimitiveSize()) {
+}
+
+NGraph *NGraphBuilder::Build() {
+    graph_ = new (zone_) NGraph(zone_);
+    entry_ = graph_->NewBlock();
+    if (!BuildBlocks()) {
+        return nullptr;
+    }
+
+    auto n = graph_->block_size();
+    filled_.assign(n, false);
+    sealed_.assign(n, false);
+    defs_.resize(n);
+    incomplete_phis_.resize(n);
+
+    current_ = entry_;
+    auto entry = factory_.CreateEntry();
+    for (auto pc : entries_) {
+        entry->add_pc(pc);
+        entry->add_target(BlockOf(pc));
+    }
+    Emit(entry);
+    filled_[entry_->id()] = true;
+    sealed_[entry_->id()] = true;
+
+    for (int i = 1; i < n; ++i) {
+        auto block = graph_->block(i);
+        TrySealBlocks();
+        FillBlock(block, block_begin_[block->id()], block_end_[block->id()]);
+        if (failed_) {
+            return nullptr;
+        }
+        filled_[block->id()] = true;
+    }
+    TrySealBlocks();
+    for (int i = 0; i < n; ++i) {
+        DCHECK(sealed_[i]);
+    }
+
+    // Write values of slots out of frame back before returning.
+    for (auto block : return_blocks_) {
+        for (const auto &slot : slots_) {
+            if (slot.first >= 0) {
+                break;
+            }
+            auto iter = slot_types_.find(slot.first);
+            if (iter == slot_types_.end()) {
+                continue; // never be written.
+            }
+            auto value = ReadVariable(slot.first, iter->second, block);
+            value = Coerce(value, iter->second, block);
+            EmitIn(block, factory_.CreateStore(slot.first, value));
+        }
+    }
+    BuildFrameStates();
+    if (failed_) {
+        return nullptr;
+    }
+    graph_->RemoveUnreachableBlocks();
+    return graph_;
+}
+
+bool NGraphBuilder::BuildBlocks() {
+    std::vector<bool> reachable(size_, false);
+    std::vector<bool> leader(size_, false);
+    std::vector<int> stack;
+
+    if (size_ <= 0) {
+        return false;
+    }
+    // Native code is entered after frame, at loops and after side exits.
+    auto entry_pc = BitCodeDisassembler::GetInst(code_[0]) == BC_frame ? 1 : 0;
+    if (entry_pc >= size_) {
+        return false;
+    }
+    entries_.push_back(entry_pc);
+    for (int pc = 0; pc < size_; ++pc) {
+        if (BitCodeDisassembler::GetInst(code_[pc]) == BC_loop_entry) {
+            entries_.push_back(pc);
+        } else if (!CanLift(code_[pc])) {
+            if (!side_exits_) {
+                return false;
+            }
+            if (pc + 1 < size_) {
+                entries_.push_back(pc + 1);
+            }
+        }
+    }
+    std::sort(entries_.begin(), entries_.end());
+    entries_.erase(std::unique(entries_.begin(), entries_.end()), entries_.end());
+    for (auto pc : entries_) {
+        leader[pc] = true;
+        stack.push_back(pc);
+    }
+    while (!stack.empty()) {
+        auto pc = stack.back();
+        stack.pop_back();
+        if (reachable[pc]) {
+            continue;
+        }
+        reachable[pc] = true;
+
+        int succ[2];
+        auto n = CanLift(code_[pc]) ? GetSuccessors(pc, code_[pc], size_, succ) : 0;
+        if (n < 0) {
+            return false;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (succ[i] >= size_) {
+                return false; // run out of code.
+            }
+            if (IsControl(code_[pc])) {
+                leader[succ[i]] = true;
+            }
+            stack.push_back(succ[i]);
+        }
+    }
+
+    pc_to_block_.assign(size_, nullptr);
+    for (int pc = 0; pc < size_; ++pc) {
+        if (reachable[pc] && leader[pc]) {
+            pc_to_block_[pc] = graph_->NewBlock();
+        }
+    }
+
+    block_begin_.assign(graph_->block_size(), -1);
+    block_end_.assign(graph_->block_size(), -1);
+    for (auto pc : entries_) {
+        graph_->AddEdge(entry_, BlockOf(pc));
+    }
+    for (int pc = 0; pc < size_; ++pc) {
+        auto block = BlockOf(pc);
+        if (!block) {
+            continue;
+        }
+        auto last = pc;
+        while (!IsControl(code_[last]) && CanLift(code_[last]) &&
+               !BlockOf(last + 1)) {
+            ++last;
+        }
+        block_begin_[block->id()] = pc;
+        block_end_[block->id()]   = last + 1;
+
+        int succ[2];
+        auto n = CanLift(code_[last]) ? GetSuccessors(last, code_[last], size_, succ) : 0;
+        DCHECK_GE(n, 0);
+        if (n == 2 && succ[0] == succ[1]) {
+            n = 1;
+        }
+        for (int i = 0; i < n; ++i) {
+            graph_->AddEdge(block, BlockOf(succ[i]));
+        }
+    }
+    return true;
+}
+
+void NGraphBuilder::FillBlock(NBasicBlock *block, int begin, int end) {
+    current_ = block;
+    for (int pc = begin; pc < end; ++pc) {
+        current_pc_ = pc;
+        LiftBitCode(pc, code_[pc]);
+        if (failed_) {
+            return;
+        }
+    }
+    if (!block->control()) {
+        DCHECK_LT(end, size_);
+        Emit(factory_.CreateJump(BlockOf(end)));
+    }
+}
+
+bool NGraphBuilder::CanLift(uint64_t bc) const {
+    auto op1   = BitCodeDisassembler::GetOp1(bc);
+    auto op2   = BitCodeDisassembler::GetOp2(bc);
+    auto imm32 = BitCodeDisassembler::GetImm32(bc);
+
+    switch (BitCodeDisassembler::GetInst(bc)) {
+        case BC_frame:
+        case BC_loop_entry:
+        case BC_mov_8b_pair:
+        case BC_load_imm_add_i64:
+        case BC_logic_not:
+        case BC_jz:
+        case BC_jnz:
+        case BC_jmp:
+        case BC_ret:
+            return true;
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_load_##byte##b: \
+            return op2 == BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT && imm32 >= 0 && \
+                   imm32 + (byte) <= constant_primitive_size_; \
+        case BC_mov_##byte##b: \
+        case BC_add_i##bit: \
+        case BC_sub_i##bit: \
+        case BC_mul_i##bit: \
+        case BC_div_i##bit: \
+        case BC_and_i##bit: \
+        case BC_or_i##bit: \
+        case BC_xor_i##bit: \
+        case BC_inv_i##bit: \
+            return true; \
+        case BC_shl_i##bit##_imm: \
+        case BC_shr_i##bit##_imm: \
+        case BC_ushr_i##bit##_imm: \
+            return imm32 >= 0;
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_load_i##bit##_imm: \
+        case BC_add_i##bit##_imm: \
+            return true;
+        MIO_SMI_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+        case BC_add_f32:
+        case BC_sub_f32:
+        case BC_mul_f32:
+        case BC_div_f32:
+        case BC_add_f64:
+        case BC_sub_f64:
+        case BC_mul_f64:
+        case BC_div_f64:
+            return true;
+
+        case BC_cmp_i8:
+        case BC_cmp_i16:
+        case BC_cmp_i32:
+        case BC_cmp_i64:
+        case BC_cmp_f32:
+        case BC_cmp_f64:
+        case BC_cmp_i64_jz:
+        case BC_cmp_i64_jnz:
+            return op1 < MAX_CC_COMPARATORS;
+
+        default:
+            return false;
+    }
+}
+
+void NGraphBuilder::LiftBitCode(int pc, uint64_t bc) {
+    auto inst  = BitCodeDisassembler::GetInst(bc);
+    auto op1   = BitCodeDisassembler::GetOp1(bc);
+    auto op2   = BitCodeDisassembler::GetOp2(bc);
+    auto op3   = BitCodeDisassembler::GetOp3(bc);
+    auto val1  = BitCodeDisassembler::GetVal1(bc);
+    auto val2  = BitCodeDisassembler::GetVal2(bc);
+    auto imm32 = BitCodeDisassembler::GetImm32(bc);
+
+    if (!CanLift(bc)) {
+        // Side exit, interpreter runs it then comes back after it.
+        DCHECK(side_exits_);
+        EmitExit(factory_.CreateDeoptimize());
+        return;
+    }
+
+    switch (inst) {
+        case BC_frame:
+        case BC_loop_entry:
+            break;
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_load_##byte##b: { \
+            if (op2 != BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT || imm32 < 0 || \
+                imm32 + (byte) > constant_primitive_size_) { \
+                Fail(); \
+                return; \
+            } \
+            mio_i##bit##_t value; \
+            memcpy(&value, constant_primitive_data_ + imm32, sizeof(value)); \
+            Write(op1, Emit(factory_.CreateConstant(NType::OfIntegral(byte), value))); \
+        } break;
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_load_i##bit##_imm: \
+            Write(op1, Emit(factory_.CreateConstant(NType::OfIntegral(byte), \
+                                                    static_cast<mio_i##bit##_t>(imm32)))); \
+            break;
+        MIO_SMI_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_mov_##byte##b: \
+            Write(val1, Read(val2, NType::OfIntegral(byte), false)); \
+            break;
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+        case BC_mov_8b_pair: // the second one is lifted by itself.
+            Write(val1, Read(val2, NType::Int64(), false));
+            break;
+
+        case BC_load_imm_add_i64: // the second one is lifted by itself.
+            Write(op1, Emit(factory_.CreateConstant(NType::Int64(), imm32)));
+            break;
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_add_i##bit##_imm: { \
+            auto type = NType::OfIntegral(byte); \
+            auto lhs = Read(op2, type, true); \
+            auto rhs = Emit(factory_.CreateConstant(type, static_cast<mio_i##bit##_t>(imm32))); \
+            Write(op1, Emit(factory_.CreateAdd(type, lhs, rhs))); \
+        } break;
+        MIO_SMI_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+    #define DEFINE_BINARY(bc_name, name, type) \
+        case BC_##bc_name: { \
+            auto lhs = Read(op2, type, true); \
+            auto rhs = Read(op3, type, true); \
+            Write(op1, Emit(factory_.Create##name(type, lhs, rhs))); \
+        } break;
+    #define DEFINE_CASE(byte, bit) \
+        DEFINE_BINARY(add_i##bit, Add, NType::OfIntegral(byte)) \
+        DEFINE_BINARY(sub_i##bit, Sub, NType::OfIntegral(byte)) \
+        DEFINE_BINARY(mul_i##bit, Mul, NType::OfIntegral(byte)) \
+        case BC_div_i##bit: { \
+            auto type = NType::OfIntegral(byte); \
+            auto lhs = Read(op2, type, true); \
+            auto rhs = Read(op3, type, true); \
+            Write(op1, EmitExit(factory_.CreateDiv(type, lhs, rhs))); \
+        } break; \
+        DEFINE_BINARY(and_i##bit, And, NType::OfIntegral(byte)) \
+        DEFINE_BINARY(or_i##bit,  Or,  NType::OfIntegral(byte)) \
+        DEFINE_BINARY(xor_i##bit, Xor, NType::OfIntegral(byte)) \
+        case BC_inv_i##bit: { \
+            auto type = NType::OfIntegral(byte); \
+            Write(op1, Emit(factory_.CreateInv(type, Read(op2, type, true)))); \
+        } break;
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+        DEFINE_BINARY(add_f32, Add, NType::Float32())
+        DEFINE_BINARY(sub_f32, Sub, NType::Float32())
+        DEFINE_BINARY(mul_f32, Mul, NType::Float32())
+        DEFINE_BINARY(div_f32, Div, NType::Float32())
+        DEFINE_BINARY(add_f64, Add, NType::Float64())
+        DEFINE_BINARY(sub_f64, Sub, NType::Float64())
+        DEFINE_BINARY(mul_f64, Mul, NType::Float64())
+        DEFINE_BINARY(div_f64, Div, NType::Float64())
+    #undef DEFINE_BINARY
+
+    // Shifting by register panics if it is negative, only the immediate
+    // ones are lifted.
+    #define DEFINE_SHIFT(bc_name, name, byte) \
+        case BC_##bc_name: { \
+            if (imm32 < 0) { \
+                Fail(); \
+                return; \
+            } \
+            auto type = NType::OfIntegral(byte); \
+            auto lhs = Read(op2, type, true); \
+            auto rhs = Emit(factory_.CreateConstant(type, imm32)); \
+            Write(op1, Emit(factory_.Create##name(type, lhs, rhs))); \
+        } break;
+    #define DEFINE_CASE(byte, bit) \
+        DEFINE_SHIFT(shl_i##bit##_imm,  Shl,  byte) \
+        DEFINE_SHIFT(shr_i##bit##_imm,  Shr,  byte) \
+        DEFINE_SHIFT(ushr_i##bit##_imm, UShr, byte)
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+    #undef DEFINE_SHIFT
+
+    #define DEFINE_CASE(bc_name, type) \
+        case BC_##bc_name: { \
+            if (op1 >= MAX_CC_COMPARATORS) { \
+                Fail(); \
+                return; \
+            } \
+            auto lhs = Read(val1, type, true); \
+            auto rhs = Read(val2, type, true); \
+            Write(op2, Emit(factory_.CreateCompare(op1, lhs, rhs))); \
+        } break;
+        DEFINE_CASE(cmp_i8,  NType::Int8())
+        DEFINE_CASE(cmp_i16, NType::Int16())
+        DEFINE_CASE(cmp_i32, NType::Int32())
+        DEFINE_CASE(cmp_i64, NType::Int64())
+        DEFINE_CASE(cmp_f32, NType::Float32())
+        DEFINE_CASE(cmp_f64, NType::Float64())
+        // The second one (jz/jnz) is lifted by itself.
+        DEFINE_CASE(cmp_i64_jz,  NType::Int64())
+        DEFINE_CASE(cmp_i64_jnz, NType::Int64())
+    #undef DEFINE_CASE
+
+        case BC_logic_not:
+            Write(op1, Emit(factory_.CreateNot(Read(op2, NType::Int8(), true))));
+            break;
+
+        case BC_jz:
+        case BC_jnz: {
+            auto cond   = Read(op2, NType::Int8(), true);
+            auto next   = BlockOf(pc + 1);
+            auto target = BlockOf(pc + imm32);
+            if (next == target) {
+                Emit(factory_.CreateJump(target));
+            } else if (inst == BC_jz) {
+                Emit(factory_.CreateBranch(cond, next, target));
+            } else {
+                Emit(factory_.CreateBranch(cond, target, next));
+            }
+        } break;
+
+        case BC_jmp:
+            Emit(factory_.CreateJump(BlockOf(pc + imm32)));
+            break;
+
+        case BC_ret:
+            Emit(factory_.CreateReturn());
+            return_blocks_.push_back(current_);
+            break;
+
+        default:
+            Fail();
+            break;
+    }
+}
+
+NValue *NGraphBuilder::EmitExit(NInstruction *instruction) {
+    Emit(instruction);
+    exits_.push_back({instruction, current_, defs_[current_->id()]});
+    return instruction;
+}
+
+void NGraphBuilder::BuildFrameStates() {
+    for (const auto &exit : exits_) {
+        auto state = new (zone_) NFrameState(exit.instruction->position(), zone_);
+        // Only written slots, others are never touched by native code.
+        for (const auto &slot : slot_types_) {
+            auto iter = exit.defs.find(slot.first);
+            auto value = iter != exit.defs.end() ? iter->second :
+                         ReadBlockStart(slot.first, slot.second, exit.block);
+            state->add_offset(slot.first);
+            state->add_value(value);
+        }
+        exit.instruction->set_frame_state(state);
+    }
+}
+
+NValue *NGraphBuilder::ReadBlockStart(int offset, NType type,
+                                      NBasicBlock *block) {
+    DCHECK_NE(entry_, block);
+    if (defs_[block->id()].find(offset) == defs_[block->id()].end()) {
+        return ReadVariable(offset, type, block); // never touched in block.
+    }
+    if (block->prev_block_size() == 1) {
+        return ReadVariable(offset, type, block->prev_block(0));
+    }
+    for (int i = 0; i < block->phi_size(); ++i) {
+        if (block->phi(i)->slot() == offset) {
+            return block->phi(i);
+        }
+    }
+    // Do not record it in defs, the slot may be written in block.
+    auto phi = factory_.CreatePhi(type);
+    phi->set_slot(offset);
+    phi->set_block(block);
+    block->add_phi(phi);
+    AddPhiOperands(offset, phi, block);
+    return phi;
+}
+
+void NGraphBuilder::TrySealBlocks() {
+    for (int i = 0; i < graph_->block_size(); ++i) {
+        auto block = graph_->block(i);
+        if (sealed_[block->id()]) {
+            continue;
+        }
+        auto all_filled = true;
+        for (int j = 0; j < block->prev_block_size(); ++j) {
+            if (!filled_[block->prev_block(j)->id()]) {
+                all_filled = false;
+                break;
+            }
+        }
+        if (all_filled) {
+            SealBlock(block);
+        }
+    }
+}
+
+void NGraphBuilder::SealBlock(NBasicBlock *block) {
+    sealed_[block->id()] = true;
+    for (const auto &pair : incomplete_phis_[block->id()]) {
+        AddPhiOperands(pair.first, pair.second, block);
+    }
+    incomplete_phis_[block->id()].clear();
+}
+
+NValue *NGraphBuilder::Read(int offset, NType type, bool exact) {
+    if (!CheckSlot(offset, type.bytes())) {
+        Fail();
+        return Emit(factory_.CreateConstant(type, 0)); // never be used.
+    }
+    auto value = ReadVariable(offset, type, current_);
+    if (exact) {
+        return Coerce(value, type, current_);
+    }
+    if (value->type().bytes() != type.bytes()) {
+        Fail();
+    }
+    return value;
+}
+
+void NGraphBuilder::Write(int offset, NValue *value) {
+    if (failed_) {
+        return;
+    }
+    if (!CheckSlot(offset, value->type().bytes())) {
+        Fail();
+        return;
+    }
+    if (value->slot() == NValue::kNoSlot) {
+        value->set_slot(offset);
+    }
+    defs_[current_->id()][offset] = value;
+    slot_types_.erase(offset);
+    slot_types_.emplace(offset, value->type());
+}
+
+NValue *NGraphBuilder::ReadVariable(int offset, NType type, NBasicBlock *block) {
+    auto &defs = defs_[block->id()];
+    auto iter = defs.find(offset);
+    if (iter != defs.end()) {
+        return iter->second;
+    }
+    return ReadVariableRecursive(offset, type, block);
+}
+
+NValue *NGraphBuilder::ReadVariableRecursive(int offset, NType type,
+                                             NBasicBlock *block) {
+    NValue *value = nullptr;
+    if (block == entry_) {
+        auto iter = parameters_.find(offset);
+        if (iter == parameters_.end()) {
+            auto param = factory_.CreateParameter(type, offset);
+            param->set_slot(offset);
+            EmitIn(entry_, param);
+            iter = parameters_.emplace(offset, param).first;
+        }
+        value = iter->second;
+    } else if (!sealed_[block->id()]) {
+        auto phi = factory_.CreatePhi(type);
+        phi->set_slot(offset);
+        phi->set_block(block);
+        block->add_phi(phi);
+        incomplete_phis_[block->id()][offset] = phi;
+        value = phi;
+    } else if (block->prev_block_size() == 1) {
+        value = ReadVariable(offset, type, block->prev_block(0));
+    } else {
+        auto phi = factory_.CreatePhi(type);
+        phi->set_slot(offset);
+        phi->set_block(block);
+        block->add_phi(phi);
+        // Break cycles first.
+        defs_[block->id()][offset] = phi;
+        AddPhiOperands(offset, phi, block);
+        value = phi;
+    }
+    defs_[block->id()][offset] = value;
+    return value;
+}
+
+void NGraphBuilder::AddPhiOperands(int offset, NPhi *phi, NBasicBlock *block) {
+    for (int i = 0; i < block->prev_block_size(); ++i) {
+        auto prev  = block->prev_block(i);
+        auto value = ReadVariable(offset, phi->type(), prev);
+        phi->add_input(Coerce(value, phi->type(), prev));
+    }
+}
+
+NValue *NGraphBuilder::Coerce(NValue *value, NType type, NBasicBlock *block) {
+    if (value->type() == type) {
+        return value;
+    }
+    auto constant = NConstant::cast(value);
+    if (!constant || constant->type().bytes() != type.bytes()) {
+        Fail();
+        return value;
+    }
+
+    // Reinterpret bits of constant: floating constants are loaded as integral
+    // ones.
+    int64_t bits = 0;
+    if (constant->type() == NType::Float32()) {
+        float f32 = static_cast<float>(constant->f64_value());
+        int32_t i32;
+        memcpy(&i32, &f32, sizeof(i32));
+        bits = i32;
+    } else if (constant->type() == NType::Float64()) {
+        auto f64 = constant->f64_value();
+        memcpy(&bits, &f64, sizeof(bits));
+    } else {
+        bits = constant->i64_value();
+    }
+
+    NConstant *result = nullptr;
+    if (type == NType::Float32()) {
+        auto i32 = static_cast<int32_t>(bits);
+        float f32;
+        memcpy(&f32, &i32, sizeof(f32));
+        result = factory_.CreateConstantFloat(type, f32);
+    } else if (type == NType::Float64()) {
+        double f64;
+        memcpy(&f64, &bits, sizeof(f64));
+        result = factory_.CreateConstantFloat(type, f64);
+    } else {
+        result = factory_.CreateConstant(type, SignExtend(bits, type.bytes()));
+    }
+    result->set_position(constant->position());
+    EmitIn(block, result);
+    return result;
+}
+
+NValue *NGraphBuilder::EmitIn(NBasicBlock *block, NInstruction *instruction) {
+    if (instruction->position() < 0 && block == current_) {
+        instruction->set_position(current_pc_);
+    }
+    auto control = block->control();
+    if (control) {
+        block->InsertBefore(control, instruction);
+    } else {
+        block->AddInstruction(instruction);
+    }
+    return instruction;
+}
+
+bool NGraphBuilder::CheckSlot(int offset, int bytes) {
+    auto iter = slots_.lower_bound(offset);
+    if (iter != slots_.end() && iter->first == offset) {
+        return iter->second == bytes;
+    }
+    if (iter != slots_.end() && offset + bytes > iter->first) {
+        return false; // overlap with the next one.
+    }
+    if (iter != slots_.begin()) {
+        --iter;
+        if (iter->first + iter->second > offset) {
+            return false; // overlap with the previous one.
+        }
+    }
+    slots_.emplace(offset, bytes);
+    return true;
+}
+
+} // namespace mio
@@ -0,0 +1,141 @@
+#ifndef MIO_NYAA_GRAPH_BUILDER_H_
+#define MIO_NYAA_GRAPH_BUILDER_H_
+
+#include "nyaa-value-factory.h"
+#include "nyaa-types.h"
+#include "base.h"
+#include <unordered_map>
+#include <vector>
+#include <map>
+
+namespace mio {
+
+class NGraph;
+class NBasicBlock;
+class MIOGeneratedFunction;
+
+/**
+ * Lift bit codes of a function to Nyaa SSA graph.
+ *
+ * Every primitive stack slot is a variable, the graph is built in one pass by
+ * sealing blocks (Braun et al. "Simple and Efficient Construction of Static
+ * Single Assignment Form"): phis of a block are completed once all of its
+ * predecessors were filled. Slots read before writing are parameters, slots
+ * out of frame (returning value) are stored back before returning.
+ *
+ * Only primitive bit codes are lifted: loads, moves, arithmetic, comparing
+ * and jumping. Functions with other bit codes (calling, objects) can not be
+ * built, unless side exits are enabled: such a bit code becomes a Deoptimize
+ * goes back to interpreter, and the bit code after it becomes an entry.
+ * Functions with slots accessed by different sizes can not be built.
+ *
+ * The entry block dispatches by the pc native code was entered at: function
+ * entry, every loop_entry (on-stack replacement) and bit codes after side
+ * exits. Slots are parameters at every entry, so phis of loop headers merge
+ * values from interpreter frame by themselves.
+ *
+ * Instructions may deoptimize (side exits, integral dividing) have frame
+ * states: values of all written slots at their pcs.
+ */
+class NGraphBuilder {
+public:
+    NGraphBuilder(Zone *zone, const uint64_t *code, int size,
+                  const void *constant_primitive_data,
+                  int constant_primitive_size);
+
+    NGraphBuilder(Zone *zone, MIOGeneratedFunction *fn);
+
+    NValueFactory *factory() { return &factory_; }
+
+    /**
+     * Bit codes can not be lifted become side exits instead of failing.
+     */
+    DEF_PROP_RW(bool, side_exits)
+
+    /**
+     * @return null if the function can not be lifted.
+     */
+    NGraph *Build();
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NGraphBuilder)
+private:
+    struct Exit {
+        NInstruction *instruction;
+        NBasicBlock  *block;
+        std::unordered_map<int, NValue *> defs; // slots known before it.
+    };
+
+    bool BuildBlocks();
+    void FillBlock(NBasicBlock *block, int begin, int end);
+    bool CanLift(uint64_t bc) const;
+    void LiftBitCode(int pc, uint64_t bc);
+
+    /**
+     * Emit instruction may deoptimize, its frame state is built after all
+     * blocks were sealed.
+     */
+    NValue *EmitExit(NInstruction *instruction);
+    void BuildFrameStates();
+
+    /**
+     * Value of slot on beginning of block, no matter it is written in block
+     * later.
+     */
+    NValue *ReadBlockStart(int offset, NType type, NBasicBlock *block);
+    void TrySealBlocks();
+    void SealBlock(NBasicBlock *block);
+
+    NValue *Read(int offset, NType type, bool exact);
+    void Write(int offset, NValue *value);
+
+    NValue *ReadVariable(int offset, NType type, NBasicBlock *block);
+    NValue *ReadVariableRecursive(int offset, NType type, NBasicBlock *block);
+    void AddPhiOperands(int offset, NPhi *phi, NBasicBlock *block);
+
+    /**
+     * Make value suitable for type: return itself if same type, reinterpret
+     * constants, otherwise fail.
+     */
+    NValue *Coerce(NValue *value, NType type, NBasicBlock *block);
+
+    NValue *Emit(NInstruction *instruction) { return EmitIn(current_, instruction); }
+    NValue *EmitIn(NBasicBlock *block, NInstruction *instruction);
+
+    NBasicBlock *BlockOf(int pc) const { return pc_to_block_[pc]; }
+
+    bool CheckSlot(int offset, int bytes);
+
+    void Fail() { failed_ = true; }
+
+    Zone *zone_;
+    const uint64_t *code_;
+    int size_;
+    const uint8_t *constant_primitive_data_;
+    int constant_primitive_size_;
+
+    NValueFactory factory_;
+    NGraph *graph_ = nullptr;
+    NBasicBlock *entry_ = nullptr;
+    NBasicBlock *current_ = nullptr;
+    int current_pc_ = 0;
+    bool failed_ = false;
+    bool side_exits_ = false;
+
+    std::vector<NBasicBlock *> pc_to_block_; // only leaders have block.
+    std::vector<int> block_begin_; // [begin, end) pcs of blocks.
+    std::vector<int> block_end_;
+    std::vector<bool> filled_;
+    std::vector<bool> sealed_;
+    std::vector<std::unordered_map<int, NValue *>> defs_;
+    std::vector<std::unordered_map<int, NPhi *>> incomplete_phis_;
+    std::vector<NBasicBlock *> return_blocks_;
+    std::vector<int> entries_; // pcs of entry blocks.
+    std::vector<Exit> exits_;
+    std::unordered_map<int, NParameter *> parameters_;
+    std::map<int, int> slots_;   // offset -> bytes of all accessed slots.
+    std::map<int, NType> slot_types_; // offset -> type of last written.
+}; // class NGraphBuilder
+
+} // namespace mio
+
+#endif // MIO_NYAA_GRAPH_BUILDER_H_
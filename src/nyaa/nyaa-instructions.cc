@@ -1,5 +1,8 @@
 #include "nyaa-instructions.h"
+#include "nyaa.h"
+#include "vm-bitcode.h"
 #include "text-output-stream.h"
+#include <inttypes.h>
 
 namespace mio {
 
@@ -19,9 +22,124 @@ namespace mio {
 //    }
 //}
 
-void NAdd::ToString(TextOutputStream *stream) const {
-    lhs()->ToString(stream);
-    stream->Write(" ");
+void NValue::PrintName(TextOutputStream *stream) const {
+    stream->Printf("%%%d", id());
+}
+
+void NFrameState::ToString(TextOutputStream *stream) const {
+    stream->Printf(" @%d {", pc());
+    for (int i = 0; i < value_size(); ++i) {
+        stream->Printf(i == 0 ? "[%d]: " : ", [%d]: ", offset(i));
+        value(i)->PrintName(stream);
+    }
+    stream->Write("}");
+}
+
+void NPhi::RemoveInput(int i) {
+    DCHECK_GE(i, 0);
+    DCHECK_LT(i, input_size());
+    for (int j = i + 1; j < input_size(); ++j) {
+        set_input(j - 1, input(j));
+    }
+    inputs_.Resize(input_size() - 1);
+}
+
+void NPhi::ToString(TextOutputStream *stream) const {
+    PrintName(stream);
+    stream->Printf(" = %s phi", type().short_name());
+    for (int i = 0; i < input_size(); ++i) {
+        stream->Write(i == 0 ? " " : ", ");
+        input(i)->PrintName(stream);
+    }
+}
+
+void NConstant::ToString(TextOutputStream *stream) const {
+    PrintName(stream);
+    if (type().is_floating()) {
+        stream->Printf(" = %s %f", type().short_name(), f64_value());
+    } else {
+        stream->Printf(" = %s %" PRId64, type().short_name(), i64_value());
+    }
+}
+
+void NParameter::ToString(TextOutputStream *stream) const {
+    PrintName(stream);
+    stream->Printf(" = %s param [%d]", type().short_name(), offset());
+}
+
+#define DEFINE_BINARY_OPERATION(name) \
+    void N##name::ToString(TextOutputStream *stream) const { \
+        PrintName(stream); \
+        stream->Printf(" = %s %s ", type().short_name(), #name); \
+        lhs()->PrintName(stream); \
+        stream->Write(", "); \
+        rhs()->PrintName(stream); \
+        if (frame_state()) { \
+            frame_state()->ToString(stream); \
+        } \
+    } \
+    bool N##name::has_side_effect() const { \
+        return (opcode() == kDiv || opcode() == kMod) && type().is_integral(); \
+    }
+NYAA_BINARY_OPS(DEFINE_BINARY_OPERATION)
+#undef DEFINE_BINARY_OPERATION
+
+void NInv::ToString(TextOutputStream *stream) const {
+    PrintName(stream);
+    stream->Printf(" = %s Inv ", type().short_name());
+    value()->PrintName(stream);
+}
+
+void NNot::ToString(TextOutputStream *stream) const {
+    PrintName(stream);
+    stream->Printf(" = %s Not ", type().short_name());
+    value()->PrintName(stream);
+}
+
+void NCompare::ToString(TextOutputStream *stream) const {
+    static const char *kConditionNames[] = {
+    #define DEFINE_NAME(name, op) #op,
+        VM_COMPARATOR(DEFINE_NAME)
+    #undef DEFINE_NAME
+    };
+    PrintName(stream);
+    stream->Printf(" = %s Compare ", type().short_name());
+    lhs()->PrintName(stream);
+    stream->Printf(" %s ", kConditionNames[condition()]);
+    rhs()->PrintName(stream);
+}
+
+void NStore::ToString(TextOutputStream *stream) const {
+    stream->Printf("Store [%d], ", offset());
+    value()->PrintName(stream);
+}
+
+void NBranch::ToString(TextOutputStream *stream) const {
+    stream->Write("Branch ");
+    condition()->PrintName(stream);
+    stream->Printf(" ? B%d : B%d", true_target()->id(), false_target()->id());
+}
+
+void NJump::ToString(TextOutputStream *stream) const {
+    stream->Printf("Jump B%d", target()->id());
+}
+
+void NReturn::ToString(TextOutputStream *stream) const {
+    stream->Write("Return");
+}
+
+void NEntry::ToString(TextOutputStream *stream) const {
+    stream->Write("Entry");
+    for (int i = 0; i < target_size(); ++i) {
+        stream->Printf("%s@%d: B%d", i == 0 ? " " : ", ", pc(i), target(i)->id());
+    }
+}
+
+void NDeoptimize::ToString(TextOutputStream *stream) const {
+    stream->Write("Deoptimize");
+    if (frame_state()) {
+        frame_state()->ToString(stream);
+    }
 }
 
 } // namespace mio
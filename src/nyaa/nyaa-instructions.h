@@ -11,20 +11,35 @@ namespace mio {
 
 #define NAYY_INSTRUCTION_OPS(M) \
     M(Constant)                 \
-    M(Add)                      \
-    M(Sub)                      \
-    M(Mul)                      \
-    M(Div)                      \
-    M(Mod)                      \
-    M(Shl)                      \
-    M(Shr)                      \
-    M(UShr)                     \
+    M(Parameter)                \
+    NYAA_BINARY_OPS(M)          \
+    M(Inv)                      \
+    M(Not)                      \
+    M(Compare)                  \
     M(Phi)                      \
-    M(Branch)
-
+    M(Store)                    \
+    M(Branch)                   \
+    M(Jump)                     \
+    M(Return)                   \
+    M(Entry)                    \
+    M(Deoptimize)
+
+#define NYAA_BINARY_OPS(M) \
+    M(Add)                 \
+    M(Sub)                 \
+    M(Mul)                 \
+    M(Div)                 \
+    M(Mod)                 \
+    M(And)                 \
+    M(Or)                  \
+    M(Xor)                 \
+    M(Shl)                 \
+    M(Shr)                 \
+    M(UShr)
 
 #define DECLARE_NYAA_INSTRUCTION(name) \
     virtual Opcode opcode() const override { return k##name; } \
+    virtual void ToString(TextOutputStream *stream) const override; \
     static N##name *cast(NValue *value) { \
         return DCHECK_NOTNULL(value)->opcode() == k##name ? reinterpret_cast<N##name*>(value) : nullptr; \
     } \
@@ -54,10 +69,18 @@ public:
         kIsDead,
     };
 
+    // Value was never written to a primitive stack slot.
+    static const int kNoSlot = 0x7fffffff;
+
     NValue(NType type) : type_(type) {}
 
     DEF_PROP_RW(int, id)
     DEF_PROP_RW(NType, type)
+    /**
+     * The primitive stack slot first written by this value in bit codes, the
+     * register allocator spills value there.
+     */
+    DEF_PROP_RW(int, slot)
     DEF_PROP_RW(RawStringRef, name)
     DEF_PTR_PROP_RW(NBasicBlock, block)
     DEF_PTR_PROP_RW(NUsedListNode, used_values)
@@ -76,6 +99,24 @@ public:
 
     virtual NValue *operand(int i) const { return nullptr; }
 
+    virtual void set_operand(int i, NValue *value) {}
+
+    /**
+     * The instruction can not be removed even its value is never used,
+     * e.g. storing, control flow and integral dividing (may trap).
+     */
+    virtual bool has_side_effect() const { return false; }
+
+    bool is_control() const {
+        return opcode() == kBranch || opcode() == kJump || opcode() == kReturn ||
+               opcode() == kEntry || opcode() == kDeoptimize;
+    }
+
+    /**
+     * Print the value as an operand: %id
+     */
+    void PrintName(TextOutputStream *stream) const;
+
 //    void Kill() { Kill(nullptr); }
 //
 //    void Kill(Zone *zone);
@@ -84,6 +125,7 @@ public:
 private:
     RawStringRef   name_ = RawString::kEmpty;
     int            id_ = -1;
+    int            slot_ = kNoSlot;
     uint32_t       flags_ = 0;
     NType          type_;
     NBasicBlock   *block_ = nullptr;
@@ -92,14 +134,50 @@ private:
 }; // class NValue
 
 
+/**
+ * Values of primitive stack slots at a bit code pc, native code writes them
+ * back to rebuild the interpreter frame when it deoptimizes at there.
+ */
+class NFrameState : public ManagedObject {
+public:
+    NFrameState(int pc, Zone *zone)
+        : pc_(pc)
+        , offsets_(DCHECK_NOTNULL(zone))
+        , values_(zone) {}
+
+    DEF_GETTER(int, pc)
+    DEF_ZONE_VECTOR_PROP_RWA(int, offset)
+    DEF_ZONE_VECTOR_PROP_RWA(NValue *, value)
+
+    void ToString(TextOutputStream *stream) const;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NFrameState)
+private:
+    int pc_;
+    ZoneVector<int> offsets_;
+    ZoneVector<NValue *> values_;
+}; // class NFrameState
+
+
 class NInstruction : public NValue {
 public:
     DEF_PTR_GETTER(NInstruction, next)
     DEF_PTR_GETTER(NInstruction, prev)
     DEF_SETTER(int, position)
 
+    /**
+     * Instructions may deoptimize have a frame state, its values are operands
+     * after the fixed ones, so they are kept alive and renamed by passes.
+     */
+    DEF_PTR_PROP_RW(NFrameState, frame_state)
+
+    int frame_state_size() const {
+        return frame_state_ ? frame_state_->value_size() : 0;
+    }
+
     virtual int position() const override { return position_; }
 
+    friend class NBasicBlock;
     DISALLOW_IMPLICIT_CONSTRUCTORS(NInstruction)
 protected:
     explicit NInstruction(NType type)
@@ -108,6 +186,7 @@ protected:
 private:
     NInstruction *next_ = nullptr;
     NInstruction *prev_ = nullptr;
+    NFrameState *frame_state_ = nullptr;
     int position_ = -1;
 }; // class NInstruction
 
@@ -115,29 +194,33 @@ private:
 template<int N>
 class NInstructionTemplate : public NInstruction {
 public:
-    virtual int operand_size() const override { return N; }
+    virtual int operand_size() const override { return N + frame_state_size(); }
 
     virtual NValue *operand(int i) const override {
         DCHECK_GE(i, 0);
-        DCHECK_LT(i, N);
-        return inputs_[i];
+        DCHECK_LT(i, operand_size());
+        return i < N ? inputs_[i] : frame_state()->value(i - N);
+    }
+
+    virtual void set_operand(int i, NValue *value) override {
+        DCHECK_GE(i, 0);
+        DCHECK_LT(i, operand_size());
+        if (i < N) {
+            inputs_[i] = DCHECK_NOTNULL(value);
+        } else {
+            frame_state()->set_value(i - N, DCHECK_NOTNULL(value));
+        }
     }
 
     DISALLOW_IMPLICIT_CONSTRUCTORS(NInstructionTemplate)
 protected:
     explicit NInstructionTemplate(NType type)
         : NInstruction(type) {
-        memset(inputs_, 0, sizeof(NValue *) * N);
-    }
-
-    void set_operand(int i, NValue *value) {
-        DCHECK_GE(i, 0);
-        DCHECK_LT(i, N);
-        inputs_[i] = DCHECK_NOTNULL(value);
+        memset(inputs_, 0, sizeof(NValue *) * (N > 0 ? N : 1));
     }
 
 private:
-    NValue *inputs_[N];
+    NValue *inputs_[N > 0 ? N : 1];
 }; // class NInstructionTemplate
 
 
@@ -145,10 +228,26 @@ private:
 /// Nyaa Instructions
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * The phi is not in instruction list of block, inputs are in the same order
+ * as predecessors of its block.
+ */
 class NPhi : public NValue {
 public:
     DEF_ZONE_VECTOR_PROP_RWA(NValue *, input)
 
+    virtual int position() const override { return -1; }
+
+    virtual int operand_size() const override { return input_size(); }
+
+    virtual NValue *operand(int i) const override { return input(i); }
+
+    virtual void set_operand(int i, NValue *value) override {
+        set_input(i, DCHECK_NOTNULL(value));
+    }
+
+    void RemoveInput(int i);
+
     DECLARE_NYAA_INSTRUCTION(Phi)
 private:
     explicit NPhi(NType type, Zone *zone)
@@ -158,6 +257,157 @@ private:
     ZoneVector<NValue *> inputs_;
 }; // class NPhi
 
+
+/**
+ * Integral constant is sign-extended to 64 bits, floating constant keeps
+ * its value in double.
+ */
+class NConstant : public NInstructionTemplate<0> {
+public:
+    int64_t i64_value() const { return i64_value_; }
+    double f64_value() const { return f64_value_; }
+
+    bool Equals(const NConstant *other) const {
+        return type() == other->type() && i64_value_ == other->i64_value_;
+    }
+
+    DECLARE_NYAA_INSTRUCTION(Constant)
+private:
+    NConstant(NType type, int64_t value)
+        : NInstructionTemplate(type)
+        , i64_value_(value) {}
+
+    NConstant(NType type, double value)
+        : NInstructionTemplate(type)
+        , f64_value_(value) {}
+
+    union {
+        int64_t i64_value_;
+        double  f64_value_;
+    };
+}; // class NConstant
+
+
+/**
+ * Value of a primitive stack slot on entering function.
+ */
+class NParameter : public NInstructionTemplate<0> {
+public:
+    DEF_GETTER(int, offset)
+
+    DECLARE_NYAA_INSTRUCTION(Parameter)
+private:
+    NParameter(NType type, int offset)
+        : NInstructionTemplate(type)
+        , offset_(offset) {}
+
+    int offset_;
+}; // class NParameter
+
+
+class NBinaryOperation : public NInstructionTemplate<2> {
+public:
+    NValue *lhs() const { return operand(0); }
+    NValue *rhs() const { return operand(1); }
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NBinaryOperation)
+protected:
+    NBinaryOperation(NType type, NValue *lhs, NValue *rhs)
+        : NInstructionTemplate(type) {
+        set_operand(0, lhs);
+        set_operand(1, rhs);
+    }
+}; // class NBinaryOperation
+
+#define DEFINE_BINARY_OPERATION(name) \
+    class N##name : public NBinaryOperation { \
+    public: \
+        virtual bool has_side_effect() const override; \
+        DECLARE_NYAA_INSTRUCTION(name) \
+    private: \
+        N##name(NType type, NValue *lhs, NValue *rhs) \
+            : NBinaryOperation(type, lhs, rhs) {} \
+    };
+NYAA_BINARY_OPS(DEFINE_BINARY_OPERATION)
+#undef DEFINE_BINARY_OPERATION
+
+
+class NInv : public NInstructionTemplate<1> {
+public:
+    NValue *value() const { return operand(0); }
+
+    DECLARE_NYAA_INSTRUCTION(Inv)
+private:
+    NInv(NType type, NValue *value)
+        : NInstructionTemplate(type) {
+        set_operand(0, value);
+    }
+}; // class NInv
+
+
+class NNot : public NInstructionTemplate<1> {
+public:
+    NValue *value() const { return operand(0); }
+
+    DECLARE_NYAA_INSTRUCTION(Not)
+private:
+    NNot(NValue *value)
+        : NInstructionTemplate(NType::Int8()) {
+        set_operand(0, value);
+    }
+}; // class NNot
+
+
+/**
+ * Comparing result is a i8 bool value, condition is BCComparator.
+ */
+class NCompare : public NInstructionTemplate<2> {
+public:
+    DEF_GETTER(int, condition)
+
+    NValue *lhs() const { return operand(0); }
+    NValue *rhs() const { return operand(1); }
+
+    DECLARE_NYAA_INSTRUCTION(Compare)
+private:
+    NCompare(int condition, NValue *lhs, NValue *rhs)
+        : NInstructionTemplate(NType::Int8())
+        , condition_(condition) {
+        set_operand(0, lhs);
+        set_operand(1, rhs);
+    }
+
+    int condition_;
+}; // class NCompare
+
+
+/**
+ * Write value back to primitive stack slot, for slots out of frame
+ * (e.g. returning value) before returning.
+ */
+class NStore : public NInstructionTemplate<1> {
+public:
+    DEF_GETTER(int, offset)
+
+    NValue *value() const { return operand(0); }
+
+    virtual bool has_side_effect() const override { return true; }
+
+    DECLARE_NYAA_INSTRUCTION(Store)
+private:
+    NStore(int offset, NValue *value)
+        : NInstructionTemplate(NType::Void())
+        , offset_(offset) {
+        set_operand(0, value);
+    }
+
+    int offset_;
+}; // class NStore
+
+
+/**
+ * Go to true_target if condition is not zero, otherwise false_target.
+ */
 class NBranch : public NInstructionTemplate<1> {
 public:
     DEF_PTR_GETTER(NBasicBlock, true_target)
@@ -165,11 +415,13 @@ public:
 
     NValue *condition() const { return operand(0); }
 
+    virtual bool has_side_effect() const override { return true; }
+
     DECLARE_NYAA_INSTRUCTION(Branch)
 private:
-    NBranch(NType type, NValue *condition, NBasicBlock *true_target,
+    NBranch(NValue *condition, NBasicBlock *true_target,
             NBasicBlock *false_target)
-        : NInstructionTemplate(type)
+        : NInstructionTemplate(NType::Void())
         , true_target_(DCHECK_NOTNULL(true_target))
         , false_target_(DCHECK_NOTNULL(false_target)) {
         set_operand(0, condition);
@@ -179,29 +431,70 @@ private:
     NBasicBlock *false_target_;
 }; // class NBranch
 
-class NConstant : public NInstructionTemplate<0> {
+
+class NJump : public NInstructionTemplate<0> {
 public:
+    DEF_PTR_GETTER(NBasicBlock, target)
 
-    DECLARE_NYAA_INSTRUCTION(Constant)
+    virtual bool has_side_effect() const override { return true; }
+
+    DECLARE_NYAA_INSTRUCTION(Jump)
 private:
-    NConstant(NType type) : NInstructionTemplate(type) {}
-}; // class NConstant
+    NJump(NBasicBlock *target)
+        : NInstructionTemplate(NType::Void())
+        , target_(DCHECK_NOTNULL(target)) {}
 
-class NAdd : public NInstructionTemplate<2> {
+    NBasicBlock *target_;
+}; // class NJump
+
+
+class NReturn : public NInstructionTemplate<0> {
 public:
-    virtual void ToString(TextOutputStream *stream) const override;
+    virtual bool has_side_effect() const override { return true; }
 
-    NValue *lhs() const { return operand(0); }
-    NValue *rhs() const { return operand(1); }
+    DECLARE_NYAA_INSTRUCTION(Return)
+private:
+    NReturn() : NInstructionTemplate(NType::Void()) {}
+}; // class NReturn
+
+
+/**
+ * Control of entry block: go to the target begins at the bit code pc native
+ * code was entered at, that is the function entry, a loop_entry for on-stack
+ * replacement or a bit code after side exit. Native code goes back to
+ * interpreter if no one matches.
+ */
+class NEntry : public NInstructionTemplate<0> {
+public:
+    DEF_ZONE_VECTOR_PROP_RWA(int, pc)
+    DEF_ZONE_VECTOR_PROP_RWA(NBasicBlock *, target)
 
-    DECLARE_NYAA_INSTRUCTION(Add)
+    virtual bool has_side_effect() const override { return true; }
+
+    DECLARE_NYAA_INSTRUCTION(Entry)
 private:
-    NAdd(NType type, NValue *lhs, NValue *rhs)
-        : NInstructionTemplate(type) {
-        set_operand(0, lhs);
-        set_operand(1, rhs);
-    }
-}; // class NAdd
+    NEntry(Zone *zone)
+        : NInstructionTemplate(NType::Void())
+        , pcs_(DCHECK_NOTNULL(zone))
+        , targets_(zone) {}
+
+    ZoneVector<int> pcs_;
+    ZoneVector<NBasicBlock *> targets_;
+}; // class NEntry
+
+
+/**
+ * Side exit at a bit code can not be lifted: values of frame state are
+ * written back, then interpreter goes on at its pc.
+ */
+class NDeoptimize : public NInstructionTemplate<0> {
+public:
+    virtual bool has_side_effect() const override { return true; }
+
+    DECLARE_NYAA_INSTRUCTION(Deoptimize)
+private:
+    NDeoptimize() : NInstructionTemplate(NType::Void()) {}
+}; // class NDeoptimize
 
 
 ////////////////////////////////////////////////////////////////////////////////
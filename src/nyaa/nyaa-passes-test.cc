@@ -0,0 +1,162 @@
+#include "nyaa-passes.h"
+#include "nyaa-graph-builder.h"
+#include "nyaa.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "memory-output-stream.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+class NPassesTest : public ::testing::Test {
+public:
+    virtual void SetUp() override {
+        zone_ = new Zone();
+        code_ = new MemorySegment();
+        builder_ = new BitCodeBuilder(code_);
+    }
+
+    virtual void TearDown() override {
+        delete builder_;
+        delete code_;
+        delete zone_;
+    }
+
+    NGraph *BuildAndOptimize() {
+        NGraphBuilder builder(zone_, static_cast<uint64_t *>(code_->offset(0)),
+                              builder_->pc(), nullptr, 0);
+        auto graph = builder.Build();
+        if (!graph) {
+            return nullptr;
+        }
+        NPassManager passes(builder.factory());
+        passes.AddDefaultPasses();
+        passes.Run(graph);
+
+        MemoryOutputStream stream(&text_);
+        graph->ToString(&stream);
+        return graph;
+    }
+
+    static int Count(NGraph *graph, NValue::Opcode opcode) {
+        int n = 0;
+        for (int i = 0; i < graph->block_size(); ++i) {
+            for (auto ins = graph->block(i)->first(); ins; ins = ins->next()) {
+                n += (ins->opcode() == opcode);
+            }
+        }
+        return n;
+    }
+
+protected:
+    Zone *zone_ = nullptr;
+    MemorySegment *code_ = nullptr;
+    BitCodeBuilder *builder_ = nullptr;
+    std::string text_;
+};
+
+TEST_F(NPassesTest, ConstantFolding) {
+    builder_->frame(16, 0, 0);            // [0]
+    builder_->load_i32_imm(0, 6);         // [1]
+    builder_->load_i32_imm(4, 7);         // [2]
+    builder_->mul_i32(8, 0, 4);           // [3]
+    builder_->add_i32_imm(8, 8, 1);       // [4]
+    builder_->mov_4b(-4, 8);              // [5]
+    builder_->ret();                      // [6]
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+    EXPECT_EQ(0, Count(graph, NValue::kMul)) << text_;
+    EXPECT_EQ(0, Count(graph, NValue::kAdd)) << text_;
+    EXPECT_EQ(1, Count(graph, NValue::kConstant)) << text_;
+
+    auto store = NStore::cast(graph->block(1)->control()->prev());
+    ASSERT_NE(nullptr, store) << text_;
+    ASSERT_NE(nullptr, NConstant::cast(store->value()));
+    EXPECT_EQ(43, NConstant::cast(store->value())->i64_value());
+}
+
+TEST_F(NPassesTest, BranchFolding) {
+    builder_->frame(16, 0, 0);            // [0]
+    builder_->load_i32_imm(0, 1);         // [1]
+    builder_->load_i32_imm(4, 2);         // [2]
+    builder_->cmp_i32(CC_LT, 8, 0, 4);    // [3] always true
+    builder_->jz(1, 8, 3);                // [4]
+    builder_->mov_4b(-4, 0);              // [5]
+    builder_->ret();                      // [6]
+    builder_->mov_4b(-4, 4);              // [7]
+    builder_->ret();                      // [8]
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+    EXPECT_EQ(0, Count(graph, NValue::kBranch)) << text_;
+    EXPECT_EQ(1, Count(graph, NValue::kReturn)) << text_;
+    EXPECT_EQ(0, Count(graph, NValue::kCompare)) << text_;
+}
+
+TEST_F(NPassesTest, ValueNumbering) {
+    builder_->frame(32, 0, 0);            // [0]
+    builder_->add_i64(16, 0, 8);          // [1] a + b
+    builder_->add_i64(24, 8, 0);          // [2] b + a
+    builder_->mul_i64(16, 16, 24);        // [3]
+    builder_->sub_i64(24, 0, 8);          // [4] dead
+    builder_->mov_8b(-8, 16);             // [5]
+    builder_->ret();                      // [6]
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+    EXPECT_EQ(1, Count(graph, NValue::kAdd)) << text_;
+    EXPECT_EQ(1, Count(graph, NValue::kMul)) << text_;
+    EXPECT_EQ(0, Count(graph, NValue::kSub)) << text_;
+    EXPECT_EQ(2, Count(graph, NValue::kParameter)) << text_;
+}
+
+TEST_F(NPassesTest, LoopInvariantPhis) {
+    builder_->frame(24, 0, 0);            // [0]
+    builder_->load_i32_imm(0, 0);         // [1] i = 0
+    builder_->load_i32_imm(8, 1);         // [2] never changed in loop
+    builder_->load_i32_imm(12, 100);      // [3]
+    builder_->cmp_i32(CC_LT, 16, 0, 12);  // [4]
+    builder_->jz(2, 16, 3);               // [5]
+    builder_->add_i32(0, 0, 8);           // [6] i += 1
+    builder_->jmp(-3);                    // [7]
+    builder_->mov_4b(-4, 0);              // [8]
+    builder_->ret();                      // [9]
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+    int phis = 0;
+    for (int i = 0; i < graph->block_size(); ++i) {
+        phis += graph->block(i)->phi_size();
+    }
+    // Only i is a real phi.
+    EXPECT_EQ(1, phis) << text_;
+    EXPECT_EQ(1, Count(graph, NValue::kBranch)) << text_;
+}
+
+TEST_F(NPassesTest, OnStackReplacementPhis) {
+    builder_->frame(24, 0, 0);            // [0]
+    builder_->load_i32_imm(0, 0);         // [1] i = 0
+    builder_->load_i32_imm(8, 1);         // [2] never changed in loop
+    builder_->load_i32_imm(12, 100);      // [3]
+    builder_->loop_entry(1, 0);           // [4]
+    builder_->cmp_i32(CC_LT, 16, 0, 12);  // [5]
+    builder_->jz(2, 16, 3);               // [6]
+    builder_->add_i32(0, 0, 8);           // [7] i += 1
+    builder_->jmp(-4);                    // [8]
+    builder_->mov_4b(-4, 0);              // [9]
+    builder_->ret();                      // [10]
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+    int phis = 0;
+    for (int i = 0; i < graph->block_size(); ++i) {
+        phis += graph->block(i)->phi_size();
+    }
+    // Invariants may come from interpreter when entering at loop_entry.
+    EXPECT_EQ(3, phis) << text_;
+    EXPECT_EQ(1, Count(graph, NValue::kBranch)) << text_;
+}
+
+} // namespace mio
@@ -0,0 +1,535 @@
+#include "nyaa-passes.h"
+#include "nyaa-value-factory.h"
+#include "nyaa.h"
+#include "vm-bitcode.h"
+#include <unordered_map>
+#include <float.h>
+#include <math.h>
+
+namespace mio {
+
+namespace {
+
+int64_t Truncate(int64_t value, NType type) {
+    switch (type.bytes()) {
+        case 1:
+            return static_cast<int8_t>(value);
+        case 2:
+            return static_cast<int16_t>(value);
+        case 4:
+            return static_cast<int32_t>(value);
+        default:
+            return value;
+    }
+}
+
+inline uint64_t U(int64_t value) { return static_cast<uint64_t>(value); }
+
+/**
+ * Fold integral binary operation, same as interpreter does.
+ *
+ * @return false if it can not be folded, e.g. dividing by zero.
+ */
+bool FoldIntegral(NValue::Opcode op, NType type, int64_t lhs, int64_t rhs,
+                  int64_t *result) {
+    auto bits = type.bytes() * 8;
+    switch (op) {
+        case NValue::kAdd:
+            *result = static_cast<int64_t>(U(lhs) + U(rhs));
+            break;
+        case NValue::kSub:
+            *result = static_cast<int64_t>(U(lhs) - U(rhs));
+            break;
+        case NValue::kMul:
+            *result = static_cast<int64_t>(U(lhs) * U(rhs));
+            break;
+        case NValue::kDiv:
+            if (rhs == 0 || rhs == -1) {
+                return false;
+            }
+            *result = lhs / rhs;
+            break;
+        case NValue::kMod:
+            if (rhs == 0 || rhs == -1) {
+                return false;
+            }
+            *result = lhs % rhs;
+            break;
+        case NValue::kAnd:
+            *result = lhs & rhs;
+            break;
+        case NValue::kOr:
+            *result = lhs | rhs;
+            break;
+        case NValue::kXor:
+            *result = lhs ^ rhs;
+            break;
+        case NValue::kShl:
+            if (rhs < 0 || rhs >= bits) {
+                return false;
+            }
+            *result = static_cast<int64_t>(U(lhs) << rhs);
+            break;
+        case NValue::kShr:
+            if (rhs < 0 || rhs >= bits) {
+                return false;
+            }
+            *result = lhs >> rhs;
+            break;
+        case NValue::kUShr:
+            if (rhs < 0 || rhs >= bits) {
+                return false;
+            }
+            *result = lhs >> rhs;
+            if (lhs < 0) {
+                *result &= ~(1LL << (bits - 1));
+            }
+            break;
+        default:
+            return false;
+    }
+    *result = Truncate(*result, type);
+    return true;
+}
+
+bool FoldFloating(NValue::Opcode op, NType type, double lhs, double rhs,
+                  double *result) {
+    switch (op) {
+        case NValue::kAdd:
+            *result = lhs + rhs;
+            break;
+        case NValue::kSub:
+            *result = lhs - rhs;
+            break;
+        case NValue::kMul:
+            *result = lhs * rhs;
+            break;
+        case NValue::kDiv:
+            *result = lhs / rhs;
+            break;
+        default:
+            return false;
+    }
+    if (type == NType::Float32()) {
+        *result = static_cast<float>(*result);
+    }
+    return true;
+}
+
+template<class T>
+bool Compare(int condition, T lhs, T rhs) {
+    switch (condition) {
+    #define DEFINE_CASE(name, op) \
+        case CC_##name: \
+            return lhs op rhs;
+        VM_COMPARATOR(DEFINE_CASE)
+    #undef DEFINE_CASE
+        default:
+            break;
+    }
+    DLOG(FATAL) << "noreached! bad condition: " << condition;
+    return false;
+}
+
+// Floating equals use epsilon, same as interpreter does.
+bool CompareFloating(int condition, NType type, double lhs, double rhs) {
+    auto epsilon = type == NType::Float32() ? FLT_EPSILON : DBL_EPSILON;
+    switch (condition) {
+        case CC_EQ:
+            return ::fabs(lhs - rhs) < epsilon;
+        case CC_NE:
+            return ::fabs(lhs - rhs) >= epsilon;
+        default:
+            return Compare(condition, lhs, rhs);
+    }
+}
+
+NConstant *Fold(NInstruction *instruction, NValueFactory *factory) {
+    // Values of frame state are not inputs of computing.
+    auto n = instruction->operand_size() - instruction->frame_state_size();
+    for (int i = 0; i < n; ++i) {
+        if (!NConstant::cast(instruction->operand(i))) {
+            return nullptr;
+        }
+    }
+    auto type = instruction->type();
+    switch (instruction->opcode()) {
+    #define DEFINE_CASE(name) case NValue::k##name:
+        NYAA_BINARY_OPS(DEFINE_CASE)
+    #undef DEFINE_CASE
+        {
+            auto lhs = NConstant::cast(instruction->operand(0));
+            auto rhs = NConstant::cast(instruction->operand(1));
+            if (type.is_floating()) {
+                double result;
+                if (FoldFloating(instruction->opcode(), type, lhs->f64_value(),
+                                 rhs->f64_value(), &result)) {
+                    return factory->CreateConstantFloat(type, result);
+                }
+            } else {
+                int64_t result;
+                if (FoldIntegral(instruction->opcode(), type, lhs->i64_value(),
+                                 rhs->i64_value(), &result)) {
+                    return factory->CreateConstant(type, result);
+                }
+            }
+        } break;
+
+        case NValue::kInv: {
+            auto value = NConstant::cast(instruction->operand(0));
+            return factory->CreateConstant(type, Truncate(~value->i64_value(), type));
+        } break;
+
+        case NValue::kNot: {
+            auto value = NConstant::cast(instruction->operand(0));
+            return factory->CreateConstant(type, value->i64_value() == 0 ? 1 : 0);
+        } break;
+
+        case NValue::kCompare: {
+            auto cmp = NCompare::cast(instruction);
+            auto lhs = NConstant::cast(cmp->lhs());
+            auto rhs = NConstant::cast(cmp->rhs());
+            bool result;
+            if (lhs->type().is_floating()) {
+                result = CompareFloating(cmp->condition(), lhs->type(),
+                                         lhs->f64_value(), rhs->f64_value());
+            } else {
+                result = Compare(cmp->condition(), lhs->i64_value(),
+                                 rhs->i64_value());
+            }
+            return factory->CreateConstant(type, result ? 1 : 0);
+        } break;
+
+        default:
+            break;
+    }
+    return nullptr;
+}
+
+struct ValueKey {
+    int     opcode;
+    int     type;
+    int64_t extra;
+    int     lhs;
+    int     rhs;
+
+    bool operator == (const ValueKey &other) const {
+        return opcode == other.opcode && type == other.type &&
+               extra == other.extra && lhs == other.lhs && rhs == other.rhs;
+    }
+};
+
+struct ValueKeyHash {
+    std::size_t operator () (const ValueKey &key) const {
+        std::size_t h = std::hash<int64_t>()(key.extra);
+        h = h * 31 + key.opcode;
+        h = h * 31 + key.type;
+        h = h * 31 + key.lhs;
+        h = h * 31 + key.rhs;
+        return h;
+    }
+};
+
+/**
+ * @return false if value can not be numbered, e.g. phi and side effects.
+ */
+bool MakeValueKey(NInstruction *instruction, ValueKey *key) {
+    key->opcode = instruction->opcode();
+    key->type   = instruction->type().kind();
+    key->extra  = 0;
+    key->lhs    = -1;
+    key->rhs    = -1;
+    switch (instruction->opcode()) {
+        case NValue::kConstant:
+            key->extra = NConstant::cast(instruction)->i64_value();
+            return true;
+        case NValue::kParameter:
+            key->extra = NParameter::cast(instruction)->offset();
+            return true;
+        case NValue::kCompare:
+            key->extra = NCompare::cast(instruction)->condition();
+            break;
+        case NValue::kStore:
+        case NValue::kBranch:
+        case NValue::kJump:
+        case NValue::kReturn:
+        case NValue::kEntry:
+        case NValue::kDeoptimize:
+            return false;
+        default:
+            break;
+    }
+    if (instruction->operand_size() > 0) {
+        key->lhs = instruction->operand(0)->id();
+    }
+    if (instruction->operand_size() > 1) {
+        key->rhs = instruction->operand(1)->id();
+    }
+    switch (instruction->opcode()) {
+        case NValue::kAdd:
+        case NValue::kMul:
+        case NValue::kAnd:
+        case NValue::kOr:
+        case NValue::kXor:
+            if (key->lhs > key->rhs) {
+                std::swap(key->lhs, key->rhs);
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/**
+ * Immediate dominators by Cooper, Harvey and Kennedy's algorithm.
+ */
+void ComputeDominators(const std::vector<NBasicBlock *> &rpo,
+                       std::unordered_map<NBasicBlock *, NBasicBlock *> *idom) {
+    std::unordered_map<NBasicBlock *, int> order;
+    for (int i = 0; i < static_cast<int>(rpo.size()); ++i) {
+        order[rpo[i]] = i;
+    }
+    auto intersect = [&](NBasicBlock *a, NBasicBlock *b) {
+        while (a != b) {
+            while (order[a] > order[b]) {
+                a = (*idom)[a];
+            }
+            while (order[b] > order[a]) {
+                b = (*idom)[b];
+            }
+        }
+        return a;
+    };
+
+    (*idom)[rpo[0]] = rpo[0];
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); ++i) {
+            auto block = rpo[i];
+            NBasicBlock *new_idom = nullptr;
+            for (int j = 0; j < block->prev_block_size(); ++j) {
+                auto prev = block->prev_block(j);
+                if (idom->find(prev) == idom->end()) {
+                    continue;
+                }
+                new_idom = new_idom ? intersect(prev, new_idom) : prev;
+            }
+            auto iter = idom->find(block);
+            if (iter == idom->end() || iter->second != new_idom) {
+                (*idom)[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+} // namespace
+
+void NPassManager::AddDefaultPasses() {
+    AddPass(new NConstantFolding());
+    AddPass(new NCopyPropagation());
+    AddPass(new NGlobalValueNumbering());
+    AddPass(new NDeadCodeElimination());
+}
+
+int NPassManager::Run(NGraph *graph) {
+    int rounds = 0;
+    bool changed = true;
+    while (changed && rounds < max_rounds_) {
+        changed = false;
+        for (const auto &pass : passes_) {
+            changed = pass->Run(graph, factory_) || changed;
+        }
+        ++rounds;
+    }
+    return rounds;
+}
+
+bool NConstantFolding::Run(NGraph *graph, NValueFactory *factory) {
+    bool changed = false;
+    for (int i = 0; i < graph->block_size(); ++i) {
+        auto block = graph->block(i);
+        auto instruction = block->first();
+        while (instruction) {
+            auto next = instruction->next();
+            auto constant = Fold(instruction, factory);
+            if (constant) {
+                constant->set_position(instruction->position());
+                block->InsertBefore(instruction, constant);
+                graph->ReplaceAllUses(instruction, constant);
+                block->RemoveInstruction(instruction);
+                changed = true;
+            }
+            instruction = next;
+        }
+
+        auto branch = block->control() ? NBranch::cast(block->control()) : nullptr;
+        if (!branch || !NConstant::cast(branch->condition())) {
+            continue;
+        }
+        auto taken = NConstant::cast(branch->condition())->i64_value() != 0;
+        auto target = taken ? branch->true_target() : branch->false_target();
+        auto other  = taken ? branch->false_target() : branch->true_target();
+        auto jump = factory->CreateJump(target);
+        jump->set_position(branch->position());
+        block->RemoveInstruction(branch);
+        block->AddInstruction(jump);
+        graph->RemoveEdge(block, other);
+        changed = true;
+    }
+    if (changed) {
+        graph->RemoveUnreachableBlocks();
+    }
+    return changed;
+}
+
+bool NCopyPropagation::Run(NGraph *graph, NValueFactory */*factory*/) {
+    bool changed = false;
+    bool again = true;
+    while (again) {
+        again = false;
+        for (int i = 0; i < graph->block_size(); ++i) {
+            auto block = graph->block(i);
+            for (int j = 0; j < block->phi_size(); ++j) {
+                auto phi = block->phi(j);
+                NValue *same = nullptr;
+                bool trivial = true;
+                for (int k = 0; k < phi->input_size(); ++k) {
+                    auto input = phi->input(k);
+                    if (input == phi || input == same) {
+                        continue;
+                    }
+                    if (same) {
+                        trivial = false;
+                        break;
+                    }
+                    same = input;
+                }
+                if (!trivial || !same) {
+                    continue;
+                }
+                graph->ReplaceAllUses(phi, same);
+                block->RemovePhi(j--);
+                again = true;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+bool NDeadCodeElimination::Run(NGraph *graph, NValueFactory */*factory*/) {
+    bool changed = graph->RemoveUnreachableBlocks();
+
+    std::unordered_map<NValue *, bool> live;
+    std::vector<NValue *> worklist;
+    for (int i = 0; i < graph->block_size(); ++i) {
+        auto block = graph->block(i);
+        for (auto instruction = block->first(); instruction;
+             instruction = instruction->next()) {
+            if (instruction->has_side_effect()) {
+                live[instruction] = true;
+                worklist.push_back(instruction);
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        auto value = worklist.back();
+        worklist.pop_back();
+        for (int i = 0; i < value->operand_size(); ++i) {
+            auto operand = value->operand(i);
+            if (!live[operand]) {
+                live[operand] = true;
+                worklist.push_back(operand);
+            }
+        }
+    }
+
+    for (int i = 0; i < graph->block_size(); ++i) {
+        auto block = graph->block(i);
+        for (int j = 0; j < block->phi_size(); ++j) {
+            if (!live[block->phi(j)]) {
+                block->RemovePhi(j--);
+                changed = true;
+            }
+        }
+        auto instruction = block->first();
+        while (instruction) {
+            auto next = instruction->next();
+            if (!live[instruction]) {
+                block->RemoveInstruction(instruction);
+                changed = true;
+            }
+            instruction = next;
+        }
+    }
+    return changed;
+}
+
+bool NGlobalValueNumbering::Run(NGraph *graph, NValueFactory */*factory*/) {
+    std::vector<NBasicBlock *> rpo;
+    graph->GetReversePostOrder(&rpo);
+    if (rpo.empty()) {
+        return false;
+    }
+
+    std::unordered_map<NBasicBlock *, NBasicBlock *> idom;
+    ComputeDominators(rpo, &idom);
+    std::unordered_map<NBasicBlock *, std::vector<NBasicBlock *>> children;
+    for (size_t i = 1; i < rpo.size(); ++i) {
+        children[idom[rpo[i]]].push_back(rpo[i]);
+    }
+
+    // Walk the dominator tree, values of dominators are visible in scope.
+    bool changed = false;
+    std::unordered_map<ValueKey, NValue *, ValueKeyHash> table;
+    struct Scope {
+        NBasicBlock *block;
+        size_t       next_child;
+        std::vector<ValueKey> keys;
+    };
+    std::vector<Scope> stack;
+    stack.push_back({rpo[0], 0, {}});
+    bool enter = true;
+    while (!stack.empty()) {
+        auto scope = &stack.back();
+        if (enter) {
+            auto block = scope->block;
+            auto instruction = block->first();
+            while (instruction) {
+                auto next = instruction->next();
+                ValueKey key;
+                if (MakeValueKey(instruction, &key)) {
+                    auto iter = table.find(key);
+                    if (iter != table.end()) {
+                        graph->ReplaceAllUses(instruction, iter->second);
+                        block->RemoveInstruction(instruction);
+                        changed = true;
+                    } else {
+                        table.emplace(key, instruction);
+                        scope->keys.push_back(key);
+                    }
+                }
+                instruction = next;
+            }
+        }
+
+        const auto &kids = children[scope->block];
+        if (scope->next_child < kids.size()) {
+            auto child = kids[scope->next_child++];
+            stack.push_back({child, 0, {}});
+            enter = true;
+        } else {
+            for (const auto &key : scope->keys) {
+                table.erase(key);
+            }
+            stack.pop_back();
+            enter = false;
+        }
+    }
+    return changed;
+}
+
+} // namespace mio
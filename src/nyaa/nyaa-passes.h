@@ -0,0 +1,91 @@
+#ifndef MIO_NYAA_PASSES_H_
+#define MIO_NYAA_PASSES_H_
+
+#include "base.h"
+#include "glog/logging.h"
+#include <memory>
+#include <vector>
+
+namespace mio {
+
+class NGraph;
+class NValueFactory;
+
+/**
+ * A transforming of Nyaa SSA graph.
+ */
+class NPass {
+public:
+    NPass() = default;
+    virtual ~NPass() = default;
+
+    virtual const char *name() const = 0;
+
+    /**
+     * @return true if graph was changed.
+     */
+    virtual bool Run(NGraph *graph, NValueFactory *factory) = 0;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NPass)
+}; // class NPass
+
+
+/**
+ * Run passes in order, again and again until graph becomes stable.
+ */
+class NPassManager {
+public:
+    NPassManager(NValueFactory *factory, int max_rounds = 8)
+        : factory_(DCHECK_NOTNULL(factory))
+        , max_rounds_(max_rounds) {}
+
+    /**
+     * Constant folding, copy propagation, global value numbering and dead code
+     * elimination.
+     */
+    void AddDefaultPasses();
+
+    void AddPass(NPass *pass) { passes_.emplace_back(pass); }
+
+    int pass_size() const { return static_cast<int>(passes_.size()); }
+
+    /**
+     * @return rounds of running.
+     */
+    int Run(NGraph *graph);
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NPassManager)
+private:
+    NValueFactory *factory_;
+    int max_rounds_;
+    std::vector<std::unique_ptr<NPass>> passes_;
+}; // class NPassManager
+
+
+#define DECLARE_NYAA_PASS(clazz, text) \
+    class N##clazz : public NPass { \
+    public: \
+        N##clazz() = default; \
+        virtual const char *name() const override { return text; } \
+        virtual bool Run(NGraph *graph, NValueFactory *factory) override; \
+        DISALLOW_IMPLICIT_CONSTRUCTORS(N##clazz) \
+    };
+
+// Fold instructions with constant operands, and branches with constant
+// condition.
+DECLARE_NYAA_PASS(ConstantFolding, "constant-folding")
+
+// Replace phis whose inputs are all the same value.
+DECLARE_NYAA_PASS(CopyPropagation, "copy-propagation")
+
+// Remove unreachable blocks, and values not used by any side effect.
+DECLARE_NYAA_PASS(DeadCodeElimination, "dead-code-elimination")
+
+// Replace values computed by the same way in a dominator.
+DECLARE_NYAA_PASS(GlobalValueNumbering, "global-value-numbering")
+
+#undef DECLARE_NYAA_PASS
+
+} // namespace mio
+
+#endif // MIO_NYAA_PASSES_H_
@@ -0,0 +1,172 @@
+#include "nyaa-register-allocator.h"
+#include "nyaa-graph-builder.h"
+#include "nyaa-passes.h"
+#include "nyaa.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+class NRegisterAllocatorTest : public ::testing::Test {
+public:
+    virtual void SetUp() override {
+        zone_ = new Zone();
+        code_ = new MemorySegment();
+        builder_ = new BitCodeBuilder(code_);
+    }
+
+    virtual void TearDown() override {
+        delete builder_;
+        delete code_;
+        delete zone_;
+    }
+
+    NGraph *BuildAndOptimize() {
+        NGraphBuilder builder(zone_, static_cast<uint64_t *>(code_->offset(0)),
+                              builder_->pc(), nullptr, 0);
+        auto graph = builder.Build();
+        if (!graph) {
+            return nullptr;
+        }
+        NPassManager passes(builder.factory());
+        passes.AddDefaultPasses();
+        passes.Run(graph);
+        return graph;
+    }
+
+    static NValue *Find(NGraph *graph, NValue::Opcode opcode) {
+        for (int i = 0; i < graph->block_size(); ++i) {
+            auto block = graph->block(i);
+            for (int j = 0; j < block->phi_size(); ++j) {
+                if (block->phi(j)->opcode() == opcode) {
+                    return block->phi(j);
+                }
+            }
+            for (auto ins = graph->block(i)->first(); ins; ins = ins->next()) {
+                if (ins->opcode() == opcode) {
+                    return ins;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void EmitLoop() {
+        builder_->frame(24, 0, 0);              // [0]
+        builder_->load_i32_imm(0, 0);           // [1] i = 0
+        builder_->load_i32_imm(4, 0);           // [2] sum = 0
+        builder_->load_i32_imm(12, 100);        // [3]
+        builder_->cmp_i32(CC_LT, 16, 0, 12);    // [4] i < 100
+        builder_->jz(0, 16, 4);                 // [5]
+        builder_->add_i32(4, 4, 0);             // [6] sum += i
+        builder_->add_i32_imm(0, 0, 1);         // [7] i += 1
+        builder_->jmp(-4);                      // [8]
+        builder_->mov_4b(-4, 4);                // [9]
+        builder_->ret();                        // [10]
+    }
+
+protected:
+    Zone *zone_ = nullptr;
+    MemorySegment *code_ = nullptr;
+    BitCodeBuilder *builder_ = nullptr;
+};
+
+TEST_F(NRegisterAllocatorTest, LoopCarriedIntervals) {
+    EmitLoop();
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+
+    NRegisterAllocator allocator(graph, {1, 2, 3, 4}, {1, 2});
+    ASSERT_TRUE(allocator.Run());
+    EXPECT_EQ(graph->entry(), allocator.blocks()[0]);
+    EXPECT_EQ(0, allocator.spilled_size());
+
+    auto phi = Find(graph, NValue::kPhi);
+    ASSERT_NE(nullptr, phi);
+    EXPECT_EQ(NLocation::kRegister, allocator.location(phi).kind);
+
+    // The phi is live across the whole loop, includes the back-edge.
+    auto add = Find(graph, NValue::kAdd);
+    ASSERT_NE(nullptr, add);
+    EXPECT_LE(allocator.interval_start(phi), allocator.position(add));
+    EXPECT_GE(allocator.interval_end(phi), allocator.position(add));
+
+    for (auto block : allocator.blocks()) {
+        EXPECT_LE(allocator.block_from(block), allocator.block_to(block));
+    }
+
+    auto constant = Find(graph, NValue::kConstant);
+    ASSERT_NE(nullptr, constant);
+    EXPECT_EQ(NLocation::kConstant, allocator.location(constant).kind);
+}
+
+TEST_F(NRegisterAllocatorTest, SpillToSlot) {
+    EmitLoop();
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+
+    // Only two registers: something must live in its own slot.
+    NRegisterAllocator allocator(graph, {1, 2}, {1});
+    ASSERT_TRUE(allocator.Run());
+    EXPECT_LT(0, allocator.spilled_size());
+
+    int registers = 0, slots = 0;
+    for (int i = 0; i < graph->block_size(); ++i) {
+        auto block = graph->block(i);
+        for (int j = 0; j < block->phi_size(); ++j) {
+            auto phi = block->phi(j);
+            auto location = allocator.location(phi);
+            if (location.kind == NLocation::kSlot) {
+                EXPECT_EQ(phi->slot(), location.index);
+                ++slots;
+            } else if (location.kind == NLocation::kRegister) {
+                EXPECT_TRUE(location.index == 1 || location.index == 2);
+                ++registers;
+            }
+        }
+    }
+    EXPECT_LE(1, registers);
+    EXPECT_LE(1, slots);
+}
+
+TEST_F(NRegisterAllocatorTest, SlotConflict) {
+    builder_->frame(24, 0, 0);              // [0]
+    builder_->load_i32_imm(0, 0);           // [1] i = 0
+    builder_->load_i32_imm(4, 0);           // [2] sum = 0
+    builder_->load_i32_imm(12, 100);        // [3]
+    builder_->cmp_i32(CC_LT, 16, 0, 12);    // [4] i < 100
+    builder_->jz(0, 16, 5);                 // [5]
+    builder_->mov_4b(20, 0);                // [6] old = i
+    builder_->add_i32_imm(0, 0, 1);         // [7] i += 1
+    builder_->add_i32(4, 4, 20);            // [8] sum += old
+    builder_->jmp(-5);                      // [9]
+    builder_->mov_4b(-4, 4);                // [10]
+    builder_->ret();                        // [11]
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+
+    NRegisterAllocator enough(graph, {1, 2, 3, 4}, {1, 2});
+    EXPECT_TRUE(enough.Run());
+
+    // Old i is still live after i + 1 was written to the same slot.
+    NRegisterAllocator none(graph, {}, {});
+    EXPECT_FALSE(none.Run());
+}
+
+TEST_F(NRegisterAllocatorTest, PhiSharesSlotWithInput) {
+    EmitLoop();
+
+    auto graph = BuildAndOptimize();
+    ASSERT_NE(nullptr, graph);
+
+    // i and i + 1 are both spilled to [0], but never interfere.
+    NRegisterAllocator allocator(graph, {}, {});
+    EXPECT_TRUE(allocator.Run());
+}
+
+} // namespace mio
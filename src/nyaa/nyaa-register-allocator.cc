@@ -0,0 +1,334 @@
+#include "nyaa-register-allocator.h"
+#include "nyaa-instructions.h"
+#include "nyaa.h"
+#include <algorithm>
+#include <limits>
+
+namespace mio {
+
+namespace {
+
+inline bool IsAllocatable(NValue *value) {
+    return value->opcode() != NValue::kConstant &&
+           value->type() != NType::Void();
+}
+
+void Union(std::vector<bool> *lhs, const std::vector<bool> &rhs) {
+    for (size_t i = 0; i < rhs.size(); ++i) {
+        if (rhs[i]) {
+            (*lhs)[i] = true;
+        }
+    }
+}
+
+} // namespace
+
+bool NRegisterAllocator::Run() {
+    graph_->GetReversePostOrder(&blocks_);
+    NumberInstructions();
+    ComputeLiveness();
+    BuildIntervals();
+    LinearScan(false);
+    LinearScan(true);
+    return AssignSpillSlots();
+}
+
+NLocation NRegisterAllocator::location(NValue *value) const {
+    if (value->opcode() == NValue::kConstant) {
+        return NLocation::Constant();
+    }
+    return interval_of(value).location;
+}
+
+int NRegisterAllocator::position(NValue *value) const {
+    DCHECK_LT(value->id(), static_cast<int>(positions_.size()));
+    return positions_[value->id()];
+}
+
+int NRegisterAllocator::block_from(NBasicBlock *block) const {
+    return block_from_[block->id()];
+}
+
+int NRegisterAllocator::block_to(NBasicBlock *block) const {
+    return block_to_[block->id()];
+}
+
+int NRegisterAllocator::interval_start(NValue *value) const {
+    return interval_of(value).start;
+}
+
+int NRegisterAllocator::interval_end(NValue *value) const {
+    return interval_of(value).end;
+}
+
+void NRegisterAllocator::NumberInstructions() {
+    int max_block_id = 0, max_value_id = 0;
+    for (auto block : blocks_) {
+        max_block_id = std::max(max_block_id, block->id());
+        for (int i = 0; i < block->phi_size(); ++i) {
+            max_value_id = std::max(max_value_id, block->phi(i)->id());
+        }
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            max_value_id = std::max(max_value_id, ins->id());
+        }
+    }
+    block_from_.assign(max_block_id + 1, -1);
+    block_to_.assign(max_block_id + 1, -1);
+    values_.assign(max_value_id + 1, nullptr);
+    positions_.assign(max_value_id + 1, -1);
+
+    // Even positions for instructions, so everything can be inserted between
+    // them later.
+    int position = 0;
+    for (auto block : blocks_) {
+        block_from_[block->id()] = position;
+        for (int i = 0; i < block->phi_size(); ++i) {
+            auto phi = block->phi(i);
+            values_[phi->id()] = phi;
+            positions_[phi->id()] = position;
+        }
+        position += 2;
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            values_[ins->id()] = ins;
+            positions_[ins->id()] = position;
+            position += 2;
+        }
+        block_to_[block->id()] = position;
+    }
+}
+
+void NRegisterAllocator::ComputeLiveness() {
+    auto n = values_.size();
+    live_in_.assign(block_from_.size(), std::vector<bool>(n, false));
+    live_out_.assign(block_from_.size(), std::vector<bool>(n, false));
+
+    auto changed = true;
+    while (changed) {
+        changed = false;
+        for (auto iter = blocks_.rbegin(); iter != blocks_.rend(); ++iter) {
+            auto block = *iter;
+            std::vector<bool> live(n, false);
+            for (int i = 0; i < block->next_block_size(); ++i) {
+                auto succ = block->next_block(i);
+                Union(&live, live_in_[succ->id()]);
+
+                // Inputs of phis are used at end of predecessor.
+                auto index = succ->IndexOfPrevBlock(block);
+                DCHECK_GE(index, 0);
+                for (int j = 0; j < succ->phi_size(); ++j) {
+                    auto input = succ->phi(j)->input(index);
+                    if (IsAllocatable(input)) {
+                        live[input->id()] = true;
+                    }
+                }
+            }
+            live_out_[block->id()] = live;
+
+            for (auto ins = block->last(); ins; ins = ins->prev()) {
+                live[ins->id()] = false;
+                for (int i = 0; i < ins->operand_size(); ++i) {
+                    auto input = ins->operand(i);
+                    if (IsAllocatable(input)) {
+                        live[input->id()] = true;
+                    }
+                }
+            }
+            for (int i = 0; i < block->phi_size(); ++i) {
+                live[block->phi(i)->id()] = false;
+            }
+            if (live != live_in_[block->id()]) {
+                live_in_[block->id()] = std::move(live);
+                changed = true;
+            }
+        }
+    }
+}
+
+void NRegisterAllocator::BuildIntervals() {
+    intervals_.resize(values_.size());
+    for (size_t i = 0; i < values_.size(); ++i) {
+        intervals_[i].value    = values_[i];
+        intervals_[i].start    = std::numeric_limits<int>::max();
+        intervals_[i].end      = -1;
+        intervals_[i].location = NLocation::None();
+    }
+
+    for (auto block : blocks_) {
+        auto from = block_from(block), to = block_to(block);
+        const auto &live_in  = live_in_[block->id()];
+        const auto &live_out = live_out_[block->id()];
+        for (size_t i = 0; i < values_.size(); ++i) {
+            if (live_in[i]) {
+                Cover(values_[i], from);
+            }
+            if (live_out[i]) {
+                Cover(values_[i], to);
+            }
+        }
+
+        // Phis are written by moves at end of predecessors.
+        for (int i = 0; i < block->phi_size(); ++i) {
+            auto phi = block->phi(i);
+            Cover(phi, from);
+            for (int j = 0; j < block->prev_block_size(); ++j) {
+                auto prev = block->prev_block(j);
+                if (block_to_[prev->id()] >= 0) {
+                    Cover(phi, block_to(prev));
+                }
+            }
+        }
+
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            auto position = positions_[ins->id()];
+            if (IsAllocatable(ins)) {
+                Cover(ins, position);
+            }
+            for (int i = 0; i < ins->operand_size(); ++i) {
+                if (IsAllocatable(ins->operand(i))) {
+                    Cover(ins->operand(i), position);
+                }
+            }
+        }
+    }
+}
+
+void NRegisterAllocator::LinearScan(bool floating) {
+    std::vector<Interval *> unhandled;
+    for (auto &interval : intervals_) {
+        if (interval.value && interval.start <= interval.end &&
+            interval.value->type().is_floating() == floating) {
+            unhandled.push_back(&interval);
+        }
+    }
+    std::stable_sort(unhandled.begin(), unhandled.end(),
+                     [](const Interval *a, const Interval *b) {
+                         return a->start < b->start;
+                     });
+
+    auto kind = floating ? NLocation::kXmm : NLocation::kRegister;
+    const auto &regs = floating ? xmm_regs_ : gp_regs_;
+    std::vector<int> free_regs(regs.rbegin(), regs.rend());
+    std::vector<Interval *> active;
+    for (auto current : unhandled) {
+        // Expire intervals end before current one, their registers are free.
+        for (auto iter = active.begin(); iter != active.end();) {
+            if ((*iter)->end < current->start) {
+                free_regs.push_back((*iter)->location.index);
+                iter = active.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+
+        if (!free_regs.empty()) {
+            current->location = {kind, free_regs.back()};
+            free_regs.pop_back();
+            active.push_back(current);
+            continue;
+        }
+
+        // Spill the one ends furthest.
+        auto spill = active.end();
+        for (auto iter = active.begin(); iter != active.end(); ++iter) {
+            if (spill == active.end() || (*iter)->end > (*spill)->end) {
+                spill = iter;
+            }
+        }
+        if (spill != active.end() && (*spill)->end > current->end) {
+            current->location = (*spill)->location;
+            (*spill)->location = {NLocation::kSlot, 0};
+            *spill = current;
+        } else {
+            current->location = {NLocation::kSlot, 0};
+        }
+    }
+}
+
+bool NRegisterAllocator::AssignSpillSlots() {
+    std::vector<Interval *> spilled;
+    for (auto &interval : intervals_) {
+        if (interval.location.kind != NLocation::kSlot) {
+            continue;
+        }
+        if (interval.value->slot() == NValue::kNoSlot) {
+            return false;
+        }
+        interval.location.index = interval.value->slot();
+        spilled.push_back(&interval);
+    }
+    spilled_size_ = static_cast<int>(spilled.size());
+
+    std::sort(spilled.begin(), spilled.end(),
+              [](const Interval *a, const Interval *b) {
+                  return a->location.index < b->location.index ||
+                         (a->location.index == b->location.index &&
+                          a->start < b->start);
+              });
+    // Intervals are hulls and too coarse for this: a phi and the value flows
+    // into it at the back-edge always overlap, but never interfere.
+    for (size_t i = 0; i < spilled.size(); ++i) {
+        for (size_t j = i + 1; j < spilled.size(); ++j) {
+            auto a = spilled[i], b = spilled[j];
+            if (a->location.index != b->location.index) {
+                break;
+            }
+            if (a->end >= b->start && (IsLiveAfter(a->value, b->value) ||
+                                       IsLiveAfter(b->value, a->value))) {
+                return false;
+            }
+        }
+    }
+    // Stores overwrite slots too.
+    for (auto block : blocks_) {
+        for (auto ins = block->first(); ins; ins = ins->next()) {
+            auto store = NStore::cast(ins);
+            if (!store) {
+                continue;
+            }
+            for (auto interval : spilled) {
+                if (interval->location.index == store->offset() &&
+                    interval->value != store->value() &&
+                    IsLiveAfter(interval->value, store)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool NRegisterAllocator::IsLiveAfter(NValue *value, NValue *def) const {
+    auto block = DCHECK_NOTNULL(def->block());
+    if (def->opcode() == NValue::kPhi) {
+        // Phis of the same block are defined at the same time.
+        return live_in_[block->id()][value->id()] ||
+               (value->opcode() == NValue::kPhi && value->block() == block);
+    }
+
+    std::vector<bool> live(live_out_[block->id()]);
+    for (auto ins = block->last(); ins && ins != def; ins = ins->prev()) {
+        live[ins->id()] = false;
+        for (int i = 0; i < ins->operand_size(); ++i) {
+            auto input = ins->operand(i);
+            if (IsAllocatable(input)) {
+                live[input->id()] = true;
+            }
+        }
+    }
+    return live[value->id()];
+}
+
+void NRegisterAllocator::Cover(NValue *value, int position) {
+    DCHECK_LT(value->id(), static_cast<int>(intervals_.size()));
+    auto interval = &intervals_[value->id()];
+    interval->start = std::min(interval->start, position);
+    interval->end   = std::max(interval->end, position);
+}
+
+const NRegisterAllocator::Interval &
+NRegisterAllocator::interval_of(NValue *value) const {
+    DCHECK_LT(value->id(), static_cast<int>(intervals_.size()));
+    return intervals_[value->id()];
+}
+
+} // namespace mio
@@ -0,0 +1,139 @@
+#ifndef MIO_NYAA_REGISTER_ALLOCATOR_H_
+#define MIO_NYAA_REGISTER_ALLOCATOR_H_
+
+#include "base.h"
+#include "glog/logging.h"
+#include <vector>
+
+namespace mio {
+
+class NGraph;
+class NBasicBlock;
+class NValue;
+
+/**
+ * Where a value lives during its live interval.
+ */
+struct NLocation {
+    enum Kind: int {
+        kNone,     // never used, no location.
+        kRegister, // general purpose register, index is the register code.
+        kXmm,      // xmm register, index is the register code.
+        kSlot,     // primitive stack slot, index is the offset.
+        kConstant, // rematerialized on every using.
+    };
+
+    Kind kind;
+    int  index;
+
+    bool is_register() const { return kind == kRegister || kind == kXmm; }
+
+    bool operator == (const NLocation &other) const {
+        return kind == other.kind && index == other.index;
+    }
+    bool operator != (const NLocation &other) const { return !(*this == other); }
+
+    static NLocation None() { return {kNone, 0}; }
+    static NLocation Constant() { return {kConstant, 0}; }
+};
+
+
+/**
+ * Linear scan register allocation (Poletto & Sarkar) for Nyaa graph.
+ *
+ * Blocks are linearized in reverse post order, every value gets one interval
+ * covering all positions it is live, loop-carried values cover the whole
+ * loop. Intervals are scanned by start position, floating values get xmm
+ * registers, others get general purpose registers, the one ends furthest is
+ * spilled when registers run out.
+ *
+ * A spilled value lives in the primitive stack slot it was written in bit
+ * codes (NValue::slot()), so frames keep their layout and GC root scanning is
+ * not affected. Allocation fails if two spilled values sharing the same slot
+ * interfere, that is one is still live where the other is defined.
+ *
+ * Constants never take registers, they are rematerialized by code generator.
+ */
+class NRegisterAllocator {
+public:
+    /**
+     * @param gp_regs  allocatable general purpose register codes.
+     * @param xmm_regs allocatable xmm register codes.
+     */
+    NRegisterAllocator(NGraph *graph,
+                       const std::vector<int> &gp_regs,
+                       const std::vector<int> &xmm_regs)
+        : graph_(DCHECK_NOTNULL(graph))
+        , gp_regs_(gp_regs)
+        , xmm_regs_(xmm_regs) {}
+
+    /**
+     * @return false if a spilled value has no slot or slots interfere.
+     */
+    bool Run();
+
+    /**
+     * Blocks in linear order, the entry is the first one.
+     */
+    const std::vector<NBasicBlock *> &blocks() const { return blocks_; }
+
+    NLocation location(NValue *value) const;
+
+    /**
+     * Position of instruction, or block starting for phis.
+     */
+    int position(NValue *value) const;
+
+    int block_from(NBasicBlock *block) const;
+    int block_to(NBasicBlock *block) const;
+
+    /**
+     * Live interval [start, end] of value, start > end if never live.
+     */
+    int interval_start(NValue *value) const;
+    int interval_end(NValue *value) const;
+
+    DEF_GETTER(int, spilled_size)
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NRegisterAllocator)
+private:
+    struct Interval {
+        NValue   *value;
+        int       start;
+        int       end;
+        NLocation location;
+    };
+
+    void NumberInstructions();
+    void ComputeLiveness();
+    void BuildIntervals();
+    void LinearScan(bool floating);
+    bool AssignSpillSlots();
+
+    /**
+     * Is value still live just after def was defined?
+     */
+    bool IsLiveAfter(NValue *value, NValue *def) const;
+
+    void Cover(NValue *value, int position);
+
+    const Interval &interval_of(NValue *value) const;
+
+    NGraph *graph_;
+    std::vector<int> gp_regs_;
+    std::vector<int> xmm_regs_;
+
+    std::vector<NBasicBlock *> blocks_;
+    std::vector<int> block_from_; // by block id
+    std::vector<int> block_to_;   // by block id
+    std::vector<std::vector<bool>> live_in_;  // by block id, value id
+    std::vector<std::vector<bool>> live_out_; // by block id, value id
+    std::vector<NValue *> values_; // by value id
+    std::vector<int> positions_;   // by value id
+    std::vector<Interval> intervals_; // by value id
+    int spilled_size_ = 0;
+}; // class NRegisterAllocator
+
+} // namespace mio
+
+#endif // MIO_NYAA_REGISTER_ALLOCATOR_H_
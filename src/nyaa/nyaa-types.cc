@@ -1,11 +1,40 @@
 #include "nyaa-types.h"
+#include "glog/logging.h"
 
 namespace mio {
 
-const char * const kNTypeShortNames[] = {
+const int NType::kNTypeBytes[] = {
+    0, // void
+    1, // i8
+    2, // i16
+    4, // i32
+    8, // i64
+    4, // f32
+    8, // f64
+    8, // object
+};
+
+const char * const NType::kNTypeShortNames[] = {
 #define DEFINE_ELEMENT(name, short_name) #short_name,
     NYAA_TYPES(DEFINE_ELEMENT)
 #undef DEFINE_ELEMENT
 };
 
+/*static*/ NType NType::OfIntegral(int bytes) {
+    switch (bytes) {
+        case 1:
+            return Int8();
+        case 2:
+            return Int16();
+        case 4:
+            return Int32();
+        case 8:
+            return Int64();
+        default:
+            DLOG(FATAL) << "noreached! bad bytes: " << bytes;
+            break;
+    }
+    return Void();
+}
+
 } // namespace mio
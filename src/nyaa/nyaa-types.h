@@ -6,6 +6,7 @@
 namespace mio {
 
 #define NYAA_TYPES(M) \
+    M(Void,    void)  \
     M(Int8,    i8)    \
     M(Int16,   i16)   \
     M(Int32,   i32)   \
@@ -29,14 +30,32 @@ public:
 
     Kind kind() const { return kind_; }
 
+    bool is_integral() const { return kind_ >= kInt8 && kind_ <= kInt64; }
+    bool is_floating() const { return kind_ == kFloat32 || kind_ == kFloat64; }
+
+    /**
+     * Placement size in stack, 0 for void.
+     */
+    int bytes() const { return kNTypeBytes[kind_]; }
+
+    const char *short_name() const { return kNTypeShortNames[kind_]; }
+
+    bool operator == (NType other) const { return kind_ == other.kind_; }
+    bool operator != (NType other) const { return kind_ != other.kind_; }
+
+    /**
+     * Integral type by placement size.
+     */
+    static NType OfIntegral(int bytes);
+
+    static const int kNTypeBytes[];
+    static const char * const kNTypeShortNames[];
 private:
     explicit NType(Kind kind) : kind_(kind) {}
 
     Kind kind_;
 };
 
-extern const char * const kNTypeShortNames[];
-
 } // namespace mio
 
 #endif // MIO_NYAA_TYPES_H_
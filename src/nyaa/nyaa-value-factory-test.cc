@@ -1,4 +1,5 @@
 #include "nyaa-value-factory.h"
+#include "nyaa.h"
 #include "gtest/gtest.h"
 
 namespace mio {
@@ -21,7 +22,42 @@ protected:
 }; // class NValueFactoryTest
 
 TEST_F(NValueFactoryTest, Sanity) {
-    //auto add = factory_->CreateAdd(NType::Int8(), <#mio::NValue *lhs#>, <#mio::NValue *rhs#>)
+    auto lhs = factory_->CreateConstant(NType::Int32(), 1);
+    auto rhs = factory_->CreateParameter(NType::Int32(), 8);
+    auto add = factory_->CreateAdd(NType::Int32(), lhs, rhs);
+
+    EXPECT_EQ(NValue::kAdd, add->opcode());
+    EXPECT_EQ(lhs, add->lhs());
+    EXPECT_EQ(rhs, add->rhs());
+    EXPECT_EQ(2, add->id());
+    EXPECT_EQ(3, factory_->next_id());
+    EXPECT_FALSE(add->has_side_effect());
+    EXPECT_TRUE(factory_->CreateDiv(NType::Int32(), lhs, rhs)->has_side_effect());
+    EXPECT_FALSE(factory_->CreateDiv(NType::Float32(), lhs, rhs)->has_side_effect());
+}
+
+TEST_F(NValueFactoryTest, BasicBlock) {
+    NGraph graph(zone_);
+    auto b0 = graph.NewBlock();
+    auto b1 = graph.NewBlock();
+    graph.AddEdge(b0, b1);
+
+    auto k = factory_->CreateConstant(NType::Int64(), 7);
+    b0->AddInstruction(k);
+    b0->AddInstruction(factory_->CreateJump(b1));
+    EXPECT_EQ(k, b0->first());
+    ASSERT_NE(nullptr, b0->control());
+    EXPECT_EQ(NValue::kJump, b0->control()->opcode());
+
+    auto phi = factory_->CreatePhi(NType::Int64());
+    phi->add_input(k);
+    b1->add_phi(phi);
+    graph.RemoveEdge(b0, b1);
+    EXPECT_EQ(0, b1->prev_block_size());
+    EXPECT_EQ(0, phi->input_size());
+
+    EXPECT_TRUE(graph.RemoveUnreachableBlocks());
+    EXPECT_EQ(1, graph.block_size());
 }
 
 } // namespace mio
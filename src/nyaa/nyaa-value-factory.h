@@ -5,16 +5,86 @@
 
 namespace mio {
 
+/**
+ * Create values in zone, every value has a unique id in its factory.
+ */
 class NValueFactory {
 public:
     NValueFactory(Zone *zone)
         : zone_(DCHECK_NOTNULL(zone)) {}
 
-    NAdd *CreateAdd(NType type, NValue *lhs, NValue *rhs) {
-        return new (zone_) NAdd(type, lhs, rhs);
+    DEF_GETTER(int, next_id)
+
+    NConstant *CreateConstant(NType type, int64_t value) {
+        return Identify(new (zone_) NConstant(type, value));
+    }
+
+    NConstant *CreateConstantFloat(NType type, double value) {
+        return Identify(new (zone_) NConstant(type, value));
+    }
+
+    NParameter *CreateParameter(NType type, int offset) {
+        return Identify(new (zone_) NParameter(type, offset));
+    }
+
+#define DEFINE_CREATOR(name) \
+    N##name *Create##name(NType type, NValue *lhs, NValue *rhs) { \
+        return Identify(new (zone_) N##name(type, lhs, rhs)); \
+    }
+    NYAA_BINARY_OPS(DEFINE_CREATOR)
+#undef DEFINE_CREATOR
+
+    NInv *CreateInv(NType type, NValue *value) {
+        return Identify(new (zone_) NInv(type, value));
+    }
+
+    NNot *CreateNot(NValue *value) {
+        return Identify(new (zone_) NNot(value));
+    }
+
+    NCompare *CreateCompare(int condition, NValue *lhs, NValue *rhs) {
+        return Identify(new (zone_) NCompare(condition, lhs, rhs));
+    }
+
+    NPhi *CreatePhi(NType type) {
+        return Identify(new (zone_) NPhi(type, zone_));
     }
+
+    NStore *CreateStore(int offset, NValue *value) {
+        return Identify(new (zone_) NStore(offset, value));
+    }
+
+    NBranch *CreateBranch(NValue *condition, NBasicBlock *true_target,
+                          NBasicBlock *false_target) {
+        return Identify(new (zone_) NBranch(condition, true_target, false_target));
+    }
+
+    NJump *CreateJump(NBasicBlock *target) {
+        return Identify(new (zone_) NJump(target));
+    }
+
+    NReturn *CreateReturn() {
+        return Identify(new (zone_) NReturn());
+    }
+
+    NEntry *CreateEntry() {
+        return Identify(new (zone_) NEntry(zone_));
+    }
+
+    NDeoptimize *CreateDeoptimize() {
+        return Identify(new (zone_) NDeoptimize());
+    }
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NValueFactory)
 private:
+    template<class T>
+    T *Identify(T *value) {
+        value->set_id(next_id_++);
+        return value;
+    }
+
     Zone *zone_;
+    int next_id_ = 0;
 };
 
 } // namespace mio
@@ -1,5 +1,221 @@
 #include "nyaa.h"
+#include "nyaa-instructions.h"
+#include "text-output-stream.h"
+#include <algorithm>
 
 namespace mio {
 
+namespace {
+
+template<class T>
+void RemoveElement(ZoneVector<T> *elements, int i) {
+    DCHECK_GE(i, 0);
+    DCHECK_LT(i, elements->size());
+    for (int j = i + 1; j < elements->size(); ++j) {
+        elements->Set(j - 1, elements->At(j));
+    }
+    elements->Resize(elements->size() - 1);
+}
+
+} // namespace
+
+NInstruction *NBasicBlock::control() const {
+    return last_ && last_->is_control() ? last_ : nullptr;
+}
+
+void NBasicBlock::AddInstruction(NInstruction *instruction) {
+    DCHECK(instruction->next_ == nullptr && instruction->prev_ == nullptr);
+    instruction->set_block(this);
+    instruction->prev_ = last_;
+    if (last_) {
+        last_->next_ = instruction;
+    } else {
+        first_ = instruction;
+    }
+    last_ = instruction;
+}
+
+void NBasicBlock::InsertBefore(NInstruction *before, NInstruction *instruction) {
+    DCHECK_EQ(this, before->block());
+    instruction->set_block(this);
+    instruction->next_ = before;
+    instruction->prev_ = before->prev_;
+    if (before->prev_) {
+        before->prev_->next_ = instruction;
+    } else {
+        first_ = instruction;
+    }
+    before->prev_ = instruction;
+}
+
+void NBasicBlock::RemoveInstruction(NInstruction *instruction) {
+    DCHECK_EQ(this, instruction->block());
+    if (instruction->prev_) {
+        instruction->prev_->next_ = instruction->next_;
+    } else {
+        first_ = instruction->next_;
+    }
+    if (instruction->next_) {
+        instruction->next_->prev_ = instruction->prev_;
+    } else {
+        last_ = instruction->prev_;
+    }
+    instruction->next_ = nullptr;
+    instruction->prev_ = nullptr;
+    instruction->set_block(nullptr);
+}
+
+void NBasicBlock::RemovePhi(int i) {
+    RemoveElement(&phis_, i);
+}
+
+int NBasicBlock::IndexOfPrevBlock(NBasicBlock *block) const {
+    for (int i = 0; i < prev_block_size(); ++i) {
+        if (prev_block(i) == block) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void NBasicBlock::RemovePrevBlock(int i) {
+    RemoveElement(&prev_blocks_, i);
+    for (int j = 0; j < phi_size(); ++j) {
+        phi(j)->RemoveInput(i);
+    }
+}
+
+void NBasicBlock::RemoveNextBlock(NBasicBlock *block) {
+    for (int i = 0; i < next_block_size(); ++i) {
+        if (next_block(i) == block) {
+            RemoveElement(&next_blocks_, i);
+            return;
+        }
+    }
+}
+
+void NBasicBlock::ToString(TextOutputStream *stream) const {
+    stream->Printf("B%d:", id());
+    for (int i = 0; i < prev_block_size(); ++i) {
+        stream->Printf("%sB%d", i == 0 ? " <- " : ", ", prev_block(i)->id());
+    }
+    stream->Write("\n");
+    for (int i = 0; i < phi_size(); ++i) {
+        stream->Write("    ");
+        phi(i)->ToString(stream);
+        stream->Write("\n");
+    }
+    for (auto instruction = first_; instruction; instruction = instruction->next()) {
+        stream->Write("    ");
+        instruction->ToString(stream);
+        stream->Write("\n");
+    }
+}
+
+NBasicBlock *NGraph::NewBlock() {
+    auto block = new (zone_) NBasicBlock(next_block_id_++, zone_);
+    blocks_.Add(block);
+    return block;
+}
+
+void NGraph::AddEdge(NBasicBlock *from, NBasicBlock *to) {
+    from->add_next_block(to);
+    to->add_prev_block(from);
+}
+
+void NGraph::RemoveEdge(NBasicBlock *from, NBasicBlock *to) {
+    from->RemoveNextBlock(to);
+    auto i = to->IndexOfPrevBlock(from);
+    DCHECK_GE(i, 0);
+    to->RemovePrevBlock(i);
+}
+
+bool NGraph::RemoveUnreachableBlocks() {
+    std::vector<NBasicBlock *> reachable;
+    GetReversePostOrder(&reachable);
+    if (static_cast<int>(reachable.size()) == block_size()) {
+        return false;
+    }
+
+    std::vector<bool> marks(next_block_id_, false);
+    for (auto block : reachable) {
+        marks[block->id()] = true;
+    }
+    for (int i = 0; i < block_size(); ++i) {
+        auto block = blocks_.At(i);
+        if (marks[block->id()]) {
+            continue;
+        }
+        while (block->next_block_size() > 0) {
+            RemoveEdge(block, block->next_block(0));
+        }
+    }
+    int n = 0;
+    for (int i = 0; i < block_size(); ++i) {
+        if (marks[blocks_.At(i)->id()]) {
+            blocks_.Set(n++, blocks_.At(i));
+        }
+    }
+    blocks_.Resize(n);
+    return true;
+}
+
+void NGraph::ReplaceAllUses(NValue *value, NValue *replacement) {
+    DCHECK_NE(value, replacement);
+    for (int i = 0; i < block_size(); ++i) {
+        auto block = blocks_.At(i);
+        for (int j = 0; j < block->phi_size(); ++j) {
+            auto phi = block->phi(j);
+            for (int k = 0; k < phi->input_size(); ++k) {
+                if (phi->input(k) == value) {
+                    phi->set_input(k, replacement);
+                }
+            }
+        }
+        for (auto instruction = block->first(); instruction;
+             instruction = instruction->next()) {
+            for (int k = 0; k < instruction->operand_size(); ++k) {
+                if (instruction->operand(k) == value) {
+                    instruction->set_operand(k, replacement);
+                }
+            }
+        }
+    }
+}
+
+void NGraph::GetReversePostOrder(std::vector<NBasicBlock *> *blocks) const {
+    blocks->clear();
+    if (block_size() == 0) {
+        return;
+    }
+
+    // Iterative DFS, the second of pair is the next successor to visit.
+    std::vector<bool> visited(next_block_id_, false);
+    std::vector<std::pair<NBasicBlock *, int>> stack;
+    stack.push_back({entry(), 0});
+    visited[entry()->id()] = true;
+    while (!stack.empty()) {
+        auto block = stack.back().first;
+        auto i = stack.back().second;
+        if (i < block->next_block_size()) {
+            stack.back().second++;
+            auto next = block->next_block(i);
+            if (!visited[next->id()]) {
+                visited[next->id()] = true;
+                stack.push_back({next, 0});
+            }
+        } else {
+            blocks->push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(blocks->begin(), blocks->end());
+}
+
+void NGraph::ToString(TextOutputStream *stream) const {
+    for (int i = 0; i < block_size(); ++i) {
+        block(i)->ToString(stream);
+    }
+}
+
 } // namespace mio
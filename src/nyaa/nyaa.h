@@ -4,30 +4,114 @@
 #include "zone-vector.h"
 #include "raw-string.h"
 #include "zone.h"
+#include <vector>
 
 namespace mio {
 
+class NValue;
 class NPhi;
 class NInstruction;
+class TextOutputStream;
 
 class NBasicBlock : public ManagedObject {
 public:
+    NBasicBlock(int id, Zone *zone)
+        : id_(id)
+        , phis_(DCHECK_NOTNULL(zone))
+        , prev_blocks_(zone)
+        , next_blocks_(zone) {}
+
     DEF_GETTER(int, id)
     DEF_PROP_RW(RawStringRef, name)
     DEF_ZONE_VECTOR_PROP_RWA(NPhi *, phi)
     DEF_ZONE_VECTOR_PROP_RWA(NBasicBlock *, prev_block)
     DEF_ZONE_VECTOR_PROP_RWA(NBasicBlock *, next_block)
+    DEF_PTR_GETTER(NInstruction, first)
+    DEF_PTR_GETTER(NInstruction, last)
+
+    /**
+     * The last instruction if it is control flow, see NValue::is_control().
+     */
+    NInstruction *control() const;
+
+    void AddInstruction(NInstruction *instruction);
+    void InsertBefore(NInstruction *before, NInstruction *instruction);
+    void RemoveInstruction(NInstruction *instruction);
+
+    void RemovePhi(int i);
+
+    /**
+     * @return index of block in predecessors, -1 if not found.
+     */
+    int IndexOfPrevBlock(NBasicBlock *block) const;
+
+    void RemovePrevBlock(int i);
+    void RemoveNextBlock(NBasicBlock *block);
 
+    void ToString(TextOutputStream *stream) const;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NBasicBlock)
 private:
     int                       id_;
     RawStringRef              name_ = RawString::kEmpty;
     ZoneVector<NPhi *>        phis_;
-    NInstruction             *first_;
-    NInstruction             *last_;
+    NInstruction             *first_ = nullptr;
+    NInstruction             *last_  = nullptr;
     ZoneVector<NBasicBlock *> prev_blocks_;
     ZoneVector<NBasicBlock *> next_blocks_;
 }; // class NBasicBlock
 
+
+/**
+ * The control flow graph of a function in SSA form, all blocks and values
+ * are allocated in the zone.
+ */
+class NGraph : public ManagedObject {
+public:
+    NGraph(Zone *zone)
+        : zone_(DCHECK_NOTNULL(zone))
+        , blocks_(zone) {}
+
+    DEF_PTR_GETTER(Zone, zone)
+    DEF_ZONE_VECTOR_PROP_RO(NBasicBlock *, block)
+
+    NBasicBlock *entry() const { return block(0); }
+
+    NBasicBlock *NewBlock();
+
+    void AddEdge(NBasicBlock *from, NBasicBlock *to);
+
+    /**
+     * Remove the edge and inputs of phis in to for it.
+     */
+    void RemoveEdge(NBasicBlock *from, NBasicBlock *to);
+
+    /**
+     * Remove blocks can not be reached from entry.
+     *
+     * @return true if any block was removed.
+     */
+    bool RemoveUnreachableBlocks();
+
+    /**
+     * Replace all operands of value to replacement.
+     */
+    void ReplaceAllUses(NValue *value, NValue *replacement);
+
+    /**
+     * Blocks in reverse post order, entry is the first one.
+     */
+    void GetReversePostOrder(std::vector<NBasicBlock *> *blocks) const;
+
+    void ToString(TextOutputStream *stream) const;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NGraph)
+private:
+    Zone *zone_;
+    ZoneVector<NBasicBlock *> blocks_;
+    int next_block_id_ = 0;
+}; // class NGraph
+
 } // namespace mio
 
 #endif // MIO_NYAA_H_
@@ -0,0 +1,202 @@
+#include "parallel-marker.h"
+#include "msg-garbage-collector.h"
+#include "vm-object-scanner.h"
+#include "vm-object-factory.h"
+#include "vm-objects.h"
+#include "vm.h"
+#include "text-output-stream.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <thread>
+#include <unordered_set>
+
+namespace mio {
+
+class ParallelMarkerTest : public ::testing::Test {
+public:
+    virtual void SetUp() override {
+        vm_ = new VM();
+        vm_->Init();
+        factory_ = vm_->object_factory();
+        element_ = factory_->CreateReflectionRef(0);
+        shared_ = factory_->GetOrNewString("shared", 6);
+    }
+
+    virtual void TearDown() override {
+        element_ = Handle<MIOReflectionType>();
+        shared_ = Handle<MIOString>();
+        delete vm_;
+    }
+
+    /**
+     * Vectors tree: every inner node has width children, leaves have width
+     * different strings and a shared string.
+     */
+    HeapObject *NewTree(int width, int depth, int *count) {
+        auto vector = factory_->CreateVector(width + 1, element_);
+        auto slots = static_cast<HeapObject **>(vector->GetData());
+        for (int i = 0; i < width; ++i) {
+            if (depth > 1) {
+                slots[i] = NewTree(width, depth - 1, count);
+            } else {
+                auto s = TextOutputStream::sprintf("%d.%d", (*count)++, i);
+                slots[i] = factory_->GetOrNewString(s.c_str(),
+                                                    static_cast<int>(s.size())).get();
+            }
+        }
+        slots[width] = shared_.get();
+        (*count)++;
+        return vector.get();
+    }
+
+    /**
+     * Set color of objects reachable from ob to color.
+     *
+     * @return number of objects.
+     */
+    static int Paint(HeapObject *ob, int color) {
+        std::unordered_set<HeapObject *> painted;
+        Paint(ob, color, &painted);
+        return static_cast<int>(painted.size());
+    }
+
+    static void Paint(HeapObject *ob, int color,
+                      std::unordered_set<HeapObject *> *painted) {
+        if (!painted->insert(ob).second) {
+            return;
+        }
+        ob->SetColor(color);
+        ObjectScanner::ForEachReference(ob, [color, painted] (HeapObject *x) {
+            Paint(x, color, painted);
+        });
+    }
+
+protected:
+    VM *vm_ = nullptr;
+    ObjectFactory *factory_;
+    Handle<MIOReflectionType> element_;
+    Handle<MIOString> shared_;
+};
+
+TEST_F(ParallelMarkerTest, Sanity) {
+    static const int kBlack = MSGGarbageCollector::kBlack;
+
+    auto count = 0;
+    auto root = NewTree(4, 3, &count);
+    // inner vectors + leaf strings + the shared string + element type
+    auto expected = count + 1 + 1;
+
+    for (int workers : {1, 2, 4}) {
+        ASSERT_EQ(expected, Paint(root, MSGGarbageCollector::kWhite0));
+
+        ParallelMarker marker(workers);
+        marker.Start();
+        EXPECT_EQ(workers, marker.number_of_workers());
+
+        EXPECT_EQ(expected, marker.Mark({root, root, nullptr}, kBlack));
+        EXPECT_EQ(kBlack, shared_->GetColor());
+        EXPECT_EQ(kBlack, element_->GetColor());
+        auto n = 0;
+        ObjectScanner::ForEachReference(root, [&n] (HeapObject *x) {
+            n += (x->GetColor() == kBlack);
+        });
+        EXPECT_EQ(4 + 1 + 1, n); // children, shared string, element type
+
+        // Seeds are traced again, but black objects are skipped.
+        EXPECT_EQ(0, marker.Mark({root}, kBlack));
+        marker.Stop();
+    }
+}
+
+TEST_F(ParallelMarkerTest, SkipBlack) {
+    static const int kBlack = MSGGarbageCollector::kBlack;
+
+    auto count = 0;
+    auto root = NewTree(4, 3, &count);
+    auto expected = Paint(root, MSGGarbageCollector::kWhite0);
+
+    // A black subtree has been traced, its references must be black.
+    auto slots = static_cast<HeapObject **>(root->AsVector()->GetData());
+    auto black = Paint(slots[0], kBlack);
+    // subtree vectors and strings, the shared string and element type are
+    // still reachable from other subtrees.
+    ASSERT_EQ(1 + 4 + 4 * 4 + 2, black);
+
+    // A white object only reachable from the black subtree is not marked.
+    auto child = static_cast<HeapObject **>(slots[0]->AsVector()->GetData())[0];
+    auto leaf = static_cast<HeapObject **>(child->AsVector()->GetData())[0];
+    leaf->SetColor(MSGGarbageCollector::kWhite0);
+
+    ParallelMarker marker(2);
+    marker.Start();
+    EXPECT_EQ(expected - black, marker.Mark({root}, kBlack));
+    EXPECT_EQ(MSGGarbageCollector::kWhite0, leaf->GetColor());
+    marker.Stop();
+}
+
+TEST_F(ParallelMarkerTest, WorkersLimit) {
+    ParallelMarker few(0);
+    EXPECT_EQ(1, few.number_of_workers());
+    ParallelMarker many(ParallelMarker::kMaxWorkers + 1);
+    EXPECT_EQ(static_cast<int>(ParallelMarker::kMaxWorkers),
+              many.number_of_workers());
+}
+
+TEST_F(ParallelMarkerTest, Chain) {
+    // Only one object can be traced at a time, other workers park.
+    auto count = 0;
+    auto root = NewTree(1, 2000, &count);
+    Paint(root, MSGGarbageCollector::kWhite0);
+
+    ParallelMarker marker(4);
+    marker.Start();
+    EXPECT_EQ(count + 2, marker.Mark({root}, MSGGarbageCollector::kBlack));
+    marker.Stop();
+}
+
+TEST_F(ParallelMarkerTest, Shared) {
+    auto marker = ParallelMarker::Shared();
+    ASSERT_EQ(marker, ParallelMarker::Shared());
+
+    // Markings from different VM threads are serialized.
+    int count = 0, marked[2] = {0, 0};
+    HeapObject *roots[2];
+    for (int i = 0; i < 2; ++i) {
+        roots[i] = NewTree(4, 3, &count);
+    }
+    Paint(roots[0], MSGGarbageCollector::kWhite0);
+    Paint(roots[1], MSGGarbageCollector::kWhite0);
+    std::thread threads[2];
+    for (int i = 0; i < 2; ++i) {
+        threads[i] = std::thread([&, i] () {
+            marked[i] = marker->Mark({roots[i]}, MSGGarbageCollector::kBlack);
+        });
+    }
+    threads[0].join();
+    threads[1].join();
+    // The shared string and element type are marked once.
+    EXPECT_EQ(count + 2, marked[0] + marked[1]);
+}
+
+TEST_F(ParallelMarkerTest, PauseBenchmark) {
+    auto count = 0;
+    auto root = NewTree(16, 4, &count);
+
+    printf("parallel marking %d objects, %d cpu cores\n", count, kNumberOfCpuCores);
+    for (int workers : {1, 2, 4, 8}) {
+        ParallelMarker marker(workers);
+        marker.Start();
+        Paint(root, MSGGarbageCollector::kWhite0);
+        auto start = std::chrono::steady_clock::now();
+        auto marked = marker.Mark({root}, MSGGarbageCollector::kBlack);
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        printf("-- workers: %d --> pause: %lld us, steals: %d, parks: %d\n",
+               workers, static_cast<long long>(cost), marker.steals(),
+               marker.parks());
+        EXPECT_EQ(count + 2, marked);
+        marker.Stop();
+    }
+}
+
+} // namespace mio
@@ -0,0 +1,209 @@
+#include "parallel-marker.h"
+#include "vm-object-scanner.h"
+#include "vm-objects.h"
+#include <algorithm>
+
+namespace mio {
+
+ParallelMarker::ParallelMarker(int number_of_workers)
+    : number_of_workers_(std::max(1, std::min(number_of_workers, static_cast<int>(kMaxWorkers))))
+    , workers_(new Worker[number_of_workers_])
+    , pending_(0)
+    , marked_(0)
+    , steals_(0)
+    , parks_(0)
+    , parked_(0) {
+}
+
+ParallelMarker::~ParallelMarker() {
+    Stop();
+    delete[] workers_;
+}
+
+/*static*/ ParallelMarker *ParallelMarker::Shared() {
+    // Never deleted, helper threads are parking until the process exits.
+    static ParallelMarker *shared = [] () {
+        auto marker = new ParallelMarker(kNumberOfCpuCores);
+        marker->Start();
+        return marker;
+    }();
+    return shared;
+}
+
+void ParallelMarker::Start() {
+    DCHECK(threads_.empty());
+    should_stop_ = false;
+    for (int i = 1; i < number_of_workers_; ++i) {
+        // Pass current epoch, thread may start waiting after next marking.
+        auto epoch = epoch_;
+        threads_.push_back(new std::thread([this, i, epoch]() {
+            Run(i, epoch);
+        }));
+    }
+}
+
+void ParallelMarker::Stop() {
+    if (threads_.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        should_stop_ = true;
+    }
+    wakeup_.notify_all();
+    for (auto thread : threads_) {
+        DCHECK(thread->joinable());
+        thread->join();
+        delete thread;
+    }
+    threads_.clear();
+}
+
+int ParallelMarker::Mark(const std::vector<HeapObject *> &seeds, int color) {
+    std::lock_guard<std::mutex> marking(marking_mutex_);
+    color_ = color;
+    steals_.store(0, std::memory_order_relaxed);
+    parks_.store(0, std::memory_order_relaxed);
+
+    // Helper threads are waiting, deal seeds to workers without locking.
+    auto n = 0, marked = 0;
+    for (auto x : seeds) {
+        if (!x) {
+            continue;
+        }
+        if (x->TestAndSetColor(color)) {
+            ++marked;
+        }
+        workers_[n++ % number_of_workers_].objects.push_back(x);
+    }
+    marked_.store(marked, std::memory_order_relaxed);
+    pending_.store(n, std::memory_order_release);
+
+    if (!threads_.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_ = static_cast<int>(threads_.size());
+            ++epoch_;
+        }
+        wakeup_.notify_all();
+    }
+    Drain(0);
+    if (!threads_.empty()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] () { return busy_ == 0; });
+    }
+    return marked_.load(std::memory_order_relaxed);
+}
+
+void ParallelMarker::Run(int id, uint64_t epoch) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait(lock, [this, epoch] () {
+                return should_stop_ || epoch_ != epoch;
+            });
+            if (should_stop_) {
+                return;
+            }
+            epoch = epoch_;
+        }
+
+        Drain(id);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0) {
+            idle_.notify_one();
+        }
+    }
+}
+
+void ParallelMarker::Drain(int id) {
+    ObjectScanner::Callback trace = [this, id] (HeapObject *x) {
+        if (x->TestAndSetColor(color_)) {
+            marked_.fetch_add(1, std::memory_order_relaxed);
+            // Count it before parent is done, so pending can not be 0 early.
+            pending_.fetch_add(1, std::memory_order_relaxed);
+            Push(id, x);
+        }
+    };
+
+    HeapObject *ob;
+    while (pending_.load(std::memory_order_acquire) > 0) {
+        if (!Pop(id, &ob) && !Steal(id, &ob)) {
+            Park();
+            continue;
+        }
+        ObjectScanner::ForEachReference(ob, trace);
+        if (pending_.fetch_sub(1) == 1) {
+            WakeUpParked(); // marking is done.
+        }
+    }
+}
+
+void ParallelMarker::Push(int id, HeapObject *ob) {
+    auto worker = &workers_[id];
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->objects.push_back(ob);
+    }
+    if (parked_.load() > 0) {
+        WakeUpParked();
+    }
+}
+
+bool ParallelMarker::Pop(int id, HeapObject **ob) {
+    auto worker = &workers_[id];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->objects.empty()) {
+        return false;
+    }
+    *ob = worker->objects.back();
+    worker->objects.pop_back();
+    return true;
+}
+
+bool ParallelMarker::Steal(int id, HeapObject **ob) {
+    for (int i = 1; i < number_of_workers_; ++i) {
+        auto victim = &workers_[(id + i) % number_of_workers_];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (victim->objects.empty()) {
+            continue;
+        }
+        *ob = victim->objects.front();
+        victim->objects.pop_front();
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ParallelMarker::Park() {
+    std::unique_lock<std::mutex> lock(park_mutex_);
+    // Pushing and finishing check it after their changes, so either they
+    // wake up it, or it sees their changes before waiting.
+    parked_.fetch_add(1);
+    parks_.fetch_add(1, std::memory_order_relaxed);
+    unparked_.wait(lock, [this] () {
+        return pending_.load() == 0 || HasObjects();
+    });
+    parked_.fetch_sub(1);
+}
+
+void ParallelMarker::WakeUpParked() {
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+    }
+    unparked_.notify_all();
+}
+
+bool ParallelMarker::HasObjects() {
+    for (int i = 0; i < number_of_workers_; ++i) {
+        std::lock_guard<std::mutex> lock(workers_[i].mutex);
+        if (!workers_[i].objects.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace mio
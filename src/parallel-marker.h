@@ -0,0 +1,131 @@
+#ifndef MIO_PARALLEL_MARKER_H_
+#define MIO_PARALLEL_MARKER_H_
+
+#include "base.h"
+#include "glog/logging.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+namespace mio {
+
+class HeapObject;
+
+/**
+ * Mark reachable objects by a pool of worker threads.
+ *
+ * Every worker has its own deque of objects to trace: the owner pushes and
+ * pops at back, idle workers steal from front of the others, deques are
+ * guarded by their mutexes. Workers find nothing to steal park until an
+ * object is pushed or marking is done. An object is
+ * claimed by setting its color by CAS (see HeapObject::TestAndSetColor), only
+ * the winner traces it. Objects have been the color are skipped, their
+ * references must have been marked, so marking costs only objects not marked
+ * yet.
+ *
+ * The thread calling Mark() is worker 0, other workers are helper threads
+ * waiting for marking jobs. Mutator must be paused during marking.
+ *
+ * GCs share one marker by Shared(), so a process has only one pool of helper
+ * threads however many VMs it runs, markings of them are serialized.
+ */
+class ParallelMarker {
+public:
+    static const int kMaxWorkers = 16;
+
+    /**
+     * @param number_of_workers include the thread calling Mark(), it is
+     *        clamped to [1, kMaxWorkers].
+     */
+    explicit ParallelMarker(int number_of_workers);
+    ~ParallelMarker();
+
+    /**
+     * The marker of kNumberOfCpuCores workers shared by the process, its
+     * helper threads are started at the first calling and never stopped.
+     */
+    static ParallelMarker *Shared();
+
+    /**
+     * Start helper threads, nothing to do if only one worker.
+     */
+    void Start();
+    void Stop();
+
+    /**
+     * Set color of objects reachable from seeds. Seeds are always traced even
+     * if they have been the color, because their references may be changed.
+     *
+     * @return number of objects whose color are set by this marking.
+     */
+    int Mark(const std::vector<HeapObject *> &seeds, int color);
+
+    DEF_GETTER(int, number_of_workers)
+
+    /**
+     * Number of objects stolen from other workers in last marking.
+     */
+    int steals() const { return steals_.load(std::memory_order_relaxed); }
+
+    /**
+     * Number of times workers parked for nothing to trace in last marking.
+     */
+    int parks() const { return parks_.load(std::memory_order_relaxed); }
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(ParallelMarker)
+private:
+    struct Worker {
+        std::mutex               mutex;
+        std::deque<HeapObject *> objects;
+    };
+
+    void Run(int id, uint64_t epoch);
+
+    /**
+     * Trace objects until no worker has any object, stealing if local deque
+     * is empty.
+     */
+    void Drain(int id);
+
+    void Push(int id, HeapObject *ob);
+    bool Pop(int id, HeapObject **ob);
+    bool Steal(int id, HeapObject **ob);
+
+    /**
+     * Wait until any worker has objects or marking is done.
+     */
+    void Park();
+
+    void WakeUpParked();
+
+    bool HasObjects();
+
+    int number_of_workers_;
+    Worker *workers_;
+    int color_ = 0;
+
+    // Pushed but not traced objects, marking is done if it is 0.
+    std::atomic<int> pending_;
+    std::atomic<int> marked_;
+    std::atomic<int> steals_;
+    std::atomic<int> parks_;
+    std::atomic<int> parked_; // workers are parking.
+
+    std::vector<std::thread *> threads_;
+    bool should_stop_ = false;
+    uint64_t epoch_ = 0; // increased by every marking.
+    int busy_ = 0;       // helper threads not finished current marking.
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable idle_;
+    std::mutex park_mutex_;
+    std::condition_variable unparked_;
+    std::mutex marking_mutex_; // one marking at a time.
+}; // class ParallelMarker
+
+} // namespace mio
+
+#endif // MIO_PARALLEL_MARKER_H_
@@ -0,0 +1,141 @@
+#include "slab-managed-allocator.h"
+#include "fallback-managed-allocator.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <vector>
+
+namespace mio {
+
+TEST(SlabManagedAllocatorTest, SizeClass) {
+    EXPECT_EQ(0, SlabManagedAllocator::SizeClass(0));
+    EXPECT_EQ(0, SlabManagedAllocator::SizeClass(16));
+    EXPECT_EQ(1, SlabManagedAllocator::SizeClass(17));
+    EXPECT_EQ(15, SlabManagedAllocator::SizeClass(256));
+    EXPECT_EQ(16, SlabManagedAllocator::SizeClass(257));
+    EXPECT_EQ(SlabManagedAllocator::kNumberOfSizeClasses - 1,
+              SlabManagedAllocator::SizeClass(SlabManagedAllocator::kMaxChunkSize));
+
+    for (int i = 0; i < SlabManagedAllocator::kNumberOfSizeClasses; ++i) {
+        auto size = SlabManagedAllocator::ChunkSize(i);
+        EXPECT_EQ(i, SlabManagedAllocator::SizeClass(size));
+        EXPECT_EQ(0, size % SlabManagedAllocator::kMinAlignment);
+    }
+}
+
+TEST(SlabManagedAllocatorTest, Sanity) {
+    SlabManagedAllocator allocator(1024 * 1024, false);
+    ASSERT_TRUE(allocator.Init());
+
+    auto p1 = static_cast<uint8_t *>(allocator.Allocate(24));
+    auto p2 = static_cast<uint8_t *>(allocator.Allocate(32));
+    ASSERT_NE(nullptr, p1);
+    EXPECT_EQ(p1 + 32, p2);
+    EXPECT_TRUE(allocator.Contains(p1));
+    EXPECT_EQ(1, allocator.used_pages());
+
+    auto usage = allocator.GetUsage(SlabManagedAllocator::SizeClass(32));
+    EXPECT_EQ(32, usage.chunk_size);
+    EXPECT_EQ(1, usage.pages);
+    EXPECT_EQ(2, usage.used_chunks);
+    EXPECT_EQ(kPageSize / 32, usage.total_chunks);
+
+    allocator.Free(p1);
+    EXPECT_EQ(p1, allocator.Allocate(17));
+    allocator.Free(p1);
+    allocator.Free(p2);
+
+    // The only page of its size class is kept.
+    EXPECT_EQ(1, allocator.used_pages());
+
+    auto large = allocator.Allocate(SlabManagedAllocator::kMaxChunkSize + 1);
+    ASSERT_NE(nullptr, large);
+    EXPECT_FALSE(allocator.Contains(large));
+    EXPECT_EQ(1, allocator.large_chunks());
+    allocator.Free(large);
+    EXPECT_EQ(0, allocator.large_chunks());
+}
+
+TEST(SlabManagedAllocatorTest, ReleasePages) {
+    SlabManagedAllocator allocator(1024 * 1024, false);
+    ASSERT_TRUE(allocator.Init());
+
+    static const int kSize = 64;
+    const int n = 3 * kPageSize / kSize;
+    std::vector<void *> chunks;
+    for (int i = 0; i < n; ++i) {
+        chunks.push_back(allocator.Allocate(kSize));
+        memset(chunks.back(), 0xcc, kSize);
+    }
+    EXPECT_EQ(3, allocator.used_pages());
+
+    for (auto chunk : chunks) {
+        allocator.Free(chunk);
+    }
+    EXPECT_EQ(1, allocator.used_pages());
+    auto usage = allocator.GetUsage(SlabManagedAllocator::SizeClass(kSize));
+    EXPECT_EQ(1, usage.pages);
+    EXPECT_EQ(0, usage.used_chunks);
+
+    // Released pages are reused by other size classes.
+    for (int i = 0; i < 2 * kPageSize / 128; ++i) {
+        ASSERT_NE(nullptr, allocator.Allocate(128));
+    }
+    EXPECT_EQ(3, allocator.used_pages());
+}
+
+TEST(SlabManagedAllocatorTest, OutOfPages) {
+    SlabManagedAllocator allocator(kPageSize, false);
+    ASSERT_TRUE(allocator.Init());
+
+    auto p1 = allocator.Allocate(16);
+    auto p2 = allocator.Allocate(512);
+    EXPECT_TRUE(allocator.Contains(p1));
+    EXPECT_FALSE(allocator.Contains(p2));
+    EXPECT_EQ(1, allocator.large_chunks());
+    allocator.Free(p2);
+    allocator.Free(p1);
+}
+
+namespace {
+
+long long AllocateBenchmark(ManagedAllocator *allocator, int count) {
+    std::vector<void *> chunks(count, nullptr);
+    uint32_t seed = 1;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        seed = seed * 1103515245 + 12345;
+        chunks[i] = allocator->Allocate(16 + (seed >> 16) % 200);
+    }
+    for (int round = 0; round < 8; ++round) {
+        for (int i = round & 1; i < count; i += 2) {
+            allocator->Free(chunks[i]);
+            seed = seed * 1103515245 + 12345;
+            chunks[i] = allocator->Allocate(16 + (seed >> 16) % 200);
+        }
+    }
+    for (auto chunk : chunks) {
+        allocator->Free(chunk);
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    return cost / (count * 10);
+}
+
+} // namespace
+
+TEST(SlabManagedAllocatorTest, AllocateBenchmark) {
+    static const int kCount = 200000;
+
+    FallbackManagedAllocator fallback(false);
+    ASSERT_TRUE(fallback.Init());
+    SlabManagedAllocator slab(SlabManagedAllocator::kDefaultCapacity, false);
+    ASSERT_TRUE(slab.Init());
+
+    auto fallback_cost = AllocateBenchmark(&fallback, kCount);
+    auto slab_cost = AllocateBenchmark(&slab, kCount);
+    printf("allocator: fallback %lld ns/op, slab %lld ns/op\n", fallback_cost,
+           slab_cost);
+    EXPECT_EQ(0, slab.large_chunks());
+}
+
+} // namespace mio
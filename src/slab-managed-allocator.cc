@@ -0,0 +1,210 @@
+#include "slab-managed-allocator.h"
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+namespace mio {
+
+// Size classes: 16 bytes step until 256, then 64 bytes step until 1024.
+static const int kSmallStepClasses = 16;
+static const int kSmallStep = 16;
+static const int kLargeStep = 64;
+static const int kSmallStepLimit = kSmallStepClasses * kSmallStep;
+
+/*virtual*/ SlabManagedAllocator::~SlabManagedAllocator() {
+    if (base_) {
+        munmap(base_, capacity_);
+    }
+    delete[] pages_;
+}
+
+/*virtual*/ bool SlabManagedAllocator::Init() {
+    capacity_ = RoundDown(capacity_, kPageSize);
+    if (capacity_ <= 0) {
+        DLOG(ERROR) << "too small slab capacity: " << capacity_;
+        return false;
+    }
+    // Only reserve the range, pages are committed by touching.
+    auto chunk = mmap(nullptr, capacity_, PROT_READ|PROT_WRITE,
+                      MAP_ANON|MAP_PRIVATE|MAP_NORESERVE, -1, 0);
+    if (chunk == MAP_FAILED) {
+        PLOG(ERROR) << "can not reserve slab pages";
+        return false;
+    }
+    base_ = static_cast<uint8_t *>(chunk);
+    number_of_pages_ = capacity_ >> kPageSizeShift;
+    pages_ = new Page[number_of_pages_];
+    for (int i = 0; i < kNumberOfSizeClasses; ++i) {
+        partial_[i]     = kNoPage;
+        class_pages_[i] = 0;
+        class_used_[i]  = 0;
+    }
+    return true;
+}
+
+/*virtual*/ void SlabManagedAllocator::Finialize() {
+    if (!running_count_) {
+        return;
+    }
+    for (int i = 0; i < kNumberOfSizeClasses; ++i) {
+        auto usage = GetUsage(i);
+        if (!usage.pages) {
+            continue;
+        }
+        printf("-- size:[%d] --> pages: %d, chunks: %d/%d (%d%%)\n",
+               usage.chunk_size, usage.pages, usage.used_chunks,
+               usage.total_chunks,
+               usage.used_chunks * 100 / usage.total_chunks);
+    }
+    printf("-- size:[large] --> %d\n", large_chunks_);
+}
+
+/*virtual*/ void *SlabManagedAllocator::Allocate(int size) {
+    DCHECK_GE(size, 0);
+    if (size > kMaxChunkSize) {
+        ++large_chunks_;
+        return ::malloc(size);
+    }
+
+    auto size_class = SizeClass(size);
+    auto index = partial_[size_class];
+    if (index == kNoPage) {
+        index = NewPage(size_class);
+        if (index == kNoPage) {
+            ++large_chunks_; // reserved range is full.
+            return ::malloc(size);
+        }
+    }
+
+    auto page = &pages_[index];
+    void *chunk;
+    if (page->free_list) {
+        chunk = page->free_list;
+        page->free_list = *static_cast<void **>(chunk);
+    } else {
+        chunk = PageAddress(index) + page->bump * ChunkSize(size_class);
+        page->bump++;
+    }
+    if (++page->used == ChunksPerPage(size_class)) {
+        RemovePage(index);
+    }
+    class_used_[size_class]++;
+    return chunk;
+}
+
+/*virtual*/ void SlabManagedAllocator::Free(const void *p) {
+    if (!Contains(p)) {
+        if (p) {
+            --large_chunks_;
+        }
+        ::free(const_cast<void *>(p));
+        return;
+    }
+
+    auto index = PageIndex(p);
+    auto page = &pages_[index];
+    auto size_class = page->size_class;
+    DCHECK_GT(page->used, 0);
+    DCHECK_EQ(0, (static_cast<const uint8_t *>(p) - PageAddress(index)) %
+              ChunkSize(size_class)) << "bad chunk: " << p;
+
+    auto chunk = const_cast<void *>(p);
+    *static_cast<void **>(chunk) = page->free_list;
+    page->free_list = chunk;
+    if (page->used-- == ChunksPerPage(size_class)) {
+        InsertPage(index);
+    }
+    class_used_[size_class]--;
+
+    // Keep the only page of this size class.
+    if (page->used == 0 && (page->prev != kNoPage || page->next != kNoPage)) {
+        RemovePage(index);
+        ReleasePage(index);
+    }
+}
+
+SlabManagedAllocator::Usage SlabManagedAllocator::GetUsage(int size_class) const {
+    DCHECK_GE(size_class, 0);
+    DCHECK_LT(size_class, kNumberOfSizeClasses);
+    Usage usage;
+    usage.chunk_size   = ChunkSize(size_class);
+    usage.pages        = class_pages_[size_class];
+    usage.used_chunks  = class_used_[size_class];
+    usage.total_chunks = usage.pages * ChunksPerPage(size_class);
+    return usage;
+}
+
+/*static*/ int SlabManagedAllocator::SizeClass(int size) {
+    DCHECK_LE(size, kMaxChunkSize);
+    if (size <= kSmallStepLimit) {
+        return size <= kSmallStep ? 0 : (size + kSmallStep - 1) / kSmallStep - 1;
+    }
+    return kSmallStepClasses +
+           (size - kSmallStepLimit + kLargeStep - 1) / kLargeStep - 1;
+}
+
+/*static*/ int SlabManagedAllocator::ChunkSize(int size_class) {
+    if (size_class < kSmallStepClasses) {
+        return (size_class + 1) * kSmallStep;
+    }
+    return kSmallStepLimit + (size_class - kSmallStepClasses + 1) * kLargeStep;
+}
+
+int SlabManagedAllocator::NewPage(int size_class) {
+    int index;
+    if (!free_pages_.empty()) {
+        index = free_pages_.back();
+        free_pages_.pop_back();
+    } else if (fresh_ < number_of_pages_) {
+        index = fresh_++;
+    } else {
+        return kNoPage;
+    }
+
+    auto page = &pages_[index];
+    page->size_class = size_class;
+    page->used       = 0;
+    page->bump       = 0;
+    page->free_list  = nullptr;
+    InsertPage(index);
+    class_pages_[size_class]++;
+    used_pages_++;
+    return index;
+}
+
+void SlabManagedAllocator::ReleasePage(int index) {
+    auto page = &pages_[index];
+    class_pages_[page->size_class]--;
+    used_pages_--;
+    if (madvise(PageAddress(index), kPageSize, MADV_DONTNEED) != 0) {
+        PLOG(WARNING) << "can not release page: " << index;
+    }
+    free_pages_.push_back(index);
+}
+
+void SlabManagedAllocator::InsertPage(int index) {
+    auto page = &pages_[index];
+    auto head = partial_[page->size_class];
+    page->prev = kNoPage;
+    page->next = head;
+    if (head != kNoPage) {
+        pages_[head].prev = index;
+    }
+    partial_[page->size_class] = index;
+}
+
+void SlabManagedAllocator::RemovePage(int index) {
+    auto page = &pages_[index];
+    if (page->prev != kNoPage) {
+        pages_[page->prev].next = page->next;
+    } else {
+        partial_[page->size_class] = page->next;
+    }
+    if (page->next != kNoPage) {
+        pages_[page->next].prev = page->prev;
+    }
+    page->prev = kNoPage;
+    page->next = kNoPage;
+}
+
+} // namespace mio
@@ -0,0 +1,124 @@
+#ifndef MIO_SLAB_MANAGED_ALLOCATOR_H_
+#define MIO_SLAB_MANAGED_ALLOCATOR_H_
+
+#include "managed-allocator.h"
+#include "glog/logging.h"
+#include <vector>
+
+namespace mio {
+
+/**
+ * Size-segregated slab allocator.
+ *
+ * A reserved range is cut into pages, a page holds chunks of one size class
+ * only. Pages have side bookkeeping (not in page header): size class, number
+ * of used chunks and a free chunk list. Pages with free chunks are linked in
+ * lists of their size class, so allocating is a list pop or a bump in the
+ * first page of the list.
+ *
+ * An empty page is given back to the OS by madvise, except the last one of
+ * its size class, the class may be reused soon. Large chunks and chunks out
+ * of reserved range are allocated by malloc.
+ *
+ * Only the thread running bit codes allocates and frees chunks.
+ */
+class SlabManagedAllocator : public ManagedAllocator {
+public:
+    static const int kMaxChunkSize = 1024;
+
+    static const int kNumberOfSizeClasses = 28;
+
+    static const int kMinAlignment = sizeof(void *) * 2;
+
+    // Reserved range, it is virtual memory only.
+    static const int kDefaultCapacity = 256 * 1024 * 1024;
+
+    // Utilization of a size class.
+    struct Usage {
+        int chunk_size;
+        int pages;
+        int used_chunks;
+        int total_chunks;
+    };
+
+    SlabManagedAllocator(int capacity, bool running_count)
+        : capacity_(capacity)
+        , running_count_(running_count) {}
+
+    virtual ~SlabManagedAllocator() override;
+
+    virtual bool Init() override;
+    virtual void Finialize() override;
+    virtual void *Allocate(int size) override;
+    virtual void Free(const void *p) override;
+
+    bool Contains(const void *p) const {
+        return p >= base_ && p < base_ + capacity_;
+    }
+
+    DEF_GETTER(int, capacity)
+
+    /**
+     * Pages are holding chunks.
+     */
+    DEF_GETTER(int, used_pages)
+
+    /**
+     * Number of chunks allocated by malloc.
+     */
+    DEF_GETTER(int, large_chunks)
+
+    Usage GetUsage(int size_class) const;
+
+    static int SizeClass(int size);
+
+    static int ChunkSize(int size_class);
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(SlabManagedAllocator)
+private:
+    struct Page {
+        int   size_class;
+        int   used;
+        int   bump;       // chunks never allocated start at it.
+        void *free_list;
+        int   prev;       // list of pages have free chunks.
+        int   next;
+    };
+
+    static const int kNoPage = -1;
+
+    int NewPage(int size_class);
+    void ReleasePage(int index);
+
+    void InsertPage(int index);
+    void RemovePage(int index);
+
+    uint8_t *PageAddress(int index) const {
+        return base_ + (static_cast<intptr_t>(index) << kPageSizeShift);
+    }
+
+    int PageIndex(const void *p) const {
+        return static_cast<int>((static_cast<const uint8_t *>(p) - base_) >> kPageSizeShift);
+    }
+
+    int ChunksPerPage(int size_class) const {
+        return kPageSize / ChunkSize(size_class);
+    }
+
+    int capacity_;
+    bool running_count_;
+    uint8_t *base_ = nullptr;
+    Page *pages_ = nullptr;
+    int number_of_pages_ = 0;
+    int fresh_ = 0; // next never used page.
+    int used_pages_ = 0;
+    int large_chunks_ = 0;
+    std::vector<int> free_pages_;
+    int partial_[kNumberOfSizeClasses];
+    int class_pages_[kNumberOfSizeClasses];
+    int class_used_[kNumberOfSizeClasses];
+}; // class SlabManagedAllocator
+
+} // namespace mio
+
+#endif // MIO_SLAB_MANAGED_ALLOCATOR_H_
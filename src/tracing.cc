@@ -35,7 +35,7 @@ bool TraceRecord::ResizeRecord(int new_tree_size) {
     return true;
 }
 
-bool TraceRecord::TraceFuncEntry(MIOGeneratedFunction *fn, int pc) {
+bool TraceRecord::TraceFuncEntry(MIOGeneratedFunction *fn, int pc, int *hit) {
     DCHECK_GE(fn->GetId(), 0);
     DCHECK_LT(fn->GetId(), tree_size_);
 
@@ -59,9 +59,19 @@ bool TraceRecord::TraceFuncEntry(MIOGeneratedFunction *fn, int pc) {
     } else {
         boundle->node = factory_->CreateFuncEntry(pc);
     }
+    if (hit && boundle->node) {
+        *hit = FuncEntry::cast(boundle->node)->hit();
+    }
     return boundle->node != nullptr;
 }
 
+void TraceRecord::ResetFuncEntry(MIOGeneratedFunction *fn) {
+    auto tree = GetTraceTreeOrNull(fn);
+    if (tree && tree->mutable_node(0)->node) {
+        FuncEntry::cast(tree->mutable_node(0)->node)->ResetHit();
+    }
+}
+
 bool TraceRecord::TraceLoopEntry(MIOGeneratedFunction *fn, int id, int pc, int *hit) {
     auto boundle = GetTraceBoundle(fn, id);
     if (!boundle) {
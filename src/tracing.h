@@ -46,7 +46,12 @@ public:
 
     bool ResizeRecord(int tree_size);
 
-    bool TraceFuncEntry(MIOGeneratedFunction *fn, int pc);
+    bool TraceFuncEntry(MIOGeneratedFunction *fn, int pc, int *hit);
+
+    /**
+     * Count hits of fn from zero again, after its native code was evicted.
+     */
+    void ResetFuncEntry(MIOGeneratedFunction *fn);
     bool TraceLoopEntry(MIOGeneratedFunction *fn, int id, int pc, int *hit);
     bool TraceLoopEdge(MIOGeneratedFunction *fn, int linked_id, int id, int pc);
     bool TraceGuardTrue(MIOGeneratedFunction *fn, bool value, int id, int pc);
@@ -74,6 +79,8 @@ public:
     TraceTree(int node_size) : node_size_(node_size) {}
     ~TraceTree() = default;
 
+    DEF_GETTER(int, node_size)
+
     bool Init(ManagedAllocator *allocator);
     void Finialize(ManagedAllocator *allocator);
 
@@ -123,6 +130,8 @@ public:
 
     void IncrHit() { ++hit_; }
 
+    void ResetHit() { hit_ = 0; }
+
     DECLARE_TRACE_NODE(FuncEntry)
 private:
     FuncEntry(int pc) : TraceNode(pc) {}
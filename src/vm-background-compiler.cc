@@ -0,0 +1,167 @@
+#include "vm-background-compiler.h"
+#include "vm-thread.h"
+#include "vm.h"
+#include "compiler.h"
+
+namespace mio {
+
+BackgroundCompiler::BackgroundCompiler(VM *vm, CodeCache *code_cache)
+    : vm_(DCHECK_NOTNULL(vm))
+    , code_cache_(DCHECK_NOTNULL(code_cache))
+    , finished_(nullptr) {
+}
+
+BackgroundCompiler::~BackgroundCompiler() {
+    Stop();
+    auto job = finished_.exchange(nullptr, std::memory_order_acquire);
+    while (job) {
+        auto next = job->next;
+        if (!job->code.empty()) {
+            code_cache_->Free(job->code);
+        }
+        delete job;
+        job = next;
+    }
+}
+
+void BackgroundCompiler::Start() {
+    DCHECK(thread_ == nullptr);
+    should_stop_ = false;
+    thread_ = new std::thread([&]() {
+        Run();
+    });
+}
+
+void BackgroundCompiler::Stop() {
+    if (!thread_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        should_stop_ = true;
+    }
+    wakeup_.notify_one();
+    DCHECK(thread_->joinable());
+    thread_->join();
+
+    delete thread_;
+    thread_ = nullptr;
+
+    // Never compiled jobs.
+    for (auto job : queue_) {
+        compiling_.erase(job->fn->GetId());
+        delete job;
+    }
+    queue_.clear();
+}
+
+bool BackgroundCompiler::Submit(MIOGeneratedFunction *fn, Kind kind,
+                                bool optimize) {
+    if (!thread_ || failed_.find(MakeKey(fn->GetId(), kind)) != failed_.end()) {
+        return false;
+    }
+    if (!compiling_.insert(fn->GetId()).second) {
+        return true;
+    }
+    auto job = new Job;
+    job->fn       = make_handle(fn);
+    job->kind     = kind;
+    job->optimize = optimize;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(job);
+    }
+    wakeup_.notify_one();
+    return true;
+}
+
+int BackgroundCompiler::InstallFinished() {
+    auto job = finished_.exchange(nullptr, std::memory_order_acquire);
+    auto thread = vm_->current();
+    // Jobs failed for space can be compiled again if cold code is evicted.
+    auto reclaimed = job && code_cache_->ReclaimForPending();
+    int installed = 0;
+    while (job) {
+        auto next = job->next;
+        auto fn = job->fn.get();
+        compiling_.erase(fn->GetId());
+
+        bool ok = false;
+        if (job->code.empty() && reclaimed) {
+            Submit(fn, job->kind, job->optimize);
+        } else if (job->code.empty()) {
+            // The function has the same codes, never try again.
+            failed_.insert(MakeKey(fn->GetId(), job->kind));
+        } else if (job->optimized) {
+            ok = thread->InstallOptimizedNativeCode(fn, job->code, job->entries,
+                                                    job->exits);
+        } else {
+            ok = thread->InstallNativeCode(fn, job->code);
+        }
+        installed += ok ? 1 : 0;
+        delete job;
+        job = next;
+    }
+    return installed;
+}
+
+bool BackgroundCompiler::IsCompiling(MIOGeneratedFunction *fn) const {
+    return compiling_.find(fn->GetId()) != compiling_.end();
+}
+
+void BackgroundCompiler::TEST_WaitForIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return queue_.empty() && busy_ == 0; });
+}
+
+void BackgroundCompiler::Run() {
+    for (;;) {
+        Job *job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait(lock, [this]() {
+                return should_stop_ || !queue_.empty();
+            });
+            if (should_stop_) {
+                break;
+            }
+            job = queue_.front();
+            queue_.pop_front();
+            ++busy_;
+        }
+
+        Compile(job);
+
+        // Publish the job, the interpreter links it at next safepoint.
+        job->next = finished_.load(std::memory_order_relaxed);
+        while (!finished_.compare_exchange_weak(job->next, job,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+        }
+        vm_->current()->RequestSafepoint(Thread::SAFEPOINT_INSTALL_CODE);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --busy_;
+        }
+        idle_.notify_all();
+    }
+}
+
+void BackgroundCompiler::Compile(Job *job) {
+    auto fn = job->fn.get();
+    if (job->kind != kBaseline && job->optimize) {
+        Compiler::BitCodeToOptimizedNativeCode(fn,
+                                               job->kind == kOnStackReplacement,
+                                               code_cache_, &job->code,
+                                               &job->entries, &job->exits);
+        job->optimized = !job->code.empty();
+    }
+    // Trace JIT takes place of on-stack replacement if fail.
+    if (job->code.empty() && job->kind != kOnStackReplacement) {
+        Compiler::BitCodeToNativeCode(fn, 0, 0, nullptr, code_cache_,
+                                      &job->code);
+    }
+}
+
+} // namespace mio
@@ -0,0 +1,112 @@
+#ifndef MIO_VM_BACKGROUND_COMPILER_H_
+#define MIO_VM_BACKGROUND_COMPILER_H_
+
+#include "vm-code-cache.h"
+#include "vm-objects.h"
+#include "handles.h"
+#include "base.h"
+#include "glog/logging.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+
+namespace mio {
+
+class VM;
+
+/**
+ * Compile hot functions in a dedicated thread, so the interpreter never stalls
+ * for compiling.
+ *
+ * Jobs are submitted by hotness counters of the interpreter. The compiler
+ * thread translates bit codes and copies native code into CodeCache, then
+ * publishes the finished job by an atomic pointer swap and requests a
+ * safepoint. The interpreter links finished code to its function at the
+ * safepoint (metadata comes from the managed allocator, it is not thread-safe)
+ * and picks it up at the next call or loop_entry.
+ *
+ * All functions except the compiling itself are called by the thread running
+ * bit codes.
+ */
+class BackgroundCompiler {
+public:
+    enum Kind: int {
+        kFunction,           // optimized code, or baseline code if fail.
+        kOnStackReplacement, // optimized code with side exits, for loop_entry.
+        kBaseline,           // baseline code only, after deoptimizing.
+    };
+
+    BackgroundCompiler(VM *vm, CodeCache *code_cache);
+    ~BackgroundCompiler();
+
+    void Start();
+    void Stop();
+
+    /**
+     * Put fn into compiling queue, it does nothing if fn is compiling.
+     *
+     * @param optimize use optimizing compiler.
+     * @return false if fn has been failed to be compiled for the same kind,
+     *         or the compiler is not running.
+     */
+    bool Submit(MIOGeneratedFunction *fn, Kind kind, bool optimize);
+
+    /**
+     * Link all finished native code to their functions, it is called at
+     * safepoints.
+     *
+     * @return number of installed functions.
+     */
+    int InstallFinished();
+
+    bool IsCompiling(MIOGeneratedFunction *fn) const;
+
+    /**
+     * Wait until all submitted jobs are finished, for testing.
+     */
+    void TEST_WaitForIdle();
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(BackgroundCompiler)
+private:
+    struct Job {
+        Handle<MIOGeneratedFunction> fn; // grabbed, can not be swept.
+        Kind             kind;
+        bool             optimize;
+        bool             optimized = false;
+        CodeRef          code = CodeRef(nullptr);
+        std::vector<int> entries;
+        std::vector<int> exits;
+        Job             *next = nullptr; // in finished list.
+    };
+
+    void Run();
+
+    void Compile(Job *job);
+
+    static int64_t MakeKey(int id, Kind kind) {
+        return (static_cast<int64_t>(id) << 2) | kind;
+    }
+
+    VM *vm_;
+    CodeCache *code_cache_;
+    std::thread *thread_ = nullptr;
+    bool should_stop_ = false;
+    int busy_ = 0; // compiling jobs.
+    std::deque<Job *> queue_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable idle_;
+    std::atomic<Job *> finished_;
+
+    // Only accessed by interpreter thread.
+    std::unordered_set<int> compiling_;
+    std::unordered_set<int64_t> failed_;
+}; // class BackgroundCompiler
+
+} // namespace mio
+
+#endif // MIO_VM_BACKGROUND_COMPILER_H_
@@ -0,0 +1,164 @@
+#include "vm-baseline-compiler.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "vm-thread.h"
+#include "vm-objects.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+class BaselineCompilerTest : public ::testing::Test {
+public:
+    virtual void SetUp() override {
+        cache_ = new CodeCache(16 * 1024);
+        ASSERT_TRUE(cache_->Init());
+        // Only the poll word of thread will be read by native code.
+        thread_ = new uint8_t[sizeof(Thread)]();
+    }
+
+    virtual void TearDown() override {
+        delete[] thread_;
+        delete cache_;
+    }
+
+    int Run(CodeRef code, int pc) {
+        auto native = reinterpret_cast<MIONativeFragment>(code.data());
+        native(reinterpret_cast<Thread *>(thread_), p_stack_, o_stack_, &pc);
+        return pc;
+    }
+
+protected:
+    CodeCache *cache_ = nullptr;
+    uint8_t *thread_ = nullptr;
+    uint8_t p_stack_[64] = {0};
+    uint8_t o_stack_[64] = {0};
+};
+
+TEST_F(BaselineCompilerTest, Loop) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.frame(24, 0, 0);              // [0]
+    builder.load_i32_imm(0, 0);           // [1] i = 0
+    builder.load_i32_imm(4, 0);           // [2] sum = 0
+    builder.load_i32_imm(8, 1);           // [3]
+    builder.load_i32_imm(12, 100);        // [4]
+    builder.cmp_i32(CC_LT, 16, 0, 12);    // [5] i < 100
+    builder.jz(0, 16, 5);                 // [6]
+    builder.add_i32(4, 4, 0);             // [7] sum += i
+    builder.mul_i32(20, 0, 0);            // [8] i * i
+    builder.add_i32(0, 0, 8);             // [9] i += 1
+    builder.jmp(-5);                      // [10]
+    builder.ret();                        // [11]
+
+    BaselineCompiler compiler(static_cast<uint64_t *>(code.offset(0)),
+                              builder.pc(), nullptr, 0);
+    auto native = compiler.Compile(cache_);
+    ASSERT_FALSE(native.empty());
+
+    EXPECT_EQ(0, Run(native, 0)); // frame has no template.
+    EXPECT_EQ(11, Run(native, 1));
+    EXPECT_EQ(100, *reinterpret_cast<int32_t *>(p_stack_ + 0));
+    EXPECT_EQ(4950, *reinterpret_cast<int32_t *>(p_stack_ + 4));
+    EXPECT_EQ(99 * 99, *reinterpret_cast<int32_t *>(p_stack_ + 20));
+    EXPECT_EQ(0, p_stack_[16]);
+}
+
+TEST_F(BaselineCompilerTest, ExitAndResume) {
+    mio_i64_t constants[] = { 0x100000000LL, 7 };
+
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.load_8b(0, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 0); // [0]
+    builder.load_8b(8, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 8); // [1]
+    builder.div_i64(16, 0, 8);                                     // [2]
+    builder.mov_o(8, 0);                                           // [3]
+    builder.call_val(24, 16, 0);                                   // [4]
+    builder.sub_i64(16, 16, 8);                                    // [5]
+    builder.ret();                                                 // [6]
+
+    BaselineCompiler compiler(static_cast<uint64_t *>(code.offset(0)),
+                              builder.pc(), constants, sizeof(constants));
+    auto native = compiler.Compile(cache_);
+    ASSERT_FALSE(native.empty());
+
+    *reinterpret_cast<void **>(o_stack_) = this;
+    EXPECT_EQ(4, Run(native, 0));
+    EXPECT_EQ(0x100000000LL / 7, *reinterpret_cast<mio_i64_t *>(p_stack_ + 16));
+    EXPECT_EQ(this, *reinterpret_cast<void **>(o_stack_ + 8));
+
+    EXPECT_EQ(6, Run(native, 5));
+    EXPECT_EQ(0x100000000LL / 7 - 7, *reinterpret_cast<mio_i64_t *>(p_stack_ + 16));
+
+    // div zero goes back to interpreter.
+    *reinterpret_cast<mio_i64_t *>(p_stack_ + 8) = 0;
+    EXPECT_EQ(2, Run(native, 2));
+}
+
+TEST_F(BaselineCompilerTest, TooFewTemplates) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.frame(16, 8, 0);      // [0]
+    builder.call_val(16, 8, 0);   // [1]
+    builder.mov_8b(-8, 0);        // [2]
+    builder.ret();                // [3]
+
+    BaselineCompiler compiler(static_cast<uint64_t *>(code.offset(0)),
+                              builder.pc(), nullptr, 0);
+    EXPECT_TRUE(compiler.Compile(cache_).empty());
+}
+
+TEST_F(BaselineCompilerTest, TraceLoop) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.frame(24, 0, 0);              // [0]
+    builder.load_i32_imm(0, 0);           // [1] i = 0
+    builder.load_i32_imm(4, 0);           // [2] sum = 0
+    builder.load_i32_imm(8, 1);           // [3]
+    builder.load_i32_imm(12, 100);        // [4]
+    builder.loop_entry(1, 0);             // [5]
+    builder.cmp_i32(CC_LT, 16, 0, 12);    // [6] i < 100
+    builder.jz(2, 16, 4);                 // [7]
+    builder.add_i32(4, 4, 0);             // [8] sum += i
+    builder.add_i32(0, 0, 8);             // [9] i += 1
+    builder.tail_jmp(1, 3, -5);           // [10]
+    builder.ret();                        // [11]
+
+    BaselineCompiler compiler(static_cast<uint64_t *>(code.offset(0)),
+                              builder.pc(), nullptr, 0);
+    auto native = compiler.CompileTrace(cache_, 5, nullptr);
+    ASSERT_FALSE(native.empty());
+
+    // The interpreter has run [1]~[4].
+    *reinterpret_cast<int32_t *>(p_stack_ + 8)  = 1;
+    *reinterpret_cast<int32_t *>(p_stack_ + 12) = 100;
+
+    // Only one entry, the loop exit is a side exit.
+    EXPECT_EQ(11, Run(native, 0));
+    EXPECT_EQ(100, *reinterpret_cast<int32_t *>(p_stack_ + 0));
+    EXPECT_EQ(4950, *reinterpret_cast<int32_t *>(p_stack_ + 4));
+}
+
+TEST_F(BaselineCompilerTest, TraceAbort) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.frame(24, 8, 0);              // [0]
+    builder.loop_entry(1, 0);             // [1]
+    builder.cmp_i32(CC_LT, 16, 0, 12);    // [2]
+    builder.jz(2, 16, 4);                 // [3]
+    builder.call_val(16, 8, 0);           // [4] no template in path.
+    builder.add_i32(0, 0, 8);             // [5]
+    builder.tail_jmp(1, 3, -5);           // [6]
+    builder.ret();                        // [7]
+
+    BaselineCompiler compiler(static_cast<uint64_t *>(code.offset(0)),
+                              builder.pc(), nullptr, 0);
+    EXPECT_TRUE(compiler.CompileTrace(cache_, 1, nullptr).empty());
+}
+
+} // namespace mio
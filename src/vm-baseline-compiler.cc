@@ -0,0 +1,550 @@
+#include "vm-baseline-compiler.h"
+#include "vm-bitcode-disassembler.h"
+#include "vm-bitcode.h"
+#include "vm-thread.h"
+#include "tracing.h"
+#include "yui/asm-amd64.h"
+#include "glog/logging.h"
+#include <assert.h>
+#include <string.h>
+
+namespace mio {
+
+namespace {
+
+// Fixed registers in native code, all of them are callee saved.
+const Reg kThread         = {kRBX};
+const Reg kExitPC         = {kR12};
+const Reg kPrimitiveStack = {kR14};
+const Reg kObjectStack    = {kR15};
+
+const int kPrologueSize     = 64;
+const int kMaxTemplateSize  = 64;
+const int kExitStubSize     = 16;
+const int kTableDispHolder  = 0x10000; // force disp32 for patching.
+
+const Cond kComparatorConds[MAX_CC_COMPARATORS] = {
+    Equal,        // CC_EQ
+    NotEqual,     // CC_NE
+    Less,         // CC_LT
+    LessEqual,    // CC_LE
+    Greater,      // CC_GT
+    GreaterEqual, // CC_GE
+};
+
+inline OpdRef Primitive(Opd *op, int offset) {
+    return Operand0(op, kPrimitiveStack, offset);
+}
+
+inline OpdRef Object(Opd *op, int offset) {
+    return Operand0(op, kObjectStack, offset);
+}
+
+void LoadPrimitive(Asm *state, Reg dst, int offset, int bytes) {
+    Opd op;
+    switch (bytes) {
+        case 1:
+            Emit_movb_r_op(state, dst, Primitive(&op, offset));
+            break;
+        case 2:
+            Emit_movw_r_op(state, dst, Primitive(&op, offset));
+            break;
+        default:
+            Emit_movq_r_op(state, dst, Primitive(&op, offset), bytes);
+            break;
+    }
+}
+
+void StorePrimitive(Asm *state, int offset, Reg src, int bytes) {
+    Opd op;
+    switch (bytes) {
+        case 1:
+            Emit_movb_op_r(state, Primitive(&op, offset), src);
+            break;
+        case 2:
+            Emit_movw_op_r(state, Primitive(&op, offset), src);
+            break;
+        default:
+            Emit_movq_op_r(state, Primitive(&op, offset), src, bytes);
+            break;
+    }
+}
+
+void StoreImmediate(Asm *state, int offset, int64_t value, int bytes) {
+    Opd op;
+    Imm imm = { static_cast<int32_t>(value) };
+    switch (bytes) {
+        case 1:
+            Emit_movb_op_i(state, Primitive(&op, offset), imm);
+            break;
+        case 2:
+            Emit_movw_op_i(state, Primitive(&op, offset), imm);
+            break;
+        case 4:
+            Emit_movq_op_i(state, Primitive(&op, offset), imm, 4);
+            break;
+        default:
+            if (value == imm.value) {
+                Emit_movq_op_i(state, Primitive(&op, offset), imm, 8);
+            } else {
+                Emit_movq_i64(state, rax, value);
+                Emit_movq_op_r(state, Primitive(&op, offset), rax, 8);
+            }
+            break;
+    }
+}
+
+// setcc byte [op]
+void EmitSetcc(Asm *state, Cond cc, OpdRef op) {
+    EmitOptionalRex32_op(state, op);
+    EmitB(state, 0x0F);
+    EmitB(state, 0x90 | cc);
+    EmitOperand(state, 0, op);
+}
+
+// jmp reg
+void EmitJmpReg(Asm *state, Reg addr) {
+    EmitOptionalRex32_r(state, addr);
+    EmitB(state, 0xFF);
+    EmitB(state, 0xC0 | (4 << 3) | RegLoBits(addr));
+}
+
+// cqo/cdq; idiv reg
+void EmitSignedDiv(Asm *state, Reg divisor, int bytes) {
+    if (bytes == 8) {
+        EmitRex64(state);
+    }
+    EmitB(state, 0x99);
+    if (bytes == 8) {
+        EmitRex64_r(state, divisor);
+    } else {
+        EmitOptionalRex32_r(state, divisor);
+    }
+    EmitB(state, 0xF7);
+    EmitB(state, 0xC0 | (7 << 3) | RegLoBits(divisor));
+}
+
+} // namespace
+
+CodeRef BaselineCompiler::Compile(CodeCache *cc) {
+    auto buf_size = kPrologueSize +
+                    (size_ + 1) * (kMaxTemplateSize + kExitStubSize) +
+                    (size_ + 1) * static_cast<int>(sizeof(int32_t));
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[buf_size]);
+    std::unique_ptr<YILabel[]> labels(new YILabel[size_ + 1]());
+    std::unique_ptr<YILabel[]> exits(new YILabel[size_ + 1]());
+    std::unique_ptr<int32_t[]> entries(new int32_t[size_ + 1]);
+
+    Asm state;
+    state.code = buf.get();
+    state.pc   = state.code;
+    state.size = buf_size;
+    state_  = &state;
+    labels_ = labels.get();
+    exits_  = exits.get();
+
+    EmitPrologue();
+
+    // Jump to the entry pc by table of offsets, they are relative to base, so
+    // native code can be moved by code cache compacting.
+    Opd op;
+    Emit_movq_r_op(&state, rax, Operand0(&op, kExitPC, 0), 4);
+    YILabel base = {0, 0};
+    Emit_call_l(&state, &base);
+    auto base_pos = PCOffset(&state);
+    Bind(&state, &base);
+    Emit_popq_r(&state, r11);
+    Emit_movq_r_op(&state, rax, Operand1(&op, r11, rax, times_4, kTableDispHolder), 4);
+    auto table_disp_pos = PCOffset(&state) - static_cast<int>(sizeof(int32_t));
+    Emit_addq_r_r(&state, rax, r11);
+    EmitJmpReg(&state, rax);
+
+    int templated = 0;
+    for (int i = 0; i < size_; ++i) {
+        Bind(&state, &labels_[i]);
+        entries[i] = PCOffset(&state) - base_pos;
+        if (EmitTemplate(i, code_[i])) {
+            ++templated;
+        }
+        DCHECK_LE(PCOffset(&state) - entries[i] - base_pos, kMaxTemplateSize);
+    }
+    // Run out of code, let interpreter process the guard.
+    Bind(&state, &labels_[size_]);
+    entries[size_] = PCOffset(&state) - base_pos;
+    EmitExit(size_);
+
+    // Too few bit codes have templates, running in native code is not better
+    // than interpreting.
+    if (templated * 2 < size_) {
+        return CodeRef(nullptr);
+    }
+
+    EmitEpilogue();
+
+    while (PCOffset(&state) % sizeof(int32_t)) {
+        Emit_int3(&state);
+    }
+    auto table_pos = PCOffset(&state);
+    for (int i = 0; i <= size_; ++i) {
+        EmitDW(&state, entries[i]);
+    }
+    int32_t table_disp = table_pos - base_pos;
+    memcpy(state.code + table_disp_pos, &table_disp, sizeof(table_disp));
+
+    DCHECK_LE(PCOffset(&state), buf_size);
+    return Install(cc);
+}
+
+CodeRef BaselineCompiler::CompileTrace(CodeCache *cc, int entry, TraceTree *tree) {
+    DCHECK_GE(entry, 0);
+    DCHECK_LT(entry, size_);
+    DCHECK_EQ(BC_loop_entry, BitCodeDisassembler::GetInst(code_[entry]));
+
+    std::vector<int> path;
+    if (!RecordTrace(entry, tree, &path)) {
+        return CodeRef(nullptr);
+    }
+
+    auto buf_size = kPrologueSize +
+                    static_cast<int>(path.size() + 1) * kMaxTemplateSize +
+                    (size_ + 1) * kExitStubSize;
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[buf_size]);
+    std::unique_ptr<YILabel[]> exits(new YILabel[size_ + 1]());
+
+    Asm state;
+    state.code = buf.get();
+    state.pc   = state.code;
+    state.size = buf_size;
+    state_  = &state;
+    labels_ = nullptr; // no jumping in a straight path.
+    exits_  = exits.get();
+
+    EmitPrologue();
+    YILabel head = {0, 0};
+    Bind(&state, &head);
+    for (size_t i = 0; i < path.size(); ++i) {
+        auto pc   = path[i];
+        auto next = i + 1 < path.size() ? path[i + 1] : entry;
+        auto bc   = code_[pc];
+        switch (BitCodeDisassembler::GetInst(bc)) {
+            case BC_jz:
+            case BC_jnz:
+                EmitGuard(pc, bc, next != pc + 1);
+                break;
+            case BC_jmp: // the path goes on at target.
+                break;
+            default:
+                if (!EmitTemplate(pc, bc)) {
+                    return CodeRef(nullptr);
+                }
+                break;
+        }
+    }
+    // Back-edge: poll safepoint then go on next iteration.
+    Opd op;
+    Operand0(&op, kThread, Thread::poll_word_offset());
+    Emit_cmpl_op_i(&state, &op, Imm{0});
+    Emit_jcc_l(&state, NotEqual, &exits_[entry], 1);
+    Emit_jmp_l(&state, &head, 1);
+
+    EmitEpilogue();
+    DCHECK_LE(PCOffset(&state), buf_size);
+    return Install(cc);
+}
+
+bool BaselineCompiler::RecordTrace(int entry, TraceTree *tree,
+                                   std::vector<int> *path) {
+    std::unique_ptr<bool[]> visited(new bool[size_]());
+    auto pc = entry;
+    do {
+        if (pc < 0 || pc >= size_ || visited[pc]) {
+            return false; // leave function or run into a nested loop.
+        }
+        visited[pc] = true;
+        path->push_back(pc);
+
+        auto bc = code_[pc];
+        switch (BitCodeDisassembler::GetInst(bc)) {
+            case BC_jz:
+            case BC_jnz: {
+                auto id     = BitCodeDisassembler::GetOp1(bc);
+                auto target = pc + BitCodeDisassembler::GetImm32(bc);
+                if (target < 0 || target > size_) {
+                    return false;
+                }
+                // Guard node's hit is the times of jumping to target.
+                auto taken = false;
+                if (tree && id > 0 && id < tree->node_size() &&
+                    tree->mutable_node(id)->node) {
+                    auto node = tree->mutable_node(id)->node;
+                    if (auto guard = GuardTrue::cast(node)) {
+                        taken = guard->hit() > guard->pass();
+                    } else if (auto guard = GuardFalse::cast(node)) {
+                        taken = guard->hit() > guard->pass();
+                    }
+                }
+                pc = taken ? target : pc + 1;
+            } break;
+
+            case BC_jmp:
+                pc += BitCodeDisassembler::GetImm32(bc);
+                break;
+
+            default:
+                ++pc;
+                break;
+        }
+    } while (pc != entry);
+    return true;
+}
+
+void BaselineCompiler::EmitGuard(int pc, uint64_t bc, bool hot_taken) {
+    auto target = pc + BitCodeDisassembler::GetImm32(bc);
+    if (target == pc + 1) {
+        return; // both directions are same.
+    }
+    auto jump_if_zero = BitCodeDisassembler::GetInst(bc) == BC_jz;
+
+    Opd op;
+    Emit_cmpb_op_i(state_, Primitive(&op, BitCodeDisassembler::GetOp2(bc)), Imm{0});
+    if (hot_taken) {
+        Emit_jcc_l(state_, jump_if_zero ? NotEqual : Equal, &exits_[pc + 1], 1);
+    } else {
+        Emit_jcc_l(state_, jump_if_zero ? Equal : NotEqual, &exits_[target], 1);
+    }
+}
+
+void BaselineCompiler::EmitPrologue() {
+    Emit_pushq_r(state_, rbp);
+    Emit_movq_r_r(state_, rbp, rsp, 8);
+    Emit_pushq_r(state_, kThread);
+    Emit_pushq_r(state_, kExitPC);
+    Emit_pushq_r(state_, kPrimitiveStack);
+    Emit_pushq_r(state_, kObjectStack);
+    Emit_movq_r_r(state_, kThread, RegArgv[0], 8);
+    Emit_movq_r_r(state_, kPrimitiveStack, RegArgv[1], 8);
+    Emit_movq_r_r(state_, kObjectStack, RegArgv[2], 8);
+    Emit_movq_r_r(state_, kExitPC, RegArgv[3], 8);
+}
+
+// Epilogue and exit stubs of all used exits.
+void BaselineCompiler::EmitEpilogue() {
+    YILabel epilogue = {0, 0};
+    Bind(state_, &epilogue);
+    Emit_xor_r_r(state_, rax, rax, 4);
+    Emit_popq_r(state_, kObjectStack);
+    Emit_popq_r(state_, kPrimitiveStack);
+    Emit_popq_r(state_, kExitPC);
+    Emit_popq_r(state_, kThread);
+    Emit_popq_r(state_, rbp);
+    Emit_ret_i(state_, 0);
+
+    Opd op;
+    for (int i = 0; i <= size_; ++i) {
+        if (YILabelIsUnused(&exits_[i])) {
+            continue;
+        }
+        Bind(state_, &exits_[i]);
+        Imm pc = { i };
+        Emit_movq_op_i(state_, Operand0(&op, kExitPC, 0), pc, 4);
+        Emit_jmp_l(state_, &epilogue, 1);
+    }
+}
+
+CodeRef BaselineCompiler::Install(CodeCache *cc) {
+    auto code_size = PCOffset(state_);
+    return cc->Install(state_->code, code_size);
+}
+
+bool BaselineCompiler::EmitTemplate(int pc, uint64_t bc) {
+    auto state = state_;
+    auto inst  = BitCodeDisassembler::GetInst(bc);
+    auto op1   = BitCodeDisassembler::GetOp1(bc);
+    auto op2   = BitCodeDisassembler::GetOp2(bc);
+    auto op3   = BitCodeDisassembler::GetOp3(bc);
+    auto val1  = BitCodeDisassembler::GetVal1(bc);
+    auto val2  = BitCodeDisassembler::GetVal2(bc);
+    auto imm32 = BitCodeDisassembler::GetImm32(bc);
+
+    Opd op;
+    switch (inst) {
+    #define DEFINE_CASE(byte, bit) \
+        case BC_load_##byte##b: \
+            if (op2 != BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT || imm32 < 0 || \
+                imm32 + (byte) > constant_primitive_size_) { \
+                break; \
+            } { \
+                mio_i##bit##_t value; \
+                memcpy(&value, constant_primitive_data_ + imm32, sizeof(value)); \
+                StoreImmediate(state, op1, value, byte); \
+            } return true;
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_load_i##bit##_imm: \
+            StoreImmediate(state, op1, static_cast<mio_i##bit##_t>(imm32), byte); \
+            return true;
+        MIO_SMI_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_mov_##byte##b: \
+            LoadPrimitive(state, rax, val2, byte); \
+            StorePrimitive(state, val1, rax, byte); \
+            return true;
+        MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
+    #undef DEFINE_CASE
+
+        case BC_mov_8b_pair: // the second one has its own template.
+            LoadPrimitive(state, rax, val2, 8);
+            StorePrimitive(state, val1, rax, 8);
+            return true;
+
+        case BC_mov_o:
+            Emit_movq_r_op(state, rax, Object(&op, val2), kObjectReferenceSize);
+            Emit_movq_op_r(state, Object(&op, val1), rax, kObjectReferenceSize);
+            return true;
+
+        case BC_load_imm_add_i64: // the second one has its own template.
+            StoreImmediate(state, op1, imm32, 8);
+            return true;
+
+        case BC_add_i32_imm:
+            LoadPrimitive(state, rax, op2, 4);
+            Emit_addl_r_i(state, rax, Imm{imm32});
+            StorePrimitive(state, op1, rax, 4);
+            return true;
+
+    #define DEFINE_CASE(byte, bit) \
+        case BC_add_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitArithOp_r_op(state, 0x03, rax, Primitive(&op, op3), byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_sub_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitArithOp_r_op(state, 0x2B, rax, Primitive(&op, op3), byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_and_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitArithOp_r_op(state, 0x23, rax, Primitive(&op, op3), byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_or_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitArithOp_r_op(state, 0x0B, rax, Primitive(&op, op3), byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_xor_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitArithOp_r_op(state, 0x33, rax, Primitive(&op, op3), byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_mul_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitSSEArith_r_op(state, 0, 0xAF, rax, Primitive(&op, op3), byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_inv_i##bit: \
+            LoadPrimitive(state, rax, op2, byte); \
+            Emit_not_r(state, rax, byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true; \
+        case BC_div_i##bit: \
+            LoadPrimitive(state, rcx, op3, byte); \
+            Emit_test_r_r(state, rcx, rcx, byte); \
+            Emit_jcc_l(state, Zero, &exits_[pc], 1); \
+            EmitArithOp_r_i(state, 0x7, rcx, Imm{-1}, byte); \
+            Emit_jcc_l(state, Equal, &exits_[pc], 1); \
+            LoadPrimitive(state, rax, op2, byte); \
+            EmitSignedDiv(state, rcx, byte); \
+            StorePrimitive(state, op1, rax, byte); \
+            return true;
+        DEFINE_CASE(4, 32)
+        DEFINE_CASE(8, 64)
+    #undef DEFINE_CASE
+
+    #define DEFINE_CASE(byte, bit, move_x_op, move_op_x, suffix) \
+        case BC_add_f##bit: \
+            move_x_op(state, xmm0, Primitive(&op, op2)); \
+            Emit_add##suffix##_x_op(state, xmm0, Primitive(&op, op3)); \
+            move_op_x(state, Primitive(&op, op1), xmm0); \
+            return true; \
+        case BC_sub_f##bit: \
+            move_x_op(state, xmm0, Primitive(&op, op2)); \
+            Emit_sub##suffix##_x_op(state, xmm0, Primitive(&op, op3)); \
+            move_op_x(state, Primitive(&op, op1), xmm0); \
+            return true; \
+        case BC_mul_f##bit: \
+            move_x_op(state, xmm0, Primitive(&op, op2)); \
+            Emit_mul##suffix##_x_op(state, xmm0, Primitive(&op, op3)); \
+            move_op_x(state, Primitive(&op, op1), xmm0); \
+            return true; \
+        case BC_div_f##bit: \
+            move_x_op(state, xmm0, Primitive(&op, op2)); \
+            Emit_div##suffix##_x_op(state, xmm0, Primitive(&op, op3)); \
+            move_op_x(state, Primitive(&op, op1), xmm0); \
+            return true;
+        DEFINE_CASE(4, 32, Emit_movss_x_op, Emit_movss_op_x, ss)
+        DEFINE_CASE(8, 64, Emit_movsd_x_op, Emit_movsd_op_x, sd)
+    #undef DEFINE_CASE
+
+        case BC_cmp_i32:
+        case BC_cmp_i64:
+        case BC_cmp_i64_jz:  // the second one has its own template.
+        case BC_cmp_i64_jnz: {
+            if (op1 >= MAX_CC_COMPARATORS) {
+                break;
+            }
+            auto bytes = inst == BC_cmp_i32 ? 4 : 8;
+            LoadPrimitive(state, rax, val1, bytes);
+            EmitArithOp_r_op(state, 0x3B, rax, Primitive(&op, val2), bytes);
+            EmitSetcc(state, kComparatorConds[op1], Primitive(&op, op2));
+        } return true;
+
+        case BC_logic_not:
+            Emit_cmpb_op_i(state, Primitive(&op, op2), Imm{0});
+            EmitSetcc(state, Equal, Primitive(&op, op1));
+            return true;
+
+        case BC_jz:
+        case BC_jnz: {
+            auto target = pc + imm32;
+            if (target < 0 || target > size_) {
+                break;
+            }
+            Emit_cmpb_op_i(state, Primitive(&op, op2), Imm{0});
+            Emit_jcc_l(state, inst == BC_jz ? Equal : NotEqual,
+                       &labels_[target], 1);
+        } return true;
+
+        case BC_jmp: {
+            auto target = pc + imm32;
+            if (target < 0 || target > size_) {
+                break;
+            }
+            if (target <= pc) { // back-edge
+                Operand0(&op, kThread, Thread::poll_word_offset());
+                Emit_cmpl_op_i(state, &op, Imm{0});
+                Emit_jcc_l(state, NotEqual, &exits_[pc], 1);
+            }
+            Emit_jmp_l(state, &labels_[target], 1);
+        } return true;
+
+        case BC_loop_entry: // tracing only in interpreter.
+            return true;
+
+        default:
+            break;
+    }
+    EmitExit(pc);
+    return false;
+}
+
+void BaselineCompiler::EmitExit(int pc) {
+    Emit_jmp_l(state_, &exits_[pc], 1);
+}
+
+} // namespace mio
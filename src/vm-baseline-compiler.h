@@ -0,0 +1,93 @@
+#ifndef MIO_VM_BASELINE_COMPILER_H_
+#define MIO_VM_BASELINE_COMPILER_H_
+
+#include "vm-code-cache.h"
+#include "base.h"
+#include <memory>
+#include <vector>
+
+struct Asm;
+struct YILabel;
+
+namespace mio {
+
+class TraceTree;
+
+/**
+ * Baseline JIT: translate a whole function's bit codes to amd64 code, every
+ * bit code maps to a fixed template.
+ *
+ * The native code is a MIONativeFragment:
+ *
+ * int native(Thread *thread, void *p_base, void *o_base, int *pc)
+ *
+ * It starts from *pc and runs until a bit code without template, then stores
+ * that pc to *pc and returns to interpreter, which runs it and can resume the
+ * native code at any pc. r14/r15 hold the primitive and object stack bases.
+ *
+ * Templates: primitive loads/moves, i32/i64 and f32/f64 arithmetic, integer
+ * comparing, branches and back-edges (polling safepoint). Others, e.g. calling,
+ * returning and object operations, go back to interpreter.
+ *
+ * A hot loop can be compiled alone as a trace: the path from its loop_entry
+ * following the hotter direction of every guard, see CompileTrace().
+ */
+class BaselineCompiler {
+public:
+    BaselineCompiler(const uint64_t *code, int size,
+                     const void *constant_primitive_data,
+                     int constant_primitive_size)
+        : code_(code)
+        , size_(size)
+        , constant_primitive_data_(static_cast<const uint8_t *>(constant_primitive_data))
+        , constant_primitive_size_(constant_primitive_size) {}
+
+    /**
+     * Translate bit codes to native code in code cache.
+     *
+     * @return empty CodeRef if too few bit codes have templates or code cache
+     *         is full.
+     */
+    CodeRef Compile(CodeCache *cc);
+
+    /**
+     * Record the hot path of loop begins at loop_entry pc: every jz/jnz goes
+     * to its more hit direction in trace tree (fall through if no record),
+     * until jumping back to entry. Then translate the path to a straight
+     * native loop, the cold directions of guards become side exits.
+     *
+     * The native code only can be entered at entry, *pc is ignored.
+     *
+     * @return empty CodeRef if the path leaves function, runs into a nested
+     *         loop or a bit code without template.
+     */
+    CodeRef CompileTrace(CodeCache *cc, int entry, TraceTree *tree);
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(BaselineCompiler)
+private:
+    /**
+     * @return false if bit code has no template, an exit was emitted.
+     */
+    bool EmitTemplate(int pc, uint64_t bc);
+    void EmitExit(int pc);
+
+    bool RecordTrace(int entry, TraceTree *tree, std::vector<int> *path);
+    void EmitGuard(int pc, uint64_t bc, bool hot_taken);
+
+    void EmitPrologue();
+    void EmitEpilogue();
+    CodeRef Install(CodeCache *cc);
+
+    const uint64_t *code_;
+    int size_;
+    const uint8_t *constant_primitive_data_;
+    int constant_primitive_size_;
+
+    Asm *state_ = nullptr;
+    YILabel *labels_ = nullptr; // jumping targets, one for every pc.
+    YILabel *exits_  = nullptr; // exit stubs, one for every pc.
+}; // class BaselineCompiler
+
+} // namespace mio
+
+#endif // MIO_VM_BASELINE_COMPILER_H_
@@ -331,6 +331,14 @@ public:
         return Emit3Addr(BC_close_fn, fn, 0, 0);
     }
 
+    int call(uint16_t base1, uint16_t base2, int32_t global_fn) {
+        return Emit3Addr(BC_call, base1, base2, global_fn);
+    }
+
+    int tail_call(uint16_t clean2, int32_t global_fn) {
+        return Emit3Addr(BC_tail_call, 0, clean2, global_fn);
+    }
+
     int call_val(uint16_t base1, uint16_t base2, int32_t obj) {
         return Emit3Addr(BC_call_val, base1, base2, obj);
     }
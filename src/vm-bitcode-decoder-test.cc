@@ -0,0 +1,92 @@
+#include "vm-bitcode-decoder.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+TEST(BitCodeDecoderTest, Sanity) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.frame(16, 8, 0);         // [0]
+    builder.load_i32_imm(0, 100);    // [1]
+    builder.mov_8b(-8, 0);           // [2]
+    builder.jz(1, 0, -2);            // [3]
+    builder.jmp(2);                  // [4]
+    builder.ret();                   // [5]
+
+    auto decoded = BitCodeDecoder::Decode(static_cast<uint64_t *>(code.offset(0)),
+                                          builder.pc(), nullptr);
+    ASSERT_NE(nullptr, decoded);
+    ASSERT_EQ(0, reinterpret_cast<uintptr_t>(decoded) % kDecodedBitCodeAlignment);
+
+    EXPECT_EQ(BC_frame, decoded[0].inst);
+    EXPECT_EQ(16, decoded[0].op1);
+    EXPECT_EQ(8, decoded[0].op2);
+    EXPECT_EQ(nullptr, decoded[0].handler);
+
+    EXPECT_EQ(BC_load_i32_imm, decoded[1].inst);
+    EXPECT_EQ(100, decoded[1].imm32);
+
+    EXPECT_EQ(BC_mov_8b, decoded[2].inst);
+    EXPECT_EQ(-8, decoded[2].val1);
+    EXPECT_EQ(0, decoded[2].val2);
+
+    EXPECT_EQ(BC_jz, decoded[3].inst);
+    EXPECT_EQ(1, decoded[3].op1);
+    EXPECT_EQ(1, decoded[3].target);
+
+    EXPECT_EQ(BC_jmp, decoded[4].inst);
+    EXPECT_EQ(6, decoded[4].target);
+
+    EXPECT_EQ(BC_ret, decoded[5].inst);
+
+    // guard
+    EXPECT_EQ(0xff, decoded[6].inst);
+    BitCodeDecoder::Free(decoded);
+}
+
+TEST(BitCodeDecoderTest, Handlers) {
+    void *handlers[MAX_BC_INSTRUCTIONS + 1];
+    for (int i = 0; i < MAX_BC_INSTRUCTIONS + 1; ++i) {
+        handlers[i] = &handlers[i];
+    }
+
+    DecodedBitCode decoded;
+    BitCodeDecoder::Decode(BitCodeBuilder::Make3AddrBC(BC_add_i64, 1, 2, 3), 0,
+                           handlers, &decoded);
+    EXPECT_EQ(&handlers[BC_add_i64], decoded.handler);
+    EXPECT_EQ(1, decoded.op1);
+    EXPECT_EQ(2, decoded.op2);
+    EXPECT_EQ(3, decoded.op3);
+
+    BitCodeDecoder::Decode(static_cast<uint64_t>(0xfe) << 56, 0, handlers,
+                           &decoded);
+    EXPECT_EQ(&handlers[MAX_BC_INSTRUCTIONS], decoded.handler);
+}
+
+TEST(BitCodeDecoderTest, CallSiteCaches) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.call_val(16, 8, 0);   // [0]
+    builder.mov_8b(-8, 0);        // [1]
+    builder.call_val(16, 8, 8);   // [2]
+    builder.ret();                // [3]
+
+    auto decoded = BitCodeDecoder::Decode(static_cast<uint64_t *>(code.offset(0)),
+                                          builder.pc(), nullptr);
+    ASSERT_NE(nullptr, decoded);
+
+    auto first = GetCallSiteCache(&decoded[0]);
+    auto second = GetCallSiteCache(&decoded[2]);
+    EXPECT_EQ(reinterpret_cast<CallSiteCache *>(&decoded[5]), first);
+    EXPECT_EQ(first + 1, second);
+    EXPECT_EQ(nullptr, first->callee);
+    EXPECT_EQ(0, second->misses);
+    BitCodeDecoder::Free(decoded);
+}
+
+} // namespace mio
@@ -0,0 +1,78 @@
+#include "vm-bitcode-decoder.h"
+#include "vm-bitcode-disassembler.h"
+#include "vm-bitcode.h"
+#include "glog/logging.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace mio {
+
+/*static*/
+DecodedBitCode *BitCodeDecoder::Decode(const uint64_t *bc, int size,
+                                       void *const *handlers) {
+    DCHECK_GE(size, 0);
+
+    int call_sites = 0;
+    for (int i = 0; i < size; ++i) {
+        auto inst = BitCodeDisassembler::GetInst(bc[i]);
+        if (inst == BC_call || inst == BC_call_val || inst == BC_tail_call) {
+            ++call_sites;
+        }
+    }
+
+    void *chunk = nullptr;
+    if (posix_memalign(&chunk, kDecodedBitCodeAlignment,
+                       (size + 1) * sizeof(DecodedBitCode) +
+                       call_sites * sizeof(CallSiteCache)) != 0) {
+        return nullptr;
+    }
+    auto decoded = static_cast<DecodedBitCode *>(chunk);
+    auto caches  = reinterpret_cast<CallSiteCache *>(decoded + size + 1);
+    memset(caches, 0, call_sites * sizeof(CallSiteCache));
+
+    call_sites = 0;
+    for (int i = 0; i < size; ++i) {
+        Decode(bc[i], i, handlers, &decoded[i]);
+        if (decoded[i].inst == BC_call || decoded[i].inst == BC_call_val ||
+            decoded[i].inst == BC_tail_call) {
+            decoded[i].target = size + 1 + call_sites++ - i;
+        }
+    }
+    // The last one is a guard, run out of code is a bad bit code.
+    Decode(static_cast<uint64_t>(0xff) << 56, size, handlers, &decoded[size]);
+    return decoded;
+}
+
+/*static*/
+void BitCodeDecoder::Decode(uint64_t bc, int pc, void *const *handlers,
+                            DecodedBitCode *decoded) {
+    auto inst = BitCodeDisassembler::GetInst(bc);
+
+    decoded->handler = !handlers ? nullptr :
+            handlers[inst < MAX_BC_INSTRUCTIONS ? static_cast<int>(inst) :
+                     static_cast<int>(MAX_BC_INSTRUCTIONS)];
+    decoded->inst    = inst;
+    decoded->flags   = 0;
+    decoded->op1     = BitCodeDisassembler::GetOp1(bc);
+    decoded->op2     = BitCodeDisassembler::GetOp2(bc);
+    decoded->op3     = BitCodeDisassembler::GetOp3(bc);
+    decoded->val1    = BitCodeDisassembler::GetVal1(bc);
+    decoded->val2    = BitCodeDisassembler::GetVal2(bc);
+    decoded->imm32   = BitCodeDisassembler::GetImm32(bc);
+    switch (inst) {
+        case BC_jz:
+        case BC_jnz:
+        case BC_jmp:
+            decoded->target = pc + decoded->imm32;
+            break;
+        default:
+            decoded->target = 0;
+            break;
+    }
+}
+
+/*static*/ void BitCodeDecoder::Free(DecodedBitCode *decoded) {
+    ::free(decoded);
+}
+
+} // namespace mio
@@ -0,0 +1,98 @@
+#ifndef MIO_VM_BITCODE_DECODER_H_
+#define MIO_VM_BITCODE_DECODER_H_
+
+#include "base.h"
+
+namespace mio {
+
+class HeapObject;
+class MIOFunction;
+
+/**
+ * The pre-decoded bit code, interpreter runs on it instead of the packed
+ * 64 bits bit code, so every field is ready for using without any shifting
+ * and masking.
+ *
+ * The index of decoded bit code is same as the packed one, so the pc can be
+ * used for debug info and tracing directly.
+ */
+struct DecodedBitCode {
+    void    *handler; // handler address for direct-threaded dispatching.
+    uint8_t  inst;
+    uint8_t  flags;
+    uint16_t op1;
+    uint16_t op2;
+    uint16_t op3;
+    int16_t  val1;
+    int16_t  val2;
+    int32_t  imm32;
+    int32_t  target;  // absolute pc of jumping target, or distance to the
+                      // call site cache for calling bit codes.
+}; // struct DecodedBitCode
+
+static_assert(sizeof(DecodedBitCode) == 32, "DecodedBitCode should be 32 bytes.");
+
+/**
+ * Inline cache of a call_val site. The caches are placed after the decoded
+ * bit codes, one for each call, call_val or tail_call, so the side table is
+ * indexed by pc through the call's target. Static and tail call's cache is
+ * bound to its global function once by linking and never missed.
+ */
+struct CallSiteCache {
+    HeapObject  *callee; // the last called function or closure object.
+    MIOFunction *fn;     // the unwrapped function of callee.
+    union {
+        DecodedBitCode *code; // generated function's code.
+        struct {
+            int32_t primitive_size;
+            int32_t object_size;
+        } args;               // native function's frame sizes.
+    };
+    uint32_t epoch;      // GC callable epoch when it be filled.
+    uint32_t misses;
+}; // struct CallSiteCache
+
+static_assert(sizeof(CallSiteCache) == sizeof(DecodedBitCode),
+              "CallSiteCache should be same size as DecodedBitCode.");
+
+// The call site has seen so many callees, use the shared lookup.
+static const uint32_t kCallSiteMaxMisses = 4;
+
+inline CallSiteCache *GetCallSiteCache(DecodedBitCode *bc) {
+    return reinterpret_cast<CallSiteCache *>(bc + bc->target);
+}
+
+static const int kDecodedBitCodeAlignment = 32;
+
+// The site has seen more than one shape, never quicken it again.
+static const uint8_t kDecodedNoQuickening = 0x1;
+
+class BitCodeDecoder {
+public:
+    /**
+     * Decode all bit codes to a cache aligned array, the empty call site
+     * caches follow it.
+     *
+     * @param bc the packed bit codes.
+     * @param size number of the packed bit codes.
+     * @param handlers handler address table, index by instruction, the last
+     *        one (handlers[MAX_BC_INSTRUCTIONS]) is for bad instructions.
+     *        it can be null when dispatching by switch.
+     * @return null if out of memory.
+     */
+    static DecodedBitCode *Decode(const uint64_t *bc, int size,
+                                  void *const *handlers);
+
+    static void Decode(uint64_t bc, int pc, void *const *handlers,
+                       DecodedBitCode *decoded);
+
+    static void Free(DecodedBitCode *decoded);
+
+    BitCodeDecoder() = delete;
+    ~BitCodeDecoder() = delete;
+    DISALLOW_IMPLICIT_CONSTRUCTORS(BitCodeDecoder)
+}; // class BitCodeDecoder
+
+} // namespace mio
+
+#endif // MIO_VM_BITCODE_DECODER_H_
@@ -44,6 +44,8 @@ void BitCodeDisassembler::Disassemble(uint64_t bc) {
         case BC_mov_4b:
         case BC_mov_8b:
         case BC_mov_o:
+            // fallthrough
+        case BC_mov_8b_pair:
             stream_->Printf("[%d] [%d]", GetVal1(bc), GetVal2(bc));
             break;
 
@@ -75,6 +77,9 @@ void BitCodeDisassembler::Disassemble(uint64_t bc) {
         case BC_cmp_i64:
         case BC_cmp_f32:
         case BC_cmp_f64:
+            // fallthrough
+        case BC_cmp_i64_jz:
+        case BC_cmp_i64_jnz:
             DCHECK_LT(GetOp1(bc), MAX_CC_COMPARATORS);
             stream_->Printf("<%s> [%u] [%d] [%d]",
                             kComparatorText[GetOp1(bc)],
@@ -208,6 +213,10 @@ void BitCodeDisassembler::Disassemble(uint64_t bc) {
                             GetImm32(bc));
             break;
 
+        case BC_tail_call:
+            stream_->Printf("[%u] @%d", GetOp2(bc), GetImm32(bc));
+            break;
+
         case BC_call_val:
             stream_->Printf("%u %u [%d]", GetOp1(bc), GetOp2(bc), GetImm32(bc));
             break;
@@ -250,6 +259,10 @@ void BitCodeDisassembler::Disassemble(uint64_t bc) {
             stream_->Printf("%d@native #%d", GetImm32(bc), GetOp2(bc));
             break;
 
+        case BC_load_imm_add_i64:
+            stream_->Printf("[%u] %d", GetOp1(bc), GetImm32(bc));
+            break;
+
         default:
             DLOG(FATAL) << "instruction: " << metadata->text << " not support yet";
             break;
@@ -0,0 +1,76 @@
+#include "vm-bitcode-fusion.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode-disassembler.h"
+#include "vm-bitcode.h"
+#include "vm-memory-segment.h"
+#include "gtest/gtest.h"
+
+namespace mio {
+
+TEST(BitCodeFusionTest, CompareAndBranch) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.cmp_i64(CC_GT, 28, 0, 20); // [0]
+    builder.jz(3, 28, 3);              // [1]
+    builder.cmp_i64(CC_LT, 28, 0, 20); // [2]
+    builder.jnz(0, 16, 3);             // [3] not the result of comparing
+
+    BitCodeFusion fusion(nullptr, 0);
+    auto bc = static_cast<uint64_t *>(code.offset(0));
+    ASSERT_EQ(1, fusion.Run(bc, builder.pc()));
+
+    EXPECT_EQ(BC_cmp_i64_jz, BitCodeDisassembler::GetInst(bc[0]));
+    EXPECT_EQ(CC_GT, BitCodeDisassembler::GetOp1(bc[0]));
+    EXPECT_EQ(28, BitCodeDisassembler::GetOp2(bc[0]));
+    EXPECT_EQ(0, BitCodeDisassembler::GetVal1(bc[0]));
+    EXPECT_EQ(20, BitCodeDisassembler::GetVal2(bc[0]));
+    EXPECT_EQ(BC_jz, BitCodeDisassembler::GetInst(bc[1]));
+    EXPECT_EQ(BC_cmp_i64, BitCodeDisassembler::GetInst(bc[2]));
+}
+
+TEST(BitCodeFusionTest, LoadImmediateAndAdd) {
+    mio_i64_t constants[] = { 1, 0x100000000LL };
+
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.load_8b(32, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 0); // [0]
+    builder.add_i64(40, 0, 32);                                     // [1]
+    builder.load_8b(32, BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT, 8); // [2]
+    builder.add_i64(40, 0, 32);                                     // [3]
+
+    BitCodeFusion fusion(constants, sizeof(constants));
+    auto bc = static_cast<uint64_t *>(code.offset(0));
+    ASSERT_EQ(1, fusion.Run(bc, builder.pc()));
+
+    EXPECT_EQ(BC_load_imm_add_i64, BitCodeDisassembler::GetInst(bc[0]));
+    EXPECT_EQ(32, BitCodeDisassembler::GetOp1(bc[0]));
+    EXPECT_EQ(1, BitCodeDisassembler::GetImm32(bc[0]));
+    EXPECT_EQ(BC_add_i64, BitCodeDisassembler::GetInst(bc[1]));
+
+    // constant out of 32 bits range.
+    EXPECT_EQ(BC_load_8b, BitCodeDisassembler::GetInst(bc[2]));
+}
+
+TEST(BitCodeFusionTest, MovePair) {
+    MemorySegment code;
+    BitCodeBuilder builder(&code);
+
+    builder.mov_8b(64, 0);  // [0]
+    builder.mov_8b(72, 48); // [1]
+    builder.mov_8b(80, 8);  // [2]
+
+    BitCodeFusion fusion(nullptr, 0);
+    auto bc = static_cast<uint64_t *>(code.offset(0));
+    ASSERT_EQ(1, fusion.Run(bc, builder.pc()));
+
+    EXPECT_EQ(BC_mov_8b_pair, BitCodeDisassembler::GetInst(bc[0]));
+    EXPECT_EQ(64, BitCodeDisassembler::GetVal1(bc[0]));
+    EXPECT_EQ(0, BitCodeDisassembler::GetVal2(bc[0]));
+    EXPECT_EQ(BC_mov_8b, BitCodeDisassembler::GetInst(bc[1]));
+    // pairs never overlap.
+    EXPECT_EQ(BC_mov_8b, BitCodeDisassembler::GetInst(bc[2]));
+}
+
+} // namespace mio
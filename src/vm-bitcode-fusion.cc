@@ -0,0 +1,90 @@
+#include "vm-bitcode-fusion.h"
+#include "vm-bitcode-builder.h"
+#include "vm-bitcode-disassembler.h"
+#include "vm-bitcode.h"
+#include "glog/logging.h"
+#include <limits>
+
+namespace mio {
+
+int BitCodeFusion::Run(uint64_t *bc, int size) {
+    int fused = 0;
+    for (int i = 0; i < size - 1; ++i) {
+        if (FuseCompareAndBranch(bc + i) ||
+            FuseLoadImmediateAndAdd(bc + i) ||
+            FuseMovePair(bc + i)) {
+            ++fused;
+            ++i; // skip the second one of the pair.
+        }
+    }
+    return fused;
+}
+
+bool BitCodeFusion::FuseCompareAndBranch(uint64_t *bc) {
+    if (BitCodeDisassembler::GetInst(bc[0]) != BC_cmp_i64) {
+        return false;
+    }
+
+    BCInstruction fused;
+    switch (BitCodeDisassembler::GetInst(bc[1])) {
+        case BC_jz:
+            fused = BC_cmp_i64_jz;
+            break;
+        case BC_jnz:
+            fused = BC_cmp_i64_jnz;
+            break;
+        default:
+            return false;
+    }
+    // The result of comparing must be the condition of branch.
+    if (BitCodeDisassembler::GetOp2(bc[0]) != BitCodeDisassembler::GetOp2(bc[1])) {
+        return false;
+    }
+    bc[0] = BitCodeBuilder::Make4OpBC(fused,
+                                      BitCodeDisassembler::GetOp1(bc[0]),
+                                      BitCodeDisassembler::GetOp2(bc[0]),
+                                      BitCodeDisassembler::GetVal1(bc[0]),
+                                      BitCodeDisassembler::GetVal2(bc[0]));
+    return true;
+}
+
+bool BitCodeFusion::FuseLoadImmediateAndAdd(uint64_t *bc) {
+    if (BitCodeDisassembler::GetInst(bc[0]) != BC_load_8b ||
+        BitCodeDisassembler::GetOp2(bc[0]) != BC_FUNCTION_CONSTANT_PRIMITIVE_SEGMENT ||
+        BitCodeDisassembler::GetInst(bc[1]) != BC_add_i64) {
+        return false;
+    }
+
+    auto dest   = BitCodeDisassembler::GetOp1(bc[0]);
+    auto offset = BitCodeDisassembler::GetImm32(bc[0]);
+    if (BitCodeDisassembler::GetOp2(bc[1]) != dest &&
+        BitCodeDisassembler::GetOp3(bc[1]) != dest) {
+        return false;
+    }
+    if (offset < 0 || offset + static_cast<int>(sizeof(mio_i64_t)) > constant_primitive_size_) {
+        return false;
+    }
+
+    mio_i64_t value;
+    memcpy(&value, constant_primitive_data_ + offset, sizeof(value));
+    if (value < std::numeric_limits<int32_t>::min() ||
+        value > std::numeric_limits<int32_t>::max()) {
+        return false;
+    }
+    bc[0] = BitCodeBuilder::Make3AddrBC(BC_load_imm_add_i64, dest, 0,
+                                        static_cast<int32_t>(value));
+    return true;
+}
+
+bool BitCodeFusion::FuseMovePair(uint64_t *bc) {
+    if (BitCodeDisassembler::GetInst(bc[0]) != BC_mov_8b ||
+        BitCodeDisassembler::GetInst(bc[1]) != BC_mov_8b) {
+        return false;
+    }
+    bc[0] = BitCodeBuilder::MakeS2AddrBC(BC_mov_8b_pair,
+                                         BitCodeDisassembler::GetVal1(bc[0]),
+                                         BitCodeDisassembler::GetVal2(bc[0]));
+    return true;
+}
+
+} // namespace mio
@@ -0,0 +1,48 @@
+#ifndef MIO_VM_BITCODE_FUSION_H_
+#define MIO_VM_BITCODE_FUSION_H_
+
+#include "base.h"
+
+namespace mio {
+
+/**
+ * Peephole pass for fusing hot bit code pairs to superinstructions:
+ *
+ * cmp_i64 + jz/jnz   -> cmp_i64_jz/cmp_i64_jnz (compare and branch)
+ * load_8b + add_i64  -> load_imm_add_i64       (constant fits in 32 bits)
+ * mov_8b  + mov_8b   -> mov_8b_pair
+ *
+ * Only the first bit code of pair will be replaced, the second one is kept
+ * for jumping in and skipped by the superinstruction. So pc, jumping delta
+ * and debug info are all unchanged.
+ *
+ * Pairs are chosen by executed pairs counting of interpreter, build with
+ * MIO_PROFILE_BC_PAIRS and see test P029_BitCodePairs.
+ */
+class BitCodeFusion {
+public:
+    BitCodeFusion(const void *constant_primitive_data,
+                  int constant_primitive_size)
+        : constant_primitive_data_(static_cast<const uint8_t *>(constant_primitive_data))
+        , constant_primitive_size_(constant_primitive_size) {}
+
+    /**
+     * Fuse bit codes in place.
+     *
+     * @return number of fused pairs.
+     */
+    int Run(uint64_t *bc, int size);
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(BitCodeFusion)
+private:
+    bool FuseCompareAndBranch(uint64_t *bc);
+    bool FuseLoadImmediateAndAdd(uint64_t *bc);
+    bool FuseMovePair(uint64_t *bc);
+
+    const uint8_t *constant_primitive_data_;
+    int constant_primitive_size_;
+}; // class BitCodeFusion
+
+} // namespace mio
+
+#endif // MIO_VM_BITCODE_FUSION_H_
@@ -136,7 +136,26 @@ namespace mio {
     M(frame) \
     M(ret) \
     M(oop) \
-    M(close_fn)
+    M(close_fn) \
+    M(tail_call)
+
+// Superinstructions, made by BitCodeFusion from a pair of bit codes.
+// The second bit code of the pair is still kept after the fused one.
+#define VM_FUSED_BC(M)  \
+    M(cmp_i64_jz)       \
+    M(cmp_i64_jnz)      \
+    M(load_imm_add_i64) \
+    M(mov_8b_pair)
+
+// Quickened object operations, only in the decoded bit codes: the first run of
+// an oop site rewrites itself to one of them by the observed operand shape.
+#define VM_QUICKENED_BC(M) \
+    M(array_get_8b)        \
+    M(map_get_int)         \
+    M(map_get_str)         \
+    M(map_put_int)         \
+    M(map_put_str)         \
+    M(str_len)
 
 #define VM_ALL_BITCODE(M) \
     M(debug)              \
@@ -146,7 +165,9 @@ namespace mio {
     VM_ARITH_BC(M)        \
     VM_TYPE_CAST(M)       \
     VM_CONTROL_BC(M)      \
-    VM_CALL_BC(M)
+    VM_CALL_BC(M)         \
+    VM_FUSED_BC(M)        \
+    VM_QUICKENED_BC(M)
 
 
 #define VM_COMPARATOR(M) \
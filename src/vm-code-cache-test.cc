@@ -1,6 +1,8 @@
 #include "vm-code-cache.h"
 #include "bit-operations.h"
 #include "gtest/gtest.h"
+#include <chrono>
+#include <thread>
 
 namespace mio {
 
@@ -200,4 +202,161 @@ TEST(CodeCacheTest, Compact) {
     ASSERT_EQ(*ref4.data(31), 0xd);
 }
 
+TEST(CodeCacheTest, Coalesce) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+
+    auto ref1 = cache.Allocate(32);
+    auto ref2 = cache.Allocate(32);
+    auto ref3 = cache.Allocate(32);
+    auto ref4 = cache.Allocate(32);
+    auto ref5 = cache.Allocate(32);
+    auto data = ref1.data();
+
+    cache.Free(ref1);
+    cache.Free(ref3);
+    ASSERT_EQ(2, cache.free_chunks());
+    ASSERT_EQ(64, cache.free_bytes());
+
+    cache.Free(ref2);
+    ASSERT_EQ(1, cache.free_chunks());
+    ASSERT_EQ(96, cache.free_bytes());
+
+    // The last one goes back to wilderness.
+    auto wilderness = cache.wilderness_size();
+    cache.Free(ref5);
+    ASSERT_EQ(1, cache.free_chunks());
+    ASSERT_EQ(wilderness + 32, cache.wilderness_size());
+
+    auto again = cache.Allocate(96);
+    ASSERT_EQ(data, again.data());
+    ASSERT_EQ(0, cache.free_chunks());
+    ASSERT_EQ(0, cache.free_bytes());
+    ASSERT_EQ(128, cache.used_bytes());
+    ASSERT_FALSE(ref4.null());
+}
+
+TEST(CodeCacheTest, SplitLargeChunk) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+
+    auto ref1 = cache.Allocate(1024);
+    auto ref2 = cache.Allocate(16);
+    cache.Free(ref1);
+    ASSERT_EQ(1024, cache.free_bytes());
+
+    auto small = cache.Allocate(100);
+    ASSERT_EQ(ref1.data(), small.data());
+    ASSERT_EQ(1, cache.free_chunks());
+    ASSERT_EQ(1024 - 100, cache.free_bytes());
+    ASSERT_EQ(100, cache.GetChunkSize(small.data()));
+    ASSERT_FALSE(ref2.null());
+}
+
+TEST(CodeCacheTest, CompactOnFragmentation) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+
+    std::vector<CodeRef> refs;
+    for (;;) {
+        auto ref = cache.Allocate(64);
+        if (ref.empty()) {
+            break;
+        }
+        refs.push_back(ref);
+    }
+    ASSERT_LT(100, refs.size());
+    // Fill the wilderness.
+    while (!cache.Allocate(4).empty()) {
+    }
+    for (size_t i = 0; i + 1 < refs.size(); i += 2) {
+        memset(refs[i + 1].data(), 0xc, 64);
+        cache.Free(refs[i]);
+    }
+    ASSERT_LE(static_cast<int>(CodeCache::kCompactThreshold), cache.GetFragmentation());
+    ASSERT_EQ(64, cache.GetLargestFreeSize());
+
+    auto ref = cache.Allocate(128);
+    ASSERT_FALSE(ref.empty());
+    ASSERT_EQ(0, cache.free_chunks());
+    ASSERT_EQ(0, cache.GetFragmentation());
+    ASSERT_EQ(0xc, *refs[1].data(0));
+    ASSERT_EQ(0xc, *refs[3].data(63));
+}
+
+TEST(CodeCacheTest, ReclaimOnRunningOut) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+
+    std::vector<CodeRef> refs;
+    for (;;) {
+        auto ref = cache.Allocate(64);
+        if (ref.empty()) {
+            break;
+        }
+        refs.push_back(ref);
+    }
+    while (!cache.Allocate(4).empty()) {
+    }
+
+    // Free the oldest chunks like evicting cold code.
+    size_t evicted = 0;
+    std::vector<int> sizes;
+    cache.set_reclaimer([&](int size) {
+        sizes.push_back(size);
+        for (int freed = 0; freed < size && evicted < refs.size(); freed += 64) {
+            cache.Free(refs[evicted++]);
+        }
+    });
+    auto ref = cache.Allocate(256);
+    ASSERT_FALSE(ref.empty());
+    ASSERT_EQ(1, sizes.size());
+    ASSERT_EQ(256, sizes[0]);
+    ASSERT_EQ(4, evicted);
+
+    // Other threads can not evict code, the owner reclaims for them later.
+    std::thread worker([&]() { ref = cache.Allocate(512); });
+    worker.join();
+    ASSERT_TRUE(ref.empty());
+    ASSERT_EQ(1, sizes.size());
+
+    ASSERT_TRUE(cache.ReclaimForPending());
+    ASSERT_EQ(2, sizes.size());
+    ASSERT_EQ(512, sizes[1]);
+    std::thread retry([&]() { ref = cache.Allocate(512); });
+    retry.join();
+    ASSERT_FALSE(ref.empty());
+    ASSERT_FALSE(cache.ReclaimForPending());
+}
+
+TEST(CodeCacheTest, AllocateBenchmark) {
+    static const int kCount = 20000;
+
+    CodeCache cache(32 * 1024 * 1024);
+    ASSERT_TRUE(cache.Init());
+
+    std::vector<CodeRef> refs;
+    uint32_t seed = 1;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kCount; ++i) {
+        seed = seed * 1103515245 + 12345;
+        auto ref = cache.Allocate(16 + (seed >> 16) % 2048);
+        ASSERT_FALSE(ref.empty());
+        refs.push_back(ref);
+    }
+    for (int i = 0; i < kCount; i += 2) {
+        cache.Free(refs[i]);
+    }
+    for (int i = 0; i < kCount; i += 2) {
+        seed = seed * 1103515245 + 12345;
+        refs[i] = cache.Allocate(16 + (seed >> 16) % 2048);
+        ASSERT_FALSE(refs[i].empty());
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    printf("code cache: %lld ns/op, fragmentation: %d%%, free chunks: %d\n",
+           static_cast<long long>(cost / (kCount * 2)),
+           cache.GetFragmentation(), cache.free_chunks());
+}
+
 } // namespace mio
@@ -1,9 +1,16 @@
 #include "vm-code-cache.h"
+#include "vm-perf-map.h"
 #include "bit-operations.h"
 #include <sys/mman.h>
+#include <algorithm>
 
 namespace mio {
 
+CodeCache::CodeCache(int default_size)
+    : size_(default_size) {
+    ResetFreeChunks();
+}
+
 CodeCache::~CodeCache() {
     delete[] bitmap_;
     if (code_) {
@@ -35,55 +42,239 @@ bool CodeCache::Init() {
     memset(bitmap_, 0, bmp_size * sizeof(*bitmap_));
 
     index_      = (code_ + size_);
-    index_free_ = index_;
+    top_        = 0;
+    owner_      = std::this_thread::get_id();
     return true;
 }
 
+CodeRef CodeCache::Install(const void *code, int size) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    auto ref = Allocate(size);
+    if (!ref.empty()) {
+        memcpy(ref.data(), code, size);
+    }
+    return ref;
+}
+
 void **CodeCache::RawAllocate(int size) {
     if (size <= kAlignmentSize) {
         size = kAlignmentSize * 2;
     }
     size = RoundUp(size, kAlignmentSize);
 
-    int      begin = FindFirstOne(0);
-    uint8_t *free = code_;
-    int      free_size = space_size() - sizeof(void *);
-
-    while ((begin << kAlignmentSizeShift) < space_size()) {
-        begin = FindFirstOne(begin + 1) + 1;
-        free = code_ + (begin << kAlignmentSizeShift);
-        auto end = FindFirstOne(begin);
-        free_size = (end - begin) << kAlignmentSizeShift;
-
-        if (size <= free_size) {
-            break;
+    int index_size = free_indexs_.empty() ? sizeof(void *) : 0;
+    if (index_size > wilderness_size()) {
+        return nullptr; // no room for the index.
+    }
+    auto units = size >> kAlignmentSizeShift;
+    auto begin = TakeFreeChunk(units, &units);
+    if (begin < 0) {
+        // Cut from wilderness, keep the room for the index.
+        if (size + index_size > wilderness_size()) {
+            return nullptr;
         }
+        begin = top_;
+        top_ += units;
     }
+    auto index_room = DCHECK_NOTNULL(MakeIndexRoom());
+    auto chunk = code_ + (begin << kAlignmentSizeShift);
+    size = units << kAlignmentSizeShift;
+    *index_room = chunk;
+    MarkUsed(chunk, size);
+    used_bytes_ += size;
+    return index_room;
+}
 
-    if (size > free_size) {
+void **CodeCache::AllocateSlow(int size) {
+    if (std::this_thread::get_id() != owner_) {
+        pending_size_ = std::max(pending_size_, size);
         return nullptr;
     }
-    auto index_room = MakeIndexRoom();
-    if (!index_room) {
-        return nullptr;
+    void **index = nullptr;
+    if (size <= free_bytes_ + wilderness_size() &&
+        GetFragmentation() >= kCompactThreshold) {
+        Compact();
+        index = RawAllocate(size);
     }
-    *index_room = free;
-    MarkUsed(free, size);
-    used_bytes_ += size;
-    return index_room;
+    if (!index && reclaimer_) {
+        auto used = used_bytes_;
+        reclaimer_(size);
+        if (used_bytes_ < used) {
+            index = RawAllocate(size);
+        }
+        if (!index && size <= free_bytes_ + wilderness_size()) {
+            Compact();
+            index = RawAllocate(size);
+        }
+    }
+    return index;
+}
+
+bool CodeCache::ReclaimForPending() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    DCHECK(std::this_thread::get_id() == owner_);
+    auto size = pending_size_;
+    pending_size_ = 0;
+    if (size == 0 || !reclaimer_) {
+        return false;
+    }
+    auto used = used_bytes_;
+    reclaimer_(size);
+    if (used_bytes_ < used && GetFragmentation() >= kCompactThreshold) {
+        Compact();
+    }
+    return used_bytes_ < used;
 }
 
 void CodeCache::Free(CodeRef ref) {
-    used_bytes_ -= GetChunkSize(ref.data());
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    auto size = GetChunkSize(ref.data());
+    used_bytes_ -= size;
+    if (perf_map_) {
+        perf_map_->Unload(ref.data());
+    }
 
     MarkUnused(ref.data());
 
+    auto begin = static_cast<int>(static_cast<uint8_t *>(ref.data()) - code_) >>
+                 kAlignmentSizeShift;
+    auto units = size >> kAlignmentSizeShift;
     *ref.index() = nullptr;
-    if (reinterpret_cast<uint8_t *>(ref.index()) > index_free_) {
-        index_free_ = reinterpret_cast<uint8_t *>(ref.index());
+    free_indexs_.push_back(ref.index());
+
+    // Coalesce with free neighbors.
+    auto prev = free_end_.find(begin - 1);
+    if (prev != free_end_.end()) {
+        auto prev_begin = prev->second;
+        auto prev_units = free_begin_[prev_begin];
+        RemoveFreeChunk(prev_begin, prev_units);
+        begin  = prev_begin;
+        units += prev_units;
+    }
+    auto next = free_begin_.find(begin + units);
+    if (next != free_begin_.end()) {
+        auto next_units = next->second;
+        RemoveFreeChunk(begin + units, next_units);
+        units += next_units;
+    }
+    if (begin + units == top_) {
+        top_ = begin; // give back to wilderness.
+    } else {
+        AddFreeChunk(begin, units);
+    }
+}
+
+void CodeCache::Describe(CodeRef ref, const char *name) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (perf_map_) {
+        perf_map_->Load(ref.data(), GetChunkSize(ref.data()), name);
     }
 }
 
+int CodeCache::GetLargestFreeSize() const {
+    int units = 0;
+    if (!large_free_.empty()) {
+        units = large_free_.rbegin()->first;
+    } else {
+        for (int i = kMaxSmallUnits - 1; i > 0; --i) {
+            if (free_heads_[i] >= 0) {
+                units = i;
+                break;
+            }
+        }
+    }
+    return std::max(units << kAlignmentSizeShift, wilderness_size());
+}
+
+int CodeCache::GetFragmentation() const {
+    auto total = free_bytes_ + wilderness_size();
+    if (total <= 0) {
+        return 0;
+    }
+    return 100 - static_cast<int>(GetLargestFreeSize() * 100LL / total);
+}
+
+int CodeCache::TakeFreeChunk(int units, int *taken) {
+    int begin = -1, n = 0;
+    for (n = units; n < kMaxSmallUnits; ++n) {
+        if (free_heads_[n] >= 0) {
+            begin = free_heads_[n];
+            break;
+        }
+    }
+    if (begin < 0) {
+        auto iter = large_free_.lower_bound(units);
+        if (iter == large_free_.end()) {
+            return -1;
+        }
+        n     = iter->first;
+        begin = iter->second;
+    }
+    RemoveFreeChunk(begin, n);
+
+    // The rest can not be a chunk if it is too small.
+    if (n - units >= 2) {
+        AddFreeChunk(begin + units, n - units);
+        *taken = units;
+    } else {
+        *taken = n;
+    }
+    return begin;
+}
+
+void CodeCache::AddFreeChunk(int begin, int units) {
+    DCHECK_GE(units, 2);
+    free_begin_[begin] = units;
+    free_end_[begin + units - 1] = begin;
+    free_bytes_ += units << kAlignmentSizeShift;
+    if (units >= kMaxSmallUnits) {
+        large_free_.emplace(units, begin);
+        return;
+    }
+    auto link = free_link(begin);
+    link[0] = -1;
+    link[1] = free_heads_[units];
+    if (free_heads_[units] >= 0) {
+        free_link(free_heads_[units])[0] = begin;
+    }
+    free_heads_[units] = begin;
+}
+
+void CodeCache::RemoveFreeChunk(int begin, int units) {
+    free_begin_.erase(begin);
+    free_end_.erase(begin + units - 1);
+    free_bytes_ -= units << kAlignmentSizeShift;
+    if (units >= kMaxSmallUnits) {
+        auto range = large_free_.equal_range(units);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (iter->second == begin) {
+                large_free_.erase(iter);
+                break;
+            }
+        }
+        return;
+    }
+    auto link = free_link(begin);
+    if (link[0] >= 0) {
+        free_link(link[0])[1] = link[1];
+    } else {
+        free_heads_[units] = link[1];
+    }
+    if (link[1] >= 0) {
+        free_link(link[1])[0] = link[0];
+    }
+}
+
+void CodeCache::ResetFreeChunks() {
+    for (int i = 0; i < kMaxSmallUnits; ++i) {
+        free_heads_[i] = -1;
+    }
+    large_free_.clear();
+    free_begin_.clear();
+    free_end_.clear();
+    free_bytes_ = 0;
+}
+
 int CodeCache::FindFirstOne(int begin) const {
     int index = begin / 32;
     DCHECK_GE(index, 0);
@@ -111,6 +302,7 @@ int CodeCache::FindFirstOne(int begin) const {
 }
 
 void CodeCache::Compact() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     std::vector<mio_buf_t<uint8_t>> chunks;
     GetAllChunks(&chunks);
 
@@ -124,12 +316,18 @@ void CodeCache::Compact() {
             memmove(p, buf.z, buf.n);
             MarkUsed(p, buf.n);
             *indexs[buf.z] = p;
+            if (perf_map_) {
+                perf_map_->Move(buf.z, p, buf.n);
+            }
             
             p += buf.n;
         } else {
             p = buf.z + buf.n;
         }
     }
+    // All free chunks are in wilderness now.
+    ResetFreeChunks();
+    top_ = static_cast<int>(p - code_) >> kAlignmentSizeShift;
 }
 
 void CodeCache::GetAllChunks(std::vector<mio_buf_t<uint8_t>> *chunks) const {
@@ -185,21 +383,17 @@ void CodeCache::MarkUnused(void *chunk) {
 }
 
 void **CodeCache::MakeIndexRoom() {
-    void **result = reinterpret_cast<void **>(&code_[index_free_ - code_]);
-
-    while (index_free_ > index_) {
-        if (*reinterpret_cast<void **>(index_free_) == nullptr) {
-            break;
-        }
-        index_free_ -= sizeof(void *);
+    void **result = nullptr;
+    if (!free_indexs_.empty()) {
+        result = free_indexs_.back();
+        free_indexs_.pop_back();
+        return result;
     }
-    if (index_free_ == index_) {
-        index_ -= sizeof(void *);
-        index_free_ = index_;
-
-        result = reinterpret_cast<void **>(&code_[index_free_ - code_]);
+    if (wilderness_size() < static_cast<int>(sizeof(void *))) {
+        return nullptr;
     }
-
+    index_ -= sizeof(void *);
+    result = reinterpret_cast<void **>(index_);
     MarkUsed(result, sizeof(void *));
     return result;
 }
@@ -5,9 +5,15 @@
 #include "glog/logging.h"
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <thread>
 
 namespace mio {
 
+class PerfCodeMap;
+
 class CodeRef {
 public:
     CodeRef(void **index)
@@ -30,23 +36,97 @@ private:
     void **index_;
 };
 
+/**
+ * Executable memory for native code. Chunks are referenced by index rooms,
+ * so compacting can move them.
+ *
+ * Chunks grow up from the bottom and index rooms grow down from the top, the
+ * space between them is the wilderness. Freed chunks are coalesced with free
+ * neighbors, then put into exact size class lists (small chunks) or a best-fit
+ * tree (large chunks), so allocating never scans the bitmap. The bitmap only
+ * marks begin and end of used chunks for walking and compacting.
+ *
+ * Allocating and freeing can be called from background compiler thread. Only
+ * the thread initialized the cache runs native code, so only it can compact
+ * the cache and evict code: other threads never move code it is running.
+ */
 class CodeCache {
 public:
-    CodeCache(int default_size) : size_(default_size) {}
+    // Free chunks smaller than it (in kAlignmentSize) are in size class lists.
+    static const int kMaxSmallUnits = 64;
+
+    // Compacting only when fragmentation (percent) reaches it.
+    static const int kCompactThreshold = 50;
+
+    /**
+     * Evict cold code for an allocation of size bytes, it is called by the
+     * owner thread when the cache is running out.
+     */
+    typedef std::function<void (int size)> Reclaimer;
+
+    CodeCache(int default_size);
     ~CodeCache();
 
     bool Init();
 
+    DEF_GETTER(int, size)
+
+    // Describe code for profilers, or null.
+    DEF_PTR_PROP_RW(PerfCodeMap, perf_map)
+
+    void set_reclaimer(const Reclaimer &reclaimer) { reclaimer_ = reclaimer; }
+
     DEF_GETTER(int, used_bytes)
 
+    DEF_GETTER(int, free_bytes)
+
     int space_size() const { return static_cast<int>(index_ - code_); }
 
+    int wilderness_size() const {
+        return space_size() - (top_ << kAlignmentSizeShift);
+    }
+
+    int free_chunks() const { return static_cast<int>(free_begin_.size()); }
+
+    /**
+     * The largest chunk can be allocated without compacting.
+     */
+    int GetLargestFreeSize() const;
+
+    /**
+     * Percent of free bytes can not be allocated in one chunk:
+     * 0 for no fragments.
+     */
+    int GetFragmentation() const;
+
     inline CodeRef Allocate(int size);
 
+    /**
+     * Allocate a chunk and copy code to it, the code can not be moved before
+     * copying finished.
+     *
+     * @return empty if no enough space.
+     */
+    CodeRef Install(const void *code, int size);
+
     void **RawAllocate(int size);
 
+    /**
+     * Reclaim space for allocations of other threads failed since the last
+     * calling, it can be called only by the owner thread.
+     *
+     * @return true if any code was evicted, the failed allocations can be
+     *         tried again.
+     */
+    bool ReclaimForPending();
+
     void Free(CodeRef ref);
 
+    /**
+     * Name the installed code for profilers, it does nothing if no perf map.
+     */
+    void Describe(CodeRef ref, const char *name);
+
     void **MakeIndexRoom();
 
     void Compact();
@@ -64,11 +144,31 @@ public:
     DISALLOW_IMPLICIT_CONSTRUCTORS(CodeCache)
 private:
     int FindFirstOne(int begin) const;
+
+    void **AllocateSlow(int size);
     
     inline void MarkUsed(void *chunk, int size);
 
     void MarkUnused(void *chunk);
 
+    /**
+     * Take the best fit free chunk and split it.
+     *
+     * @return unit of the chunk, or -1 if no free chunk fits.
+     */
+    int TakeFreeChunk(int units, int *taken);
+
+    void AddFreeChunk(int begin, int units);
+
+    void RemoveFreeChunk(int begin, int units);
+
+    void ResetFreeChunks();
+
+    // Links of size class lists are in free chunks.
+    int32_t *free_link(int begin) {
+        return reinterpret_cast<int32_t *>(code_ + (begin << kAlignmentSizeShift));
+    }
+
     int bitmap_size() const { return ((size_ / kAlignmentSize) + 31) / 32; }
 
     void bitmap_set(int index) {
@@ -82,16 +182,27 @@ private:
     uint8_t  *code_       = nullptr;
     int       size_;
     int       used_bytes_ = 0;
+    int       free_bytes_ = 0; // in free chunks, not includes wilderness.
     uint32_t *bitmap_     = nullptr;
-    uint8_t  *index_free_ = nullptr;
     uint8_t  *index_      = nullptr;
+    int       top_        = 0; // unit of wilderness.
+    int       free_heads_[kMaxSmallUnits];
+    std::multimap<int, int> large_free_; // units -> begin unit.
+    std::unordered_map<int, int> free_begin_; // begin unit -> units.
+    std::unordered_map<int, int> free_end_;   // last unit -> begin unit.
+    std::vector<void **> free_indexs_;
+    std::thread::id owner_;
+    std::recursive_mutex mutex_;
+    PerfCodeMap *perf_map_ = nullptr;
+    Reclaimer reclaimer_;
+    int pending_size_ = 0; // the largest failed allocation of other threads.
 }; // CodeCache
 
 inline CodeRef CodeCache::Allocate(int size) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     auto index = RawAllocate(size);
-    if (!index && size <= space_size() - used_bytes_) {
-        Compact();
-        index = RawAllocate(size);
+    if (!index) {
+        index = AllocateSlow(size);
     }
     return CodeRef(index);
 }
@@ -1,62 +1,128 @@
 #include "vm-function-register.h"
 #include "vm-code-cache.h"
 #include "yui/asm-amd64.h"
+#include <algorithm>
+#include <vector>
 
 namespace mio {
 
 const Reg kPrimitiveStack = r14;
 const Reg kObjectStack = r15;
 
+namespace {
+
+// Bytes of the longest instruction emitted in warpers.
+const int kMaxInstructionSize = 16;
+
+/**
+ * Assembler buffer grows on demand, warpers have no labels, so moving the
+ * emitted code is safe.
+ */
+class AsmBuffer {
+public:
+    explicit AsmBuffer(int initial_size)
+        : buf_(initial_size) {
+        state_.code = &buf_[0];
+        state_.pc   = state_.code;
+        state_.size = buf_.size();
+    }
+
+    /**
+     * Make room for at least n bytes.
+     */
+    Asm *Reserve(int n) {
+        auto offset = size();
+        if (offset + n > static_cast<int>(buf_.size())) {
+            buf_.resize(std::max(buf_.size() * 2, static_cast<size_t>(offset + n)));
+            state_.code = &buf_[0];
+            state_.pc   = state_.code + offset;
+            state_.size = buf_.size();
+        }
+        return &state_;
+    }
+
+    const uint8_t *code() const { return state_.code; }
+
+    int size() const { return static_cast<int>(state_.pc - state_.code); }
+
+private:
+    std::vector<uint8_t> buf_;
+    Asm state_;
+};
+
+} // namespace
+
+void **FunctionRegister::GetOrBuildWarper(const char *name,
+                                           MIOString *signature) {
+    std::string key(signature->GetData(), signature->GetLength());
+    auto iter = warpers_.find(key);
+    if (iter != warpers_.end()) {
+        return iter->second;
+    }
+    auto warper = BuildWarper(signature);
+    if (!warper) {
+        return nullptr;
+    }
+    warpers_.emplace(key, warper);
+    if (code_cache_->perf_map()) {
+        std::string desc("warper:");
+        desc.append(key).append(" ").append(name);
+        code_cache_->Describe(CodeRef(warper), desc.c_str());
+    }
+    return warper;
+}
+
 void **FunctionRegister::BuildWarper(MIOString *signature) {
-    std::unique_ptr<uint8_t[]> buf(new uint8_t[1024]);
-    Asm state;
-    state.code = buf.get();
-    state.pc   = state.code;
-    state.size = 1024;
+    auto sign = signature->Get();
+    AsmBuffer buf(64);
+    auto state = buf.Reserve(7 * kMaxInstructionSize);
 
-    Emit_pushq_r(&state, rbp);
-    Emit_movq_r_r(&state, rbp, rsp, 8);
+    // r14 and r15 are callee saved.
+    Emit_pushq_r(state, rbp);
+    Emit_movq_r_r(state, rbp, rsp, 8);
+    Emit_pushq_r(state, kPrimitiveStack);
+    Emit_pushq_r(state, kObjectStack);
 
-    Emit_movq_r_r(&state, rax, RegArgv[1], 8);
-    Emit_movq_r_r(&state, kPrimitiveStack, RegArgv[2], 8);
-    Emit_movq_r_r(&state, kObjectStack, RegArgv[3], 8);
+    Emit_movq_r_r(state, rax, RegArgv[1], 8);
+    Emit_movq_r_r(state, kPrimitiveStack, RegArgv[2], 8);
+    Emit_movq_r_r(state, kObjectStack, RegArgv[3], 8);
 
     int ooff = 0, poff = 0;
     int rarg = 1, xarg = 0;
     Opd op;
 
-    auto sign = signature->Get();
     for (int i = 2; i < sign.n; ++i) {
+        state = buf.Reserve(kMaxInstructionSize);
         if (islower(sign.z[i])) { // object
             Operand0(&op, kObjectStack, ooff);
-            Emit_movq_r_op(&state, RegArgv[rarg++], &op, kObjectReferenceSize);
+            Emit_movq_r_op(state, RegArgv[rarg++], &op, kObjectReferenceSize);
             ooff += kObjectReferenceSize;
         } else if (isdigit(sign.z[i])) {
             switch (sign.z[i]) {
                 case '1':
                 case '8':
                     Operand0(&op, kPrimitiveStack, poff);
-                    Emit_movq_r_op(&state, RegArgv[rarg++], &op, 1);
+                    Emit_movq_r_op(state, RegArgv[rarg++], &op, 1);
                     break;
                 case '7':
                     Operand0(&op, kPrimitiveStack, poff);
-                    Emit_movq_r_op(&state, RegArgv[rarg++], &op, 2);
+                    Emit_movq_r_op(state, RegArgv[rarg++], &op, 2);
                     break;
                 case '5':
                     Operand0(&op, kPrimitiveStack, poff);
-                    Emit_movq_r_op(&state, RegArgv[rarg++], &op, 4);
+                    Emit_movq_r_op(state, RegArgv[rarg++], &op, 4);
                     break;
                 case '9':
                     Operand0(&op, kPrimitiveStack, poff);
-                    Emit_movq_r_op(&state, RegArgv[rarg++], &op, 8);
+                    Emit_movq_r_op(state, RegArgv[rarg++], &op, 8);
                     break;
                 case '3':
                     Operand0(&op, kPrimitiveStack, poff);
-                    Emit_movss_x_op(&state, XmmArgv[xarg++], &op);
+                    Emit_movss_x_op(state, XmmArgv[xarg++], &op);
                     break;
                 case '6':
                     Operand0(&op, kPrimitiveStack, poff);
-                    Emit_movsd_x_op(&state, XmmArgv[xarg++], &op);
+                    Emit_movsd_x_op(state, XmmArgv[xarg++], &op);
                     break;
                 default:
                     DLOG(FATAL) << "noreached!";
@@ -72,38 +138,39 @@ void **FunctionRegister::BuildWarper(MIOString *signature) {
         }
     }
 
+    state = buf.Reserve(7 * kMaxInstructionSize);
     Operand0(&op, rax, MIONativeFunction::kNativePointerOffset);
-    Emit_call_op(&state, &op);
+    Emit_call_op(state, &op);
 
     if (islower(sign.z[0])) { // object
         Operand0(&op, kObjectStack, -kObjectReferenceSize);
-        Emit_movq_op_r(&state, &op, rax, kObjectReferenceSize);
+        Emit_movq_op_r(state, &op, rax, kObjectReferenceSize);
     } else if (isdigit(sign.z[0])) { // number
         switch (sign.z[0]) {
             case '1':
             case '8':
                 Operand0(&op, kPrimitiveStack, -4);
-                Emit_movq_op_r(&state, &op, rax, 1);
+                Emit_movq_op_r(state, &op, rax, 1);
                 break;
             case '7':
                 Operand0(&op, kPrimitiveStack, -4);
-                Emit_movq_op_r(&state, &op, rax, 2);
+                Emit_movq_op_r(state, &op, rax, 2);
                 break;
             case '5':
                 Operand0(&op, kPrimitiveStack, -4);
-                Emit_movq_op_r(&state, &op, rax, 4);
+                Emit_movq_op_r(state, &op, rax, 4);
                 break;
             case '9':
                 Operand0(&op, kPrimitiveStack, -8);
-                Emit_movq_op_r(&state, &op, rax, 8);
+                Emit_movq_op_r(state, &op, rax, 8);
                 break;
             case '3':
                 Operand0(&op, kPrimitiveStack, -4);
-                Emit_movss_op_x(&state, &op, xmm0);
+                Emit_movss_op_x(state, &op, xmm0);
                 break;
             case '6':
                 Operand0(&op, kPrimitiveStack, -8);
-                Emit_movsd_op_x(&state, &op, xmm0);
+                Emit_movsd_op_x(state, &op, xmm0);
                 break;
             default:
                 DLOG(FATAL) << "noreached!";
@@ -111,18 +178,18 @@ void **FunctionRegister::BuildWarper(MIOString *signature) {
         }
     } else if (sign.z[0] == '!') {
         // void return
-        Emit_xor_r_r(&state, rax, rax, 8);
+        Emit_xor_r_r(state, rax, rax, 8);
     } else {
         DLOG(FATAL) << "noreached!";
     }
 
-    Emit_popq_r(&state, rbp);
-    Emit_ret_i(&state, 0);
+    Emit_popq_r(state, kObjectStack);
+    Emit_popq_r(state, kPrimitiveStack);
+    Emit_popq_r(state, rbp);
+    Emit_ret_i(state, 0);
 
-    auto size = static_cast<int>(state.pc - state.code);
-    auto code = code_cache_->Allocate(size);
-    memcpy(code.data(), state.code, size);
-    return code.index();
+    auto code = code_cache_->Install(buf.code(), buf.size());
+    return code.empty() ? nullptr : code.index();
 }
 
 } // namespace mio
@@ -5,6 +5,8 @@
 #include "vm-objects.h"
 #include "base.h"
 #include <vector>
+#include <unordered_map>
+#include <string>
 
 namespace mio {
 
@@ -21,6 +23,13 @@ public:
     inline bool RegisterNativeFunction(const char *name,
                                        MIOFunctionPrototype pointer);
 
+    /**
+     * Register a leaf native function, calling it skips the call stack
+     * bookkeeping, so it can not re-enter VM or make a backtrace.
+     */
+    inline bool RegisterLeafFunction(const char *name,
+                                     MIOLeafFunctionPrototype pointer);
+
     template<class F>
     inline bool RegisterFunctionTemplate(const char *name, F *pointer);
 
@@ -35,9 +44,18 @@ public:
     DISALLOW_IMPLICIT_CONSTRUCTORS(FunctionRegister)
 
 private:
+    /**
+     * Get the native warper for calling native functions by signature, all
+     * functions have the same signature share one warper.
+     *
+     * @param name the first function uses the warper, for describing code.
+     */
+    void **GetOrBuildWarper(const char *name, MIOString *signature);
+
     void **BuildWarper(MIOString *signature);
 
     CodeCache *code_cache_;
+    std::unordered_map<std::string, void **> warpers_; // signature -> warper
 }; // class FunctionRegister
 
 inline bool FunctionRegister::RegisterNativeFunction(const char *name,
@@ -49,6 +67,15 @@ inline bool FunctionRegister::RegisterNativeFunction(const char *name,
     return !fn.empty();
 }
 
+inline bool FunctionRegister::RegisterLeafFunction(const char *name,
+                                                   MIOLeafFunctionPrototype pointer) {
+    auto fn = FindNativeFunction(name);
+    if (!fn.empty()) {
+        fn->SetLeafPointer(DCHECK_NOTNULL(pointer));
+    }
+    return !fn.empty();
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 /// FunctionTemplate
@@ -201,7 +228,7 @@ bool FunctionRegister::RegisterFunctionTemplate(const char *name, F *pointer) {
         return false;
     }
 
-    auto warper = BuildWarper(fn->GetSignature());
+    auto warper = GetOrBuildWarper(name, fn->GetSignature());
     if (!warper) {
         return false;
     }
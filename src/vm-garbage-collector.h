@@ -23,7 +23,15 @@ public:
 
     virtual void Active(bool pause) = 0;
 
+    /**
+     * It changes after any function or closure be deleted, the inline caches
+     * of calling filled in old epoch are invalid.
+     */
+    uint32_t callable_epoch() const { return callable_epoch_; }
+
     DISALLOW_IMPLICIT_CONSTRUCTORS(GarbageCollector)
+protected:
+    uint32_t callable_epoch_ = 0;
 };
 
 } // namespace mio
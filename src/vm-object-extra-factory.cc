@@ -1,4 +1,5 @@
 #include "vm-object-extra-factory.h"
+#include <algorithm>
 
 namespace mio {
 
@@ -30,11 +31,38 @@ ObjectExtraFactory::CreateFunctionDebugInfo(RawStringRef unit_name,
 
 NativeCodeFragment *
 ObjectExtraFactory::CreateNativeCodeFragment(NativeCodeFragment *next,
-                                             void **index) {
+                                             void **index, int entry) {
     auto fragment = static_cast<NativeCodeFragment *>(allocator_->Allocate(sizeof(NativeCodeFragment)));
+    if (!fragment) {
+        return nullptr;
+    }
     fragment->next  = next;
     fragment->index = index;
+    fragment->entry = entry;
+    fragment->deopt_info = nullptr;
+    fragment->function = nullptr;
+    fragment->prev_installed = nullptr;
+    fragment->next_installed = nullptr;
+    fragment->hits = 0;
+    fragment->age  = 0;
     return fragment;
 }
 
+NativeCodeDeoptInfo *
+ObjectExtraFactory::CreateNativeCodeDeoptInfo(const std::vector<int> &entries,
+                                              const std::vector<int> &exits) {
+    auto n = entries.size() + exits.size();
+    auto size = sizeof(NativeCodeDeoptInfo) + (n > 0 ? n - 1 : 0) * sizeof(int);
+    auto info = static_cast<NativeCodeDeoptInfo *>(allocator_->Allocate(size));
+    if (!info) {
+        return nullptr;
+    }
+    info->deopt_count = 0;
+    info->entry_size  = static_cast<int>(entries.size());
+    info->exit_size   = static_cast<int>(exits.size());
+    std::copy(entries.begin(), entries.end(), info->pcs);
+    std::copy(exits.begin(), exits.end(), info->pcs + entries.size());
+    return info;
+}
+
 } // namespace mio
@@ -17,7 +17,10 @@ public:
                                                const std::vector<int> &p2p);
     
     NativeCodeFragment *CreateNativeCodeFragment(NativeCodeFragment *next,
-                                                 void **index);
+                                                 void **index, int entry);
+
+    NativeCodeDeoptInfo *CreateNativeCodeDeoptInfo(const std::vector<int> &entries,
+                                                   const std::vector<int> &exits);
 
     DISALLOW_IMPLICIT_CONSTRUCTORS(ObjectExtraFactory)
 private:
@@ -3,6 +3,16 @@
 
 namespace mio {
 
+namespace {
+
+inline void Reference(HeapObject *ob, const ObjectScanner::Callback &callback) {
+    if (ob) {
+        callback(ob);
+    }
+}
+
+} // namespace
+
 void ObjectScanner::Scan(HeapObject *ob, Callback callback) {
     if (!ob) {
         return;
@@ -13,83 +23,91 @@ void ObjectScanner::Scan(HeapObject *ob, Callback callback) {
     }
     traced_objects_.insert(ob);
 
+    ForEachReference(ob, [this, &callback] (HeapObject *x) {
+        Scan(x, callback);
+    });
+}
+
+/*static*/
+void ObjectScanner::ForEachReference(HeapObject *ob, const Callback &callback) {
     switch (ob->GetKind()) {
         case HeapObject::kString:
+        case HeapObject::kExternal:
             break;
 
         case HeapObject::kError: {
             auto err = ob->AsError();
-            Scan(err->GetLinkedError(), callback);
-            Scan(err->GetFileName(), callback);
-            Scan(err->GetMessage(), callback);
+            Reference(err->GetLinkedError(), callback);
+            Reference(err->GetFileName(), callback);
+            Reference(err->GetMessage(), callback);
         } break;
 
         case HeapObject::kUnion: {
             auto uni = ob->AsUnion();
-            Scan(uni->GetTypeInfo(), callback);
+            Reference(uni->GetTypeInfo(), callback);
             if (uni->GetTypeInfo()->IsObject()) {
-                Scan(uni->GetObject(), callback);
+                Reference(uni->GetObject(), callback);
             }
         } break;
 
         case HeapObject::kUpValue: {
             auto upval = ob->AsUpValue();
             if (upval->IsObjectValue()) {
-                Scan(upval->GetObject(), callback);
+                Reference(upval->GetObject(), callback);
             }
         } break;
 
         case HeapObject::kClosure: {
             auto fn = ob->AsClosure();
-            Scan(fn->GetName(), callback);
+            Reference(fn->GetName(), callback);
             if (fn->IsOpen()) {
                 return;
             }
-            Scan(fn->GetFunction(), callback);
+            Reference(fn->GetFunction(), callback);
             auto buf = fn->GetUpValuesBuf();
             for (int i = 0; i < buf.n; ++i) {
                 auto val = buf.z[i].val;
-                Scan(val, callback);
+                Reference(val, callback);
                 if (val->IsObjectValue()) {
-                    Scan(val->GetObject(), callback);
+                    Reference(val->GetObject(), callback);
                 }
             }
         } break;
 
         case HeapObject::kGeneratedFunction: {
             auto fn = ob->AsGeneratedFunction();
-            Scan(fn->GetName(), callback);
+            Reference(fn->GetName(), callback);
             auto buf = fn->GetConstantObjectBuf();
             for (int i = 0; i < buf.n; ++i) {
-                Scan(buf.z[i], callback);
+                Reference(buf.z[i], callback);
             }
         } break;
 
         case HeapObject::kNativeFunction: {
             auto fn = ob->AsNativeFunction();
-            Scan(fn->GetName(), callback);
-            Scan(fn->GetSignature(), callback);
+            Reference(fn->GetName(), callback);
+            Reference(fn->GetSignature(), callback);
         } break;
 
         case HeapObject::kSlice: {
             auto slice = ob->AsSlice();
-            Scan(slice->GetVector(), callback);
+            Reference(slice->GetVector(), callback);
         } break;
 
         case HeapObject::kVector: {
             auto vector = ob->AsVector();
-            Scan(vector->GetElement(), callback);
+            Reference(vector->GetElement(), callback);
             if (vector->GetElement()->IsObject()) {
                 for (int i = 0; i < vector->GetSize(); ++i) {
-                    Scan(vector->GetObject(i), callback);
+                    Reference(vector->GetObject(i), callback);
                 }
             }
         } break;
 
         case HeapObject::kHashMap: {
             auto map = ob->AsHashMap();
-            Scan(map->GetKey(), callback);
-            Scan(map->GetValue(), callback);
+            Reference(map->GetKey(), callback);
+            Reference(map->GetValue(), callback);
             if (map->GetKey()->IsPrimitive() && map->GetValue()->IsPrimitive()) {
                 break;
             }
@@ -98,10 +116,10 @@ void ObjectScanner::Scan(HeapObject *ob, Callback callback) {
                 auto node = map->GetSlot(i)->head;
                 while (node) {
                     if (map->GetKey()->IsObject()) {
-                        Scan(*static_cast<HeapObject **>(node->GetKey()), callback);
+                        Reference(*static_cast<HeapObject **>(node->GetKey()), callback);
                     }
                     if (map->GetValue()->IsObject()) {
-                        Scan(*static_cast<HeapObject **>(node->GetValue()), callback);
+                        Reference(*static_cast<HeapObject **>(node->GetValue()), callback);
                     }
                     node = node->GetNext();
                 }
@@ -120,20 +138,20 @@ void ObjectScanner::Scan(HeapObject *ob, Callback callback) {
 
         case HeapObject::kReflectionArray: {
             auto type = ob->AsReflectionArray();
-            Scan(type->GetElement(), callback);
+            Reference(type->GetElement(), callback);
         } break;
 
         case HeapObject::kReflectionMap: {
             auto type = ob->AsReflectionMap();
-            Scan(type->GetKey(), callback);
-            Scan(type->GetValue(), callback);
+            Reference(type->GetKey(), callback);
+            Reference(type->GetValue(), callback);
         } break;
 
         case HeapObject::kReflectionFunction: {
             auto type = ob->AsReflectionFunction();
-            Scan(type->GetReturn(), callback);
+            Reference(type->GetReturn(), callback);
             for (int i = 0; i < type->GetNumberOfParameters(); ++i) {
-                Scan(type->GetParamter(i), callback);
+                Reference(type->GetParamter(i), callback);
             }
         } break;
 
@@ -18,6 +18,12 @@ public:
 
     void Scan(HeapObject *ob, Callback callback);
 
+    /**
+     * Call callback for each object referenced by ob directly, not
+     * recursively, null references are skipped.
+     */
+    static void ForEachReference(HeapObject *ob, const Callback &callback);
+
     DISALLOW_IMPLICIT_CONSTRUCTORS(ObjectScanner)
 private:
     std::unordered_set<HeapObject *> traced_objects_;
@@ -2,6 +2,8 @@
 
 namespace mio {
 
+/*static*/ std::atomic<int> HeapObject::concurrent_updatings_(0);
+
 int HeapObject::GetSize() const {
 #define DEFINE_CASE(name) \
     case HeapObject::k##name: \
@@ -40,6 +40,7 @@ class MIOReflectionType;
 
 struct FunctionDebugInfo;
 struct NativeCodeFragment;
+struct DecodedBitCode;
 
 #define MIO_REFLECTION_TYPES(M) \
     M(ReflectionVoid)           \
@@ -73,8 +74,18 @@ typedef int (*MIOFunctionPrototype)(VM *, Thread *);
 
 typedef int (*MIONativeWarper)(Thread *, MIONativeFunction *, void *, void *);
 
+// Leaf native function: it gets the base of arguments in primitive and object
+// stack directly, and can not re-enter VM, panic or run GC.
+typedef int (*MIOLeafFunctionPrototype)(VM *, void *, void *);
+
 typedef int (*MIONativeFragment)(Thread *, void *, void *, int *);
 
+// Results of MIONativeFragment: interpreter goes on at *pc, the thread should
+// exit, or a speculative guard failed and interpreter goes on at *pc.
+static const int kNativeFragmentContinue = 0;
+static const int kNativeFragmentExit     = 1;
+static const int kNativeFragmentDeopt    = 2;
+
 template<class T>
 inline T HeapObjectGet(const void *obj, int offset) {
     return *reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(obj) + offset);
@@ -124,113 +135,80 @@ public:
     static const int kMaxGCGeneration = 0xf;
     static const int kMaxGCColor      = 0xf;
 
-    static const int kNextOffset = 0;                                  // for double-linked list
-    static const int kPrevOffset = kNextOffset + sizeof(HeapObject *); // for double-linked list
-    static const int kListEntryOffset = kPrevOffset;
-
+    // The header has no list links, GC keeps objects in its own tables.
     // HI-8  bits: heap object of kind
     // LO-24 bits: GC flags
-    static const int kHeaderFlagsOffset = kPrevOffset + sizeof(HeapObject *);
+    static const int kHeaderFlagsOffset = 0;
     static const int kHeapObjectOffset = kHeaderFlagsOffset + sizeof(uint32_t);
 
-    HeapObject *InitEntry() {
-        SetNext(this);
-        SetPrev(this);
-        return this;
-    }
-
     HeapObject *Init(Kind kind) {
-        InitEntry();
-        SetHeaderFlags(0);
+        ahf()->store(0, std::memory_order_relaxed);
         SetKind(kind);
         return this;
     }
 
-    DEFINE_HEAP_OBJ_RW(HeapObject *, Next)
-    DEFINE_HEAP_OBJ_RW(HeapObject *, Prev)
-
-#if 1
+    // Header flags are shared by mutator and GC threads (e.g. background
+    // sweeper), so they are always read and updated atomically.
     bool IsGrabbed() const { return GetHandleCount() > 0; }
 
-    int GetHandleCount() const { return (GetHeaderFlags() & GC_HANDLE_COUNT_MASK); }
+    int GetHandleCount() const {
+        return (ahf()->load(std::memory_order_acquire) & GC_HANDLE_COUNT_MASK);
+    }
+
+    void Grab() { UpdateHandleCount(1); }
+
+    void Drop() { UpdateHandleCount(-1); }
 
-    void Grab() {
-        SetHeaderFlags((GetHeaderFlags() & ~GC_HANDLE_COUNT_MASK) |
-                       ((GetHandleCount() + 1) & GC_HANDLE_COUNT_MASK));
+    /**
+     * Other threads may update header flags between begin and end, handle
+     * counts are updated by CAS only in it. They are called by mutator.
+     */
+    static void BeginConcurrentUpdating() {
+        concurrent_updatings_.fetch_add(1, std::memory_order_relaxed);
     }
 
-    void Drop() {
-        SetHeaderFlags((GetHeaderFlags() & ~GC_HANDLE_COUNT_MASK) |
-                       ((GetHandleCount() - 1) & GC_HANDLE_COUNT_MASK));
+    static void EndConcurrentUpdating() {
+        concurrent_updatings_.fetch_sub(1, std::memory_order_relaxed);
     }
 
     int GetGeneration() const {
-        return static_cast<int>((GetHeaderFlags() >> 20) & 0xf);
+        return static_cast<int>((ahf()->load(std::memory_order_acquire) >> 20) & 0xf);
     }
 
     void SetGeneration(int g) {
-        SetHeaderFlags((GetHeaderFlags() & ~GC_GENERATION_MASK) | ((g << 20) & GC_GENERATION_MASK));
+        UpdateHeaderFlags(GC_GENERATION_MASK, [g] (uint32_t) { return g << 20; });
     }
 
     int GetColor() const {
-        return static_cast<int>((GetHeaderFlags() >> 16) & 0xf);
+        return static_cast<int>((ahf()->load(std::memory_order_acquire) >> 16) & 0xf);
     }
 
     void SetColor(int c) {
-        SetHeaderFlags((GetHeaderFlags() & ~GC_COLOR_MASK) | ((c << 16) & GC_COLOR_MASK));
+        UpdateHeaderFlags(GC_COLOR_MASK, [c] (uint32_t) { return c << 16; });
     }
-#else
-    bool IsGrabbed() const { return GetHandleCount() > 0; }
 
-    int GetHandleCount() const {
-        return (ahf()->load(std::memory_order_release) & GC_HANDLE_COUNT_MASK);
-    }
-
-    inline void Grab() {
-        uint32_t flags, nval;
-        do {
-            flags = ahf()->load(std::memory_order_release);
-            nval = (flags & ~GC_HANDLE_COUNT_MASK) |
-                   (((flags & GC_HANDLE_COUNT_MASK) + 1) & GC_HANDLE_COUNT_MASK);
-        } while (!ahf()->compare_exchange_strong(flags, nval));
-    }
-
-    inline void Drop() {
-        uint32_t flags, nval;
-        do {
-            flags = ahf()->load(std::memory_order_release);
-            nval = (flags & ~GC_HANDLE_COUNT_MASK) |
-                   (((flags & GC_HANDLE_COUNT_MASK) - 1) & GC_HANDLE_COUNT_MASK);
-        } while (!ahf()->compare_exchange_strong(flags, nval));
-    }
-
-    int GetGeneration() const {
-        return static_cast<int>((ahf()->load(std::memory_order_release) >> 20) & 0xf);
-    }
-
-    inline void SetGeneration(int g) {
-        uint32_t flags, nval;
-        do {
-            flags = ahf()->load(std::memory_order_release);
-            nval  = (flags & ~GC_GENERATION_MASK) | ((g << 20) & GC_GENERATION_MASK);
-        } while (!ahf()->compare_exchange_strong(flags, nval));
-    }
-
-    int GetColor() const {
-        return static_cast<int>((ahf()->load(std::memory_order_release) >> 16) & 0xf);
-    }
-
-    inline void SetColor(int c) {
-        uint32_t flags, nval;
-        do {
-            flags = ahf()->load(std::memory_order_release);
-            nval  = (flags & ~GC_COLOR_MASK) | ((c << 16) & GC_COLOR_MASK);
-        } while (!ahf()->compare_exchange_strong(flags, nval));
+    /**
+     * Set color to c by CAS, so only one of parallel markers claims it.
+     *
+     * @return false if color has been c.
+     */
+    bool TestAndSetColor(int c) {
+        auto flags = ahf()->load(std::memory_order_relaxed);
+        for (;;) {
+            if (static_cast<int>((flags >> 16) & 0xf) == c) {
+                return false;
+            }
+            uint32_t nval = (flags & ~GC_COLOR_MASK) | ((c << 16) & GC_COLOR_MASK);
+            if (ahf()->compare_exchange_weak(flags, nval,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
     }
-#endif
 
     Kind GetKind() const {
-        return static_cast<Kind>((GetHeaderFlags() >> 24) & 0xff);
+        return static_cast<Kind>((ahf()->load(std::memory_order_relaxed) >> 24) & 0xff);
     }
 
 #define HeapObject_TYPE_CAST(name) \
@@ -281,8 +259,6 @@ public:
     DISALLOW_IMPLICIT_CONSTRUCTORS(HeapObject)
 
 private:
-    DEFINE_HEAP_OBJ_RW(uint32_t, HeaderFlags)
-
     std::atomic<uint32_t> *ahf() { // atomic-header-flags
         return reinterpret_cast<std::atomic<uint32_t> *>(reinterpret_cast<uint8_t *>(this) + kHeaderFlagsOffset);
     }
@@ -291,9 +267,43 @@ private:
         return reinterpret_cast<const std::atomic<uint32_t> *>(reinterpret_cast<const uint8_t *>(this) + kHeaderFlagsOffset);
     }
 
+    void UpdateHandleCount(int delta) {
+        if (concurrent_updatings_.load(std::memory_order_relaxed) > 0) {
+            UpdateHeaderFlags(GC_HANDLE_COUNT_MASK, [delta] (uint32_t flags) {
+                return (flags & GC_HANDLE_COUNT_MASK) + delta;
+            });
+            return;
+        }
+        // Only mutator updates header flags now, no CAS on the hot path.
+        auto flags = ahf()->load(std::memory_order_relaxed);
+        auto count = ((flags & GC_HANDLE_COUNT_MASK) + delta) & GC_HANDLE_COUNT_MASK;
+        ahf()->store((flags & ~GC_HANDLE_COUNT_MASK) | count,
+                     std::memory_order_release);
+    }
+
     void SetKind(Kind kind) {
-        SetHeaderFlags((GetHeaderFlags() & ~KIND_MASK) | ((static_cast<int>(kind) << 24) & KIND_MASK));
+        UpdateHeaderFlags(KIND_MASK, [kind] (uint32_t) {
+            return static_cast<uint32_t>(kind) << 24;
+        });
     }
+
+    /**
+     * Replace bits of mask in header flags by CAS, field returns new bits
+     * from current flags.
+     */
+    template<class F>
+    void UpdateHeaderFlags(uint32_t mask, F field) {
+        auto flags = ahf()->load(std::memory_order_relaxed);
+        uint32_t nval;
+        do {
+            nval = (flags & ~mask) | (static_cast<uint32_t>(field(flags)) & mask);
+        } while (!ahf()->compare_exchange_weak(flags, nval,
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+    }
+
+    // Counted per process, so it works for any number of VMs.
+    static std::atomic<int> concurrent_updatings_;
 }; // class HeapObject
 
 union InternalAllValue {
@@ -361,13 +371,15 @@ public:
     static const int kObjectArgumentsSizeOffset = kPrimitiveArgumentsSizeOffset + sizeof(int);
     static const int kNativePointerOffset = kObjectArgumentsSizeOffset + sizeof(int);
     static const int kNativeWarperIndexOffset = kNativePointerOffset + sizeof(MIOFunctionPrototype);
-    static const int kMIONativeFunctionOffset = kNativeWarperIndexOffset + sizeof(void **);
+    static const int kLeafPointerOffset = kNativeWarperIndexOffset + sizeof(void **);
+    static const int kMIONativeFunctionOffset = kLeafPointerOffset + sizeof(MIOLeafFunctionPrototype);
 
     DEFINE_HEAP_OBJ_RW(MIOString *, Signature)
     DEFINE_HEAP_OBJ_RW(int, PrimitiveArgumentsSize)
     DEFINE_HEAP_OBJ_RW(int, ObjectArgumentsSize)
     DEFINE_HEAP_OBJ_RW(MIOFunctionPrototype, NativePointer)
     DEFINE_HEAP_OBJ_RW(void **, NativeWarperIndex)
+    DEFINE_HEAP_OBJ_RW(MIOLeafFunctionPrototype, LeafPointer)
 
     inline void SetTemplate(void *pointer) {
         HeapObjectSet<void *>(this, kNativePointerOffset, pointer);
@@ -377,6 +389,18 @@ public:
         return reinterpret_cast<MIONativeWarper>(*GetNativeWarperIndex());
     }
 
+    /**
+     * Native code can call the function directly in C calling convention:
+     * R (Thread *, arguments in order of signature), instead of marshalling
+     * arguments from stacks by the warper.
+     *
+     * @return null if the function was not registered by template.
+     */
+    inline void *GetDirectEntry() const {
+        return GetNativeWarperIndex() ?
+               reinterpret_cast<void *>(GetNativePointer()) : nullptr;
+    }
+
     DECLARE_VM_OBJECT(NativeFunction)
     DISALLOW_IMPLICIT_CONSTRUCTORS(MIONativeFunction)
 }; // class MIONativeFunction
@@ -403,7 +427,8 @@ public:
     static const int kCodeSizeOffset = kConstantObjectSizeOffset + sizeof(int);
     static const int kNativeCodeFragmentOffset = kCodeSizeOffset + sizeof(int);
     static const int kDebugInfoOffset = kNativeCodeFragmentOffset + sizeof(NativeCodeFragment *);
-    static const int kHeaderOffset = kDebugInfoOffset + sizeof(DebugInfo *);
+    static const int kDecodedCodeOffset = kDebugInfoOffset + sizeof(DebugInfo *);
+    static const int kHeaderOffset = kDecodedCodeOffset + sizeof(DecodedBitCode *);
 
     DEFINE_HEAP_OBJ_RW(uint32_t, GeneratedFlags)
     DEFINE_HEAP_OBJ_RW(int, ConstantPrimitiveSize)
@@ -411,6 +436,7 @@ public:
     DEFINE_HEAP_OBJ_RW(int, CodeSize)
     DEFINE_HEAP_OBJ_RW(NativeCodeFragment *, NativeCodeFragment)
     DEFINE_HEAP_OBJ_RW(DebugInfo *, DebugInfo)
+    DEFINE_HEAP_OBJ_RW(DecodedBitCode *, DecodedCode)
 
     int GetId() const {
         return (GetGeneratedFlags() & ~kRecompilingKindMask) >> 4;
@@ -982,11 +1008,42 @@ struct FunctionDebugInfo {
     int         pc_to_position[1]; // pc to position;
 };
 
+/**
+ * Deoptimization metadata of native code compiled by optimizing compiler:
+ *
+ * +-------------+------------+-----------+--------------+-------------+
+ * | deopt_count | entry_size | exit_size | entry pcs... | exit pcs... |
+ * +-------------+------------+-----------+--------------+-------------+
+ */
+struct NativeCodeDeoptInfo {
+    int deopt_count; // failed guards, native code is dropped if too many.
+    int entry_size;  // function entry, loop_entry (OSR) and after side exits.
+    int exit_size;   // side exits and guards.
+    int pcs[1];      // entry pcs then exit pcs.
+};
+
 struct NativeCodeFragment {
-    NativeCodeFragment *next;
-    void              **index;
+    NativeCodeFragment   *next;
+    void                **index;
+    int                   entry; // loop_entry pc of trace, or -1 for whole function.
+    NativeCodeDeoptInfo  *deopt_info; // only for optimized code, or null.
+    MIOGeneratedFunction *function; // owner of the fragment.
+    // Ring of all installed fragments for aging, see Thread::AgeNativeCode().
+    NativeCodeFragment   *prev_installed;
+    NativeCodeFragment   *next_installed;
+    int                   hits; // entered times since the last aging.
+    int                   age;  // agings without any hit.
 };
 
+inline void UnlinkInstalledNativeCodeFragment(NativeCodeFragment *fragment) {
+    if (fragment->next_installed) {
+        fragment->prev_installed->next_installed = fragment->next_installed;
+        fragment->next_installed->prev_installed = fragment->prev_installed;
+        fragment->prev_installed = nullptr;
+        fragment->next_installed = nullptr;
+    }
+}
+
 struct MIOStringDataHash {
     std::size_t operator()(const char *data) const {
         std::size_t h = 1315423911;
@@ -1023,42 +1080,6 @@ inline void *MIOVector::GetDataAddress(int index) {
     return static_cast<uint8_t *>(GetData()) + index * GetElement()->GetTypePlacementSize();
 }
 
-inline void HORemove(HeapObject *ob) {
-    DCHECK_NOTNULL(ob->GetNext())->SetPrev(ob->GetPrev());
-    DCHECK_NOTNULL(ob->GetPrev())->SetNext(ob->GetNext());
-    ob->SetNext(nullptr); // for debugging
-    ob->SetPrev(nullptr); // for debugging
-}
-
-inline void HOInsertHead(HeapObject *h, HeapObject *x) {
-    x->SetNext(h->GetNext());
-    x->GetNext()->SetPrev(x);
-    x->SetPrev(h);
-    h->SetNext(x);
-}
-
-inline void HOInsertTail(HeapObject *h, HeapObject *x) {
-    x->SetPrev(h->GetPrev());
-    x->GetPrev()->SetNext(x);
-    x->SetNext(h);
-    h->SetPrev(x);
-}
-
-inline void HOLink(HeapObject *h, HeapObject *n) {
-    h->GetPrev()->SetNext(n->GetNext());
-    n->GetNext()->SetPrev(h->GetPrev());
-    h->SetPrev(n->GetPrev());
-    h->GetPrev()->SetNext(h);
-}
-
-inline bool HOIsEmpty(HeapObject *h) {
-    return h->GetNext() == h;
-}
-
-inline bool HOIsNotEmpty(HeapObject *h) {
-    return !HOIsEmpty(h);
-}
-
 } // namespace mio
 
 #endif // MIO_VM_OBJECTS_H_
@@ -0,0 +1,135 @@
+#include "vm-perf-map.h"
+#include "vm-code-cache.h"
+#include "gtest/gtest.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+namespace mio {
+
+namespace {
+
+std::string ReadAll(const std::string &file_name) {
+    std::ifstream in(file_name, std::ios::binary);
+    std::stringstream buf;
+    buf << in.rdbuf();
+    return buf.str();
+}
+
+template<class T>
+T ReadAt(const std::string &data, size_t offset) {
+    T value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+TEST(PerfCodeMapTest, PerfMap) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+    std::unique_ptr<PerfCodeMap> map(new PerfCodeMap("/tmp", false));
+    ASSERT_TRUE(map->Init());
+    cache.set_perf_map(map.get());
+
+    auto ref = cache.Allocate(16);
+    ASSERT_FALSE(ref.empty());
+    cache.Describe(ref, "mio:::main::main [main.mio]");
+
+    char expected[128];
+    snprintf(expected, arraysize(expected), "%lx 10 mio:::main::main [main.mio]\n",
+             reinterpret_cast<uintptr_t>(ref.data()));
+    EXPECT_EQ(expected, ReadAll(map->map_file_name()));
+    EXPECT_TRUE(map->dump_file_name().empty());
+    unlink(map->map_file_name().c_str());
+}
+
+TEST(PerfCodeMapTest, JitDump) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+    std::unique_ptr<PerfCodeMap> map(new PerfCodeMap("/tmp", true));
+    ASSERT_TRUE(map->Init());
+    cache.set_perf_map(map.get());
+
+    auto hole = cache.Allocate(32);
+    auto ref = cache.Allocate(8);
+    ASSERT_FALSE(ref.empty());
+    memset(ref.data(), 0xc3, 8);
+    cache.Describe(ref, "foo");
+    cache.Free(hole);
+    cache.Compact();
+
+    auto dump = ReadAll(map->dump_file_name());
+    // File header.
+    ASSERT_LT(40u, dump.size());
+    EXPECT_EQ(static_cast<uint32_t>(PerfCodeMap::kJitDumpMagic), ReadAt<uint32_t>(dump, 0));
+    EXPECT_EQ(static_cast<uint32_t>(PerfCodeMap::kJitDumpVersion), ReadAt<uint32_t>(dump, 4));
+    EXPECT_EQ(40u, ReadAt<uint32_t>(dump, 8));
+    EXPECT_EQ(static_cast<uint32_t>(getpid()), ReadAt<uint32_t>(dump, 20));
+
+    // Load record: header, fixed fields, name and code bytes.
+    size_t p = 40;
+    EXPECT_EQ(PerfCodeMap::kCodeLoad, ReadAt<uint32_t>(dump, p));
+    auto total_size = ReadAt<uint32_t>(dump, p + 4);
+    EXPECT_EQ(16u + 40u + 4u + 8u, total_size);
+    EXPECT_EQ(8u, ReadAt<uint64_t>(dump, p + 16 + 24));
+    EXPECT_STREQ("foo", dump.data() + p + 16 + 40);
+    EXPECT_EQ('\xc3', dump[p + 16 + 40 + 4]);
+
+    // Move record after compacting.
+    p += total_size;
+    ASSERT_LT(p, dump.size());
+    EXPECT_EQ(PerfCodeMap::kCodeMove, ReadAt<uint32_t>(dump, p));
+    EXPECT_EQ(16u + 48u, ReadAt<uint32_t>(dump, p + 4));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ref.data()),
+              ReadAt<uint64_t>(dump, p + 16 + 24));
+    EXPECT_EQ(dump.size(), p + 16 + 48);
+
+    unlink(map->map_file_name().c_str());
+    unlink(map->dump_file_name().c_str());
+}
+
+TEST(PerfCodeMapTest, JitDumpFreedAndThreads) {
+    CodeCache cache(16 * 1024);
+    ASSERT_TRUE(cache.Init());
+    std::unique_ptr<PerfCodeMap> map(new PerfCodeMap("/tmp", true));
+    ASSERT_TRUE(map->Init());
+    cache.set_perf_map(map.get());
+
+    // Background compiler describes code in its own thread.
+    auto hole = cache.Allocate(32);
+    auto ref = cache.Allocate(8);
+    ASSERT_FALSE(ref.empty());
+    uint32_t tid = 0;
+    std::thread worker([&]() {
+        cache.Describe(ref, "foo");
+        tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    });
+    worker.join();
+    ASSERT_NE(static_cast<uint32_t>(getpid()), tid);
+
+    // The freed address is taken by code without description, it is not
+    // moved as "foo" by compacting.
+    auto data = ref.data();
+    cache.Free(ref);
+    ref = cache.Allocate(8);
+    ASSERT_EQ(data, ref.data());
+    cache.Free(hole);
+    cache.Compact();
+    ASSERT_NE(data, ref.data());
+
+    auto dump = ReadAll(map->dump_file_name());
+    size_t p = 40;
+    ASSERT_LT(p, dump.size());
+    EXPECT_EQ(PerfCodeMap::kCodeLoad, ReadAt<uint32_t>(dump, p));
+    EXPECT_EQ(static_cast<uint32_t>(getpid()), ReadAt<uint32_t>(dump, p + 16));
+    EXPECT_EQ(tid, ReadAt<uint32_t>(dump, p + 16 + 4));
+    EXPECT_EQ(dump.size(), p + ReadAt<uint32_t>(dump, p + 4));
+
+    unlink(map->map_file_name().c_str());
+    unlink(map->dump_file_name().c_str());
+}
+
+} // namespace mio
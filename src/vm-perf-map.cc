@@ -0,0 +1,191 @@
+#include "vm-perf-map.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+
+namespace mio {
+
+namespace {
+
+struct JitDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JitDumpRecordHeader {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct JitDumpCodeLoad {
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    // name and code bytes follow.
+};
+
+struct JitDumpCodeMove {
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t old_code_addr;
+    uint64_t new_code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+// perf record -k 1 uses the monotonic clock.
+inline uint64_t Timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Code can be installed by background compiler thread.
+inline uint32_t ThreadId() {
+    return static_cast<uint32_t>(syscall(SYS_gettid));
+}
+
+} // namespace
+
+PerfCodeMap::PerfCodeMap(const char *dir, bool jitdump)
+    : dir_(dir)
+    , jitdump_(jitdump) {
+}
+
+PerfCodeMap::~PerfCodeMap() {
+    if (dump_marker_) {
+        munmap(dump_marker_, kPageSize);
+    }
+    if (dump_fp_) {
+        fclose(dump_fp_);
+    }
+    if (map_fp_) {
+        fclose(map_fp_);
+    }
+}
+
+bool PerfCodeMap::Init() {
+    char buf[64];
+    snprintf(buf, arraysize(buf), "/perf-%d.map", getpid());
+    map_file_name_ = dir_ + buf;
+    map_fp_ = fopen(map_file_name_.c_str(), "w");
+    if (!map_fp_) {
+        PLOG(ERROR) << "can not open perf map: " << map_file_name_;
+        return false;
+    }
+    return !jitdump_ || InitJitDump();
+}
+
+bool PerfCodeMap::InitJitDump() {
+    char buf[64];
+    snprintf(buf, arraysize(buf), "/jit-%d.dump", getpid());
+    dump_file_name_ = dir_ + buf;
+    dump_fp_ = fopen(dump_file_name_.c_str(), "w+");
+    if (!dump_fp_) {
+        PLOG(ERROR) << "can not open jitdump: " << dump_file_name_;
+        return false;
+    }
+    dump_marker_ = mmap(nullptr, kPageSize, PROT_READ|PROT_EXEC, MAP_PRIVATE,
+                        fileno(dump_fp_), 0);
+    if (dump_marker_ == MAP_FAILED) {
+        dump_marker_ = nullptr;
+        PLOG(ERROR) << "can not mmap jitdump: " << dump_file_name_;
+        return false;
+    }
+
+    JitDumpHeader header;
+    header.magic      = kJitDumpMagic;
+    header.version    = kJitDumpVersion;
+    header.total_size = sizeof(header);
+    header.elf_mach   = kElfMachX86_64;
+    header.pad1       = 0;
+    header.pid        = static_cast<uint32_t>(getpid());
+    header.timestamp  = Timestamp();
+    header.flags      = 0;
+    fwrite(&header, sizeof(header), 1, dump_fp_);
+    fflush(dump_fp_);
+    return true;
+}
+
+void PerfCodeMap::Load(const void *code, int size, const char *name) {
+    auto index = next_code_index_++;
+    chunks_[reinterpret_cast<uintptr_t>(code)] = std::make_pair(index, name);
+    fprintf(map_fp_, "%lx %x %s\n", reinterpret_cast<uintptr_t>(code), size,
+            name);
+    fflush(map_fp_);
+    if (!dump_fp_) {
+        return;
+    }
+
+    auto name_size = strlen(name) + 1;
+    WriteRecordHeader(kCodeLoad, static_cast<int>(sizeof(JitDumpCodeLoad) +
+                                                  name_size + size));
+    JitDumpCodeLoad load;
+    load.pid        = static_cast<uint32_t>(getpid());
+    load.tid        = ThreadId();
+    load.vma        = reinterpret_cast<uintptr_t>(code);
+    load.code_addr  = load.vma;
+    load.code_size  = size;
+    load.code_index = index;
+    fwrite(&load, sizeof(load), 1, dump_fp_);
+    fwrite(name, name_size, 1, dump_fp_);
+    fwrite(code, size, 1, dump_fp_);
+    fflush(dump_fp_);
+}
+
+void PerfCodeMap::Move(const void *from, const void *to, int size) {
+    auto iter = chunks_.find(reinterpret_cast<uintptr_t>(from));
+    if (iter == chunks_.end()) {
+        return; // not described.
+    }
+    auto chunk = std::move(iter->second);
+    chunks_.erase(iter);
+    auto &name = chunk.second;
+
+    // perf map has no moving, the later line takes the new address.
+    fprintf(map_fp_, "%lx %x %s\n", reinterpret_cast<uintptr_t>(to), size,
+            name.c_str());
+    fflush(map_fp_);
+    chunks_[reinterpret_cast<uintptr_t>(to)] = chunk;
+    if (!dump_fp_) {
+        return;
+    }
+
+    WriteRecordHeader(kCodeMove, sizeof(JitDumpCodeMove));
+    JitDumpCodeMove move;
+    move.pid           = static_cast<uint32_t>(getpid());
+    move.tid           = ThreadId();
+    move.vma           = reinterpret_cast<uintptr_t>(to);
+    move.old_code_addr = reinterpret_cast<uintptr_t>(from);
+    move.new_code_addr = move.vma;
+    move.code_size     = size;
+    move.code_index    = chunk.first;
+    fwrite(&move, sizeof(move), 1, dump_fp_);
+    fflush(dump_fp_);
+}
+
+void PerfCodeMap::Unload(const void *code) {
+    chunks_.erase(reinterpret_cast<uintptr_t>(code));
+}
+
+void PerfCodeMap::WriteRecordHeader(RecordId id, int size) {
+    JitDumpRecordHeader header;
+    header.id         = id;
+    header.total_size = static_cast<uint32_t>(sizeof(header) + size);
+    header.timestamp  = Timestamp();
+    fwrite(&header, sizeof(header), 1, dump_fp_);
+}
+
+} // namespace mio
@@ -0,0 +1,78 @@
+#ifndef MIO_VM_PERF_MAP_H_
+#define MIO_VM_PERF_MAP_H_
+
+#include "base.h"
+#include "glog/logging.h"
+#include <string>
+#include <unordered_map>
+#include <stdio.h>
+
+namespace mio {
+
+/**
+ * Describe native code in CodeCache for linux perf, so `perf report' shows
+ * mio functions instead of [unknown] frames:
+ *
+ * - perf map: `<dir>/perf-<pid>.map', one text line for each chunk, it is
+ *   read by perf report directly.
+ * - jitdump: `<dir>/jit-<pid>.dump', load and move records with code bytes,
+ *   for `perf record -k 1' then `perf inject --jit'.
+ *
+ * Calls are serialized by CodeCache lock.
+ */
+class PerfCodeMap {
+public:
+    // JIT_CODE_LOAD and JIT_CODE_MOVE of jitdump specification.
+    enum RecordId: uint32_t {
+        kCodeLoad = 0,
+        kCodeMove = 1,
+    };
+
+    static const uint32_t kJitDumpMagic   = 0x4A695444; // "JiTD"
+    static const uint32_t kJitDumpVersion = 1;
+    static const uint32_t kElfMachX86_64  = 62;
+
+    PerfCodeMap(const char *dir, bool jitdump);
+    ~PerfCodeMap();
+
+    bool Init();
+
+    const std::string &map_file_name() const { return map_file_name_; }
+    const std::string &dump_file_name() const { return dump_file_name_; }
+
+    /**
+     * A chunk of code was installed.
+     */
+    void Load(const void *code, int size, const char *name);
+
+    /**
+     * A chunk of code was moved by compacting.
+     */
+    void Move(const void *from, const void *to, int size);
+
+    /**
+     * A chunk of code was freed, its address can be taken by other code.
+     */
+    void Unload(const void *code);
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(PerfCodeMap)
+private:
+    bool InitJitDump();
+
+    void WriteRecordHeader(RecordId id, int size);
+
+    std::string dir_;
+    bool jitdump_;
+    std::string map_file_name_;
+    std::string dump_file_name_;
+    FILE *map_fp_ = nullptr;
+    FILE *dump_fp_ = nullptr;
+    void *dump_marker_ = nullptr; // perf finds jitdump by its mmap event.
+    uint64_t next_code_index_ = 0;
+    // Described chunks for moving: address -> code index and name.
+    std::unordered_map<uintptr_t, std::pair<uint64_t, std::string>> chunks_;
+}; // class PerfCodeMap
+
+} // namespace mio
+
+#endif // MIO_VM_PERF_MAP_H_
@@ -35,6 +35,13 @@ void Profiler::Stop() {
     thread_ = nullptr;
 }
 
+void Profiler::DoSample() {
+    while (shoud_sample_.load(std::memory_order_release)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(sample_rate_));
+        vm_->current()->RequestSafepoint(Thread::SAFEPOINT_SAMPLE);
+    }
+}
+
 void Profiler::TEST_PrintSamples() {
     for (int i = 0; i < max_hot_points_; ++i) {
         auto fn = hot_points_[i].fn;
@@ -31,10 +31,14 @@ public:
 
     void TEST_PrintSamples();
 
+    /**
+     * Take a sample of current thread, only called at its safepoint.
+     */
+    void SampleTick();
+
     DISALLOW_IMPLICIT_CONSTRUCTORS(Profiler)
 private:
-    inline void DoSample();
-    void SampleTick();
+    void DoSample();
 
     VM *vm_;
     int sample_rate_ = 10;
@@ -53,13 +57,6 @@ inline void Profiler::Start() {
     });
 }
 
-inline void Profiler::DoSample() {
-    while (shoud_sample_.load(std::memory_order_release)) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(sample_rate_));
-        SampleTick();
-    }
-}
-
 inline int64_t Profiler::EstimateCallHit(int64_t sample_hit) const {
     return sample_hit * (1000LL / sample_rate_);
 }
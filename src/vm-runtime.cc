@@ -19,6 +19,13 @@ const RtNativeFunctionEntry kRtNaFn[] = {
     { .name = nullptr, .pointer = nullptr, } // end of functions
 };
 
+const RtLeafFunctionEntry kRtLeafFn[] = {
+    // base library
+    { "::base::tick",   &NativeBaseLibrary::LeafTick, },
+
+    { .name = nullptr, .pointer = nullptr, } // end of functions
+};
+
 /* static */ int NativeBaseLibrary::NewError(VM *vm, Thread *thread) {
     bool ok = true;
     auto message = thread->GetString(0, &ok);
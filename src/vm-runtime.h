@@ -14,7 +14,13 @@ struct RtNativeFunctionEntry {
     MIOFunctionPrototype  pointer;
 };
 
+struct RtLeafFunctionEntry {
+    const char *              name;
+    MIOLeafFunctionPrototype  pointer;
+};
+
 extern const RtNativeFunctionEntry kRtNaFn[];
+extern const RtLeafFunctionEntry kRtLeafFn[];
 
 class NativeBaseLibrary {
 public:
@@ -34,6 +40,11 @@ public:
         return 0;
     }
 
+    static int LeafTick(VM *vm, void *p_base, void */*o_base*/) {
+        *reinterpret_cast<int *>(static_cast<uint8_t *>(p_base) - 4) = vm->tick();
+        return 0;
+    }
+
     static int GC(VM *vm, Thread *thread) {
         vm->gc()->Step(vm->tick());
         return 0;
@@ -7,9 +7,15 @@
 #include "vm-objects.h"
 #include "vm.h"
 #include "vm-function-register.h"
+#include "vm-background-compiler.h"
+#include "vm-memory-segment.h"
+#include "vm-code-cache.h"
+#include "msg-garbage-collector.h"
 #include "handles.h"
 #include "code-label.h"
+#include "memory-output-stream.h"
 #include "gtest/gtest.h"
+#include <chrono>
 
 namespace mio {
 
@@ -198,6 +204,10 @@ void TestNativeFoo8(Thread *t, MIOExternal *ex) {
     ex->SetValue(nullptr);
 }
 
+mio_i64_t TestNativeFoo9(Thread *t, mio_i64_t v) {
+    return v * 2;
+}
+
 TEST_F(ThreadTest, P022_FunctionTemplate) {
     ParsingError error;
 
@@ -226,6 +236,21 @@ TEST_F(ThreadTest, P022_FunctionTemplate) {
     ok = vm_->function_register()->RegisterFunctionTemplate("::main::foo8",
                                                             &TestNativeFoo8);
     ASSERT_TRUE(ok);
+    ok = vm_->function_register()->RegisterFunctionTemplate("::main::foo9",
+                                                            &TestNativeFoo9);
+    ASSERT_TRUE(ok);
+
+    // Functions have the same signature share one warper.
+    auto foo3 = vm_->function_register()->FindNativeFunction("::main::foo3");
+    auto foo4 = vm_->function_register()->FindNativeFunction("::main::foo4");
+    auto foo9 = vm_->function_register()->FindNativeFunction("::main::foo9");
+    EXPECT_EQ(foo3->GetNativeWarperIndex(), foo9->GetNativeWarperIndex());
+    EXPECT_NE(foo3->GetNativeWarperIndex(), foo4->GetNativeWarperIndex());
+
+    typedef mio_i64_t (*DirectFoo)(Thread *, mio_i64_t);
+    auto direct = reinterpret_cast<DirectFoo>(foo9->GetDirectEntry());
+    ASSERT_NE(nullptr, direct);
+    EXPECT_EQ(14, direct(vm_->main_thread(), 7));
 
     if (vm_->Run() != 0) {
         std::string buf;
@@ -310,4 +335,488 @@ TEST_F(ThreadTest, P028_WhileLoopProfile) {
     }
 }
 
+namespace {
+
+// Interpret test/029 only, no just-in-time compiling.
+long long DispatchBenchmark(bool direct_threaded) {
+    VM vm;
+    vm.AddSerachPath("libs");
+    EXPECT_TRUE(vm.set_direct_threaded(direct_threaded));
+    EXPECT_TRUE(vm.Init());
+
+    ParsingError error;
+    EXPECT_TRUE(vm.CompileProject("test/029", &error)) << error.ToString();
+
+    auto start = std::chrono::steady_clock::now();
+    if (vm.Run() != 0) {
+        std::string buf;
+        vm.PrintBackstrace(&buf);
+        ADD_FAILURE() << buf;
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    // Decoded bit codes refer to handlers of this mode.
+    EXPECT_FALSE(vm.set_direct_threaded(!direct_threaded));
+    EXPECT_EQ(direct_threaded, vm.direct_threaded());
+    return cost;
+}
+
+} // namespace
+
+TEST_F(ThreadTest, P029_DispatchBenchmark) {
+    auto switch_cost = DispatchBenchmark(false);
+    if (!MIO_DIRECT_THREADED) {
+        printf("dispatch: switch %lld us, direct-threaded not supported\n",
+               switch_cost);
+        return;
+    }
+    auto direct_cost = DispatchBenchmark(true);
+    printf("dispatch: switch %lld us, direct-threaded %lld us\n", switch_cost,
+           direct_cost);
+}
+
+#if MIO_PROFILE_BC_PAIRS
+// Executed bit code pairs of loop benchmarks, the hot ones are fused by
+// BitCodeFusion.
+TEST_F(ThreadTest, P029_BitCodePairs) {
+    for (auto project : {"test/028", "test/029"}) {
+        VM vm;
+        vm.AddSerachPath("libs");
+        ASSERT_TRUE(vm.Init());
+
+        ParsingError error;
+        ASSERT_TRUE(vm.CompileProject(project, &error)) << error.ToString();
+        ASSERT_EQ(0, vm.Run());
+
+        std::string buf;
+        MemoryOutputStream stream(&buf);
+        vm.main_thread()->PrintBitCodePairs(&stream, 16);
+        printf("-- %s --\n%s", project, buf.c_str());
+    }
+}
+#endif
+
+TEST_F(ThreadTest, P030_QuickenedObjectOperations) {
+    ParsingError error;
+
+    ASSERT_TRUE(vm_->CompileProject("test/030", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+}
+
+TEST_F(ThreadTest, NoGCScopeRawGetters) {
+    auto thread = vm_->main_thread();
+    auto s = vm_->object_factory()->GetOrNewString("raw", 3);
+    auto color = s->GetColor();
+    thread->o_stack()->Push<HeapObject *>(s.get());
+
+    {
+        NoGCScope no_gc(thread);
+        auto ok = true;
+        EXPECT_EQ(s.get(), thread->TEST_GetRawString(0, &ok));
+        EXPECT_TRUE(ok);
+        EXPECT_EQ(nullptr, thread->TEST_GetRawHashMap(0, &ok));
+        EXPECT_FALSE(ok);
+
+        // Requested GC step waits for the next safepoint, out of this scope.
+        thread->TEST_RunGC();
+        EXPECT_EQ(color, s->GetColor());
+        EXPECT_EQ(s.get(), thread->o_stack()->Get<HeapObject *>(0));
+    }
+
+    // Marking roots starts at the safepoint.
+    EXPECT_TRUE(thread->TEST_ProcessSafepoint());
+    EXPECT_EQ(MSGGarbageCollector::kGray, s->GetColor());
+}
+
+TEST_F(ThreadTest, GenerationsInHeaderAcrossCollections) {
+    auto gc = static_cast<MSGGarbageCollector *>(vm_->gc());
+    auto nursery = gc->nursery();
+    auto thread = vm_->main_thread();
+    auto minor = [gc] () {
+        do {
+            gc->Step(0);
+        } while (!gc->TEST_IsPaused());
+    };
+
+    // Header is only the flags word, young objects have no table entries.
+    EXPECT_EQ(4, static_cast<int>(HeapObject::kHeapObjectOffset));
+    auto tables = gc->TEST_GetTableSize(0) + gc->TEST_GetTableSize(1);
+    HeapObject *live = nullptr, *dead = nullptr;
+    {
+        auto a = vm_->object_factory()->CreateExternal(1, nullptr);
+        auto b = vm_->object_factory()->CreateExternal(2, nullptr);
+        live = a.get();
+        dead = b.get();
+    }
+    EXPECT_EQ(reinterpret_cast<uint8_t *>(live) +
+              RoundUp(live->GetSize(), Nursery::kObjectAlignment),
+              reinterpret_cast<uint8_t *>(dead));
+    EXPECT_EQ(tables, gc->TEST_GetTableSize(0) + gc->TEST_GetTableSize(1));
+    EXPECT_EQ(0, live->GetGeneration());
+    thread->o_stack()->Push<HeapObject *>(live);
+
+    // Minor collection releases the dead one, and promotes the living one in
+    // place.
+    minor();
+    EXPECT_FALSE(nursery->IsAllocated(dead));
+    EXPECT_TRUE(nursery->IsAllocated(live));
+    EXPECT_EQ(1, live->GetGeneration());
+    EXPECT_EQ(tables, gc->TEST_GetTableSize(0) + gc->TEST_GetTableSize(1));
+
+    // Old objects are only swept by major collections. It was black when
+    // promoted, the first major collection whitens it.
+    thread->o_stack()->Set<HeapObject *>(0, nullptr);
+    minor();
+    EXPECT_TRUE(nursery->IsAllocated(live));
+    gc->FullGC();
+    gc->FullGC();
+    EXPECT_FALSE(nursery->IsAllocated(live));
+}
+
+TEST_F(ThreadTest, UpValueFoundAgainDuringSweeping) {
+    auto gc = static_cast<MSGGarbageCollector *>(vm_->gc());
+    auto thread = vm_->main_thread();
+    static const int32_t kUniqueId = 1001;
+
+    int32_t value = 0x1234;
+    auto val = vm_->object_factory()->GetOrNewUpValue(&value, sizeof(value),
+                                                      kUniqueId, true).get();
+    // Unreachable while marking.
+    do {
+        gc->Step(0);
+    } while (!gc->TEST_IsSweeping());
+
+    // Closing over it again, before the dead one released.
+    {
+        auto again = vm_->object_factory()->GetOrNewUpValue(&value, sizeof(value),
+                                                            kUniqueId, true);
+        ASSERT_EQ(val, again.get());
+    }
+    thread->o_stack()->Push<HeapObject *>(val);
+    do {
+        gc->Step(0);
+    } while (!gc->TEST_IsPaused());
+
+    EXPECT_TRUE(gc->nursery()->IsAllocated(val));
+    auto again = vm_->object_factory()->GetOrNewUpValue(&value, sizeof(value),
+                                                        kUniqueId, true);
+    EXPECT_EQ(val, again.get());
+    EXPECT_EQ(value, *static_cast<int32_t *>(again->GetValue()));
+}
+
+static int safepoint_count = 0;
+
+int CountRoutine(VM *vm, Thread *thread) {
+    if (++safepoint_count >= 10) {
+        thread->set_should_exit(true);
+    }
+    return 0;
+}
+
+TEST_F(ThreadTest, P031_SafepointExit) {
+    ParsingError error;
+
+    ASSERT_TRUE(vm_->CompileProject("test/031", &error)) << error.ToString();
+    vm_->function_register()->RegisterNativeFunction("::main::count", CountRoutine);
+
+    safepoint_count = 0;
+    ASSERT_EQ(0, vm_->Run());
+    EXPECT_EQ(10, safepoint_count);
+    EXPECT_TRUE(vm_->main_thread()->should_exit());
+}
+
+TEST_F(ThreadTest, P032_CallSiteInlineCaches) {
+    ParsingError error;
+
+    ASSERT_TRUE(vm_->CompileProject("test/032", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+}
+
+TEST_F(ThreadTest, P033_TailCall) {
+    ParsingError error;
+
+    ASSERT_TRUE(vm_->CompileProject("test/033", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+}
+
+int IncRoutine(VM *vm, Thread *thread) {
+    thread->p_stack()->Set<mio_int_t>(-8, thread->GetInt(0) + 1);
+    return 0;
+}
+
+int IncLeafRoutine(VM *vm, void *p_base, void *o_base) {
+    auto arg = static_cast<mio_int_t *>(p_base);
+    arg[-1] = arg[0] + 1;
+    return 0;
+}
+
+TEST_F(ThreadTest, P034_LeafNativeCallBenchmark) {
+    for (int leaf = 0; leaf < 2; ++leaf) {
+        TearDown();
+        SetUp();
+
+        ParsingError error;
+        ASSERT_TRUE(vm_->CompileProject("test/034", &error)) << error.ToString();
+        if (leaf) {
+            vm_->function_register()->RegisterLeafFunction("::main::inc", IncLeafRoutine);
+        } else {
+            vm_->function_register()->RegisterNativeFunction("::main::inc", IncRoutine);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::string buf;
+        if (vm_->Run() != 0) {
+            vm_->PrintBackstrace(&buf);
+            FAIL() << buf;
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        printf("native call: %s, %lld ns/call\n", leaf ? "leaf" : "normal",
+               static_cast<long long>(cost / 1000000));
+    }
+}
+
+TEST_F(ThreadTest, P035_BaselineJIT) {
+    ParsingError error;
+
+    vm_->set_hot_func_limit(100);
+    ASSERT_TRUE(vm_->CompileProject("test/035", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+
+    auto entry = vm_->function_register()->FindOrNull("::main::triangle");
+    ASSERT_NE(nullptr, entry);
+    auto fn = vm_->o_global()->Get<HeapObject *>(entry->offset())->AsGeneratedFunction();
+    ASSERT_NE(nullptr, fn);
+    EXPECT_EQ(MIOGeneratedFunction::ALL, fn->GetRecompilingKind());
+}
+
+TEST_F(ThreadTest, P036_TraceJIT) {
+    ParsingError error;
+
+    vm_->set_hot_loop_limit(100);
+    // Only test trace JIT, on-stack replacement will compile whole function.
+    vm_->set_jit_optimize(0);
+    ASSERT_TRUE(vm_->CompileProject("test/036", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+
+    auto entry = vm_->function_register()->FindOrNull("::main::main");
+    ASSERT_NE(nullptr, entry);
+    auto fn = vm_->o_global()->Get<HeapObject *>(entry->offset())->AsGeneratedFunction();
+    ASSERT_NE(nullptr, fn);
+    EXPECT_EQ(MIOGeneratedFunction::PARTIAL, fn->GetRecompilingKind());
+    EXPECT_NE(nullptr, fn->GetNativeCodeFragment());
+}
+
+TEST_F(ThreadTest, P037_OnStackReplacement) {
+    ParsingError error;
+
+    vm_->set_hot_loop_limit(100);
+    ASSERT_TRUE(vm_->CompileProject("test/037", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+
+    auto entry = vm_->function_register()->FindOrNull("::main::main");
+    ASSERT_NE(nullptr, entry);
+    auto fn = vm_->o_global()->Get<HeapObject *>(entry->offset())->AsGeneratedFunction();
+    ASSERT_NE(nullptr, fn);
+    EXPECT_EQ(MIOGeneratedFunction::ALL, fn->GetRecompilingKind());
+    EXPECT_NE(nullptr, fn->GetNativeCodeFragment());
+
+    // Guard of `d` failed after i > 2000, the rest ran in interpreter, and
+    // the sum is still right.
+    EXPECT_GT(vm_->main_thread()->deopts(), 0);
+}
+
+TEST_F(ThreadTest, P038_BackgroundJIT) {
+    ParsingError error;
+
+    delete vm_;
+    vm_ = new VM();
+    vm_->AddSerachPath("libs");
+    vm_->set_jit(true);
+    vm_->set_jit_optimize(1);
+    vm_->set_jit_background(true);
+    vm_->set_hot_func_limit(100);
+    vm_->set_hot_loop_limit(100);
+    ASSERT_TRUE(vm_->Init());
+    ASSERT_NE(nullptr, vm_->background_compiler());
+
+    // On-stack replacement and deoptimizing.
+    ASSERT_TRUE(vm_->CompileProject("test/037", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+
+    // Compiling may not finish before running finished.
+    vm_->background_compiler()->TEST_WaitForIdle();
+    vm_->background_compiler()->InstallFinished();
+    auto entry = vm_->function_register()->FindOrNull("::main::main");
+    ASSERT_NE(nullptr, entry);
+    auto fn = vm_->o_global()->Get<HeapObject *>(entry->offset())->AsGeneratedFunction();
+    ASSERT_NE(nullptr, fn);
+    EXPECT_EQ(MIOGeneratedFunction::ALL, fn->GetRecompilingKind());
+    EXPECT_FALSE(vm_->background_compiler()->IsCompiling(fn));
+
+    // Run the installed code again, so its guard must fail.
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+    EXPECT_GT(vm_->main_thread()->deopts(), 0);
+}
+
+TEST_F(ThreadTest, P039_EvictColdNativeCode) {
+    ParsingError error;
+
+    delete vm_;
+    vm_ = new VM();
+    vm_->AddSerachPath("libs");
+    vm_->set_jit(true);
+    vm_->set_native_code_size(2 * kPageSize);
+    vm_->set_hot_func_limit(100);
+    vm_->set_hot_loop_limit(1000000);
+    ASSERT_TRUE(vm_->Init());
+
+    // Leave a little room for the program, the code cache is running out.
+    auto cc = vm_->code_cache();
+    ASSERT_FALSE(cc->Allocate(cc->size() * 3 / 4 - 256).empty());
+
+    ASSERT_TRUE(vm_->CompileProject("test/039", &error)) << error.ToString();
+    std::string buf;
+    if (vm_->Run() != 0) {
+        buf.clear();
+        vm_->PrintBackstrace(&buf);
+        FAIL() << buf;
+    }
+
+    MIOGeneratedFunction *fns[4];
+    for (int i = 0; i < arraysize(fns); ++i) {
+        std::string name("::main::f");
+        name.append(1, '1' + i);
+        auto entry = vm_->function_register()->FindOrNull(name.c_str());
+        ASSERT_NE(nullptr, entry) << name;
+        fns[i] = vm_->o_global()->Get<HeapObject *>(entry->offset())->AsGeneratedFunction();
+        ASSERT_NE(nullptr, fns[i]) << name;
+    }
+    // f1 was not called after f2 became hot.
+    EXPECT_EQ(MIOGeneratedFunction::NONE, fns[0]->GetRecompilingKind());
+    EXPECT_EQ(nullptr, fns[0]->GetNativeCodeFragment());
+    for (int i = 1; i < arraysize(fns); ++i) {
+        EXPECT_EQ(MIOGeneratedFunction::ALL, fns[i]->GetRecompilingKind());
+    }
+}
+
+TEST_F(ThreadTest, P039_ReclaimNativeCodeOnRunningOut) {
+    ParsingError error;
+    int max_size = 0;
+    for (int i = 0; i < 2; ++i) {
+        delete vm_;
+        vm_ = new VM();
+        vm_->AddSerachPath("libs");
+        vm_->set_jit(true);
+        vm_->set_hot_func_limit(100);
+        vm_->set_hot_loop_limit(1000000);
+        ASSERT_TRUE(vm_->Init());
+        ASSERT_TRUE(vm_->CompileProject("test/039", &error)) << error.ToString();
+
+        // Leave room for only one of functions at the second running.
+        auto cc = vm_->code_cache();
+        if (max_size > 0) {
+            auto room = max_size * 3 / 2;
+            ASSERT_FALSE(cc->Allocate(cc->GetLargestFreeSize() - room).empty());
+        }
+        std::string buf;
+        if (vm_->Run() != 0) {
+            buf.clear();
+            vm_->PrintBackstrace(&buf);
+            FAIL() << buf;
+        }
+
+        MIOGeneratedFunction *fns[4];
+        for (int j = 0; j < arraysize(fns); ++j) {
+            std::string name("::main::f");
+            name.append(1, '1' + j);
+            auto entry = vm_->function_register()->FindOrNull(name.c_str());
+            ASSERT_NE(nullptr, entry) << name;
+            fns[j] = vm_->o_global()->Get<HeapObject *>(entry->offset())->AsGeneratedFunction();
+            ASSERT_NE(nullptr, fns[j]) << name;
+        }
+        if (max_size == 0) {
+            for (auto fn : fns) {
+                ASSERT_NE(nullptr, fn->GetNativeCodeFragment());
+                max_size = std::max(max_size,
+                        cc->GetChunkSize(*fn->GetNativeCodeFragment()->index));
+            }
+            continue;
+        }
+        // Every hot function evicted the previous one for its native code.
+        for (int j = 0; j < arraysize(fns) - 1; ++j) {
+            EXPECT_EQ(MIOGeneratedFunction::NONE, fns[j]->GetRecompilingKind());
+            EXPECT_EQ(nullptr, fns[j]->GetNativeCodeFragment());
+        }
+        EXPECT_EQ(MIOGeneratedFunction::ALL, fns[3]->GetRecompilingKind());
+        EXPECT_NE(nullptr, fns[3]->GetNativeCodeFragment());
+    }
+}
+
+TEST_F(ThreadTest, P040_AllocatorBenchmark) {
+    static const char *kAllocators[] = {"fallback", "slab"};
+
+    for (auto name : kAllocators) {
+        delete vm_;
+        vm_ = new VM();
+        vm_->AddSerachPath("libs");
+        vm_->set_allocator_name(name);
+        ASSERT_TRUE(vm_->Init());
+
+        ParsingError error;
+        ASSERT_TRUE(vm_->CompileProject("test/040", &error)) << error.ToString();
+
+        auto start = std::chrono::steady_clock::now();
+        std::string buf;
+        if (vm_->Run() != 0) {
+            vm_->PrintBackstrace(&buf);
+            FAIL() << buf;
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        printf("allocator: %s, cost: %lld us\n", name,
+               static_cast<long long>(cost));
+    }
+}
+
 } // namespace mio
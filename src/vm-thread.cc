@@ -3,11 +3,18 @@
 #include "vm-objects.h"
 #include "vm-object-surface.h"
 #include "vm-stack.h"
+#include "vm-runtime.h"
+#include "vm-code-cache.h"
+#include "vm-object-extra-factory.h"
 #include "vm-memory-segment.h"
 #include "vm-bitcode-disassembler.h"
+#include "vm-bitcode-decoder.h"
 #include "vm-bitcode.h"
 #include "vm.h"
+#include "vm-profiler.h"
+#include "vm-background-compiler.h"
 #include "tracing.h"
+#include "compiler.h"
 #include "memory-output-stream.h"
 #include "handles.h"
 #include "glog/logging.h"
@@ -25,7 +32,7 @@ struct CallContext {
     MIOFunction *callee;
 
     int pc;
-    uint64_t *bc;
+    DecodedBitCode *bc;
 
     inline MIOGeneratedFunction *generated_function() {
         auto fn = callee->AsGeneratedFunction();
@@ -82,353 +89,570 @@ private:
     int          max_deep_;
 }; // class CallStack
 
-#define RunGC() (vm_->gc_->Step(vm_->tick_))
+// GC steps only run at safepoints, see Thread::ProcessSafepoint().
+#define RunGC() { \
+    ++gc_steps_; \
+    RequestSafepoint(SAFEPOINT_GC_STEP); \
+} (void)0
+
+#define SAFEPOINT() { \
+    ++vm_->tick_; \
+    if (poll_word_.load(std::memory_order_relaxed) && !ProcessSafepoint()) { \
+        return; \
+    } \
+} (void)0
 
 #define TRACE(body) if (!(body)) { \
     Panic(OUT_OF_MEMORY, ok, "trace fail: out of memory."); \
     return; \
 } (void)0
 
+// Go on running in native code if current function has been compiled, see
+// BaselineCompiler and NCodeGenerator.
+#define RESUME_NATIVE() if (vm_->jit_) { \
+    auto native = GetNativeCode(generated_function()); \
+    if (native && !RunNativeCode(native)) { \
+        return; \
+    } \
+} (void)0
+
+// Direct-threaded dispatch: every handler fetches and jumps to the next one by
+// itself, instead of going back to the top of the switch.
+// kThreaded is a template parameter of Interpret(), the switch loop has no
+// handler table, for comparing both modes in one build.
+#if MIO_DIRECT_THREADED
+#define BC_CASE(name) case BC_##name: L_##name
+#define BC_NEXT() if (kThreaded) { \
+    bc = &bc_[pc_++]; \
+    BC_PROFILE_PAIR(bc); \
+    goto *bc->handler; \
+} break
+#define BC_REDISPATCH() if (kThreaded) { \
+    goto *bc->handler; \
+} --pc_; break
+#else
+#define BC_CASE(name) case BC_##name
+#define BC_NEXT() break
+#define BC_REDISPATCH() { --pc_; break; } (void)0
+#endif
+
+#if MIO_PROFILE_BC_PAIRS
+#define BC_PROFILE_PAIR(bc) { \
+    auto next = std::min<int>((bc)->inst, MAX_BC_INSTRUCTIONS); \
+    ++bc_pairs_[last_inst_ * (MAX_BC_INSTRUCTIONS + 1) + next]; \
+    last_inst_ = next; \
+} (void)0
+#else
+#define BC_PROFILE_PAIR(bc) (void)0
+#endif
+
+// The observed shape of a quickened site has changed, rewrite it back to the
+// generic oop and run the same bit code again.
+#define BC_DEQUICKEN() { \
+    bc->inst     = BC_oop; \
+    bc->handler  = handlers ? handlers[BC_oop] : nullptr; \
+    bc->flags   |= kDecodedNoQuickening; \
+    BC_REDISPATCH(); \
+} (void)0
+
+static inline bool IsPrimitive8Bytes(MIOReflectionType *type) {
+    return type->IsPrimitive() && type->GetTypePlacementSize() == 8;
+}
+
+static inline bool IsIntegerKeyMap(MIOHashMap *map) {
+    return map->GetKey()->IsReflectionIntegral() &&
+           map->GetKey()->GetTypePlacementSize() == sizeof(mio_int_t);
+}
+
+static inline bool IsStringKeyMap(MIOHashMap *map) {
+    return map->GetKey()->IsReflectionString();
+}
+
+static inline MIOPair *FindIntegerKeyPair(MIOHashMap *map, mio_int_t key) {
+    auto code = NativeBaseLibrary::PrimitiveHash(&key, sizeof(key));
+    auto node = map->GetSlot(code % map->GetSlotSize())->head;
+    while (node && *static_cast<mio_int_t *>(node->GetKey()) != key) {
+        node = node->GetNext();
+    }
+    return node;
+}
+
+static inline MIOPair *FindStringKeyPair(MIOHashMap *map, MIOString *key) {
+    auto code = NativeBaseLibrary::StringHash(&key, sizeof(key));
+    auto node = map->GetSlot(code % map->GetSlotSize())->head;
+    while (node) {
+        if (NativeBaseLibrary::StringEqualTo({node->GetKey(), sizeof(key)},
+                                             {&key, sizeof(key)})) {
+            break;
+        }
+        node = node->GetNext();
+    }
+    return node;
+}
+
+// Array or slice viewed by raw pointers, only for NoGCScope.
+struct RawArray {
+    MIOVector *core;
+    int begin;
+    int size;
+    int element_size;
+
+    void *Get(mio_int_t index) const {
+        return static_cast<uint8_t *>(core->GetData()) +
+               (index + begin) * element_size;
+    }
+};
+
+static inline bool GetRawArray(HeapObject *ob, RawArray *array) {
+    if (ob->IsSlice()) {
+        auto slice = ob->AsSlice();
+        array->core  = slice->GetVector();
+        array->begin = slice->GetRangeBegin();
+        array->size  = slice->GetRangeSize();
+    } else if (ob->IsVector()) {
+        array->core  = ob->AsVector();
+        array->begin = 0;
+        array->size  = array->core->GetSize();
+    } else {
+        return false;
+    }
+    array->element_size = array->core->GetElement()->GetTypePlacementSize();
+    return true;
+}
+
 Thread::Thread(VM *vm)
     : vm_(DCHECK_NOTNULL(vm))
     , p_stack_(new Stack())
     , o_stack_(new Stack())
-    , call_stack_(new CallStack(vm->max_call_deep())) {
+    , call_stack_(new CallStack(vm->max_call_deep()))
+    , poll_word_(0) {
+    memset(megamorphic_caches_, 0, sizeof(megamorphic_caches_));
+#if MIO_PROFILE_BC_PAIRS
+    bc_pairs_ = new int64_t[(MAX_BC_INSTRUCTIONS + 1) * (MAX_BC_INSTRUCTIONS + 1)];
+    memset(bc_pairs_, 0, (MAX_BC_INSTRUCTIONS + 1) * (MAX_BC_INSTRUCTIONS + 1) *
+           sizeof(*bc_pairs_));
+    last_inst_ = MAX_BC_INSTRUCTIONS;
+#endif
 }
 
 Thread::~Thread() {
     delete p_stack_;
     delete o_stack_;
     delete call_stack_;
+#if MIO_PROFILE_BC_PAIRS
+    delete[] bc_pairs_;
+#endif
+}
+
+#if MIO_PROFILE_BC_PAIRS
+void Thread::PrintBitCodePairs(TextOutputStream *stream, int top) {
+    static const int kNumberOfInsts = MAX_BC_INSTRUCTIONS + 1;
+
+    std::vector<int> pairs;
+    int64_t total = 0;
+    for (int i = 0; i < kNumberOfInsts * kNumberOfInsts; ++i) {
+        if (bc_pairs_[i] > 0) {
+            pairs.push_back(i);
+            total += bc_pairs_[i];
+        }
+    }
+    top = std::min(top, static_cast<int>(pairs.size()));
+    std::partial_sort(pairs.begin(), pairs.begin() + top, pairs.end(),
+                      [this] (int a, int b) { return bc_pairs_[a] > bc_pairs_[b]; });
+
+    auto text = [] (int inst) {
+        return inst < MAX_BC_INSTRUCTIONS ? kInstructionMetadata[inst].text : "-";
+    };
+    stream->Printf("bit code pairs: %lld\n", static_cast<long long>(total));
+    for (int i = 0; i < top; ++i) {
+        auto n = bc_pairs_[pairs[i]];
+        stream->Printf("%-16s %-16s %12lld %5.1f%%\n",
+                       text(pairs[i] / kNumberOfInsts),
+                       text(pairs[i] % kNumberOfInsts),
+                       static_cast<long long>(n), n * 100.0 / total);
+    }
+}
+#endif
+
+inline void Thread::EnterGeneratedFunction(DecodedBitCode *bc,
+                                           HeapObject *callee,
+                                           DecodedBitCode *code) {
+    auto ctx = call_stack_->Push();
+    ctx->p_stack_base = p_stack_->base_size();
+    ctx->p_stack_size = p_stack_->size();
+    ctx->o_stack_base = o_stack_->base_size();
+    ctx->o_stack_size = o_stack_->size();
+    ctx->pc = pc_;
+    ctx->bc = bc_;
+    ctx->callee = callee_.get();
+    callee_ = static_cast<MIOFunction *>(callee);
+
+    p_stack_->AdjustFrame(bc->op1, 0);
+    o_stack_->AdjustFrame(bc->op2, 0);
+
+    pc_ = 0;
+    bc_ = code;
+
+    vm_->gc_->Active(false);
 }
 
 void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
+#if MIO_DIRECT_THREADED
+    if (vm_->direct_threaded_) {
+        Interpret<true>(callee, ok);
+        return;
+    }
+#endif
+    Interpret<false>(callee, ok);
+}
+
+template<bool kThreaded>
+void Thread::Interpret(MIOGeneratedFunction *callee, bool *ok) {
+#if MIO_DIRECT_THREADED
+    // Index by instruction byte, the last one is for bad instructions.
+    static void *const kDispatchTable[MAX_BC_INSTRUCTIONS + 1] = {
+    #define DEFINE_LABEL(name) &&L_##name,
+        VM_ALL_BITCODE(DEFINE_LABEL)
+    #undef  DEFINE_LABEL
+        &&L_default,
+    };
+    void *const *handlers = kThreaded ? kDispatchTable : nullptr;
+#else
+    void *const *handlers = nullptr;
+#endif
+
     auto init = call_stack_->Push();
 
     init->p_stack_base = p_stack_->base_size(),
     init->p_stack_size = p_stack_->size(),
     init->o_stack_base = o_stack_->base_size(),
     init->o_stack_size = o_stack_->size(),
-    init->bc = static_cast<uint64_t *>(callee->GetCode());
+    init->bc = nullptr;
     init->pc = 0;
     init->callee = nullptr;
 
     pc_ = init->pc;
-    bc_ = init->bc;
     callee_ = callee;
+    bc_ = GetOrDecodeCode(callee, handlers, ok);
+    if (!*ok) {
+        return;
+    }
+    init->bc = bc_;
+    SAFEPOINT();
 
-    while (!should_exit_) {
-        auto bc = bc_[pc_++];
+    for (;;) {
+        auto bc = &bc_[pc_++];
+        BC_PROFILE_PAIR(bc);
 
-        switch (BitCodeDisassembler::GetInst(bc)) {
-            case BC_debug:
+        switch (bc->inst) {
+            BC_CASE(debug):
                 *ok = false;
                 exit_code_ = DEBUGGING;
                 return;
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_load_##byte##b: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto segment = BitCodeDisassembler::GetOp2(bc); \
-                auto offset = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(load_##byte##b): { \
+                auto dest = bc->op1; \
+                auto segment = bc->op2; \
+                auto offset = bc->imm32; \
                 ProcessLoadPrimitive(byte, dest, segment, offset, ok); \
                 if (!*ok) { \
                     return; \
                 } \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
-            case BC_load_o: {
-                auto dest = BitCodeDisassembler::GetOp1(bc);
-                auto segment = BitCodeDisassembler::GetOp2(bc);
-                auto offset = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(load_o): {
+                auto dest = bc->op1;
+                auto segment = bc->op2;
+                auto offset = bc->imm32;
                 ProcessLoadObject(dest, segment, offset, ok);
                 if (!*ok) {
                     return;
                 }
-            } break;
+            } BC_NEXT();
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_load_i##bit##_imm: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto imm32 = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(load_i##bit##_imm): { \
+                auto dest = bc->op1; \
+                auto imm32 = bc->imm32; \
                 p_stack_->Set(dest, static_cast<mio_i##bit##_t>(imm32)); \
-            } break;
+            } BC_NEXT();
             MIO_SMI_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_mov_##byte##b: { \
-                auto dest = BitCodeDisassembler::GetVal1(bc); \
-                auto src  = BitCodeDisassembler::GetVal2(bc); \
-                memcpy(p_stack_->offset(dest), p_stack_->offset(src), byte); \
-            } break;
+            BC_CASE(mov_##byte##b): { \
+                auto dest = bc->val1; \
+                auto src  = bc->val2; \
+                memmove(p_stack_->offset(dest), p_stack_->offset(src), byte); \
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
-            case BC_mov_o: {
-                auto dest = BitCodeDisassembler::GetVal1(bc);
-                auto src  = BitCodeDisassembler::GetVal2(bc);
+            BC_CASE(mov_o): {
+                auto dest = bc->val1;
+                auto src  = bc->val2;
 
                 auto ob = o_stack_->Get<HeapObject *>(src);
                 o_stack_->Set(dest, ob);
-            } break;
+            } BC_NEXT();
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_and_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(and_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetI##bit(lhs) & GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_or_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(or_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetI##bit(lhs) | GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_xor_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(xor_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetI##bit(lhs) ^ GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_inv_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto operand = BitCodeDisassembler::GetOp2(bc); \
+            BC_CASE(inv_i##bit): { \
+                auto dest = bc->op1; \
+                auto operand = bc->op2; \
                 p_stack_->Set(dest, ~GetI##bit(operand)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_shl_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(shl_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 if (GetInt(rhs) < 0) { \
                     Panic(PANIC, ok, "negative shift left: %lld", GetInt(rhs)); \
                     return; \
                 } \
                 p_stack_->Set<mio_i##bit##_t>(dest, GetI##bit(lhs) << GetInt(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_shr_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(shr_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 if (GetInt(rhs) < 0) { \
                     Panic(PANIC, ok, "negative arithmetic shift right: %lld", GetInt(rhs)); \
                     return; \
                 } \
                 p_stack_->Set<mio_i##bit##_t>(dest, GetI##bit(lhs) >> GetInt(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_ushr_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(ushr_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 if (GetInt(rhs) < 0) { \
                     Panic(PANIC, ok, "negative logic shift right: %lld", GetInt(rhs)); \
                     return; \
                 } \
                 auto result = GetI##bit(lhs) >> GetInt(rhs); \
                 p_stack_->Set<mio_i##bit##_t>(dest, GetI##bit(lhs) >= 0 ? result : result & ~(1ULL << ((bit) - 1))); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_shl_i##bit##_imm: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto imm = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(shl_i##bit##_imm): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto imm = bc->imm32; \
                 if (imm < 0) { \
                     Panic(PANIC, ok, "negative shift left: %d", imm); \
                     return; \
                 } \
                 p_stack_->Set<mio_i##bit##_t>(dest, GetI##bit(lhs) << imm); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_shr_i##bit##_imm: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto imm = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(shr_i##bit##_imm): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto imm = bc->imm32; \
                 if (imm < 0) { \
                     Panic(PANIC, ok, "negative shift left: %d", imm); \
                     return; \
                 } \
                 p_stack_->Set<mio_i##bit##_t>(dest, GetI##bit(lhs) >> imm); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_ushr_i##bit##_imm: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto imm = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(ushr_i##bit##_imm): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto imm = bc->imm32; \
                 if (imm < 0) { \
                     Panic(PANIC, ok, "negative shift left: %d", imm); \
                     return; \
                 } \
                 auto result = GetI##bit(lhs) >> imm; \
                 p_stack_->Set<mio_i##bit##_t>(dest, GetI##bit(lhs) >= 0 ? result : result & ~(1ULL << ((bit) - 1))); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_add_i##bit##_imm: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs  = BitCodeDisassembler::GetOp2(bc); \
-                auto imm32 = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(add_i##bit##_imm): { \
+                auto dest = bc->op1; \
+                auto lhs  = bc->op2; \
+                auto imm32 = bc->imm32; \
                 p_stack_->Set(dest, GetI##bit(lhs) + static_cast<mio_i##bit##_t>(imm32)); \
-            } break;
+            } BC_NEXT();
             MIO_SMI_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_add_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(add_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetI##bit(lhs) + GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_sub_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(sub_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetI##bit(lhs) - GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_mul_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(mul_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetI##bit(lhs) * GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_div_i##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(div_i##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 if (GetI##bit(rhs) == 0) { \
                     Panic(DIV_ZERO, ok, "div zero."); \
                     return; \
                 } \
                 p_stack_->Set(dest, GetI##bit(lhs) / GetI##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_add_f##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(add_f##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetF##bit(lhs) + GetF##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_FLOAT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_sub_f##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(sub_f##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetF##bit(lhs) - GetF##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_FLOAT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_mul_f##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(mul_f##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetF##bit(lhs) * GetF##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_FLOAT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_div_f##bit: { \
-                auto dest = BitCodeDisassembler::GetOp1(bc); \
-                auto lhs = BitCodeDisassembler::GetOp2(bc); \
-                auto rhs = BitCodeDisassembler::GetOp3(bc); \
+            BC_CASE(div_f##bit): { \
+                auto dest = bc->op1; \
+                auto lhs = bc->op2; \
+                auto rhs = bc->op3; \
                 p_stack_->Set(dest, GetF##bit(lhs) / GetF##bit(rhs)); \
-            } break;
+            } BC_NEXT();
             MIO_FLOAT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
-            case BC_logic_not: {
-                auto dest = BitCodeDisassembler::GetOp1(bc);
-                auto operand = BitCodeDisassembler::GetOp2(bc);
+            BC_CASE(logic_not): {
+                auto dest = bc->op1;
+                auto operand = bc->op2;
                 p_stack_->Set<mio_bool_t>(dest, GetI8(operand) == 0 ? 1 : 0);
-            } break;
+            } BC_NEXT();
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_store_##byte##b: { \
-                auto src = BitCodeDisassembler::GetOp1(bc); \
-                auto segment = BitCodeDisassembler::GetOp2(bc); \
-                auto dest = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(store_##byte##b): { \
+                auto src = bc->op1; \
+                auto segment = bc->op2; \
+                auto dest = bc->imm32; \
                 ProcessStorePrimitive(byte, src, segment, dest, ok); \
                 if (!*ok) { \
                     return; \
                 } \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
-            case BC_store_o: {
-                auto src = BitCodeDisassembler::GetOp1(bc);
-                auto segment = BitCodeDisassembler::GetOp2(bc);
-                auto dest = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(store_o): {
+                auto src = bc->op1;
+                auto segment = bc->op2;
+                auto dest = bc->imm32;
                 ProcessStoreObject(src, segment, dest, ok);
                 if (!*ok) {
                     return;
                 }
-            } break;
+            } BC_NEXT();
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_cmp_i##bit: { \
-                auto op = static_cast<BCComparator>(BitCodeDisassembler::GetOp1(bc)); \
-                auto result = BitCodeDisassembler::GetOp2(bc); \
-                auto val1 = BitCodeDisassembler::GetVal1(bc); \
-                auto val2 = BitCodeDisassembler::GetVal2(bc); \
+            BC_CASE(cmp_i##bit): { \
+                auto op = static_cast<BCComparator>(bc->op1); \
+                auto result = bc->op2; \
+                auto val1 = bc->val1; \
+                auto val2 = bc->val2; \
                 switch (op) { \
                     case CC_EQ: \
                         p_stack_->Set<mio_bool_t>(result, GetI##bit(val1) == GetI##bit(val2)); \
@@ -452,15 +676,15 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(PANIC, ok, "bad comparator %d", op); \
                         return; \
                 } \
-            } break;
+            } BC_NEXT();
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
-            case BC_cmp_f32: {
-                auto op = static_cast<BCComparator>(BitCodeDisassembler::GetOp1(bc));
-                auto result = BitCodeDisassembler::GetOp2(bc);
-                auto val1 = BitCodeDisassembler::GetVal1(bc);
-                auto val2 = BitCodeDisassembler::GetVal2(bc);
+            BC_CASE(cmp_f32): {
+                auto op = static_cast<BCComparator>(bc->op1);
+                auto result = bc->op2;
+                auto val1 = bc->val1;
+                auto val2 = bc->val2;
                 switch (op) {
                     case CC_EQ:
                         p_stack_->Set<mio_bool_t>(result, ::fabsf(GetF32(val1) - GetF32(val2)) < FLT_EPSILON);
@@ -484,13 +708,13 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(PANIC, ok, "bad comparator %d", op);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_cmp_f64: {
-                auto op = static_cast<BCComparator>(BitCodeDisassembler::GetOp1(bc));
-                auto result = BitCodeDisassembler::GetOp2(bc);
-                auto val1 = BitCodeDisassembler::GetVal1(bc);
-                auto val2 = BitCodeDisassembler::GetVal2(bc);
+            BC_CASE(cmp_f64): {
+                auto op = static_cast<BCComparator>(bc->op1);
+                auto result = bc->op2;
+                auto val1 = bc->val1;
+                auto val2 = bc->val2;
                 switch (op) {
                     case CC_EQ:
                         p_stack_->Set<mio_bool_t>(result, ::fabs(GetF64(val1) - GetF64(val2)) < DBL_EPSILON);
@@ -514,12 +738,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(PANIC, ok, "bad comparator %d", op);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_sext_i8: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(sext_i8): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
             #define DEFINE_CASE(byte, bit) \
                 case byte: p_stack_->Set<mio_i##bit##_t>(result, GetI8(input));
                 switch (bytes) {
@@ -529,12 +753,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         return;
                 }
             #undef DEFINE_CASE
-            } break;
+            } BC_NEXT();
 
-            case BC_sext_i16: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(sext_i16): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                     case 2:
                         p_stack_->Set(result, GetI16(input));
@@ -549,12 +773,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "i16 can not extend to i%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_sext_i32: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(sext_i32): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                     case 4:
                         p_stack_->Set(result, GetI32(input));
@@ -566,12 +790,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "i32 can not extend to i%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_trunc_i16: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(trunc_i16): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                     case 2:
                         p_stack_->Set(result, GetI16(input));
@@ -583,12 +807,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "i16 can not truncate to i%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_trunc_i32: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(trunc_i32): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                     case 4:
                         p_stack_->Set(result, GetI32(input));
@@ -603,12 +827,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "i32 can not truncate to i%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_trunc_i64: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(trunc_i64): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
             #define DEFINE_CASE(byte, bit)\
                 case byte: \
                     p_stack_->Set(result, static_cast<mio_i##bit##_t>(GetI64(input)));
@@ -619,12 +843,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         return;
                 }
             #undef DEFINE_CASE
-            } break;
+            } BC_NEXT();
 
-            case BC_fpext_f32: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(fpext_f32): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                     case 4:
                         p_stack_->Set(result, GetF32(input));
@@ -636,12 +860,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "f32 can not extend to f%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_fptrunc_f64: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(fptrunc_f64): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                     case 8:
                         p_stack_->Set(result, GetF64(input));
@@ -653,13 +877,13 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "f64 can not truncate to f%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
         #define DEFINE_CASE(byte, bit) \
-            case BC_sitofp_i##bit: { \
-                auto result = BitCodeDisassembler::GetOp1(bc); \
-                auto bytes  = BitCodeDisassembler::GetOp2(bc); \
-                auto input  = BitCodeDisassembler::GetImm32(bc); \
+            BC_CASE(sitofp_i##bit): { \
+                auto result = bc->op1; \
+                auto bytes  = bc->op2; \
+                auto input  = bc->imm32; \
                 switch (bytes) { \
                     case 4: \
                         p_stack_->Set(result, static_cast<mio_f32_t>(GetI##bit(input))); \
@@ -671,15 +895,15 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "i" #bit " can not cast to f%d.", bytes * 8); \
                         return; \
                 } \
-            } break;
+            } BC_NEXT();
 
             MIO_INT_BYTES_TO_BITS(DEFINE_CASE)
         #undef DEFINE_CASE
 
-            case BC_fptosi_f32: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(fptosi_f32): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                 #define DEFINE_CASE(byte, bit) \
                     case byte: \
@@ -691,12 +915,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "f32 can not cast to i%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_fptosi_f64: {
-                auto result = BitCodeDisassembler::GetOp1(bc);
-                auto bytes  = BitCodeDisassembler::GetOp2(bc);
-                auto input  = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(fptosi_f64): {
+                auto result = bc->op1;
+                auto bytes  = bc->op2;
+                auto input  = bc->imm32;
                 switch (bytes) {
                 #define DEFINE_CASE(byte, bit) \
                     case byte: \
@@ -708,23 +932,24 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         Panic(BAD_BIT_CODE, ok, "f64 can not cast to i%d.", bytes * 8);
                         return;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_frame: {
-                auto size1 = BitCodeDisassembler::GetOp1(bc);
-                auto size2 = BitCodeDisassembler::GetOp2(bc);
+            BC_CASE(frame): {
+                auto size1 = bc->op1;
+                auto size2 = bc->op2;
 
                 p_stack_->AdjustFrame(0, size1);
                 o_stack_->AdjustFrame(0, size2);
 
-                auto clean2 = BitCodeDisassembler::GetVal2(bc);
+                auto clean2 = bc->val2;
                 memset(o_stack_->offset(clean2), 0, size2 - clean2);
                 vm_->gc_->Active(true);
 
                 //RunGC();
-            } break;
+                RESUME_NATIVE();
+            } BC_NEXT();
 
-            case BC_ret: {
+            BC_CASE(ret): {
                 auto ctx = call_stack_->Top();
                 pc_     = ctx->pc;
                 bc_     = ctx->bc;
@@ -742,32 +967,60 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                     exit_code_ = SUCCESS;
                     return;
                 }
-            } break;
+                SAFEPOINT();
+                RESUME_NATIVE();
+            } BC_NEXT();
 
-            case BC_loop_entry: {
-                auto id = BitCodeDisassembler::GetOp2(bc);
-                auto native = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(loop_entry): {
+                auto id = bc->op2;
+                auto native = bc->imm32;
                 if (vm_->jit_) {
-                    if (native <= 0) {
+                    // Whole function compiled by baseline JIT does not need
+                    // any trace.
+                    if (native == 0 && generated_function()->GetRecompilingKind() !=
+                        MIOGeneratedFunction::ALL) {
                         int hit = 0;
                         TRACE(vm_->record_->TraceLoopEntry(generated_function(), id, pc_ - 1, &hit));
+                        auto fn = generated_function();
                         if (hit >= vm_->hot_loop_limit()) {
-                            CompileToNativeCodeFragment(generated_function(), id, pc_ - 1, ok);
-                            if (!*ok) {
-                                return;
+                            if (vm_->jit_optimize_ > 0 && vm_->background_compiler_ &&
+                                fn->GetRecompilingKind() == MIOGeneratedFunction::NONE &&
+                                vm_->background_compiler_->Submit(fn, BackgroundCompiler::kOnStackReplacement, true)) {
+                                // Keep interpreting, the loop enters the code
+                                // after it is installed.
+                            } else if (vm_->jit_optimize_ > 0 &&
+                                fn->GetRecompilingKind() ==
+                                MIOGeneratedFunction::NONE &&
+                                CompileToOptimizedNativeCode(fn, true)) {
+                                // On-stack replacement: go on running the loop
+                                // in native code from this loop_entry.
+                                --pc_;
+                                RESUME_NATIVE();
+                            } else {
+                                CompileToNativeCodeFragment(generated_function(), id, pc_ - 1, ok);
+                                if (!*ok) {
+                                    return;
+                                }
                             }
                         }
-                    } else {
-
-
+                    } else if (native > 0) {
+                        auto fragment = GetNativeCodeFragment(generated_function(), pc_ - 1);
+                        // Exit from a side exit.
+                        if (fragment && !RunNativeCode(fragment)) {
+                            return;
+                        }
+                    } else if (IsNativeCodeEntry(generated_function(), pc_ - 1)) {
+                        // Installed by background compiler during the loop.
+                        --pc_;
+                        RESUME_NATIVE();
                     }
                 }
-            } break;
+                SAFEPOINT();
+            } BC_NEXT();
 
-            case BC_jz: {
-                auto id    = BitCodeDisassembler::GetOp1(bc);
-                auto cond  = BitCodeDisassembler::GetOp2(bc);
-                auto delta = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(jz): {
+                auto id    = bc->op1;
+                auto cond  = bc->op2;
 
                 auto value = p_stack_->Get<mio_bool_t>(cond);
                 if (vm_->jit_ && id > 0) {
@@ -775,56 +1028,109 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                 }
 
                 if (value == 0) {
-                    pc_ += delta - 1;
+                    pc_ = bc->target;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_jnz: {
-                auto id    = BitCodeDisassembler::GetOp1(bc);
-                auto cond  = BitCodeDisassembler::GetOp2(bc);
-                auto delta = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(jnz): {
+                auto id    = bc->op1;
+                auto cond  = bc->op2;
 
                 auto value = p_stack_->Get<mio_bool_t>(cond);
                 if (vm_->jit_ && id > 0) {
                     TRACE(vm_->record_->TraceGuardTrue(generated_function(), value, id, pc_ - 1));
                 }
                 if (value != 0) {
-                    pc_ += delta - 1;
+                    pc_ = bc->target;
                 }
-            } break;
+            } BC_NEXT();
 
-            case BC_jmp: {
-                auto linked_id = BitCodeDisassembler::GetOp1(bc);
-                auto id = BitCodeDisassembler::GetOp2(bc);
-                auto delta = BitCodeDisassembler::GetImm32(bc);
+            BC_CASE(jmp): {
+                auto linked_id = bc->op1;
+                auto id = bc->op2;
                 if (vm_->jit_ && id > 0 && linked_id > 0) {
                     TRACE(vm_->record_->TraceLoopEdge(generated_function(), linked_id, id, pc_ - 1));
                 }
 
-                pc_ += delta - 1;
-            } break;
+                pc_ = bc->target;
+                if (pc_ <= bc - bc_) { // back-edge
+                    SAFEPOINT();
+                    RESUME_NATIVE();
+                }
+            } BC_NEXT();
+
+        // Superinstructions: run the first bit code, then the second one
+        // (kept after the fused one) and skip it.
+        #define DEFINE_CASE(name, trace, cond) \
+            BC_CASE(cmp_i64_##name): { \
+                mio_bool_t value = 0; \
+                switch (static_cast<BCComparator>(bc->op1)) { \
+                    VM_COMPARATOR(DEFINE_COMPARE) \
+                    default: \
+                        Panic(PANIC, ok, "bad comparator %d", bc->op1); \
+                        return; \
+                } \
+                p_stack_->Set<mio_bool_t>(bc->op2, value); \
+                bc = &bc_[pc_++]; \
+                DCHECK_EQ(BC_##name, bc->inst); \
+                if (vm_->jit_ && bc->op1 > 0) { \
+                    TRACE(vm_->record_->trace(generated_function(), value, bc->op1, pc_ - 1)); \
+                } \
+                if (cond) { \
+                    pc_ = bc->target; \
+                } \
+            } BC_NEXT();
+        #define DEFINE_COMPARE(name, op) \
+            case CC_##name: \
+                value = GetI64(bc->val1) op GetI64(bc->val2); \
+                break;
+            DEFINE_CASE(jz, TraceGuardFalse, value == 0)
+            DEFINE_CASE(jnz, TraceGuardTrue, value != 0)
+        #undef DEFINE_COMPARE
+        #undef DEFINE_CASE
 
-            case BC_call_val: {
+            BC_CASE(load_imm_add_i64): {
+                p_stack_->Set<mio_i64_t>(bc->op1, bc->imm32);
+                bc = &bc_[pc_++];
+                DCHECK_EQ(BC_add_i64, bc->inst);
+                p_stack_->Set(bc->op1, GetI64(bc->op2) + GetI64(bc->op3));
+            } BC_NEXT();
+
+            BC_CASE(mov_8b_pair): {
+                memmove(p_stack_->offset(bc->val1), p_stack_->offset(bc->val2), 8);
+                bc = &bc_[pc_++];
+                DCHECK_EQ(BC_mov_8b, bc->inst);
+                memmove(p_stack_->offset(bc->val1), p_stack_->offset(bc->val2), 8);
+            } BC_NEXT();
+
+            BC_CASE(call_val): {
+                SAFEPOINT();
                 if (call_stack_->size() >= vm_->max_call_deep()) {
                     Panic(STACK_OVERFLOW, ok, "stack overflow, max calling deep %d",
                           vm_->max_call_deep());
                     return;
                 }
 
-                auto obj_addr = BitCodeDisassembler::GetImm32(bc);
-                Handle<HeapObject> ob(o_stack_->Get<HeapObject *>(obj_addr));
-                DCHECK(ob->IsNativeFunction() || ob->IsGeneratedFunction() ||
-                       ob->IsClosure()) << ob->GetKind();
-
-                Handle<MIOFunction> fn;
-                if (ob->IsClosure()) {
-                    auto closure = ob->AsClosure();
-                    fn = DCHECK_NOTNULL(closure->GetFunction());
-                } else {
-                    fn = static_cast<MIOFunction *>(ob.get());
+                auto ob = GetRawObject(bc->imm32);
+                auto cache = GetOrFillCallSiteCache(bc, ob, handlers, ok);
+                if (!cache) {
+                    return;
                 }
 
-                if (fn->IsNativeFunction()) {
+                auto fn = cache->fn;
+                if (fn->IsNativeFunction() &&
+                    fn->AsNativeFunction()->GetLeafPointer()) {
+                    // Leaf native function: no calling context and frame.
+                    auto leaf = fn->AsNativeFunction()->GetLeafPointer();
+                    (*leaf)(vm_, p_stack_->offset(bc->op1), o_stack_->offset(bc->op2));
+                    RESUME_NATIVE();
+                } else if (fn->IsNativeFunction()) {
+                #ifndef NDEBUG
+                    DCHECK_EQ(0, no_gc_depth_) << "native call in NoGCScope.";
+                #endif
+                    // Native function can run full GC, so keep them alive.
+                    auto grabbed_ob = make_handle(ob);
+                    auto grabbed_fn = make_handle(fn);
                     auto native = fn->AsNativeFunction();
                     if (!native->GetNativePointer()) {
                         Panic(NULL_NATIVE_FUNCTION, ok, "NULL native function!");
@@ -840,12 +1146,12 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                     ctx->bc           = bc_;
                     ctx->callee       = callee_.get();
 
-                    auto base1 = BitCodeDisassembler::GetOp1(bc);
-                    auto base2 = BitCodeDisassembler::GetOp2(bc);
-                    p_stack_->AdjustFrame(base1, native->GetPrimitiveArgumentsSize());
-                    o_stack_->AdjustFrame(base2, native->GetObjectArgumentsSize());
+                    auto base1 = bc->op1;
+                    auto base2 = bc->op2;
+                    p_stack_->AdjustFrame(base1, cache->args.primitive_size);
+                    o_stack_->AdjustFrame(base2, cache->args.object_size);
 
-                    callee_ = static_cast<MIOFunction*>(ob.get());
+                    callee_ = static_cast<MIOFunction*>(ob);
                     if (native->GetNativeWarperIndex()) {
                         (*native->GetNativeWarper())(this, native, p_stack_->offset(0), o_stack_->offset(0));
                     } else {
@@ -860,38 +1166,66 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                         exit_code_ = SUCCESS;
                         return;
                     }
+                    SAFEPOINT(); // the native function may request to exit.
+                    RESUME_NATIVE();
                 } else {
-                    auto ctx = call_stack_->Push();
-                    ctx->p_stack_base = p_stack_->base_size();
-                    ctx->p_stack_size = p_stack_->size();
-                    ctx->o_stack_base = o_stack_->base_size();
-                    ctx->o_stack_size = o_stack_->size();
-                    ctx->pc = pc_;
-                    ctx->bc = bc_;
-                    ctx->callee = callee_.get();
-                    callee_ = static_cast<MIOFunction*>(ob.get());
-
-                    DCHECK(fn->IsGeneratedFunction()) << fn->GetKind();
-                    auto normal = DCHECK_NOTNULL(fn->AsGeneratedFunction());
                     if (vm_->jit_) {
-                        TRACE(vm_->record_->TraceFuncEntry(normal, 0));
+                        TRACE(TraceFuncEntry(fn->AsGeneratedFunction()));
                     }
+                    EnterGeneratedFunction(bc, ob, cache->code);
+                }
+            } BC_NEXT();
 
-                    auto base1 = BitCodeDisassembler::GetOp1(bc);
-                    auto base2 = BitCodeDisassembler::GetOp2(bc);
-                    p_stack_->AdjustFrame(base1, 0);
-                    o_stack_->AdjustFrame(base2, 0);
-
-                    pc_ = 0;
-                    bc_ = static_cast<uint64_t *>(normal->GetCode());
-
-                    vm_->gc_->Active(false);
+            BC_CASE(call): {
+                SAFEPOINT();
+                if (call_stack_->size() >= vm_->max_call_deep()) {
+                    Panic(STACK_OVERFLOW, ok, "stack overflow, max calling deep %d",
+                          vm_->max_call_deep());
+                    return;
                 }
-            } break;
 
-            case BC_close_fn: {
-                auto dest = BitCodeDisassembler::GetOp1(bc);
-                auto closure = GetClosure(dest, ok);
+                auto cache = GetCallSiteCache(bc);
+                if (!cache->code) {
+                    cache->code = GetOrDecodeCode(cache->fn->AsGeneratedFunction(),
+                                                  handlers, ok);
+                    if (!*ok) {
+                        return;
+                    }
+                }
+                if (vm_->jit_) {
+                    TRACE(TraceFuncEntry(cache->fn->AsGeneratedFunction()));
+                }
+                EnterGeneratedFunction(bc, cache->callee, cache->code);
+            } BC_NEXT();
+
+            BC_CASE(tail_call): {
+                SAFEPOINT();
+                auto cache = GetCallSiteCache(bc);
+                if (!cache->code) {
+                    cache->code = GetOrDecodeCode(cache->fn->AsGeneratedFunction(),
+                                                  handlers, ok);
+                    if (!*ok) {
+                        return;
+                    }
+                }
+                if (vm_->jit_) {
+                    TRACE(TraceFuncEntry(cache->fn->AsGeneratedFunction()));
+                }
+                // Reuse the current frame and calling context, arguments
+                // have been moved to the bottom of frame.
+                auto clean2 = bc->op2;
+                memset(o_stack_->offset(clean2), 0, o_stack_->size() - clean2);
+                callee_ = static_cast<MIOFunction *>(cache->callee);
+
+                pc_ = 0;
+                bc_ = cache->code;
+                vm_->gc_->Active(false);
+            } BC_NEXT();
+
+            BC_CASE(close_fn): {
+                auto dest = bc->op1;
+                NoGCScope no_gc(this);
+                auto closure = GetRawClosure(dest, ok);
                 if (!*ok) {
                     Panic(PANIC, ok, "not closure for close.");
                     return;
@@ -914,32 +1248,127 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                     } else {
                         addr = o_stack_->offset(upval->desc.offset);
 
-                        vm_->gc_->WriteBarrier(closure.get(),
+                        vm_->gc_->WriteBarrier(closure,
                                                o_stack_->Get<HeapObject *>(upval->desc.offset));
                     }
                     upval->val = vm_->gc_->GetOrNewUpValue(addr,
                             kMaxReferenceValueSize, id, is_primitive).get();
-                    vm_->gc_->WriteBarrier(closure.get(), upval->val);
+                    vm_->gc_->WriteBarrier(closure, upval->val);
                 }
                 closure->Close(); // close closure;
 
                 RunGC();
-            } break;
+            } BC_NEXT();
 
-            case BC_oop:
-                ProcessObjectOperation(BitCodeDisassembler::GetOp1(bc),
-                                       BitCodeDisassembler::GetOp2(bc),
-                                       BitCodeDisassembler::GetVal1(bc),
-                                       BitCodeDisassembler::GetVal2(bc), ok);
+            BC_CASE(oop):
+                ProcessObjectOperation(bc->op1,
+                                       bc->op2,
+                                       bc->val1,
+                                       bc->val2, ok);
                 if (!*ok) {
                     Panic(PANIC, ok, "oop process fail! %s",
-                          kObjectOperatorText[BitCodeDisassembler::GetOp1(bc)]);
+                          kObjectOperatorText[bc->op1]);
                     return;
                 }
-                break;
+                if (!(bc->flags & kDecodedNoQuickening)) {
+                    QuickenObjectOperation(bc, handlers);
+                }
+                BC_NEXT();
+
+            // Quickened object operations:
+            // op2: object addr, val1: key/index addr, val2: value/result addr.
+            // No GC can run before they finish reading, so use raw pointers,
+            // but keep the object grabbed as the generic one when stepping GC.
+            BC_CASE(array_get_8b): {
+                auto receiver = o_stack_->Get<HeapObject *>(bc->op2);
+                auto ob = receiver ? receiver->AsVector() : nullptr;
+                if (!ob || !IsPrimitive8Bytes(ob->GetElement())) {
+                    BC_DEQUICKEN();
+                }
+                auto index = p_stack_->Get<mio_int_t>(bc->val1);
+                if (index < 0 || index >= ob->GetSize()) {
+                    BC_DEQUICKEN(); // let generic one panic.
+                }
+                p_stack_->Set(bc->val2, static_cast<mio_i64_t *>(ob->GetData())[index]);
+            } BC_NEXT();
+
+        #define DEFINE_CASE(name, guard, key_stack, key_type, find) \
+            BC_CASE(map_get_##name): { \
+                auto receiver = o_stack_->Get<HeapObject *>(bc->op2); \
+                auto ob = receiver ? receiver->AsHashMap() : nullptr; \
+                if (!ob || !guard(ob)) { \
+                    BC_DEQUICKEN(); \
+                } \
+                auto pair = find(ob, key_stack->Get<key_type>(bc->val1)); \
+                Handle<MIOUnion> rv; \
+                if (pair) { \
+                    rv = vm_->object_factory()->CreateUnion(pair->GetValue(), \
+                            ob->GetValue()->GetTypePlacementSize(), \
+                            make_handle(ob->GetValue())); \
+                } else { \
+                    rv = vm_->object_factory()->CreateUnion(nullptr, 0, \
+                            vm_->GetVoidType()); \
+                } \
+                if (rv.empty()) { \
+                    Panic(OUT_OF_MEMORY, ok, "no memory for create union."); \
+                    return; \
+                } \
+                o_stack_->Set(bc->val2, rv.get()); \
+                RunGC(); \
+            } BC_NEXT(); \
+            BC_CASE(map_put_##name): { \
+                auto receiver = o_stack_->Get<HeapObject *>(bc->op2); \
+                auto ob = receiver ? receiver->AsHashMap() : nullptr; \
+                if (!ob || !guard(ob)) { \
+                    BC_DEQUICKEN(); \
+                } \
+                auto value_type = ob->GetValue(); \
+                void *value = value_type->IsObject() ? o_stack_->offset(bc->val2) \
+                            : p_stack_->offset(bc->val2); \
+                auto pair = find(ob, key_stack->Get<key_type>(bc->val1)); \
+                if (pair) { \
+                    FastMemoryMove(pair->GetValue(), value, \
+                                   value_type->GetTypePlacementSize()); \
+                } else { \
+                    void *key = key_stack->offset(bc->val1); \
+                    MIOHashMapSurface surface(ob, vm_->allocator_); \
+                    surface.RawPut(key, value, ok); \
+                    if (!*ok) { \
+                        Panic(OUT_OF_MEMORY, ok, "no memory for putting map key-value pair."); \
+                        return; \
+                    } \
+                    if (ob->GetKey()->IsObject()) { \
+                        vm_->gc_->WriteBarrier(ob, *static_cast<HeapObject **>(key)); \
+                    } \
+                } \
+                if (value_type->IsObject()) { \
+                    vm_->gc_->WriteBarrier(ob, *static_cast<HeapObject **>(value)); \
+                } \
+                RunGC(); \
+            } BC_NEXT();
+
+            DEFINE_CASE(int, IsIntegerKeyMap, p_stack_, mio_int_t, FindIntegerKeyPair)
+            DEFINE_CASE(str, IsStringKeyMap, o_stack_, MIOString *, FindStringKeyPair)
+        #undef DEFINE_CASE
 
+            BC_CASE(str_len): {
+                auto receiver = o_stack_->Get<HeapObject *>(bc->op2);
+                auto ob = receiver ? receiver->AsString() : nullptr;
+                if (!ob) {
+                    BC_DEQUICKEN();
+                }
+                p_stack_->Set<mio_int_t>(bc->val2, ob->GetLength());
+            } BC_NEXT();
+
+        #if MIO_DIRECT_THREADED
+            // Bit codes without any handler yet.
+            L_fptrunc_f32:
+            L_fpext_f64:
+            L_test:
+            L_default:
+        #endif
             default: {
-                auto cmd = BitCodeDisassembler::GetInst(bc);
+                auto cmd = bc->inst;
                 if (cmd >= 0 && cmd < MAX_BC_INSTRUCTIONS) {
                     Panic(PANIC, ok, "bitcode command: \"%s\" not support yet.",
                           kInstructionMetadata[cmd].text);
@@ -948,9 +1377,157 @@ void Thread::Execute(MIOGeneratedFunction *callee, bool *ok) {
                 }
             } return;
         } // switch
+    } // for
+}
+
+bool Thread::ProcessSafepoint() {
+#ifndef NDEBUG
+    DCHECK_EQ(0, no_gc_depth_) << "safepoint in NoGCScope.";
+#endif
+    auto requests = poll_word_.fetch_and(SAFEPOINT_EXIT, std::memory_order_relaxed);
+    if (requests & SAFEPOINT_GC_STEP) {
+        for (; gc_steps_ > 0; --gc_steps_) {
+            vm_->gc_->Step(vm_->tick_);
+        }
+    }
+    if ((requests & SAFEPOINT_SAMPLE) && vm_->profiler_) {
+        vm_->profiler_->SampleTick();
+    }
+    if ((requests & SAFEPOINT_INSTALL_CODE) && vm_->background_compiler_) {
+        vm_->background_compiler_->InstallFinished();
+    }
+    return (requests & SAFEPOINT_EXIT) == 0;
+}
+
+CallSiteCache *Thread::GetOrFillCallSiteCache(DecodedBitCode *bc,
+                                              HeapObject *ob,
+                                              void *const *handlers,
+                                              bool *ok) {
+    // Check it before comparing, an empty cache has a null callee too.
+    if (!ob || !(ob->IsNativeFunction() || ob->IsGeneratedFunction() ||
+                 ob->IsClosure())) {
+        Panic(PANIC, ok, "call non-function object, kind: %d",
+              ob ? ob->GetKind() : -1);
+        return nullptr;
+    }
+
+    auto epoch = vm_->gc_->callable_epoch();
+    auto cache = GetCallSiteCache(bc);
+    if (cache->misses >= kCallSiteMaxMisses) {
+        auto hash = reinterpret_cast<uintptr_t>(ob) / kAlignmentSize;
+        cache = &megamorphic_caches_[hash % kMegamorphicCacheSize];
+    } else if (cache->callee && cache->callee != ob) {
+        ++cache->misses; // polymorphic site.
+    }
+    if (cache->callee == ob && cache->epoch == epoch) {
+        return cache;
+    }
+
+    MIOFunction *fn = nullptr;
+    if (ob->IsClosure()) {
+        fn = DCHECK_NOTNULL(ob->AsClosure()->GetFunction());
+    } else {
+        fn = static_cast<MIOFunction *>(ob);
+    }
+
+    if (fn->IsNativeFunction()) {
+        auto native = fn->AsNativeFunction();
+        cache->args.primitive_size = native->GetPrimitiveArgumentsSize();
+        cache->args.object_size    = native->GetObjectArgumentsSize();
+    } else {
+        DCHECK(fn->IsGeneratedFunction()) << fn->GetKind();
+        cache->code = GetOrDecodeCode(fn->AsGeneratedFunction(), handlers, ok);
+        if (!*ok) {
+            cache->callee = nullptr;
+            return nullptr;
+        }
+    }
+    cache->callee = ob;
+    cache->fn     = fn;
+    cache->epoch  = epoch;
+    return cache;
+}
+
+DecodedBitCode *Thread::GetOrDecodeCode(MIOGeneratedFunction *fn,
+                                        void *const *handlers, bool *ok) {
+    auto decoded = fn->GetDecodedCode();
+    if (decoded) {
+        return decoded;
+    }
+    decoded = BitCodeDecoder::Decode(static_cast<uint64_t *>(fn->GetCode()),
+                                     fn->GetCodeSize(), handlers);
+    if (!decoded) {
+        Panic(OUT_OF_MEMORY, ok, "decode bit code fail: out of memory.");
+        return nullptr;
+    }
+    vm_->code_decoded_ = true;
+    fn->SetDecodedCode(decoded);
+    LinkStaticCalls(decoded, fn->GetCodeSize());
+    return decoded;
+}
 
-        ++vm_->tick_;
-    } // while
+void Thread::LinkStaticCalls(DecodedBitCode *decoded, int size) {
+    for (int i = 0; i < size; ++i) {
+        if (decoded[i].inst != BC_call && decoded[i].inst != BC_tail_call) {
+            continue;
+        }
+        // Global functions are never rebound, so bind them once.
+        auto ob = vm_->o_global_->Get<HeapObject *>(decoded[i].imm32);
+        DCHECK(ob->IsGeneratedFunction()) << ob->GetKind();
+
+        auto cache = GetCallSiteCache(&decoded[i]);
+        cache->callee = ob;
+        cache->fn     = ob->AsGeneratedFunction();
+        cache->code   = ob->AsGeneratedFunction()->GetDecodedCode();
+    }
+}
+
+
+void Thread::QuickenObjectOperation(DecodedBitCode *bc,
+                                    void *const *handlers) {
+    // Receiver may be nil, that site keeps the generic one.
+    auto quickened = BC_oop;
+    HeapObject *receiver = nullptr;
+    switch (static_cast<BCObjectOperatorId>(bc->op1)) {
+        case OO_ArrayGet: {
+            receiver = o_stack_->Get<HeapObject *>(bc->op2);
+            auto ob = receiver ? receiver->AsVector() : nullptr;
+            if (ob && IsPrimitive8Bytes(ob->GetElement())) {
+                quickened = BC_array_get_8b;
+            }
+        } break;
+
+        case OO_MapGet:
+        case OO_MapPut: {
+            receiver = o_stack_->Get<HeapObject *>(bc->op2);
+            auto map = receiver ? receiver->AsHashMap() : nullptr;
+            if (!map) {
+                break;
+            }
+            auto get = bc->op1 == OO_MapGet;
+            if (IsIntegerKeyMap(map)) {
+                quickened = get ? BC_map_get_int : BC_map_put_int;
+            } else if (IsStringKeyMap(map)) {
+                quickened = get ? BC_map_get_str : BC_map_put_str;
+            }
+        } break;
+
+        case OO_StrLen:
+            receiver = o_stack_->Get<HeapObject *>(bc->op2);
+            if (receiver && receiver->IsString()) {
+                quickened = BC_str_len;
+            }
+            break;
+
+        default:
+            break;
+    }
+    if (quickened == BC_oop) {
+        bc->flags |= kDecodedNoQuickening;
+        return;
+    }
+    bc->inst    = quickened;
+    bc->handler = handlers ? handlers[quickened] : nullptr;
 }
 
 FunctionDebugInfo *Thread::GetDebugInfo(int layout, int *pc) {
@@ -1163,10 +1740,11 @@ void Thread::ProcessLoadObject(uint16_t dest, uint16_t segment, int32_t offset,
 }
 
 void Thread::ProcessStoreObject(uint16_t addr, uint16_t segment, int dest, bool *ok) {
-    auto src = make_handle(o_stack_->Get<HeapObject *>(addr));
+    NoGCScope no_gc(this);
+    auto src = GetRawObject(addr);
     switch (static_cast<BCSegment>(segment)) {
         case BC_GLOBAL_OBJECT_SEGMENT:
-            vm_->o_global_->Set(dest, src.get());
+            vm_->o_global_->Set(dest, src);
             break;
 
         case BC_UP_OBJECT_SEGMENT: {
@@ -1187,7 +1765,7 @@ void Thread::ProcessStoreObject(uint16_t addr, uint16_t segment, int dest, bool
                 Panic(BAD_BIT_CODE, ok, "upvalue is not object value!");
                 return;
             }
-            upval->SetObject(src.get());
+            upval->SetObject(src);
         } break;
 
         default:
@@ -1214,16 +1792,17 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_UnionTest: {
-            auto type_info = GetTypeInfo(val2, ok);
+            NoGCScope no_gc(this);
+            auto type_info = GetRawTypeInfo(val2, ok);
             if (!*ok) {
                 return;
             }
-            auto ob = GetUnion(val1, ok);
+            auto ob = GetRawUnion(val1, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object is not union, addr: %d", val1);
                 return;
             }
-            if (ob->GetTypeInfo() == type_info.get()) {
+            if (ob->GetTypeInfo() == type_info) {
                 p_stack_->Set<mio_bool_t>(result, 1);
             } else {
                 p_stack_->Set<mio_bool_t>(result, 0);
@@ -1231,17 +1810,18 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_UnionUnbox: {
-            auto type_info = GetTypeInfo(val2, ok);
+            NoGCScope no_gc(this);
+            auto type_info = GetRawTypeInfo(val2, ok);
             if (!*ok) {
                 return;
             }
-            auto ob = GetUnion(val1, ok);
+            auto ob = GetRawUnion(val1, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object is not union, addr: %d", val1);
                 return;
             }
 
-            if (ob->GetTypeInfo() == type_info.get()) {
+            if (ob->GetTypeInfo() == type_info) {
                 if (type_info->IsPrimitive()) {
                     FastMemoryMove(p_stack_->offset(result), ob->GetData(),
                                    type_info->GetTypePlacementSize());
@@ -1250,7 +1830,7 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
                                    kObjectReferenceSize);
                 }
             } else {
-                CreateEmptyValue(result, type_info, ok);
+                CreateEmptyValue(result, make_handle(type_info), ok);
             }
             RunGC();
         } break;
@@ -1281,14 +1861,15 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_StrCat: {
-            auto lhs = GetString(val1, ok);
-            if (lhs.empty()) {
+            NoGCScope no_gc(this);
+            auto lhs = GetRawString(val1, ok);
+            if (!lhs) {
                 Panic(PANIC, ok, "object not string. addr: %d", val1);
                 return;
             }
 
-            auto rhs = GetString(val2, ok);
-            if (rhs.empty()) {
+            auto rhs = GetRawString(val2, ok);
+            if (!rhs) {
                 Panic(PANIC, ok, "object not string. addr: %d", val2);
                 return;
             }
@@ -1305,8 +1886,9 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_StrLen: {
-            auto ob = GetString(result, ok);
-            if (ob.empty()) {
+            NoGCScope no_gc(this);
+            auto ob = GetRawString(result, ok);
+            if (!ob) {
                 Panic(PANIC, ok, "object not string. addr: %d", result);
                 return;
             }
@@ -1354,8 +1936,10 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
 
         case OO_ArraySet:
         case OO_ArrayDirectSet: {
-            auto ob = GetObject(result);
-            if (!ob->IsSlice() && !ob->IsVector()) {
+            NoGCScope no_gc(this);
+            auto ob = GetRawObject(result);
+            RawArray array;
+            if (!GetRawArray(ob, &array)) {
                 Panic(PANIC, ok, "incorrect object type, unexpected array or slice.");
                 return;
             }
@@ -1366,57 +1950,57 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
             } else {
                 index = GetInt(val1);
             }
-            MIOArraySurface surface(ob, vm_->allocator());
-            if (index < 0 || index >= surface.size()) {
+            if (index < 0 || index >= array.size) {
                 Panic(PANIC, ok, "index out of range. %lld vs. [0, %d)", index,
-                      surface.size());
+                      array.size);
                 return;
             }
 
+            auto is_object = array.core->GetElement()->IsObject();
             void *src = nullptr;
-            if (surface.element()->IsObject()) {
+            if (is_object) {
                 src = o_stack_->offset(val2);
             } else {
                 src = p_stack_->offset(val2);
             }
-            FastMemoryMove(surface.RawGet(index), src, surface.element_size());
-            if (surface.element()->IsObject()) {
-                vm_->gc_->WriteBarrier(ob.get(), *static_cast<HeapObject **>(src));
+            FastMemoryMove(array.Get(index), src, array.element_size);
+            if (is_object) {
+                vm_->gc_->WriteBarrier(ob, *static_cast<HeapObject **>(src));
             }
         } break;
 
         case OO_ArrayGet: {
-            auto ob = GetObject(result);
-            if (!ob->IsSlice() && !ob->IsVector()) {
+            NoGCScope no_gc(this);
+            RawArray array;
+            if (!GetRawArray(GetRawObject(result), &array)) {
                 Panic(PANIC, ok, "incorrect object type, unexpected array or slice.");
                 return;
             }
 
-            MIOArraySurface surface(ob, vm_->allocator());
             auto index = p_stack_->Get<mio_int_t>(val1);
-            if (index < 0 || index >= surface.size()) {
+            if (index < 0 || index >= array.size) {
                 Panic(PANIC, ok, "index out of range. %lld vs. [0, %d)", index,
-                      surface.size());
+                      array.size);
                 return;
             }
 
             void *dest = nullptr;
-            if (surface.element()->IsObject()) {
+            if (array.core->GetElement()->IsObject()) {
                 dest = o_stack_->offset(val2);
             } else {
                 dest = p_stack_->offset(val2);
             }
-            FastMemoryMove(dest, surface.RawGet(index), surface.element_size());
+            FastMemoryMove(dest, array.Get(index), array.element_size);
         } break;
 
         case OO_ArraySize: {
-            auto ob = GetObject(result);
-            if (!ob->IsSlice() && !ob->IsVector()) {
+            NoGCScope no_gc(this);
+            RawArray array;
+            if (!GetRawArray(GetRawObject(result), &array)) {
                 Panic(PANIC, ok, "incorrect object type, unexpected array or slice.");
                 return;
             }
-            MIOArraySurface surface(ob, vm_->allocator());
-            p_stack_->Set<mio_int_t>(val1, surface.size());
+            p_stack_->Set<mio_int_t>(val1, array.size);
         } break;
 
         case OO_Slice: {
@@ -1451,7 +2035,8 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_MapWeak: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object is not map. addr: %d", result);
                 return;
@@ -1460,7 +2045,8 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_MapPut: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object is not map. addr: %d", result);
                 return;
@@ -1479,29 +2065,30 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
             } else {
                 value = p_stack_->offset(val2);
             }
-            MIOHashMapSurface surface(ob.get(), vm_->allocator_);
+            MIOHashMapSurface surface(ob, vm_->allocator_);
             surface.RawPut(key, value, ok);
             if (!*ok) {
                 Panic(OUT_OF_MEMORY, ok, "no memory for putting map key-value pair.");
                 return;
             }
             if (ob->GetKey()->IsObject()) {
-                vm_->gc_->WriteBarrier(ob.get(), *static_cast<HeapObject **>(key));
+                vm_->gc_->WriteBarrier(ob, *static_cast<HeapObject **>(key));
             }
             if (ob->GetValue()->IsObject()) {
-                vm_->gc_->WriteBarrier(ob.get(), *static_cast<HeapObject **>(value));
+                vm_->gc_->WriteBarrier(ob, *static_cast<HeapObject **>(value));
             }
 
             RunGC();
         } break;
 
         case OO_MapDelete: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "incorrect object type, unexpected map. addr: %d", result);
                 return;
             }
-            MIOHashMapSurface surface(ob.get(), vm_->allocator_);
+            MIOHashMapSurface surface(ob, vm_->allocator_);
             const void *key;
             if (ob->GetKey()->IsObject()) {
                 key = o_stack_->offset(val1);
@@ -1512,12 +2099,13 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_MapGet: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object not map. addr: %d", result);
                 return;
             }
-            MIOHashMapSurface surface(ob.get(), vm_->allocator_);
+            MIOHashMapSurface surface(ob, vm_->allocator_);
             const void *value = nullptr;
             if (ob->GetKey()->IsObject()) {
                 value = surface.RawGet(o_stack_->offset(val1));
@@ -1527,7 +2115,7 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
             Handle<MIOUnion> rv;
             if (value) {
                 rv = vm_->object_factory()->CreateUnion(value,
-                                                        ob->GetKey()->GetTypePlacementSize(),
+                                                        ob->GetValue()->GetTypePlacementSize(),
                                                         make_handle(ob->GetValue()));
             } else {
                 auto void_type = vm_->GetVoidType();
@@ -1546,13 +2134,14 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
         } break;
 
         case OO_MapFirstKey: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object not map. addr: %d", result);
                 return;
             }
 
-            MIOHashMapSurface surface(ob.get(), vm_->allocator_);
+            MIOHashMapSurface surface(ob, vm_->allocator_);
             auto pair = surface.GetNextRoom(nullptr);
             if (!pair) {
                 return;
@@ -1566,16 +2155,17 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
             }
             if (ob->GetValue()->IsObject()) {
                 FastMemoryMove(o_stack_->offset(val2), pair->GetValue(),
-                               ob->GetKey()->GetTypePlacementSize());
+                               ob->GetValue()->GetTypePlacementSize());
             } else {
                 FastMemoryMove(p_stack_->offset(val2), pair->GetValue(),
-                               ob->GetKey()->GetTypePlacementSize());
+                               ob->GetValue()->GetTypePlacementSize());
             }
             ++pc_;
         } break;
 
         case OO_MapNextKey: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object not map. addr: %d", result);
                 return;
@@ -1587,7 +2177,7 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
             } else {
                 key = p_stack_->offset(val1);
             }
-            MIOHashMapSurface surface(ob.get(), vm_->allocator_);
+            MIOHashMapSurface surface(ob, vm_->allocator_);
             auto pair = surface.GetNextRoom(key);
             if (!pair) {
                 ++pc_;
@@ -1597,21 +2187,21 @@ void Thread::ProcessObjectOperation(int id, uint16_t result, int16_t val1,
 
             if (ob->GetValue()->IsObject()) {
                 FastMemoryMove(o_stack_->offset(val2), pair->GetValue(),
-                               ob->GetKey()->GetTypePlacementSize());
+                               ob->GetValue()->GetTypePlacementSize());
             } else {
                 FastMemoryMove(p_stack_->offset(val2), pair->GetValue(),
-                               ob->GetKey()->GetTypePlacementSize());
+                               ob->GetValue()->GetTypePlacementSize());
             }
         } break;
 
         case OO_MapSize: {
-            auto ob = GetHashMap(result, ok);
+            NoGCScope no_gc(this);
+            auto ob = GetRawHashMap(result, ok);
             if (!*ok) {
                 Panic(PANIC, ok, "object not map. addr: %d", result);
                 return;
             }
-            MIOHashMapSurface surface(ob.get(), vm_->allocator_);
-            p_stack_->Set<mio_int_t>(val2, surface.size());
+            p_stack_->Set<mio_int_t>(val2, ob->GetSize());
         } break;
 
         default:
@@ -1712,15 +2302,258 @@ void Thread::CreateEmptyValue(int result, Handle<MIOReflectionType> reflection,
 
 void Thread::CompileToNativeCodeFragment(MIOGeneratedFunction *fn, int id,
                                          int pc, bool *ok) {
-    // TODO:
+    CodeRef code(nullptr);
+    Compiler::BitCodeToNativeCodeFragment(fn, pc, id, vm_->record_->GetTraceTreeOrNull(fn),
+                                          vm_->code_cache_, &code);
+    if (code.empty()) {
+        bc_[pc].imm32 = -1; // the path has no chance to be compiled.
+        return;
+    }
+    ObjectExtraFactory factory(vm_->allocator_);
+    auto fragment = factory.CreateNativeCodeFragment(fn->GetNativeCodeFragment(),
+                                                     code.index(), pc);
+    if (!fragment) {
+        vm_->code_cache_->Free(code);
+        Panic(OUT_OF_MEMORY, ok, "jit fail: out of memory.");
+        return;
+    }
+    LinkNativeCodeFragment(fn, fragment);
+    DescribeNativeCode(fn, code, pc);
+    if (fn->GetRecompilingKind() == MIOGeneratedFunction::NONE) {
+        fn->SetRecompilingKind(MIOGeneratedFunction::PARTIAL);
+    }
+    bc_[pc].imm32 = 1;
+}
+
+bool Thread::TraceFuncEntry(MIOGeneratedFunction *fn) {
+    int hit = 0;
+    if (!vm_->record_->TraceFuncEntry(fn, 0, &hit)) {
+        return false;
+    }
+    // Only try once, a function can not be compiled still has the same codes.
+    if (hit == vm_->hot_func_limit() &&
+        fn->GetRecompilingKind() != MIOGeneratedFunction::ALL) {
+        CompileToNativeCode(fn);
+    }
+    return true;
+}
+
+void Thread::CompileToNativeCode(MIOGeneratedFunction *fn) {
+    if (vm_->background_compiler_) {
+        vm_->background_compiler_->Submit(fn, BackgroundCompiler::kFunction,
+                                          vm_->jit_optimize_ > 0);
+        return;
+    }
+    // Baseline code covers more bit codes than side exits of optimized code.
+    if (vm_->jit_optimize_ > 0 && CompileToOptimizedNativeCode(fn, false)) {
+        return;
+    }
+    CompileToBaselineNativeCode(fn); // or keep interpreting.
+}
+
+bool Thread::CompileToOptimizedNativeCode(MIOGeneratedFunction *fn,
+                                          bool side_exits) {
+    CodeRef code(nullptr);
+    std::vector<int> entries, exits;
+    Compiler::BitCodeToOptimizedNativeCode(fn, side_exits, vm_->code_cache_,
+                                           &code, &entries, &exits);
+    return !code.empty() && InstallOptimizedNativeCode(fn, code, entries, exits);
+}
+
+bool Thread::CompileToBaselineNativeCode(MIOGeneratedFunction *fn) {
+    CodeRef code(nullptr);
+    Compiler::BitCodeToNativeCode(fn, 0, 0, vm_->record_->GetTraceTreeOrNull(fn),
+                                  vm_->code_cache_, &code);
+    return !code.empty() && InstallNativeCode(fn, code);
+}
+
+bool Thread::InstallNativeCode(MIOGeneratedFunction *fn, CodeRef code) {
+    ObjectExtraFactory factory(vm_->allocator_);
+    auto fragment = factory.CreateNativeCodeFragment(fn->GetNativeCodeFragment(),
+                                                     code.index(), -1);
+    if (!fragment) {
+        vm_->code_cache_->Free(code);
+        return false;
+    }
+    LinkNativeCodeFragment(fn, fragment);
+    DescribeNativeCode(fn, code, -1);
+    fn->SetRecompilingKind(MIOGeneratedFunction::ALL);
+    return true;
+}
+
+void Thread::LinkNativeCodeFragment(MIOGeneratedFunction *fn,
+                                    NativeCodeFragment *fragment) {
+    // Age others before linking, the new one has no chance to be entered.
+    AgeNativeCode();
+
+    auto head = vm_->installed_fragments_;
+    fragment->function = fn;
+    fragment->prev_installed = head->prev_installed;
+    fragment->next_installed = head;
+    head->prev_installed->next_installed = fragment;
+    head->prev_installed = fragment;
+
+    DCHECK_EQ(fn->GetNativeCodeFragment(), fragment->next);
+    fn->SetNativeCodeFragment(fragment);
+}
+
+int Thread::AgeNativeCode() {
+    auto cc = vm_->code_cache_;
+    auto evicting = cc->used_bytes() * 100LL >=
+                    static_cast<int64_t>(cc->size()) * kCodeCacheHighWater;
+    auto head = vm_->installed_fragments_;
+    int evicted = 0;
+    for (auto fragment = head->next_installed; fragment != head;) {
+        auto next = fragment->next_installed;
+        if (fragment->hits > 0) {
+            fragment->hits = 0;
+            fragment->age  = 0;
+        } else if (++fragment->age >= kMaxNativeCodeAge && evicting &&
+                   *fragment->index != running_native_) {
+            EvictNativeCodeFragment(fragment);
+            ++evicted;
+        }
+        fragment = next;
+    }
+    return evicted;
+}
+
+void Thread::ReclaimNativeCode(int size) {
+    auto cc = vm_->code_cache_;
+    auto head = vm_->installed_fragments_;
+    auto used = cc->used_bytes();
+    for (int round = 0; round < 2; ++round) {
+        for (auto fragment = head->next_installed; fragment != head;) {
+            if (used - cc->used_bytes() >= size) {
+                return;
+            }
+            auto next = fragment->next_installed;
+            if (fragment->hits > 0) {
+                fragment->hits = 0;
+                fragment->age  = 0;
+            } else if (*fragment->index != running_native_) {
+                EvictNativeCodeFragment(fragment);
+            }
+            fragment = next;
+        }
+    }
+}
+
+void Thread::EvictNativeCodeFragment(NativeCodeFragment *fragment) {
+    auto fn = fragment->function;
+    if (fn->GetNativeCodeFragment() == fragment) {
+        fn->SetNativeCodeFragment(fragment->next);
+    } else {
+        auto prev = fn->GetNativeCodeFragment();
+        while (prev->next != fragment) {
+            prev = prev->next;
+        }
+        prev->next = fragment->next;
+    }
+
+    if (fragment->entry >= 0 && fn->GetDecodedCode()) {
+        // Let the loop be traced and compiled again.
+        fn->GetDecodedCode()[fragment->entry].imm32 = 0;
+    }
+
+    // Older whole function code is never entered, only the head can be.
+    auto rest = fn->GetNativeCodeFragment();
+    if (rest && rest->entry < 0) {
+        fn->SetRecompilingKind(MIOGeneratedFunction::ALL);
+    } else {
+        fn->SetRecompilingKind(rest ? MIOGeneratedFunction::PARTIAL :
+                               MIOGeneratedFunction::NONE);
+        if (fragment->entry < 0) {
+            // Compile it again if it becomes hot.
+            vm_->record_->ResetFuncEntry(fn);
+        }
+    }
+
+    UnlinkInstalledNativeCodeFragment(fragment);
+    vm_->code_cache_->Free(CodeRef(fragment->index));
+    if (fragment->deopt_info) {
+        vm_->allocator_->Free(fragment->deopt_info);
+    }
+    vm_->allocator_->Free(fragment);
+}
+
+bool Thread::InstallOptimizedNativeCode(MIOGeneratedFunction *fn, CodeRef code,
+                                        const std::vector<int> &entries,
+                                        const std::vector<int> &exits) {
+    // Without metadata, optimized code would be entered at any bit code as
+    // baseline code, so never install it.
+    ObjectExtraFactory factory(vm_->allocator_);
+    auto info = factory.CreateNativeCodeDeoptInfo(entries, exits);
+    if (!info) {
+        vm_->code_cache_->Free(code);
+        return false;
+    }
+    if (!InstallNativeCode(fn, code)) {
+        vm_->allocator_->Free(info);
+        return false;
+    }
+    fn->GetNativeCodeFragment()->deopt_info = info;
+    return true;
+}
+
+void Thread::Deoptimize(MIOGeneratedFunction *fn) {
+    // The head may be evicted or replaced while the native code was running.
+    auto fragment = fn->GetNativeCodeFragment();
+    auto info = fragment ? fragment->deopt_info : nullptr;
+    if (!info || ++info->deopt_count < kMaxDeoptCount) {
+        return;
+    }
+    // Speculation keeps failing, the new fragment takes place of it. Reset
+    // the count first, compiling may evict the fragment for space.
+    info->deopt_count = 0;
+    if (vm_->background_compiler_) {
+        vm_->background_compiler_->Submit(fn, BackgroundCompiler::kBaseline, false);
+    } else {
+        CompileToBaselineNativeCode(fn);
+    }
+}
+
+void Thread::DescribeNativeCode(MIOGeneratedFunction *fn, CodeRef code,
+                                int entry) {
+    if (!vm_->code_cache_->perf_map()) {
+        return;
+    }
+    std::string name("mio:");
+    if (fn->GetName()) {
+        name.append(fn->GetName()->GetData(), fn->GetName()->GetLength());
+    } else {
+        name.append("fn#").append(std::to_string(fn->GetId()));
+    }
+    if (entry >= 0) {
+        name.append("@").append(std::to_string(entry));
+    }
+    if (fn->GetDebugInfo()) {
+        name.append(" [").append(fn->GetDebugInfo()->file_name).append("]");
+    }
+    vm_->code_cache_->Describe(code, name.c_str());
+}
+
+/*static*/ int Thread::ProcessSafepointFromNative(Thread *thread) {
+    ++thread->vm_->tick_;
+    return thread->ProcessSafepoint() ? 1 : 0;
+}
+
+/*static*/ int Thread::poll_word_offset() {
+    static const auto offset =
+        reinterpret_cast<intptr_t>(&static_cast<Thread *>(0)->poll_word_);
+    return static_cast<int>(offset);
 }
 
 Handle<MIOReflectionType> Thread::GetTypeInfo(int index, bool *ok) {
+    return make_handle(GetRawTypeInfo(index, ok));
+}
+
+MIOReflectionType *Thread::GetRawTypeInfo(int index, bool *ok) {
     if (index < 0 || index >= vm_->all_type_->size()) {
         Panic(PANIC, ok, "type info index out of range.");
-        return Handle<MIOReflectionType>();
+        return nullptr;
     }
-    return vm_->all_type_->Get(index);
+    return *static_cast<MIOReflectionType **>(vm_->all_type_->RawGet(index));
 }
 
 } // namespace mio
@@ -2,16 +2,37 @@
 #define MIO_VM_THREAD_H_
 
 #include "vm-objects.h"
+#include "vm-bitcode-decoder.h"
 #include "vm-stack.h"
 #include "handles.h"
 #include "base.h"
 #include <stdarg.h>
+#include <atomic>
+#include <algorithm>
+
+// Interpreter dispatch mode, define MIO_DIRECT_THREADED as 0 to force the
+// portable switch dispatching. Direct-threaded dispatching needs the
+// "labels as values" extension of GCC or Clang.
+#ifndef MIO_DIRECT_THREADED
+#if defined(__GNUC__) || defined(__clang__)
+#define MIO_DIRECT_THREADED 1
+#else
+#define MIO_DIRECT_THREADED 0
+#endif
+#endif
+
+// Count executed bit code pairs for choosing superinstructions of
+// BitCodeFusion, define MIO_PROFILE_BC_PAIRS as 1 to enable it.
+#ifndef MIO_PROFILE_BC_PAIRS
+#define MIO_PROFILE_BC_PAIRS 0
+#endif
 
 namespace mio {
 
 class VM;
 struct CallContext;
 class CallStack;
+class CodeRef;
 
 class TextOutputStream;
 
@@ -28,12 +49,42 @@ public:
         DIV_ZERO,
     };
 
+    // Requests delivered by the poll word, the interpreter only checks it
+    // at safepoints: jmp back-edges, loop_entry, calls and returns. Baseline
+    // and trace native code check it at back-edges and go back to interpreter.
+    enum SafepointRequest: uint32_t {
+        SAFEPOINT_EXIT         = 0x1,
+        SAFEPOINT_GC_STEP      = 0x2,
+        SAFEPOINT_SAMPLE       = 0x4,
+        SAFEPOINT_INSTALL_CODE = 0x8, // background compiler finished jobs.
+    };
+
     Thread(VM *vm);
     ~Thread();
 
     DEF_GETTER(ExitCode, exit_code)
-    DEF_PROP_RW(bool, should_exit)
     DEF_PROP_RW(int, syscall)
+    DEF_GETTER(int, deopts)
+
+    bool should_exit() const {
+        return poll_word_.load(std::memory_order_relaxed) & SAFEPOINT_EXIT;
+    }
+
+    void set_should_exit(bool should_exit) {
+        if (should_exit) {
+            RequestSafepoint(SAFEPOINT_EXIT);
+        } else {
+            poll_word_.fetch_and(~SAFEPOINT_EXIT, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Request the thread to do something at the next safepoint, it can be
+     * called from other threads.
+     */
+    void RequestSafepoint(uint32_t requests) {
+        poll_word_.fetch_or(requests, std::memory_order_relaxed);
+    }
 
     Stack *p_stack() const { return p_stack_; }
     Stack *o_stack() const { return o_stack_; }
@@ -44,6 +95,27 @@ public:
 
     void Execute(MIOGeneratedFunction *callee, bool *ok);
 
+#if MIO_PROFILE_BC_PAIRS
+    /**
+     * Print the most executed bit code pairs, they are candidates of
+     * superinstructions if bit codes are not fused.
+     */
+    void PrintBitCodePairs(TextOutputStream *stream, int top);
+#endif
+
+    /**
+     * Offset of poll word in thread, for polling it in native code.
+     */
+    static int poll_word_offset();
+
+    /**
+     * Process safepoint for optimized native code, it is called at back-edges
+     * when poll word is not zero.
+     *
+     * @return 0 if the thread should exit.
+     */
+    static int ProcessSafepointFromNative(Thread *thread);
+
     inline mio_bool_t GetBool(int addr) { return GetI8(addr); }
     inline mio_i8_t   GetI8(int addr);
     inline mio_i16_t  GetI16(int addr);
@@ -72,12 +144,185 @@ public:
 
     void PanicV(ExitCode exit_code, bool *ok, const char *fmt, va_list ap);
 
+    /**
+     * Evict installed fragments in aging order until size bytes of the code
+     * cache are freed, it is called when allocating native code fails. Like
+     * aging, fragments entered since the last aging get a second chance, the
+     * running one is never evicted.
+     */
+    void ReclaimNativeCode(int size);
+
+    // Raw getters and GC requesting of interpreter, for testing NoGCScope.
+    MIOString *TEST_GetRawString(int addr, bool *ok) { return GetRawString(addr, ok); }
+    MIOHashMap *TEST_GetRawHashMap(int addr, bool *ok) { return GetRawHashMap(addr, ok); }
+    void TEST_RunGC() {
+        ++gc_steps_;
+        RequestSafepoint(SAFEPOINT_GC_STEP);
+    }
+    bool TEST_ProcessSafepoint() { return ProcessSafepoint(); }
+
+    friend class NoGCScope;
+    friend class BackgroundCompiler;
     DISALLOW_IMPLICIT_CONSTRUCTORS(Thread)
 private:
+    static const int kMegamorphicCacheSize = 256;
+
+    // Optimized native code is dropped after so many failed guards.
+    static const int kMaxDeoptCount = 16;
+
+    // Native code not entered for so many agings is cold.
+    static const int kMaxNativeCodeAge = 2;
+
+    // Cold native code is evicted only when the code cache is used over it
+    // (percent).
+    static const int kCodeCacheHighWater = 75;
+
+    /**
+     * Compile the hot loop begins at loop_entry pc to a trace fragment, then
+     * patch imm32 of loop_entry: 1 for compiled, -1 for never trying again.
+     */
     void CompileToNativeCodeFragment(MIOGeneratedFunction *fn, int id, int pc, bool *ok);
 
+    /**
+     * Get trace native code of the loop begins at pc.
+     *
+     * @return null if the loop was not compiled.
+     */
+    inline MIONativeFragment GetNativeCodeFragment(MIOGeneratedFunction *fn, int pc);
+
+    /**
+     * Count the entry of fn, it will be compiled by baseline JIT when it
+     * becomes hot.
+     *
+     * @return false if out of memory.
+     */
+    bool TraceFuncEntry(MIOGeneratedFunction *fn);
+
+    /**
+     * Compile the whole fn, by background compiler if it is enabled.
+     */
+    void CompileToNativeCode(MIOGeneratedFunction *fn);
+
+    /**
+     * Compile fn by optimizing compiler, the native code can be entered at
+     * loop_entry for on-stack replacement.
+     *
+     * @param side_exits bit codes can not be compiled go back to interpreter.
+     * @return false if fn can not be compiled.
+     */
+    bool CompileToOptimizedNativeCode(MIOGeneratedFunction *fn, bool side_exits);
+
+    bool CompileToBaselineNativeCode(MIOGeneratedFunction *fn);
+
+    bool InstallNativeCode(MIOGeneratedFunction *fn, CodeRef code);
+
+    /**
+     * Link fragment as the head of fn, and age all installed fragments.
+     */
+    void LinkNativeCodeFragment(MIOGeneratedFunction *fn,
+                                NativeCodeFragment *fragment);
+
+    /**
+     * Age all installed fragments like the clock algorithm: a fragment
+     * entered since the last aging gets younger, or it gets older. Old
+     * fragments are evicted if the code cache is running out, their functions
+     * and loops go back to interpreter and can be compiled again when they
+     * become hot.
+     *
+     * @return number of evicted fragments.
+     */
+    int AgeNativeCode();
+
+    void EvictNativeCodeFragment(NativeCodeFragment *fragment);
+
+    /**
+     * Name native code of fn for profilers, entry is the loop_entry pc of
+     * trace, or -1 for whole function.
+     */
+    void DescribeNativeCode(MIOGeneratedFunction *fn, CodeRef code, int entry);
+
+    bool InstallOptimizedNativeCode(MIOGeneratedFunction *fn, CodeRef code,
+                                    const std::vector<int> &entries,
+                                    const std::vector<int> &exits);
+
+    /**
+     * Native code of whole fn was installed when the loop at pc was running in
+     * interpreter, and it can be entered at pc.
+     */
+    inline bool IsNativeCodeEntry(MIOGeneratedFunction *fn, int pc);
+
+    /**
+     * A guard of optimized native code of fn failed, and it was deoptimized,
+     * replace it by baseline native code if it fails too many times.
+     */
+    void Deoptimize(MIOGeneratedFunction *fn);
+
+    /**
+     * Get baseline native code of the whole function.
+     *
+     * @return null if fn was not compiled.
+     */
+    inline MIONativeFragment GetNativeCode(MIOGeneratedFunction *fn);
+
+    /**
+     * Run native code of current function from pc_, until it goes back to
+     * interpreter at a bit code without template or deoptimizes.
+     *
+     * @return false if the thread should exit.
+     */
+    inline bool RunNativeCode(MIONativeFragment native);
+
+    /**
+     * Process all requests in poll word.
+     *
+     * @return false if the thread should exit.
+     */
+    bool ProcessSafepoint();
+
+    /**
+     * Bit code interpreter, kThreaded selects direct-threaded dispatch or the
+     * switch loop once for this execution.
+     */
+    template<bool kThreaded>
+    void Interpret(MIOGeneratedFunction *callee, bool *ok);
+
+    DecodedBitCode *GetOrDecodeCode(MIOGeneratedFunction *fn,
+                                    void *const *handlers, bool *ok);
+
+    /**
+     * Bind static call sites to their global functions, it runs once after
+     * the code be decoded.
+     */
+    void LinkStaticCalls(DecodedBitCode *decoded, int size);
+
+    inline void EnterGeneratedFunction(DecodedBitCode *bc, HeapObject *callee,
+                                       DecodedBitCode *code);
+
+    /**
+     * Get the inline cache of call_val for calling ob, megamorphic site uses
+     * the shared caches. Missing cache will be filled by resolving ob.
+     *
+     * @return null if fail.
+     */
+    CallSiteCache *GetOrFillCallSiteCache(DecodedBitCode *bc, HeapObject *ob,
+                                          void *const *handlers, bool *ok);
+
+    /**
+     * Rewrite the oop bit code to a quickened one by the shape of its operands
+     * just processed.
+     */
+    void QuickenObjectOperation(DecodedBitCode *bc, void *const *handlers);
+
     Handle<MIOReflectionType> GetTypeInfo(int index, bool *ok);
 
+    // Raw pointer accessors for interpreter, use them only in NoGCScope.
+    inline HeapObject *GetRawObject(int addr);
+    inline MIOString  *GetRawString(int addr, bool *ok);
+    inline MIOUnion   *GetRawUnion(int addr, bool *ok);
+    inline MIOClosure *GetRawClosure(int addr, bool *ok);
+    inline MIOHashMap *GetRawHashMap(int addr, bool *ok);
+    MIOReflectionType *GetRawTypeInfo(int index, bool *ok);
+
     FunctionDebugInfo *GetDebugInfo(int layout, int *pc);
 
     void ProcessLoadPrimitive(int bytes, uint16_t dest, uint16_t segment,
@@ -108,12 +353,44 @@ private:
     Stack *o_stack_;
     CallStack *call_stack_;
     int pc_ = 0;
-    uint64_t *bc_ = nullptr;
+    DecodedBitCode *bc_ = nullptr;
     AtomicHandle<MIOFunction> callee_;
-    bool should_exit_ = false;
+    std::atomic<uint32_t> poll_word_;
+    MIONativeFragment running_native_ = nullptr; // can not be evicted.
+    int gc_steps_ = 0; // requested but not run GC steps.
+    int deopts_ = 0; // guards of optimized native code failed.
+    CallSiteCache megamorphic_caches_[kMegamorphicCacheSize];
+#ifndef NDEBUG
+    int no_gc_depth_ = 0; // depth of NoGCScope.
+#endif
+#if MIO_PROFILE_BC_PAIRS
+    // Executed times of bit code pairs, indexed by [last][next].
+    int64_t *bc_pairs_;
+    int last_inst_;
+#endif
     ExitCode exit_code_ = SUCCESS;
 }; // class Thread
 
+/**
+ * Debug only guard for accessing heap objects by raw pointers: no GC step can
+ * be run in this scope, so objects can not be moved or swept.
+ */
+class NoGCScope {
+public:
+#ifndef NDEBUG
+    NoGCScope(Thread *thread) : thread_(thread) { ++thread_->no_gc_depth_; }
+    ~NoGCScope() { --thread_->no_gc_depth_; }
+#else
+    NoGCScope(Thread *) {}
+#endif
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NoGCScope)
+private:
+#ifndef NDEBUG
+    Thread *thread_;
+#endif
+}; // class NoGCScope
+
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Inline Functions:
@@ -209,11 +486,79 @@ inline Handle<MIOHashMap> Thread::GetHashMap(int addr, bool *ok) {
     return make_handle(ob->AsHashMap());
 }
 
+inline HeapObject *Thread::GetRawObject(int addr) {
+    return o_stack_->Get<HeapObject *>(addr);
+}
+
+#define DEFINE_RAW_GETTER(name) \
+    inline MIO##name *Thread::GetRaw##name(int addr, bool *ok) { \
+        auto ob = GetRawObject(addr); \
+        if (!ob || !ob->Is##name()) { \
+            *ok = false; \
+            return nullptr; \
+        } \
+        return ob->As##name(); \
+    }
+
+DEFINE_RAW_GETTER(String)
+DEFINE_RAW_GETTER(Union)
+DEFINE_RAW_GETTER(Closure)
+DEFINE_RAW_GETTER(HashMap)
+
+#undef DEFINE_RAW_GETTER
+
 inline MIOGeneratedFunction *Thread::generated_function() {
     auto fn = callee_->AsGeneratedFunction();
     return fn ? fn : DCHECK_NOTNULL(callee_->AsClosure())->GetFunction()->AsGeneratedFunction();
 }
 
+inline MIONativeFragment Thread::GetNativeCode(MIOGeneratedFunction *fn) {
+    if (fn->GetRecompilingKind() != MIOGeneratedFunction::ALL) {
+        return nullptr;
+    }
+    // Read the index every time, code cache compacting can move the code.
+    auto fragment = fn->GetNativeCodeFragment();
+    ++fragment->hits;
+    return reinterpret_cast<MIONativeFragment>(*fragment->index);
+}
+
+inline MIONativeFragment Thread::GetNativeCodeFragment(MIOGeneratedFunction *fn,
+                                                      int pc) {
+    for (auto fragment = fn->GetNativeCodeFragment(); fragment;
+         fragment = fragment->next) {
+        if (fragment->entry == pc) {
+            ++fragment->hits;
+            return reinterpret_cast<MIONativeFragment>(*fragment->index);
+        }
+    }
+    return nullptr;
+}
+
+inline bool Thread::IsNativeCodeEntry(MIOGeneratedFunction *fn, int pc) {
+    if (fn->GetRecompilingKind() != MIOGeneratedFunction::ALL) {
+        return false;
+    }
+    auto info = fn->GetNativeCodeFragment()->deopt_info;
+    if (!info) {
+        return true; // baseline code can be entered at any bit code.
+    }
+    auto end = info->pcs + info->entry_size;
+    return std::find(info->pcs, end, pc) != end;
+}
+
+inline bool Thread::RunNativeCode(MIONativeFragment native) {
+    int pc = pc_;
+    running_native_ = native;
+    auto rv = native(this, p_stack_->offset(0), o_stack_->offset(0), &pc);
+    running_native_ = nullptr;
+    pc_ = pc;
+    if (rv == kNativeFragmentDeopt) {
+        ++deopts_;
+        Deoptimize(generated_function());
+    }
+    return rv != kNativeFragmentExit;
+}
+
 inline mio_buf_t<uint8_t> Thread::const_primitive_buf() {
     return DCHECK_NOTNULL(generated_function())->GetConstantPrimitiveBuf();
 }
@@ -7,8 +7,11 @@
 #include "vm-bitcode-disassembler.h"
 #include "vm-runtime.h"
 #include "vm-profiler.h"
+#include "vm-background-compiler.h"
+#include "vm-perf-map.h"
 #include "vm-object-surface.h"
 #include "fallback-managed-allocator.h"
+#include "slab-managed-allocator.h"
 #include "zone.h"
 #include "simple-file-system.h"
 #include "types.h"
@@ -25,14 +28,20 @@ namespace mio {
 
 VM::VM()
     : gc_name_("msg")
+    , allocator_name_("fallback")
     , main_thread_(new Thread(this))
     , p_global_(new MemorySegment())
     , o_global_(new MemorySegment())
     , ast_zone_(new Zone())
+    , installed_fragments_(new NativeCodeFragment())
     , source_position_dict_(new SourceFilePositionDict()) {
+    installed_fragments_->prev_installed = installed_fragments_;
+    installed_fragments_->next_installed = installed_fragments_;
 }
 
 VM::~VM() {
+    // Submitted functions are grabbed by the compiler.
+    delete background_compiler_;
     delete source_position_dict_;
     delete p_global_;
     delete o_global_;
@@ -41,6 +50,8 @@ VM::~VM() {
 
     delete all_type_;
     delete all_var_;
+    // Handles in backtrace must be dropped before objects' memory released.
+    backtrace_.clear();
     delete gc_;
     if (allocator_) {
         allocator_->Finialize();
@@ -48,6 +59,8 @@ VM::~VM() {
     delete record_;
     delete allocator_;
     delete code_cache_;
+    delete perf_code_map_;
+    delete installed_fragments_;
 }
 
 bool VM::Init() {
@@ -58,8 +71,27 @@ bool VM::Init() {
         DLOG(ERROR) << "native code cache initialize fail!";
         return false;
     }
+    code_cache_->set_reclaimer([this](int size) {
+        main_thread_->ReclaimNativeCode(size);
+    });
+    if (perf_map_) {
+        perf_code_map_ = new PerfCodeMap("/tmp", true);
+        if (!perf_code_map_->Init()) {
+            DLOG(ERROR) << "perf map initialize fail!";
+            return false;
+        }
+        code_cache_->set_perf_map(perf_code_map_);
+    }
 
-    allocator_ = new FallbackManagedAllocator(false);
+    if (allocator_name_.compare("slab") == 0) {
+        allocator_ = new SlabManagedAllocator(SlabManagedAllocator::kDefaultCapacity,
+                                              false);
+    } else if (allocator_name_.compare("fallback") == 0) {
+        allocator_ = new FallbackManagedAllocator(false);
+    } else {
+        DLOG(ERROR) << "bad allocator name: " << allocator_name_;
+        return false;
+    }
     if (!allocator_->Init()) {
         DLOG(ERROR) << "allocator init fail!";
         delete allocator_;
@@ -100,6 +132,10 @@ bool VM::Init() {
     if (jit_) {
         record_ = new TraceRecord(allocator_);
     }
+    if (jit_ && jit_background_) {
+        background_compiler_ = new BackgroundCompiler(this, code_cache_);
+        background_compiler_->Start();
+    }
 
     // TODO:
     return true;
@@ -156,6 +192,12 @@ bool VM::CompileProject(const char *project_dir, ParsingError *error) {
         function_register_->RegisterNativeFunction(nafn->name, nafn->pointer);
         ++nafn;
     }
+
+    auto leaf = &kRtLeafFn[0];
+    while (leaf->name != nullptr) {
+        function_register_->RegisterLeafFunction(leaf->name, leaf->pointer);
+        ++leaf;
+    }
     return true;
 }
 
@@ -27,7 +27,10 @@ class SourceFilePositionDict;
 class CodeCache;
 class Profiler;
 class TraceRecord;
+class BackgroundCompiler;
+class PerfCodeMap;
 struct ParsingError;
+struct NativeCodeFragment;
 
 typedef int (*MIOFunctionPrototype)(VM *, Thread *);
 
@@ -61,15 +64,23 @@ public:
     DEF_PROP_RW(int, native_code_size)
     DEF_GETTER(int, tick)
     DEF_PROP_RW(std::string, gc_name)
+    DEF_PROP_RW(std::string, allocator_name)
     DEF_GETTER(std::vector<BacktraceLayout>, backtrace)
     DEF_PROP_RW(bool, jit)
+    DEF_GETTER(bool, direct_threaded)
     DEF_PROP_RW(int, jit_optimize)
+    DEF_PROP_RW(bool, jit_background)
+    DEF_PROP_RW(bool, perf_map)
     DEF_PROP_RW(int, hot_loop_limit)
+    DEF_PROP_RW(int, hot_func_limit)
     DEF_PTR_GETTER_NOTNULL(Thread, main_thread)
     DEF_PTR_GETTER_NOTNULL(FunctionRegister, function_register)
     DEF_PTR_GETTER_NOTNULL(GarbageCollector, gc)
     DEF_PTR_GETTER(ManagedAllocator, allocator)
+    DEF_PTR_GETTER(CodeCache, code_cache)
+    DEF_PTR_GETTER(MemorySegment, o_global)
     DEF_PTR_GETTER(SourceFilePositionDict, source_position_dict)
+    DEF_PTR_GETTER(BackgroundCompiler, background_compiler)
 
     MIOHashMapStub<Handle<MIOString>, mio_i32_t> *all_var() const {
         return DCHECK_NOTNULL(all_var_);
@@ -79,6 +90,20 @@ public:
         return DCHECK_NOTNULL(all_type_);
     }
 
+    /**
+     * Decoded bit codes refer to handlers of the dispatch mode, so it can be
+     * changed only before any bit code is decoded.
+     *
+     * @return false if bit codes have been decoded, the mode is not changed.
+     */
+    bool set_direct_threaded(bool value) {
+        if (code_decoded_) {
+            return false;
+        }
+        direct_threaded_ = value;
+        return true;
+    }
+
     Thread *current() const { return DCHECK_NOTNULL(main_thread_); }
 
     ObjectFactory *object_factory() const {
@@ -108,6 +133,13 @@ private:
      */
     std::string gc_name_;
 
+    /**
+     * Name of managed allocator:
+     * "fallback" - Use malloc, the default one.
+     * "slab"     - Use size-segregated slab pages.
+     */
+    std::string allocator_name_;
+
     /** Search path for compiling */
     std::vector<std::string> search_path_;
 
@@ -120,12 +152,36 @@ private:
     /** Enable/Disable just-in-time compiling */
     bool jit_ = false;
 
-    /** just-in-time compiling optimization level */
+    /**
+     * Dispatch bit codes by direct-threaded jumping, or by the switch loop.
+     * It is ignored if MIO_DIRECT_THREADED is 0.
+     */
+    bool direct_threaded_ = true;
+
+    /** Any bit code has been decoded, dispatch mode is fixed. */
+    bool code_decoded_ = false;
+
+    /**
+     * just-in-time compiling optimization level, hot functions are compiled by
+     * optimizing compiler (see NCodeGenerator) first if it is not zero.
+     */
     int jit_optimize_ = 0;
 
+    /** Compile hot functions in background compiler thread */
+    bool jit_background_ = false;
+
+    /**
+     * Describe native code for linux perf: /tmp/perf-<pid>.map for
+     * `perf report' and /tmp/jit-<pid>.dump for `perf inject --jit'
+     */
+    bool perf_map_ = false;
+
     /** How many hit loop to be hot */
     int hot_loop_limit_ = 1000;
 
+    /** How many hit function to be compiled by baseline JIT */
+    int hot_func_limit_ = 1000;
+
     int max_call_deep_ = kDefaultMaxCallDeep;
     int native_code_size_ = kDefaultNativeCodeSize;
     Thread *main_thread_;
@@ -137,10 +193,14 @@ private:
     std::unordered_map<int64_t, int> type_id2index_;
     ManagedAllocator *allocator_ = nullptr;
     CodeCache *code_cache_ = nullptr;
+    PerfCodeMap *perf_code_map_ = nullptr;
     GarbageCollector *gc_ = nullptr;
     FunctionRegister *function_register_ = nullptr;
     ParsedModuleMap *all_modules_ = nullptr;
     Profiler *profiler_ = nullptr;
+    BackgroundCompiler *background_compiler_ = nullptr;
+    /** Sentinel of the ring of all installed native code fragments */
+    NativeCodeFragment *installed_fragments_;
     TraceRecord *record_ = nullptr;
     SourceFilePositionDict *source_position_dict_;
     std::vector<BacktraceLayout> backtrace_;